@@ -0,0 +1,21 @@
+
+
+# Codecs of flare/io/cord_buf_codec.h besides snappy, registered only if the
+# library is found.
+find_path(LZ4_INCLUDE_PATH NAMES lz4frame.h)
+find_library(LZ4_LIB NAMES lz4)
+if (LZ4_INCLUDE_PATH AND LZ4_LIB)
+    message(STATUS "Found lz4: ${LZ4_LIB}")
+    include_directories(${LZ4_INCLUDE_PATH})
+    add_definitions(-DFLARE_HAVE_LZ4)
+    list(APPEND DYNAMIC_LIB ${LZ4_LIB})
+endif ()
+
+find_path(ZSTD_INCLUDE_PATH NAMES zstd.h)
+find_library(ZSTD_LIB NAMES zstd)
+if (ZSTD_INCLUDE_PATH AND ZSTD_LIB)
+    message(STATUS "Found zstd: ${ZSTD_LIB}")
+    include_directories(${ZSTD_INCLUDE_PATH})
+    add_definitions(-DFLARE_HAVE_ZSTD)
+    list(APPEND DYNAMIC_LIB ${ZSTD_LIB})
+endif ()
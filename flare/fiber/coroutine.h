@@ -0,0 +1,365 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef FLARE_FIBER_COROUTINE_H_
+#define FLARE_FIBER_COROUTINE_H_
+
+#if !defined(__cpp_impl_coroutine)
+#error "flare/fiber/coroutine.h requires coroutine support, configure with -DENABLE_COROUTINE=ON"
+#endif
+
+#include <cerrno>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "flare/future/future.h"
+#include "flare/fiber/fiber_cond.h"
+#include "flare/fiber/fiber_mutex.h"
+#include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/internal/waitable_event.h"
+
+// Stackless fibers.
+//
+// A `fiber_task<T>` is a coroutine scheduled by the same fiber workers as
+// ordinary fibers. It borrows a pooled fiber stack only while running: each
+// time it's resumed, it runs in a short-lived fiber which returns its stack
+// to the pool once the task suspends again. A suspended task costs nothing
+// but its coroutine frame, so millions of mostly idle in-flight tasks are
+// affordable, while stackful fibers hold at least a page of stack plus a
+// guard page each.
+//
+//   flare::fiber_task<int> fetch(flare::fiber_mutex &m, flare::future<int> f) {
+//       co_await flare::coro_lock(m);
+//       std::lock_guard lk(m, std::adopt_lock);
+//       co_return co_await std::move(f);
+//   }
+//   auto rc = flare::fiber_task_start(fetch(m, std::move(f)));  // future<int>
+//
+// Blocking calls (fiber_mutex::lock, fiber_cond::wait, fiber_future_get, ...)
+// still work inside a task but pin the stack while blocking, use the
+// `co_await`-able counterparts below instead.
+
+namespace flare {
+
+    template<class T = void>
+    class fiber_task;
+
+    namespace coroutine_internal {
+
+        // Resumes `h' in a new fiber, or in place if no fiber can be created.
+        inline void resume_in_fiber(std::coroutine_handle<> h) {
+            fiber_id_t tid;
+            if (fiber_start_background(&tid, nullptr, [h](void *) -> void * {
+                h.resume();
+                return nullptr;
+            }, nullptr) != 0) {
+                h.resume();
+            }
+        }
+
+        // Callback of the *_async functions, `arg' is the address of the handle.
+        inline void resume_address_in_fiber(void *arg) {
+            resume_in_fiber(std::coroutine_handle<>::from_address(arg));
+        }
+
+        struct task_promise_base {
+            // Who is awaiting on the task, resumed once the task finishes.
+            std::coroutine_handle<> continuation;
+
+            struct final_awaiter {
+                bool await_ready() noexcept { return false; }
+
+                template<class P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+                    auto c = h.promise().continuation;
+                    return c ? c : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {}
+            };
+
+            // Tasks are lazy, they run once awaited or started.
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            final_awaiter final_suspend() noexcept { return {}; }
+
+            // Same as fibers, exceptions must not escape a task.
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+
+        template<class T>
+        struct task_promise : task_promise_base {
+            std::optional<T> value;
+
+            fiber_task<T> get_return_object() noexcept;
+
+            template<class U>
+            void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+
+            T result() { return std::move(*value); }
+        };
+
+        template<>
+        struct task_promise<void> : task_promise_base {
+            fiber_task<void> get_return_object() noexcept;
+
+            void return_void() noexcept {}
+
+            void result() noexcept {}
+        };
+
+        // Root of a started task, destroys itself once done.
+        struct detached_task {
+            struct promise_type {
+                detached_task get_return_object() noexcept {
+                    return {std::coroutine_handle<promise_type>::from_promise(*this)};
+                }
+
+                std::suspend_always initial_suspend() noexcept { return {}; }
+
+                std::suspend_never final_suspend() noexcept { return {}; }
+
+                void return_void() noexcept {}
+
+                void unhandled_exception() noexcept { std::terminate(); }
+            };
+
+            std::coroutine_handle<promise_type> handle;
+        };
+
+        template<class T, class P>
+        detached_task run_detached(fiber_task<T> task, P p) {
+            if constexpr (std::is_void_v<T>) {
+                co_await std::move(task);
+                p.set_value();
+            } else {
+                p.set_value(co_await std::move(task));
+            }
+        }
+
+        struct event_awaiter {
+            void *event;
+            int expected_value;
+            int rc;
+
+            bool await_ready() noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> h) noexcept {
+                // Must be set before queueing, we may be resumed at any time
+                // after that.
+                rc = 0;
+                if (fiber_internal::waitable_event_wait_async(
+                        event, expected_value, resume_address_in_fiber, h.address()) == 0) {
+                    return true;
+                }
+                rc = errno;
+                return false;
+            }
+
+            int await_resume() const noexcept { return rc; }
+        };
+
+        struct mutex_lock_awaiter {
+            fiber_mutex_t *m;
+
+            bool await_ready() noexcept { return fiber_mutex_trylock(m) == 0; }
+
+            bool await_suspend(std::coroutine_handle<> h) noexcept {
+                const int rc = fiber_mutex_lock_async(m, resume_address_in_fiber, h.address());
+                if (rc == EINPROGRESS) {
+                    return true;
+                }
+                if (rc != 0) {
+                    // Out of memory, fallback to blocking.
+                    fiber_mutex_lock(m);
+                }
+                return false;
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        struct cond_wait_awaiter {
+            fiber_cond_t *c;
+            fiber_mutex_t *m;
+            int rc;
+
+            bool await_ready() noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> h) noexcept {
+                rc = 0;
+                const int r = fiber_cond_wait_async(c, m, resume_address_in_fiber, h.address());
+                if (r == EINPROGRESS) {
+                    return true;
+                }
+                rc = r;
+                return false;
+            }
+
+            int await_resume() const noexcept { return rc; }
+        };
+
+        struct yield_awaiter {
+            bool await_ready() noexcept { return false; }
+
+            void await_suspend(std::coroutine_handle<> h) noexcept { resume_in_fiber(h); }
+
+            void await_resume() noexcept {}
+        };
+
+    }  // namespace coroutine_internal
+
+    // A lazily started coroutine returning `T'. `co_await` it from another
+    // task or run it with `fiber_task_start`.
+    template<class T>
+    class fiber_task {
+    public:
+        using promise_type = coroutine_internal::task_promise<T>;
+
+        fiber_task(fiber_task &&other) noexcept
+                : _handle(std::exchange(other._handle, nullptr)) {}
+
+        fiber_task &operator=(fiber_task &&other) noexcept {
+            if (this != &other) {
+                if (_handle) {
+                    _handle.destroy();
+                }
+                _handle = std::exchange(other._handle, nullptr);
+            }
+            return *this;
+        }
+
+        ~fiber_task() {
+            if (_handle) {
+                _handle.destroy();
+            }
+        }
+
+        // Runs the task in the awaiting task's fiber and resumes the awaiting
+        // task with the result once done, without going through the scheduler.
+        auto operator co_await() && noexcept {
+            struct awaiter {
+                std::coroutine_handle<promise_type> handle;
+
+                bool await_ready() noexcept { return false; }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+                    handle.promise().continuation = caller;
+                    return handle;
+                }
+
+                T await_resume() { return handle.promise().result(); }
+            };
+            return awaiter{_handle};
+        }
+
+    private:
+        friend promise_type;
+
+        explicit fiber_task(std::coroutine_handle<promise_type> h) noexcept : _handle(h) {}
+
+        std::coroutine_handle<promise_type> _handle;
+    };
+
+    namespace coroutine_internal {
+
+        template<class T>
+        fiber_task<T> task_promise<T>::get_return_object() noexcept {
+            return fiber_task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+        }
+
+        inline fiber_task<void> task_promise<void>::get_return_object() noexcept {
+            return fiber_task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+        }
+
+    }  // namespace coroutine_internal
+
+    // Runs `task` in background on fiber workers. Returns a future satisfied
+    // with the result of `task`.
+    template<class T>
+    auto fiber_task_start(fiber_task<T> task) {
+        std::conditional_t<std::is_void_v<T>, promise<>, promise<T>> p;
+        auto rc = p.get_future();
+        coroutine_internal::resume_in_fiber(
+                coroutine_internal::run_detached(std::move(task), std::move(p)).handle);
+        return rc;
+    }
+
+    // Reschedules the calling task, letting other fibers and tasks run.
+    inline coroutine_internal::yield_awaiter coro_yield() noexcept {
+        return {};
+    }
+
+    // Locks `m`, resumed once locked. The awaiting task does not hold any
+    // stack while waiting for the lock. Unlock with `m.unlock()` as usual.
+    inline coroutine_internal::mutex_lock_awaiter coro_lock(fiber_mutex &m) noexcept {
+        return {m.native_handler()};
+    }
+
+    inline coroutine_internal::mutex_lock_awaiter coro_lock(fiber_mutex_t *m) noexcept {
+        return {m};
+    }
+
+    // Same as `fiber_cond::wait` without holding a stack while waiting.
+    // `co_await` returns 0 on success, errno otherwise.
+    inline coroutine_internal::cond_wait_awaiter coro_wait(
+            fiber_cond &cond, std::unique_lock<fiber_mutex> &lock) noexcept {
+        return {cond.native_handler(), lock.mutex()->native_handler(), 0};
+    }
+
+    // Waits on `event` as `waitable_event_wait(event, expected_value, NULL)`
+    // does. `co_await` returns 0 once woken up, or EWOULDBLOCK if `*event`
+    // does not equal `expected_value`.
+    inline coroutine_internal::event_awaiter coro_wait_event(void *event, int expected_value) noexcept {
+        return {event, expected_value, 0};
+    }
+
+    namespace future_internal {
+
+        // `co_await std::move(f)` resumes the awaiting task with the value of
+        // `f` once it's satisfied.
+        template<class... Ts>
+        auto operator co_await(future<Ts...> &&f) {
+            struct awaiter {
+                future<Ts...> f;
+                std::optional<boxed<Ts...>> receiver;
+
+                bool await_ready() noexcept { return false; }
+
+                void await_suspend(std::coroutine_handle<> h) {
+                    // The continuation may resume us before `then` returns, which
+                    // may destroy the frame `f` lives in, move it out first.
+                    auto local = std::move(f);
+                    std::move(local).then([this, h](boxed<Ts...> boxed) noexcept {
+                        receiver.emplace(std::move(boxed));
+                        coroutine_internal::resume_in_fiber(h);
+                    });
+                }
+
+                unboxed_type_t<Ts...> await_resume() { return std::move(*receiver).get(); }
+            };
+            return awaiter{std::move(f), std::nullopt};
+        }
+
+    }  // namespace future_internal
+
+}  // namespace flare
+
+#endif  // FLARE_FIBER_COROUTINE_H_
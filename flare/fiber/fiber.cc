@@ -17,6 +17,8 @@ namespace flare {
         tmp.stack_type = attr.stack_type;
         tmp.flags = attr.flags;
         tmp.keytable_pool = attr.keytable_pool;
+        tmp.priority = attr.priority;
+        tmp.tag = attr.tag;
         if (attr.policy == launch_policy::eImmediately) {
             _save_error = fiber_start_urgent(&_fid, &tmp, std::move(fn), args);
         } else {
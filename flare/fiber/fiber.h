@@ -21,28 +21,40 @@ namespace flare {
         fiber_stack_type_t stack_type;
         fiber_attribute_flag flags;
         fiber_keytable_pool_t *keytable_pool;
+        // One of FIBER_PRIORITY_*, normal by default.
+        fiber_priority_t priority;
+        // See fiber_attribute::tag, untagged by default.
+        const char *tag;
     };
 
     static const attribute kAttrPthread{.policy = launch_policy::eImmediately,
             .stack_type = FIBER_STACKTYPE_PTHREAD,
             .flags = 0,
-            .keytable_pool = nullptr};
+            .keytable_pool = nullptr,
+            .priority = FIBER_PRIORITY_NORMAL,
+            .tag = nullptr};
 
     static const attribute kAttrSmall = attribute{.policy = launch_policy::eImmediately,
             .stack_type = FIBER_STACKTYPE_SMALL,
             .flags = 0,
-            .keytable_pool = nullptr};
+            .keytable_pool = nullptr,
+            .priority = FIBER_PRIORITY_NORMAL,
+            .tag = nullptr};
 
 
     static const attribute kAttrNormal = attribute{.policy = launch_policy::eImmediately,
             .stack_type = FIBER_STACKTYPE_NORMAL,
             .flags = 0,
-            .keytable_pool = nullptr};
+            .keytable_pool = nullptr,
+            .priority = FIBER_PRIORITY_NORMAL,
+            .tag = nullptr};
 
     static const attribute kAttrLarge{.policy = launch_policy::eImmediately,
             .stack_type = FIBER_STACKTYPE_LARGE,
             .flags = 0,
-            .keytable_pool = nullptr};
+            .keytable_pool = nullptr,
+            .priority = FIBER_PRIORITY_NORMAL,
+            .tag = nullptr};
 
     class fiber {
     public:
@@ -59,7 +71,8 @@ namespace flare {
 
         fiber(launch_policy policy, flare::base::function<void *(void *)> &&fn, void *args = nullptr)
                 : fiber(
-                attribute{.policy = policy, .stack_type = FIBER_STACKTYPE_NORMAL, .flags = 0, .keytable_pool = nullptr},
+                attribute{.policy = policy, .stack_type = FIBER_STACKTYPE_NORMAL, .flags = 0, .keytable_pool = nullptr,
+                          .priority = FIBER_PRIORITY_NORMAL, .tag = nullptr},
                 std::forward<flare::base::function<void *(void *)>>(fn),
                 args) {}
 
@@ -0,0 +1,178 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/fiber/fiber_channel.h"
+#include <algorithm>
+#include "flare/base/fast_rand.h"
+#include "flare/fiber/internal/waitable_event.h"
+
+namespace flare {
+
+    using flare::fiber_internal::waitable_event_create_checked;
+    using flare::fiber_internal::waitable_event_destroy;
+    using flare::fiber_internal::waitable_event_wait;
+    using flare::fiber_internal::waitable_event_wake;
+    using flare::fiber_internal::waitable_event_wake_all;
+
+    fiber_channel_base::fiber_channel_base()
+            : _closed(false), _send_waiters(0), _recv_waiters(0), _nwatchers(0) {
+        _not_full = waitable_event_create_checked<std::atomic<int> >();
+        _not_full->store(0, std::memory_order_relaxed);
+        _not_empty = waitable_event_create_checked<std::atomic<int> >();
+        _not_empty->store(0, std::memory_order_relaxed);
+    }
+
+    fiber_channel_base::~fiber_channel_base() {
+        waitable_event_destroy(_not_full);
+        waitable_event_destroy(_not_empty);
+    }
+
+    void fiber_channel_base::close() {
+        _closed.store(true, std::memory_order_release);
+        _not_full->fetch_add(1, std::memory_order_release);
+        waitable_event_wake_all(_not_full);
+        _not_empty->fetch_add(1, std::memory_order_release);
+        waitable_event_wake_all(_not_empty);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_nwatchers.load(std::memory_order_relaxed) > 0) {
+            notify_watchers();
+        }
+    }
+
+    // The waiter counts and the ring are a Dekker pair: the waiter increases
+    // the count before checking the ring again, the notifier changes the ring
+    // before checking the count, so at least one of them sees the other.
+    int fiber_channel_base::begin_wait_send() {
+        _send_waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return _not_full->load(std::memory_order_acquire);
+    }
+
+    int fiber_channel_base::begin_wait_recv() {
+        _recv_waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return _not_empty->load(std::memory_order_acquire);
+    }
+
+    int fiber_channel_base::wait_send(int expected, const timespec *abstime) {
+        if (waitable_event_wait(_not_full, expected, abstime) < 0 && errno == ETIMEDOUT) {
+            return ETIMEDOUT;
+        }
+        return 0;
+    }
+
+    int fiber_channel_base::wait_recv(int expected, const timespec *abstime) {
+        if (waitable_event_wait(_not_empty, expected, abstime) < 0 && errno == ETIMEDOUT) {
+            return ETIMEDOUT;
+        }
+        return 0;
+    }
+
+    void fiber_channel_base::notify_sent(size_t n) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_recv_waiters.load(std::memory_order_relaxed) > 0) {
+            _not_empty->fetch_add(1, std::memory_order_release);
+            if (n == 1) {
+                waitable_event_wake(_not_empty);
+            } else {
+                waitable_event_wake_all(_not_empty);
+            }
+        }
+        if (_nwatchers.load(std::memory_order_relaxed) > 0) {
+            notify_watchers();
+        }
+    }
+
+    void fiber_channel_base::notify_received(size_t n) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_send_waiters.load(std::memory_order_relaxed) > 0) {
+            _not_full->fetch_add(1, std::memory_order_release);
+            if (n == 1) {
+                waitable_event_wake(_not_full);
+            } else {
+                waitable_event_wake_all(_not_full);
+            }
+        }
+    }
+
+    void fiber_channel_base::add_watcher(std::atomic<int> *event) {
+        std::unique_lock<fiber_mutex> lk(_watchers_mutex);
+        _watchers.push_back(event);
+        _nwatchers.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void fiber_channel_base::remove_watcher(std::atomic<int> *event) {
+        std::unique_lock<fiber_mutex> lk(_watchers_mutex);
+        auto it = std::find(_watchers.begin(), _watchers.end(), event);
+        if (it != _watchers.end()) {
+            *it = _watchers.back();
+            _watchers.pop_back();
+            _nwatchers.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    void fiber_channel_base::notify_watchers() {
+        // The events are not destroyed until removed, which needs the lock.
+        std::unique_lock<fiber_mutex> lk(_watchers_mutex);
+        for (std::atomic<int> *event : _watchers) {
+            event->fetch_add(1, std::memory_order_release);
+            waitable_event_wake(event);
+        }
+    }
+
+    int fiber_channel_select(fiber_channel_base *const *channels, size_t n,
+                             size_t *index, const timespec *abstime) {
+        if (n == 0 || index == nullptr) {
+            return EINVAL;
+        }
+        std::atomic<int> *event = waitable_event_create_checked<std::atomic<int> >();
+        event->store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < n; ++i) {
+            channels[i]->add_watcher(event);
+        }
+        // Start from a random channel to not starve the latter ones.
+        const size_t offset = flare::base::fast_rand_less_than(n);
+        int rc = 0;
+        while (true) {
+            const int expected = event->load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool found = false;
+            for (size_t i = 0; i < n; ++i) {
+                const size_t k = (offset + i) % n;
+                if (channels[k]->size() > 0 || channels[k]->closed()) {
+                    *index = k;
+                    found = true;
+                    break;
+                }
+            }
+            if (found) {
+                break;
+            }
+            if (waitable_event_wait(event, expected, abstime) < 0 && errno == ETIMEDOUT) {
+                rc = ETIMEDOUT;
+                break;
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            channels[i]->remove_watcher(event);
+        }
+        waitable_event_destroy(event);
+        return rc;
+    }
+
+}  // namespace flare
@@ -0,0 +1,293 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_FIBER_FIBER_CHANNEL_H_
+#define FLARE_FIBER_FIBER_CHANNEL_H_
+
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "flare/base/profile.h"
+#include "flare/log/logging.h"
+#include "flare/times/time.h"
+#include "flare/fiber/fiber_mutex.h"
+#include "flare/fiber/internal/mpmc_ring_queue.h"
+
+namespace flare {
+
+    // Parts of fiber_channel not depending on the type of values.
+    class fiber_channel_base {
+    public:
+        // Following sends fail with EPIPE. Receivers get the values left in the
+        // channel and then EPIPE.
+        // NOTE: Values sent concurrently with close() may be left unreceived.
+        void close();
+
+        bool closed() const { return _closed.load(std::memory_order_acquire); }
+
+        // Not accurate when the channel is being modified.
+        virtual size_t size() const = 0;
+
+    protected:
+        fiber_channel_base();
+
+        virtual ~fiber_channel_base();
+
+        // Register the calling fiber as waiting for room / values, returns the
+        // value to wait for. Must be paired with end_wait_*().
+        int begin_wait_send();
+
+        int begin_wait_recv();
+
+        // Returns ETIMEDOUT if |abstime| was reached, 0 otherwise.
+        int wait_send(int expected, const timespec *abstime);
+
+        int wait_recv(int expected, const timespec *abstime);
+
+        void end_wait_send() { _send_waiters.fetch_sub(1, std::memory_order_relaxed); }
+
+        void end_wait_recv() { _recv_waiters.fetch_sub(1, std::memory_order_relaxed); }
+
+        // Called after |n| values were sent / received.
+        void notify_sent(size_t n);
+
+        void notify_received(size_t n);
+
+    private:
+        FLARE_DISALLOW_COPY_AND_ASSIGN(fiber_channel_base);
+
+        friend int fiber_channel_select(fiber_channel_base *const *channels, size_t n,
+                                        size_t *index, const timespec *abstime);
+
+        void add_watcher(std::atomic<int> *event);
+
+        void remove_watcher(std::atomic<int> *event);
+
+        void notify_watchers();
+
+        std::atomic<bool> _closed;
+        std::atomic<int> *_not_full;
+        std::atomic<int> *_not_empty;
+        std::atomic<int> FLARE_CACHELINE_ALIGNMENT _send_waiters;
+        std::atomic<int> FLARE_CACHELINE_ALIGNMENT _recv_waiters;
+        // Fibers in fiber_channel_select().
+        std::atomic<int> FLARE_CACHELINE_ALIGNMENT _nwatchers;
+        // Doesn't block the worker pthread when contended by fibers.
+        fiber_mutex _watchers_mutex;
+        std::vector<std::atomic<int> *> _watchers;
+    };
+
+    // Bounded multi-producer multi-consumer channel for passing values between
+    // fibers (or pthreads). Values go through a lock-free ring, senders park
+    // only when the channel is full and receivers only when it's empty.
+    //
+    // Unless specified, methods return 0 on success, EAGAIN if the channel is
+    // full (empty) for try_send (try_recv), ETIMEDOUT if the deadline is
+    // reached and EPIPE if the channel is closed.
+    //
+    // Example:
+    //   flare::fiber_channel<std::string> ch(1024);
+    //   // producer
+    //   ch.send("hello");
+    //   ch.close();
+    //   // consumer
+    //   std::string s;
+    //   while (ch.recv(&s) == 0) { ... }
+    template<typename T>
+    class fiber_channel : public fiber_channel_base {
+    public:
+        // |capacity| is rounded up to power of 2 (at least 2).
+        explicit fiber_channel(size_t capacity) {
+            FLARE_CHECK_EQ(0, _ring.init(capacity)) << "Invalid capacity=" << capacity;
+        }
+
+        size_t capacity() const { return _ring.capacity(); }
+
+        size_t size() const override { return _ring.volatile_size(); }
+
+        int send(const T &value) { return send_impl(T(value), true, nullptr); }
+
+        int send(T &&value) { return send_impl(std::move(value), true, nullptr); }
+
+        int try_send(const T &value) { return send_impl(T(value), false, nullptr); }
+
+        int try_send(T &&value) { return send_impl(std::move(value), false, nullptr); }
+
+        int send_for(T value, long timeout_us) {
+            return send_until(std::move(value),
+                              flare::time_point::future_unix_micros(timeout_us).to_timespec());
+        }
+
+        int send_until(T value, timespec duetime) {
+            return send_impl(std::move(value), true, &duetime);
+        }
+
+        // Send values in order, blocking while the channel is full.
+        // Returns number of values sent, which is less than |n| only if the
+        // channel is closed.
+        size_t send_batch(const T *values, size_t n);
+
+        int recv(T *value) { return recv_impl(value, true, nullptr); }
+
+        int try_recv(T *value) { return recv_impl(value, false, nullptr); }
+
+        int recv_for(T *value, long timeout_us) {
+            return recv_until(value, flare::time_point::future_unix_micros(timeout_us).to_timespec());
+        }
+
+        int recv_until(T *value, timespec duetime) {
+            return recv_impl(value, true, &duetime);
+        }
+
+        // Receive at most |n| values, blocking until there's at least one.
+        // Returns number of values received, 0 if the channel is closed and
+        // drained.
+        size_t recv_batch(T *values, size_t n);
+
+    private:
+        int send_impl(T &&value, bool blocking, const timespec *abstime);
+
+        int recv_impl(T *value, bool blocking, const timespec *abstime);
+
+        flare::fiber_internal::MPMCRingQueue<T> _ring;
+    };
+
+    // Wait until any of |channels| has values to receive or is closed, and set
+    // |index| to its position in |channels|. The value may be taken by other
+    // receivers before the caller calls try_recv(), in which case just select
+    // again.
+    // Returns 0 on success, ETIMEDOUT if |abstime| (may be NULL) was reached,
+    // EINVAL if |n| is 0.
+    int fiber_channel_select(fiber_channel_base *const *channels, size_t n,
+                             size_t *index, const timespec *abstime);
+
+    template<typename T>
+    int fiber_channel<T>::send_impl(T &&value, bool blocking, const timespec *abstime) {
+        while (true) {
+            if (closed()) {
+                return EPIPE;
+            }
+            if (_ring.push(std::move(value))) {
+                notify_sent(1);
+                return 0;
+            }
+            if (!blocking) {
+                return EAGAIN;
+            }
+            const int expected = begin_wait_send();
+            // Retry after registered so that either the push succeeds or a
+            // receiver making room sees us.
+            bool sent = false;
+            int rc = 0;
+            if (!closed()) {
+                sent = _ring.push(std::move(value));
+                if (!sent) {
+                    rc = wait_send(expected, abstime);
+                }
+            }
+            end_wait_send();
+            if (sent) {
+                notify_sent(1);
+                return 0;
+            }
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
+    template<typename T>
+    int fiber_channel<T>::recv_impl(T *value, bool blocking, const timespec *abstime) {
+        while (true) {
+            if (_ring.pop(value)) {
+                notify_received(1);
+                return 0;
+            }
+            if (closed()) {
+                // Values sent before close() are visible now.
+                if (_ring.pop(value)) {
+                    notify_received(1);
+                    return 0;
+                }
+                return EPIPE;
+            }
+            if (!blocking) {
+                return EAGAIN;
+            }
+            const int expected = begin_wait_recv();
+            bool received = false;
+            int rc = 0;
+            if (!closed()) {
+                received = _ring.pop(value);
+                if (!received) {
+                    rc = wait_recv(expected, abstime);
+                }
+            }
+            end_wait_recv();
+            if (received) {
+                notify_received(1);
+                return 0;
+            }
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
+    template<typename T>
+    size_t fiber_channel<T>::send_batch(const T *values, size_t n) {
+        size_t nsent = 0;
+        while (nsent < n) {
+            size_t i = nsent;
+            while (i < n && !closed() && _ring.push(values[i])) {
+                ++i;
+            }
+            if (i != nsent) {
+                notify_sent(i - nsent);
+                nsent = i;
+                continue;
+            }
+            // The channel is full or closed, wait for one slot.
+            if (send_impl(T(values[nsent]), true, nullptr) != 0) {
+                break;
+            }
+            ++nsent;
+        }
+        return nsent;
+    }
+
+    template<typename T>
+    size_t fiber_channel<T>::recv_batch(T *values, size_t n) {
+        if (n == 0 || recv_impl(&values[0], true, nullptr) != 0) {
+            return 0;
+        }
+        size_t nrecv = 1;
+        while (nrecv < n && _ring.pop(&values[nrecv])) {
+            ++nrecv;
+        }
+        if (nrecv > 1) {
+            notify_received(nrecv - 1);
+        }
+        return nrecv;
+    }
+
+}  // namespace flare
+
+#endif  // FLARE_FIBER_FIBER_CHANNEL_H_
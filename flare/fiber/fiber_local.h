@@ -9,6 +9,8 @@
 #include "flare/fiber/internal/types.h"
 #include "flare/fiber/internal/fiber.h"
 #include "flare/fiber/internal/unstable.h"
+#include "flare/fiber/internal/key.h"
+#include "flare/log/logging.h"
 
 namespace flare {
 
@@ -20,11 +22,12 @@ namespace flare {
     template<class T>
     class fiber_local {
     public:
-        // A dedicated FLS slot is allocated for this `fiber_local`.
+        // A dedicated FLS slot is allocated for this `fiber_local`. The value is
+        // constructed on the first access of each fiber (or pthread) and
+        // destroyed when it exits. Fibers started with a keytable_pool inherit
+        // values left in the pooled keytables by previous fibers instead.
         fiber_local() {
-            fiber_key_create2(&_key, local_dtor<T>, nullptr);
-            T *d = std::make_unique<T>().release();
-            fiber_setspecific(_key, d);
+            FLARE_CHECK_EQ(0, fiber_key_create2(&_key, local_dtor<T>, nullptr));
         }
 
         // The FLS slot is released on destruction.
@@ -37,12 +40,20 @@ namespace flare {
 
         T &operator*() const noexcept { return *get(); }
 
-        T *get() const noexcept { return static_cast<T *>(get_impl()); }
+        T *get() const noexcept {
+            void *p = fiber_internal::fast_getspecific(_key);
+            if (FLARE_LIKELY(p != nullptr)) {
+                return static_cast<T *>(p);
+            }
+            return create();
+        }
 
     private:
 
-        void *get_impl() const noexcept {
-            return ::fiber_getspecific(_key);
+        FLARE_NO_INLINE T *create() const noexcept {
+            T *d = std::make_unique<T>().release();
+            FLARE_CHECK_EQ(0, fiber_setspecific(_key, d));
+            return d;
         }
 
     private:
@@ -0,0 +1,68 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/fiber/fiber_shared_mutex.h"
+#include <algorithm>
+#include <atomic>
+#include "flare/base/hardware.h"
+
+namespace flare {
+
+    // Threads are numbered on first use, thus each worker maps to a shard of
+    // its own as long as there are enough shards.
+    static std::atomic<size_t> g_next_thread_index{0};
+    static FLARE_THREAD_LOCAL size_t tls_thread_index = static_cast<size_t>(-1);
+
+    fiber_sharded_shared_mutex::fiber_sharded_shared_mutex(size_t nshard)
+            : _nshard(nshard ? nshard : std::max(flare::num_cpus(), 1)),
+              _shards(new Shard[_nshard]) {}
+
+    size_t fiber_sharded_shared_mutex::current_shard() const {
+        size_t index = tls_thread_index;
+        if (FLARE_UNLIKELY(index == static_cast<size_t>(-1))) {
+            index = g_next_thread_index.fetch_add(1, std::memory_order_relaxed);
+            tls_thread_index = index;
+        }
+        return index % _nshard;
+    }
+
+    void fiber_sharded_shared_mutex::lock() {
+        for (size_t i = 0; i < _nshard; ++i) {
+            _shards[i].mutex.lock();
+        }
+    }
+
+    bool fiber_sharded_shared_mutex::try_lock() {
+        for (size_t i = 0; i < _nshard; ++i) {
+            if (!_shards[i].mutex.try_lock()) {
+                while (i > 0) {
+                    _shards[--i].mutex.unlock();
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void fiber_sharded_shared_mutex::unlock() {
+        for (size_t i = _nshard; i > 0; --i) {
+            _shards[i - 1].mutex.unlock();
+        }
+    }
+
+}  // namespace flare
@@ -0,0 +1,144 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_FIBER_FIBER_SHARED_MUTEX_H_
+#define FLARE_FIBER_FIBER_SHARED_MUTEX_H_
+
+#include <memory>
+#include <system_error>
+#include "flare/fiber/internal/fiber.h"
+#include "flare/base/profile.h"
+#include "flare/log/logging.h"
+
+namespace flare {
+
+    // Reader-writer lock parking fibers rather than their workers, as opposed
+    // to flare::rw_lock. Writers are preferred: once a writer is waiting, new
+    // readers wait until the writer is done. Works with std::unique_lock and
+    // std::shared_lock.
+    class fiber_shared_mutex {
+    public:
+        typedef fiber_rwlock_t *native_handler_type;
+
+        fiber_shared_mutex() {
+            int ec = fiber_rwlock_init(&_rwlock, NULL);
+            if (ec != 0) {
+                throw std::system_error(std::error_code(ec, std::system_category()),
+                                        "fiber_shared_mutex constructor failed");
+            }
+        }
+
+        ~fiber_shared_mutex() { FLARE_CHECK_EQ(0, fiber_rwlock_destroy(&_rwlock)); }
+
+        native_handler_type native_handler() { return &_rwlock; }
+
+        void lock() {
+            int ec = fiber_rwlock_wrlock(&_rwlock);
+            if (ec != 0) {
+                throw std::system_error(std::error_code(ec, std::system_category()),
+                                        "fiber_shared_mutex lock failed");
+            }
+        }
+
+        bool try_lock() { return !fiber_rwlock_trywrlock(&_rwlock); }
+
+        void unlock() { fiber_rwlock_unlock(&_rwlock); }
+
+        void lock_shared() {
+            int ec = fiber_rwlock_rdlock(&_rwlock);
+            if (ec != 0) {
+                throw std::system_error(std::error_code(ec, std::system_category()),
+                                        "fiber_shared_mutex lock_shared failed");
+            }
+        }
+
+        bool try_lock_shared() { return !fiber_rwlock_tryrdlock(&_rwlock); }
+
+        void unlock_shared() { fiber_rwlock_unlock(&_rwlock); }
+
+    private:
+        FLARE_DISALLOW_COPY_AND_ASSIGN(fiber_shared_mutex);
+
+        fiber_rwlock_t _rwlock;
+    };
+
+    // "Big reader" lock for data read millions of times per second and
+    // written rarely, e.g. configuration tables. The lock is sharded by
+    // thread so that readers only touch the cacheline of the worker running
+    // them, while writers lock all shards.
+    //
+    // As the fiber may be migrated to another worker while holding the read
+    // lock, lock_shared() returns the shard locked which must be passed to
+    // unlock_shared(). Prefer shared_guard.
+    class fiber_sharded_shared_mutex {
+    public:
+        // `nshard' defaults to number of CPUs.
+        explicit fiber_sharded_shared_mutex(size_t nshard = 0);
+
+        void lock();
+
+        bool try_lock();
+
+        void unlock();
+
+        size_t lock_shared() {
+            const size_t shard = current_shard();
+            _shards[shard].mutex.lock_shared();
+            return shard;
+        }
+
+        // Returns the shard locked or -1 if a writer holds or waits for the lock.
+        ssize_t try_lock_shared() {
+            const size_t shard = current_shard();
+            return _shards[shard].mutex.try_lock_shared() ? static_cast<ssize_t>(shard) : -1;
+        }
+
+        void unlock_shared(size_t shard) { _shards[shard].mutex.unlock_shared(); }
+
+        size_t shard_count() const { return _nshard; }
+
+        class shared_guard {
+        public:
+            explicit shared_guard(fiber_sharded_shared_mutex &mutex)
+                    : _mutex(mutex), _shard(mutex.lock_shared()) {}
+
+            ~shared_guard() { _mutex.unlock_shared(_shard); }
+
+        private:
+            FLARE_DISALLOW_COPY_AND_ASSIGN(shared_guard);
+
+            fiber_sharded_shared_mutex &_mutex;
+            const size_t _shard;
+        };
+
+    private:
+        FLARE_DISALLOW_COPY_AND_ASSIGN(fiber_sharded_shared_mutex);
+
+        struct FLARE_CACHELINE_ALIGNMENT Shard {
+            fiber_shared_mutex mutex;
+        };
+
+        size_t current_shard() const;
+
+        const size_t _nshard;
+        std::unique_ptr<Shard[]> _shards;
+    };
+
+}  // namespace flare
+
+#endif  // FLARE_FIBER_FIBER_SHARED_MUTEX_H_
@@ -24,6 +24,10 @@
 #include "flare/base/singleton_on_pthread_once.h"
 #include "flare/memory/object_pool.h"           // flare::get_object
 #include "flare/memory/resource_pool.h"         // flare::get_resource
+#include "flare/times/time.h"
+#include "flare/variable/latency_recorder.h"  // detail::PercentileWindow, detail::CDF
+#include "flare/variable/passive_status.h"
+#include "flare/variable/recorder.h"
 
 namespace flare::fiber_internal {
 
@@ -45,17 +49,63 @@ namespace flare::fiber_internal {
         }
     }  // namespace anonymous
 
+    // Distribution of a count, like LatencyRecorder without the latency
+    // naming: `name' is the average, `name'_percentiles the 50%, 90%, 99% and
+    // 99.9% percentiles and `name'_cdf the cdf in the recent window.
+    struct CountHistogram {
+        flare::variable::IntRecorder average;
+        flare::variable::detail::Percentile percentile;
+        flare::variable::detail::PercentileWindow percentile_window;
+        flare::variable::PassiveStatus<flare::variable::Vector<int64_t, 4> > percentiles;
+        flare::variable::detail::CDF cdf;
+
+        explicit CountHistogram(const std::string &name);
+
+        CountHistogram &operator<<(int64_t value) {
+            average << value;
+            percentile << value;
+            return *this;
+        }
+    };
+
+    static flare::variable::Vector<int64_t, 4> get_count_percentiles(void *arg) {
+        std::vector<flare::variable::detail::GlobalPercentileSamples> buckets;
+        static_cast<flare::variable::detail::PercentileWindow *>(arg)->get_samples(&buckets);
+        std::unique_ptr<flare::variable::detail::PercentileSamples<1022> > cb(
+                new flare::variable::detail::PercentileSamples<1022>);
+        cb->combine_of(buckets.begin(), buckets.end());
+        flare::variable::Vector<int64_t, 4> result;
+        result[0] = cb->get_number(0.5);
+        result[1] = cb->get_number(0.9);
+        result[2] = cb->get_number(0.99);
+        result[3] = cb->get_number(0.999);
+        return result;
+    }
+
+    CountHistogram::CountHistogram(const std::string &name)
+            : average(name), percentile_window(&percentile, -1),
+              percentiles(get_count_percentiles, &percentile_window), cdf(&percentile_window) {
+        percentiles.expose_as(name, "percentiles", flare::variable::DISPLAY_ON_HTML);
+        percentiles.set_vector_names("50%,90%,99%,99.9%");
+        cdf.expose_as(name, "cdf", flare::variable::DISPLAY_ON_HTML);
+    }
+
     struct ExecutionQueueVars {
         flare::variable::Adder<int64_t> running_task_count;
         flare::variable::Adder<int64_t> execq_count;
         flare::variable::Adder<int64_t> execq_active_count;
+        // Number of tasks iterated per call to execute.
+        CountHistogram batch_size;
+        // Number of pending tasks, sampled when the consumer starts a batch.
+        CountHistogram depth;
 
         ExecutionQueueVars();
     };
 
     ExecutionQueueVars::ExecutionQueueVars()
             : running_task_count("fiber_execq_running_task_count"), execq_count("fiber_execq_count"),
-              execq_active_count("fiber_execq_active_count") {
+              execq_active_count("fiber_execq_active_count"), batch_size("fiber_execq_batch_size"),
+              depth("fiber_execq_depth") {
     }
 
     inline ExecutionQueueVars *get_execq_vars() {
@@ -77,6 +127,12 @@ namespace flare::fiber_internal {
         TaskNode *const prev_head = _head.exchange(node, std::memory_order_release);
         if (prev_head != NULL) {
             node->next = prev_head;
+            if (_options.max_batch_latency_us > 0 &&
+                (node->high_priority || node->stop_task)) {
+                // Don't let the consumer wait for a batch, see _wait_for_batch.
+                _batch_butex->fetch_add(1, std::memory_order_release);
+                waitable_event_wake(_batch_butex);
+            }
             return;
         }
         // Get the right to execute the task, start a fiber to avoid deadlock
@@ -126,6 +182,10 @@ namespace flare::fiber_internal {
         ExecutionQueueBase *m = (ExecutionQueueBase *) head->q;
         TaskNode *cur_tail = NULL;
         bool destroy_queue = false;
+        if (m->_options.max_batch_latency_us > 0 && !head->iterated &&
+            !head->stop_task && !head->high_priority) {
+            m->_wait_for_batch(head, &cur_tail);
+        }
         for (;;) {
             if (head->iterated) {
                 FLARE_CHECK(head->next != NULL);
@@ -133,19 +193,23 @@ namespace flare::fiber_internal {
                 head = head->next;
                 m->return_task_node(saved_head);
             }
+            vars->depth << m->_pending_tasks.load(std::memory_order_relaxed);
             int rc = 0;
+            int niterated = 0;
             if (m->_high_priority_tasks.load(std::memory_order_relaxed) > 0) {
-                int nexecuted = 0;
                 // Don't care the return value
-                rc = m->_execute(head, true, &nexecuted);
+                rc = m->_execute(head, true, &niterated);
                 m->_high_priority_tasks.fetch_sub(
-                        nexecuted, std::memory_order_relaxed);
-                if (nexecuted == 0) {
+                        niterated, std::memory_order_relaxed);
+                if (niterated == 0) {
                     // Some high_priority tasks are not in queue
                     sched_yield();
                 }
             } else {
-                rc = m->_execute(head, false, NULL);
+                rc = m->_execute(head, false, &niterated);
+            }
+            if (niterated > 0 && rc != ESTOP) {
+                vars->batch_size << niterated;
             }
             if (rc == ESTOP) {
                 destroy_queue = true;
@@ -186,7 +250,81 @@ namespace flare::fiber_internal {
         return NULL;
     }
 
+    void ExecutionQueueBase::_wait_for_batch(TaskNode *head, TaskNode **tail) {
+        const int batch_size = _options.max_batch_size;
+        const timespec abstime =
+                flare::time_point::future_unix_micros(_options.max_batch_latency_us).to_timespec();
+        while (true) {
+            const int expected = _batch_butex->load(std::memory_order_acquire);
+            // High priority tasks and stopping can't wait for the batch.
+            if ((batch_size > 0 &&
+                 _pending_tasks.load(std::memory_order_relaxed) >= batch_size) ||
+                _high_priority_tasks.load(std::memory_order_relaxed) > 0 ||
+                stopped()) {
+                break;
+            }
+            if (waitable_event_wait(_batch_butex, expected, &abstime) < 0 &&
+                errno != EWOULDBLOCK && errno != EINTR) {
+                break;  // ETIMEDOUT
+            }
+        }
+        // Link tasks pushed meanwhile after head.
+        *tail = head;
+        _more_tasks(head, tail, true);
+    }
+
+    int ExecutionQueueBase::reserve_task(bool blocking, const timespec *abstime,
+                                         int64_t *npending) {
+        const int64_t capacity = _options.max_pending_tasks;
+        if (capacity <= 0) {
+            *npending = _pending_tasks.fetch_add(1, std::memory_order_relaxed) + 1;
+            return 0;
+        }
+        int64_t n = _pending_tasks.load(std::memory_order_relaxed);
+        while (true) {
+            if (n < capacity) {
+                if (_pending_tasks.compare_exchange_weak(n, n + 1, std::memory_order_relaxed)) {
+                    *npending = n + 1;
+                    return 0;
+                }
+                continue;
+            }
+            if (!blocking) {
+                return EAGAIN;
+            }
+            if (stopped()) {
+                return EINVAL;
+            }
+            // Pairs with release_task(): either we see the room made or the
+            // releaser sees us waiting.
+            _capacity_waiters.fetch_add(1);
+            const int expected = _capacity_butex->load(std::memory_order_acquire);
+            int rc = 0;
+            if (_pending_tasks.load() >= capacity && !stopped() &&
+                waitable_event_wait(_capacity_butex, expected, abstime) < 0 &&
+                errno == ETIMEDOUT) {
+                rc = ETIMEDOUT;
+            }
+            _capacity_waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (rc != 0) {
+                return rc;
+            }
+            n = _pending_tasks.load(std::memory_order_relaxed);
+        }
+    }
+
+    void ExecutionQueueBase::release_task() {
+        _pending_tasks.fetch_sub(1);
+        if (_options.max_pending_tasks > 0 && _capacity_waiters.load() > 0) {
+            _capacity_butex->fetch_add(1, std::memory_order_release);
+            waitable_event_wake(_capacity_butex);
+        }
+    }
+
     void ExecutionQueueBase::return_task_node(TaskNode *node) {
+        if (!node->stop_task) {
+            release_task();
+        }
         node->clear_before_return(_clear_func);
         flare::return_object<TaskNode>(node);
         get_execq_vars()->running_task_count << -1;
@@ -242,6 +380,9 @@ namespace flare::fiber_internal {
                     std::memory_order_relaxed)) {
                 // Set _stopped to make lattern execute() fail immediately
                 _stopped.store(true, std::memory_order_release);
+                // Fail producers waiting for room.
+                _capacity_butex->fetch_add(1, std::memory_order_release);
+                waitable_event_wake_all(_capacity_butex);
                 // Deref additionally which is added at creation so that this
                 // queue's reference will hit 0(recycle) when no one addresses it.
                 _release_additional_reference();
@@ -352,6 +493,7 @@ namespace flare::fiber_internal {
             m->_type_specific_function = type_specific_function;
             FLARE_CHECK(m->_head.load(std::memory_order_relaxed) == NULL);
             FLARE_CHECK_EQ(0, m->_high_priority_tasks.load(std::memory_order_relaxed));
+            FLARE_CHECK_EQ(0, m->_pending_tasks.load(std::memory_order_relaxed));
             ExecutionQueueOptions opt;
             if (options != NULL) {
                 opt = *options;
@@ -387,6 +529,12 @@ namespace flare::fiber_internal {
         if (should_break_for_high_priority_tasks()) {
             return;
         }  // else the next high_priority_task would be delayed for at most one task
+        const int max_batch_size = _q->_options.max_batch_size;
+        if (max_batch_size > 0 && _num_iterated >= max_batch_size) {
+            // Leave the remaining tasks to the next call to execute.
+            _should_break = true;
+            return;
+        }
 
         while (_cur_node && !_cur_node->stop_task) {
             if (_high_priority == _cur_node->high_priority) {
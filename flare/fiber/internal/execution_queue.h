@@ -166,6 +166,26 @@ namespace flare::fiber_internal {
         // Note that TaskOptions.in_place_if_possible = false will not work, if implementation of
         // Executor is in-place(synchronous).
         Executor *executor;
+
+        // Max number of tasks pushed but not executed yet. When the queue is
+        // full, execution_queue_execute parks the calling fiber (or blocks the
+        // pthread) until the consumer catches up, use execution_queue_try_execute
+        // or execution_queue_timed_execute to not block forever.
+        // NOTE: Don't push tasks into a full queue in |execute| of the same
+        // queue or in-place tasks, which is a deadlock.
+        // default: 0 (unbounded)
+        int64_t max_pending_tasks;
+
+        // Max number of tasks iterated by a TaskIterator, remaining tasks are
+        // passed to the following calls of |execute|.
+        // default: 0 (unlimited)
+        int max_batch_size;
+
+        // When the consumer starts on an idle queue, it waits at most so many
+        // microseconds for max_batch_size (if set) tasks to be pushed before
+        // calling |execute|, so that tasks coming in a row are coalesced.
+        // default: 0 (don't wait)
+        int64_t max_batch_latency_us;
     };
 
     // Start a ExecutionQueue. If |options| is NULL, the queue will be created with
@@ -216,6 +236,32 @@ namespace flare::fiber_internal {
                                 const TaskOptions *options,
                                 TaskHandle *handle);
 
+    // Same as execution_queue_execute but returns EAGAIN instead of blocking
+    // when the queue is full (see ExecutionQueueOptions.max_pending_tasks).
+    template<typename T>
+    int execution_queue_try_execute(ExecutionQueueId<T> id,
+                                    typename flare::base::add_const_reference<T>::type task);
+
+    template<typename T>
+    int execution_queue_try_execute(ExecutionQueueId<T> id,
+                                    typename flare::base::add_const_reference<T>::type task,
+                                    const TaskOptions *options,
+                                    TaskHandle *handle);
+
+    // Same as execution_queue_execute but returns ETIMEDOUT if the queue is
+    // still full at |abstime|.
+    template<typename T>
+    int execution_queue_timed_execute(ExecutionQueueId<T> id,
+                                      typename flare::base::add_const_reference<T>::type task,
+                                      const timespec *abstime);
+
+    template<typename T>
+    int execution_queue_timed_execute(ExecutionQueueId<T> id,
+                                      typename flare::base::add_const_reference<T>::type task,
+                                      const timespec *abstime,
+                                      const TaskOptions *options,
+                                      TaskHandle *handle);
+
     // [Thread safe and ABA free] Cancel the corrosponding task.
     // Returns:
     //  -1: The task was executed or h is an invalid handle
@@ -152,13 +152,19 @@ namespace flare::fiber_internal {
         // User cannot create ExecutionQueue fron construct
         ExecutionQueueBase(Forbidden)
                 : _head(NULL), _versioned_ref(0)  // join() depends on even version
-                , _high_priority_tasks(0) {
+                , _high_priority_tasks(0), _pending_tasks(0), _capacity_waiters(0) {
             _join_butex = waitable_event_create_checked<std::atomic<int> >();
             _join_butex->store(0, std::memory_order_relaxed);
+            _capacity_butex = waitable_event_create_checked<std::atomic<int> >();
+            _capacity_butex->store(0, std::memory_order_relaxed);
+            _batch_butex = waitable_event_create_checked<std::atomic<int> >();
+            _batch_butex->store(0, std::memory_order_relaxed);
         }
 
         ~ExecutionQueueBase() {
             waitable_event_destroy(_join_butex);
+            waitable_event_destroy(_capacity_butex);
+            waitable_event_destroy(_batch_butex);
         }
 
         bool stopped() const { return _stopped.load(std::memory_order_acquire); }
@@ -183,6 +189,22 @@ namespace flare::fiber_internal {
 
         void start_execute(TaskNode *node);
 
+        // Take a room for a new task, waiting until |abstime| if |blocking| is
+        // true and the queue is full. |npending| is set to the number of
+        // pending tasks including the new one.
+        int reserve_task(bool blocking, const timespec *abstime, int64_t *npending);
+
+        void cancel_reserved_task() { release_task(); }
+
+        // Called after a task is pushed.
+        void on_task_pushed(int64_t npending) {
+            if (_options.max_batch_latency_us > 0 &&
+                npending == _options.max_batch_size) {
+                _batch_butex->fetch_add(1, std::memory_order_release);
+                waitable_event_wake(_batch_butex);
+            }
+        }
+
         TaskNode *allocate_node();
 
         void return_task_node(TaskNode *node);
@@ -198,6 +220,11 @@ namespace flare::fiber_internal {
 
         void _on_recycle();
 
+        void release_task();
+
+        // Called by the consumer starting with |head|, see max_batch_latency_us.
+        void _wait_for_batch(TaskNode *head, TaskNode **tail);
+
         int _execute(TaskNode *head, bool high_priority, int *niterated);
 
         static void *_execute_tasks(void *arg);
@@ -232,6 +259,13 @@ namespace flare::fiber_internal {
         clear_task_mem _clear_func;
         ExecutionQueueOptions _options;
         std::atomic<int> *_join_butex;
+        // Tasks pushed and not returned yet.
+        std::atomic<int64_t> FLARE_CACHELINE_ALIGNMENT _pending_tasks;
+        // Producers waiting for room, bumping _capacity_butex wakes them up.
+        std::atomic<int> _capacity_waiters;
+        std::atomic<int> *_capacity_butex;
+        // Bumped when max_batch_size tasks are pending.
+        std::atomic<int> *_batch_butex;
     };
 
     template<typename T>
@@ -297,20 +331,45 @@ namespace flare::fiber_internal {
 
         int execute(typename flare::base::add_const_reference<T>::type task,
                     const TaskOptions *options, TaskHandle *handle) {
+            return execute_impl(task, options, handle, true, NULL);
+        }
+
+        int try_execute(typename flare::base::add_const_reference<T>::type task,
+                        const TaskOptions *options, TaskHandle *handle) {
+            return execute_impl(task, options, handle, false, NULL);
+        }
+
+        int timed_execute(typename flare::base::add_const_reference<T>::type task,
+                          const timespec *abstime,
+                          const TaskOptions *options, TaskHandle *handle) {
+            return execute_impl(task, options, handle, true, abstime);
+        }
+
+    private:
+        int execute_impl(typename flare::base::add_const_reference<T>::type task,
+                         const TaskOptions *options, TaskHandle *handle,
+                         bool blocking, const timespec *abstime) {
             if (stopped()) {
                 return EINVAL;
             }
+            int64_t npending = 0;
+            const int rc = reserve_task(blocking, abstime, &npending);
+            if (rc != 0) {
+                return rc;
+            }
             TaskNode *node = allocate_node();
             if (FLARE_UNLIKELY(node == NULL)) {
+                cancel_reserved_task();
                 return ENOMEM;
             }
+            node->stop_task = false;
             void *const mem = allocator::allocate(node);
             if (FLARE_UNLIKELY(!mem)) {
+                // The reservation is released along with the node.
                 return_task_node(node);
                 return ENOMEM;
             }
             new(mem) T(task);
-            node->stop_task = false;
             TaskOptions opt;
             if (options) {
                 opt = *options;
@@ -322,12 +381,14 @@ namespace flare::fiber_internal {
                 handle->version = node->version;
             }
             start_execute(node);
+            on_task_pushed(npending);
             return 0;
         }
     };
 
     inline ExecutionQueueOptions::ExecutionQueueOptions()
-            : fiber_attr(FIBER_ATTR_NORMAL), executor(NULL) {}
+            : fiber_attr(FIBER_ATTR_NORMAL), executor(NULL), max_pending_tasks(0),
+              max_batch_size(0), max_batch_latency_us(0) {}
 
     template<typename T>
     inline int execution_queue_start(
@@ -371,6 +432,48 @@ namespace flare::fiber_internal {
         }
     }
 
+    template<typename T>
+    inline int execution_queue_try_execute(ExecutionQueueId<T> id,
+                                           typename flare::base::add_const_reference<T>::type task) {
+        return execution_queue_try_execute(id, task, NULL, NULL);
+    }
+
+    template<typename T>
+    inline int execution_queue_try_execute(ExecutionQueueId<T> id,
+                                           typename flare::base::add_const_reference<T>::type task,
+                                           const TaskOptions *options,
+                                           TaskHandle *handle) {
+        typename ExecutionQueue<T>::scoped_ptr_t
+                ptr = ExecutionQueue<T>::address(id);
+        if (ptr != NULL) {
+            return ptr->try_execute(task, options, handle);
+        } else {
+            return EINVAL;
+        }
+    }
+
+    template<typename T>
+    inline int execution_queue_timed_execute(ExecutionQueueId<T> id,
+                                             typename flare::base::add_const_reference<T>::type task,
+                                             const timespec *abstime) {
+        return execution_queue_timed_execute(id, task, abstime, NULL, NULL);
+    }
+
+    template<typename T>
+    inline int execution_queue_timed_execute(ExecutionQueueId<T> id,
+                                             typename flare::base::add_const_reference<T>::type task,
+                                             const timespec *abstime,
+                                             const TaskOptions *options,
+                                             TaskHandle *handle) {
+        typename ExecutionQueue<T>::scoped_ptr_t
+                ptr = ExecutionQueue<T>::address(id);
+        if (ptr != NULL) {
+            return ptr->timed_execute(task, abstime, options, handle);
+        } else {
+            return EINVAL;
+        }
+    }
+
     template<typename T>
     inline int execution_queue_stop(ExecutionQueueId<T> id) {
         typename ExecutionQueue<T>::scoped_ptr_t
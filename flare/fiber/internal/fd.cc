@@ -22,6 +22,8 @@
 #include "flare/base/compat.h"
 #include <new>                                   // std::nothrow
 #include <sys/poll.h>                            // poll()
+#include <algorithm>                             // std::min
+#include <gflags/gflags.h>
 
 #if defined(FLARE_PLATFORM_OSX)
 
@@ -43,6 +45,15 @@
 
 namespace flare::fiber_internal {
 
+    DEFINE_int32(fiber_epoll_thread_num, FIBER_EPOLL_THREAD_NUM,
+                 "Number of fibers polling file descriptors for fiber_fd_*wait, fds are "
+                 "sharded among them. Each of them occupies a worker when no worker polls "
+                 "(-fiber_worker_poll_fd). Read once at first fiber_fd_*wait");
+    DEFINE_bool(fiber_fd_edge_triggered, false,
+                "Register file descriptors into epoll once with EPOLLET instead of "
+                "EPOLL_CTL_ADD/EPOLL_CTL_DEL per wait. File descriptors must be closed "
+                "by fiber_fd_close(). Read once at first fiber_fd_*wait");
+
     extern FLARE_THREAD_LOCAL fiber_worker *tls_task_group;
 
     template<typename T, size_t NBLOCK, size_t BLOCK_SIZE>
@@ -110,12 +121,26 @@ namespace flare::fiber_internal {
 // Able to address 67108864 file descriptors, should be enough.
     LazyArray<EpollButex *, 262144/*NBLOCK*/, 256/*BLOCK_SIZE*/> fd_butexes;
 
+    // Non-zero if the fd is registered into epoll with EPOLLET.
+    LazyArray<int, 262144/*NBLOCK*/, 256/*BLOCK_SIZE*/> fd_registered;
+
+    // Readiness sequence of the fd (value of its butex, bumped by the epoll
+    // thread on each edge) when its registration was last checked by
+    // epoll_ctl.
+    LazyArray<int, 262144/*NBLOCK*/, 256/*BLOCK_SIZE*/> fd_checked_seq;
+
     static const int FIBER_DEFAULT_EPOLL_SIZE = 65536;
 
+    static const int FIBER_MAX_EPOLL_THREAD_NUM = 64;
+
+#if defined(FLARE_PLATFORM_LINUX)
+    short epoll_to_poll_events(uint32_t epoll_events);
+#endif
+
     class EpollThread {
     public:
         EpollThread()
-                : _epfd(-1), _stop(false), _tid(0) {
+                : _epfd(-1), _stop(false), _tid(0), _edge_triggered(false) {
         }
 
         int start(int epoll_size) {
@@ -129,6 +154,7 @@ namespace flare::fiber_internal {
                 return -1;
             }
 #if defined(FLARE_PLATFORM_LINUX)
+            _edge_triggered = FLAGS_fiber_fd_edge_triggered;
             _epfd = epoll_create(epoll_size);
 #elif defined(FLARE_PLATFORM_OSX)
             _epfd = kqueue();
@@ -227,6 +253,11 @@ namespace flare::fiber_internal {
                 }
                 butex = p->load(std::memory_order_consume);
             }
+#if defined(FLARE_PLATFORM_LINUX)
+            if (_edge_triggered) {
+                return fd_wait_edge_triggered(fd, events, abstime, p, butex);
+            }
+#endif
             // Save value of butex before adding to epoll because the butex may
             // be changed before waitable_event_wait. No memory fence because EPOLL_CTL_MOD
             // and EPOLL_CTL_ADD shall have release fence.
@@ -291,6 +322,10 @@ namespace flare::fiber_internal {
                 waitable_event_wake_all(butex);
             }
 #if defined(FLARE_PLATFORM_LINUX)
+            std::atomic<int> *registered = fd_registered.get(fd);
+            if (registered != NULL) {
+                registered->store(0, std::memory_order_relaxed);
+            }
             epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL);
 #elif defined(FLARE_PLATFORM_OSX)
             struct kevent evt;
@@ -308,11 +343,186 @@ namespace flare::fiber_internal {
             return _epfd >= 0;
         }
 
+        // Called by idle workers, see -fiber_worker_poll_fd.
+        // Returns number of events handled.
+        int poll_nonblocking() {
+            const int epfd = _epfd;
+            if (epfd < 0 || _stop) {
+                return 0;
+            }
+#if defined(FLARE_PLATFORM_LINUX)
+            epoll_event e[32];
+            const int n = epoll_wait(epfd, e, 32, 0);
+#elif defined(FLARE_PLATFORM_OSX)
+            struct kevent e[32];
+            const timespec zero = {0, 0};
+            const int n = kevent(epfd, NULL, 0, e, 32, &zero);
+#endif
+            if (n <= 0) {
+                return 0;
+            }
+            handle_events(epfd, e, n);
+            return n;
+        }
+
     private:
+#if defined(FLARE_PLATFORM_LINUX)
+        // The fd stays in epoll until fiber_fd_close(), so a wait costs no
+        // epoll_ctl. The butex is a readiness sequence bumped by the epoll
+        // thread on each edge. Edges before the wait are not reported, so a
+        // wait loads the sequence, checks readiness by poll() and sleeps on
+        // the sequence, which is re-checked after queueing.
+        int fd_wait_edge_triggered(int fd, unsigned events, const timespec *abstime,
+                                   std::atomic<EpollButex *> *pbutex,
+                                   EpollButex *butex) {
+            const short poll_events = epoll_to_poll_events(events);
+            if (poll_events == 0) {
+                errno = EINVAL;
+                return -1;
+            }
+            std::atomic<int> *registered = fd_registered.get_or_new(fd);
+            std::atomic<int> *checked_seq = fd_checked_seq.get_or_new(fd);
+            if (NULL == registered || NULL == checked_seq) {
+                errno = ENOMEM;
+                return -1;
+            }
+            // Checked by EPOLL_CTL_ADD in this wait.
+            bool checked = false;
+            if (registered->load(std::memory_order_acquire) == 0) {
+                const int seq = butex->load(std::memory_order_relaxed);
+                if (register_edge_triggered(fd, EPOLL_CTL_ADD) < 0) {
+                    return -1;
+                }
+                checked_seq->store(seq, std::memory_order_relaxed);
+                registered->store(1, std::memory_order_release);
+                checked = true;
+            }
+            while (true) {
+                if (pbutex->load(std::memory_order_relaxed) == CLOSING_GUARD) {
+                    // Woken up by fiber_fd_close() before the fd is closed.
+                    return 0;
+                }
+                // Load the sequence before checking readiness, an edge after
+                // the check changes it and fails or wakes up the wait.
+                const int seq = butex->load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                pollfd ufds = {fd, poll_events, 0};
+                const int rc = poll(&ufds, 1, 0);
+                if (rc > 0) {
+                    // Including POLLNVAL after fiber_fd_close().
+                    return 0;
+                }
+                if (rc < 0 && errno != EINTR) {
+                    return -1;
+                }
+                if (!checked && checked_seq->load(std::memory_order_relaxed) == seq) {
+                    // No edge since the registration was checked. The fd may
+                    // have been closed by close() rather than fiber_fd_close()
+                    // and reused, which removed it from epoll silently.
+                    // Readiness is re-checked by the kernel. Fds which ever
+                    // reported edges skip this, so waits on them need no
+                    // epoll_ctl.
+                    if (register_edge_triggered(fd, EPOLL_CTL_MOD) < 0) {
+                        return -1;
+                    }
+                    checked = true;
+                }
+                if (waitable_event_wait(butex, seq, abstime) < 0) {
+                    if (errno == EINTR) {
+                        return 0;
+                    }
+                    if (errno != EWOULDBLOCK) {
+                        return -1;
+                    }
+                }
+                // Woken up by events the caller does not wait for, check again.
+            }
+        }
+
+        // Add `fd' into epoll or modify the existing registration by `op',
+        // falling back to the other operation if `fd' is (not) in epoll.
+        // Returns 0 on success, -1 otherwise.
+        int register_edge_triggered(int fd, int op) {
+            epoll_event evt;
+            evt.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            evt.data.fd = fd;
+            if (epoll_ctl(_epfd, op, fd, &evt) == 0) {
+                return 0;
+            }
+            if (op == EPOLL_CTL_ADD && errno == EEXIST) {
+                return 0;
+            }
+            if (op == EPOLL_CTL_MOD && errno == ENOENT &&
+                (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &evt) == 0 || errno == EEXIST)) {
+                return 0;
+            }
+            FLARE_PLOG_IF(FATAL, errno != EBADF)
+                << "Fail to add fd=" << fd << " into epfd=" << _epfd;
+            return -1;
+        }
+#endif
+
+#if defined(FLARE_PLATFORM_LINUX)
+        typedef epoll_event event_type;
+#elif defined(FLARE_PLATFORM_OSX)
+        typedef struct kevent event_type;
+#endif
+
+        void handle_events(int epfd, event_type *e, int n) {
+#if defined(FLARE_PLATFORM_LINUX)
+# ifndef BAIDU_KERNEL_FIXED_EPOLLONESHOT_BUG
+            if (!_edge_triggered) {
+                for (int i = 0; i < n; ++i) {
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, e[i].data.fd, NULL);
+                }
+            }
+# endif
+#endif
+            for (int i = 0; i < n; ++i) {
+#if defined(FLARE_PLATFORM_LINUX)
+                EpollButex *butex = NULL;
+# ifdef BAIDU_KERNEL_FIXED_EPOLLONESHOT_BUG
+                if (!_edge_triggered) {
+                    butex = static_cast<EpollButex*>(e[i].data.ptr);
+                } else
+# endif
+                {
+                    std::atomic<EpollButex *> *pbutex = fd_butexes.get(e[i].data.fd);
+                    butex = pbutex ? pbutex->load(std::memory_order_consume) : NULL;
+                }
+#elif defined(FLARE_PLATFORM_OSX)
+                EpollButex *butex = static_cast<EpollButex *>(e[i].udata);
+#endif
+                if (butex != NULL && butex != CLOSING_GUARD) {
+                    butex->fetch_add(1, std::memory_order_relaxed);
+                    waitable_event_wake_all(butex);
+                }
+            }
+        }
+
         static void *run_this(void *arg) {
             return static_cast<EpollThread *>(arg)->run();
         }
 
+        // Milliseconds until the earliest timer of current worker, -1 if
+        // there's no timer.
+        static int worker_timer_timeout_ms() {
+            fiber_worker *g = tls_task_group;
+            if (g == NULL) {
+                return -1;
+            }
+            const int64_t nearest = g->nearest_timer();
+            if (nearest == std::numeric_limits<int64_t>::max()) {
+                return -1;
+            }
+            const int64_t timeout_us = nearest - flare::get_current_time_micros();
+            if (timeout_us <= 0) {
+                return 0;
+            }
+            return (int) std::min<int64_t>((timeout_us + 999) / 1000,
+                                           std::numeric_limits<int>::max());
+        }
+
         void *run() {
             const int initial_epfd = _epfd;
             const size_t MAX_EVENTS = 32;
@@ -329,19 +539,28 @@ namespace flare::fiber_internal {
 
 #if defined(FLARE_PLATFORM_LINUX)
 # ifndef BAIDU_KERNEL_FIXED_EPOLLONESHOT_BUG
-            FLARE_DLOG(INFO) << "Use DEL+ADD instead of EPOLLONESHOT+MOD due to kernel bug. Performance will be much lower.";
+            FLARE_DLOG_IF(INFO, !_edge_triggered)
+                << "Use DEL+ADD instead of EPOLLONESHOT+MOD due to kernel bug. Performance will be much lower.";
 # endif
 #endif
             while (!_stop) {
                 const int epfd = _epfd;
+                // The worker is blocked in epoll_wait, wake up in time to
+                // run timers of its fibers.
+                const int timeout_ms = worker_timer_timeout_ms();
 #if defined(FLARE_PLATFORM_LINUX)
-                const int n = epoll_wait(epfd, e, MAX_EVENTS, -1);
+                const int n = epoll_wait(epfd, e, MAX_EVENTS, timeout_ms);
 #elif defined(FLARE_PLATFORM_OSX)
-                const int n = kevent(epfd, NULL, 0, e, MAX_EVENTS, NULL);
+                timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+                const int n = kevent(epfd, NULL, 0, e, MAX_EVENTS,
+                                     timeout_ms < 0 ? NULL : &timeout);
 #endif
                 if (_stop) {
                     break;
                 }
+                if (tls_task_group != NULL) {
+                    tls_task_group->run_timers();
+                }
 
                 if (n < 0) {
                     if (errno == EINTR) {
@@ -360,30 +579,7 @@ namespace flare::fiber_internal {
                     break;
                 }
 
-#if defined(FLARE_PLATFORM_LINUX)
-# ifndef BAIDU_KERNEL_FIXED_EPOLLONESHOT_BUG
-                for (int i = 0; i < n; ++i) {
-                    epoll_ctl(epfd, EPOLL_CTL_DEL, e[i].data.fd, NULL);
-                }
-# endif
-#endif
-                for (int i = 0; i < n; ++i) {
-#if defined(FLARE_PLATFORM_LINUX)
-# ifdef BAIDU_KERNEL_FIXED_EPOLLONESHOT_BUG
-                    EpollButex* butex = static_cast<EpollButex*>(e[i].data.ptr);
-# else
-                    std::atomic<EpollButex*>* pbutex = fd_butexes.get(e[i].data.fd);
-                    EpollButex* butex = pbutex ?
-                        pbutex->load(std::memory_order_consume) : NULL;
-# endif
-#elif defined(FLARE_PLATFORM_OSX)
-                    EpollButex *butex = static_cast<EpollButex *>(e[i].udata);
-#endif
-                    if (butex != NULL && butex != CLOSING_GUARD) {
-                        butex->fetch_add(1, std::memory_order_relaxed);
-                        waitable_event_wake_all(butex);
-                    }
-                }
+                handle_events(epfd, e, n);
             }
 
             delete[] e;
@@ -395,28 +591,46 @@ namespace flare::fiber_internal {
         int _epfd;
         bool _stop;
         fiber_id_t _tid;
+        bool _edge_triggered;
         flare::base::Mutex _start_mutex;
     };
 
-    EpollThread epoll_thread[FIBER_EPOLL_THREAD_NUM];
+    EpollThread epoll_thread[FIBER_MAX_EPOLL_THREAD_NUM];
+
+    static int get_epoll_thread_num() {
+        static const int n = std::min(std::max(FLAGS_fiber_epoll_thread_num, 1),
+                                      FIBER_MAX_EPOLL_THREAD_NUM);
+        return n;
+    }
 
     static inline EpollThread &get_epoll_thread(int fd) {
-        if (FIBER_EPOLL_THREAD_NUM == 1UL) {
+        const int n = get_epoll_thread_num();
+        if (n == 1) {
             EpollThread &et = epoll_thread[0];
             et.start(FIBER_DEFAULT_EPOLL_SIZE);
             return et;
         }
 
-        EpollThread &et = epoll_thread[flare::hash::fmix32(fd) % FIBER_EPOLL_THREAD_NUM];
+        EpollThread &et = epoll_thread[flare::hash::fmix32(fd) % n];
         et.start(FIBER_DEFAULT_EPOLL_SIZE);
         return et;
     }
 
+    // Used by fiber_worker::wait_task() before parking.
+    int poll_fd_events(unsigned hint) {
+        const int n = get_epoll_thread_num();
+        int nevents = 0;
+        for (int i = 0; i < n && nevents == 0; ++i) {
+            nevents = epoll_thread[(hint + i) % n].poll_nonblocking();
+        }
+        return nevents;
+    }
+
 //TODO(zhujiashun): change name
     int stop_and_join_epoll_threads() {
         // Returns -1 if any epoll thread failed to stop.
         int rc = 0;
-        for (size_t i = 0; i < FIBER_EPOLL_THREAD_NUM; ++i) {
+        for (int i = 0; i < FIBER_MAX_EPOLL_THREAD_NUM; ++i) {
             if (epoll_thread[i].stop_and_join() < 0) {
                 rc = -1;
             }
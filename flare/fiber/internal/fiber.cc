@@ -121,29 +121,40 @@ namespace flare::fiber_internal {
     }
 
     __thread fiber_worker *tls_task_group_nosignal = NULL;
+    // schedule_group::retired_count() when tls_task_group_nosignal was chosen.
+    __thread int64_t tls_task_group_nosignal_nretired = 0;
 
-    FLARE_FORCE_INLINE int
-    start_from_non_worker(fiber_id_t *__restrict tid,
-                          const fiber_attribute *__restrict attr,
-                          flare::base::function<void *(void *)> &&fn,
-                          void *__restrict arg) {
-        schedule_group *c = get_or_new_task_control();
-        if (NULL == c) {
-            return ENOMEM;
-        }
+    // Choose the fiber_worker to insert fibers created by a non-worker.
+    FLARE_FORCE_INLINE fiber_worker *
+    choose_group_for_non_worker(schedule_group *c, const fiber_attribute *attr) {
         if (attr != NULL && (attr->flags & FIBER_NOSIGNAL)) {
             // Remember the fiber_worker to insert NOSIGNAL tasks for 2 reasons:
             // 1. NOSIGNAL is often for creating many fibers in batch,
             //    inserting into the same fiber_worker maximizes the batch.
             // 2. fiber_flush() needs to know which fiber_worker to flush.
             fiber_worker *g = tls_task_group_nosignal;
-            if (NULL == g) {
+            const int64_t nretired = c->retired_count();
+            if (NULL == g || tls_task_group_nosignal_nretired != nretired) {
+                // The remembered one is possibly retired and to be deleted.
                 g = c->choose_one_group();
                 tls_task_group_nosignal = g;
+                tls_task_group_nosignal_nretired = nretired;
             }
-            return g->start_background<true>(tid, attr, std::move(fn), arg);
+            return g;
+        }
+        return c->choose_one_group();
+    }
+
+    FLARE_FORCE_INLINE int
+    start_from_non_worker(fiber_id_t *__restrict tid,
+                          const fiber_attribute *__restrict attr,
+                          flare::base::function<void *(void *)> &&fn,
+                          void *__restrict arg) {
+        schedule_group *c = get_or_new_task_control();
+        if (NULL == c) {
+            return ENOMEM;
         }
-        return c->choose_one_group()->start_background<true>(
+        return choose_group_for_non_worker(c, attr)->start_background<true>(
                 tid, attr, std::move(fn), arg);
     }
 
@@ -198,6 +209,31 @@ int fiber_start_background(fiber_id_t *__restrict tid,
     return flare::fiber_internal::start_from_non_worker(tid, attr, std::move(fn), arg);
 }
 
+int fiber_start_batch(fiber_id_t *__restrict tids,
+                      const fiber_attribute *__restrict attr,
+                      flare::base::function<void *(void *)> *fns,
+                      void *const *args, size_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    flare::fiber_internal::fiber_worker *g = flare::fiber_internal::tls_task_group;
+    if (g) {
+        // start from worker
+        return g->start_background_batch<false>(tids, attr, fns, args, n);
+    }
+    flare::fiber_internal::schedule_group *c = flare::fiber_internal::get_or_new_task_control();
+    if (NULL == c) {
+        for (size_t i = 0; i < n; ++i) {
+            tids[i] = INVALID_FIBER_ID;
+        }
+        return ENOMEM;
+    }
+    // NOSIGNAL fibers go to the same worker as fiber_start_background does,
+    // so that fiber_flush() signals them.
+    return flare::fiber_internal::choose_group_for_non_worker(c, attr)
+            ->start_background_batch<true>(tids, attr, fns, args, n);
+}
+
 void fiber_flush() {
     flare::fiber_internal::fiber_worker *g = flare::fiber_internal::tls_task_group;
     if (g) {
@@ -207,6 +243,11 @@ void fiber_flush() {
     if (g) {
         // NOSIGNAL tasks were created in this non-worker.
         flare::fiber_internal::tls_task_group_nosignal = NULL;
+        if (flare::fiber_internal::tls_task_group_nosignal_nretired !=
+            flare::fiber_internal::get_task_control()->retired_count()) {
+            // Retired workers hand over tasks to others with signals.
+            return;
+        }
         return g->flush_nosignal_tasks_remote();
     }
 }
@@ -282,15 +323,17 @@ int fiber_setconcurrency(int num) {
             flare::fiber_internal::never_set_fiber_concurrency = false;
         }
         flare::fiber_internal::FLAGS_fiber_concurrency = num;
+        flare::fiber_internal::schedule_group *c = flare::fiber_internal::get_task_control();
+        if (c != NULL && num < c->concurrency()) {
+            // Workers grown lazily above the new maximum are retired.
+            FLARE_SCOPED_LOCK(flare::fiber_internal::g_task_control_mutex);
+            c->remove_workers(c->concurrency() - num);
+        }
         return 0;
     }
     flare::fiber_internal::schedule_group *c = flare::fiber_internal::get_task_control();
-    if (c != NULL) {
-        if (num < c->concurrency()) {
-            return EPERM;
-        } else if (num == c->concurrency()) {
-            return 0;
-        }
+    if (c != NULL && num == c->concurrency()) {
+        return 0;
     }
     FLARE_SCOPED_LOCK(flare::fiber_internal::g_task_control_mutex);
     c = flare::fiber_internal::get_task_control();
@@ -315,6 +358,11 @@ int fiber_setconcurrency(int num) {
                 c->add_workers(num - flare::fiber_internal::FLAGS_fiber_concurrency);
         return 0;
     }
+    if (num < flare::fiber_internal::FLAGS_fiber_concurrency) {
+        // Retire workers, they quit after running fibers yield.
+        flare::fiber_internal::FLAGS_fiber_concurrency -=
+                c->remove_workers(flare::fiber_internal::FLAGS_fiber_concurrency - num);
+    }
     return (num == flare::fiber_internal::FLAGS_fiber_concurrency ? 0 : EPERM);
 }
 
@@ -330,8 +378,9 @@ int fiber_about_to_quit() {
     return EPERM;
 }
 
-int fiber_timer_add(fiber_timer_id *id, timespec abstime,
-                    void (*on_timer)(void *), void *arg) {
+int fiber_timer_add_with_slack(fiber_timer_id *id, timespec abstime,
+                               int64_t slack_us, void (*on_timer)(void *),
+                               void *arg) {
     flare::fiber_internal::schedule_group *c = flare::fiber_internal::get_or_new_task_control();
     if (c == NULL) {
         return ENOMEM;
@@ -340,7 +389,7 @@ int fiber_timer_add(fiber_timer_id *id, timespec abstime,
     if (tt == NULL) {
         return ENOMEM;
     }
-    fiber_timer_id tmp = tt->schedule(on_timer, arg, abstime);
+    fiber_timer_id tmp = tt->schedule(on_timer, arg, abstime, slack_us);
     if (tmp != 0) {
         *id = tmp;
         return 0;
@@ -348,6 +397,11 @@ int fiber_timer_add(fiber_timer_id *id, timespec abstime,
     return ESTOP;
 }
 
+int fiber_timer_add(fiber_timer_id *id, timespec abstime,
+                    void (*on_timer)(void *), void *arg) {
+    return fiber_timer_add_with_slack(id, abstime, 0, on_timer, arg);
+}
+
 int fiber_timer_del(fiber_timer_id id) {
     flare::fiber_internal::schedule_group *c = flare::fiber_internal::get_task_control();
     if (c != NULL) {
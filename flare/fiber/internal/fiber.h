@@ -58,6 +58,19 @@ extern int fiber_start_background(fiber_id_t *__restrict tid,
                                   flare::base::function<void*(void*)> && fn,
                                   void *__restrict args);
 
+// Create `n' fibers `fns[i](args[i])' with attributes `attr' like
+// fiber_start_background() and put identifiers into `tids'. All fibers are
+// queued in one pass and idle workers are signalled once, which is much
+// cheaper than creating the fibers one by one when fanning out. `fns' are
+// moved from. `args' can be NULL to pass NULL to all fibers.
+// On error, fibers created so far still run and remaining `tids' are set
+// to INVALID_FIBER_ID.
+// Return 0 on success, errno otherwise.
+extern int fiber_start_batch(fiber_id_t *__restrict tids,
+                             const fiber_attribute *__restrict attr,
+                             flare::base::function<void*(void*)> *fns,
+                             void *const *args, size_t n);
+
 // Wake up operations blocking the thread. Different functions may behave
 // differently:
 //   flare::fiber_sleep_for(): returns -1 and sets errno to ESTOP if fiber_stop()
@@ -146,7 +159,8 @@ extern int fiber_getconcurrency(void);
 // Set number of worker pthreads to `num'. After a successful call,
 // fiber_getconcurrency() shall return new set number, but workers may
 // take some time to quit or create.
-// NOTE: currently concurrency cannot be reduced after any fiber created.
+// Reducing concurrency retires workers, which hand over their queued fibers
+// to others and quit after the fibers running on them yield.
 extern int fiber_setconcurrency(int num);
 
 
@@ -0,0 +1,111 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/fiber/internal/fiber_accounting.h"
+#include <string.h>
+#include <algorithm>                                  // std::sort
+#include <vector>
+#include <gflags/gflags.h>
+#include "flare/base/scoped_lock.h"                   // FLARE_SCOPED_LOCK
+#include "flare/base/static_atomic.h"
+#include "flare/hash/murmurhash3.h"
+#include "flare/log/logging.h"
+#include "flare/variable/passive_status.h"
+
+namespace flare::fiber_internal {
+
+    DEFINE_bool(fiber_enable_accounting, false,
+                "Count cpu time, context switches and time spent in runqueues "
+                "of each fiber, which are aggregated by fiber_attribute::tag "
+                "and shown in /vars/fiber_tag_top");
+    DEFINE_int32(fiber_tag_top_n, 10, "Show so many tags in /vars/fiber_tag_top");
+
+    // Tags are never removed. The table is probed linearly without locking,
+    // new tags are inserted with _tag_mutex held.
+    static const size_t MAX_TAGS = 1024;
+    static std::atomic<fiber_tag_stat *> g_tag_stats[MAX_TAGS];
+    static std::atomic<size_t> g_ntag(0);
+    static pthread_mutex_t g_tag_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    static void describe_top_tags_from_flag(std::ostream &os, void *) {
+        describe_top_tags(os, std::max(FLAGS_fiber_tag_top_n, 0));
+    }
+
+    fiber_tag_stat *get_or_create_tag_stat(const char *tag) {
+        if (tag == NULL) {
+            return NULL;
+        }
+        const size_t len = strlen(tag);
+        uint32_t hash = 0;
+        flare::hash::MurmurHash3_x86_32(tag, len, 0, &hash);
+        for (size_t i = 0; i < MAX_TAGS; ++i) {
+            std::atomic<fiber_tag_stat *> &slot = g_tag_stats[(hash + i) % MAX_TAGS];
+            fiber_tag_stat *s = slot.load(std::memory_order_acquire);
+            if (s == NULL) {
+                FLARE_SCOPED_LOCK(g_tag_mutex);
+                s = slot.load(std::memory_order_relaxed);
+                if (s == NULL) {
+                    if (g_ntag.load(std::memory_order_relaxed) == 0) {
+                        static flare::variable::PassiveStatus<std::string> top_tags(
+                                "fiber_tag_top", describe_top_tags_from_flag, NULL);
+                    }
+                    s = new fiber_tag_stat;
+                    s->tag.assign(tag, len);
+                    slot.store(s, std::memory_order_release);
+                    g_ntag.fetch_add(1, std::memory_order_relaxed);
+                    return s;
+                }
+            }
+            if (s->tag.size() == len && memcmp(s->tag.data(), tag, len) == 0) {
+                return s;
+            }
+        }
+        FLARE_LOG_EVERY_SECOND(WARNING) << "Too many fiber tags, ignore tag=" << tag;
+        return NULL;
+    }
+
+    void describe_top_tags(std::ostream &os, size_t n) {
+        struct tag_row {
+            const fiber_tag_stat *stat;
+            int64_t cpu_cycles;
+        };
+        std::vector<tag_row> rows;
+        for (size_t i = 0; i < MAX_TAGS; ++i) {
+            const fiber_tag_stat *s = g_tag_stats[i].load(std::memory_order_acquire);
+            if (s != NULL) {
+                rows.push_back({s, s->cpu_cycles.get_value()});
+            }
+        }
+        std::sort(rows.begin(), rows.end(), [](const tag_row &a, const tag_row &b) {
+            return a.cpu_cycles > b.cpu_cycles;
+        });
+        if (rows.size() > n) {
+            rows.resize(n);
+        }
+        os << "tag cpu_ms runnable_ms nswitch nfiber";
+        for (size_t i = 0; i < rows.size(); ++i) {
+            const fiber_tag_stat *s = rows[i].stat;
+            os << '\n' << s->tag
+               << ' ' << accounting_cycles_to_ns(rows[i].cpu_cycles) / 1000000.0
+               << ' ' << accounting_cycles_to_ns(s->runnable_cycles.get_value()) / 1000000.0
+               << ' ' << s->nswitch.get_value()
+               << ' ' << s->nfiber.get_value();
+        }
+    }
+
+}  // namespace flare::fiber_internal
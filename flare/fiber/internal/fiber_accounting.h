@@ -0,0 +1,59 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_FIBER_INTERNAL_FIBER_ACCOUNTING_H_
+#define FLARE_FIBER_INTERNAL_FIBER_ACCOUNTING_H_
+
+#include <ostream>
+#include <string>
+#include <gflags/gflags_declare.h>
+#include "flare/variable/reducer.h"                      // flare::variable::Adder
+#include "flare/times/internal/cycle_clock.h"             // cycle_clock
+
+namespace flare::fiber_internal {
+
+    DECLARE_bool(fiber_enable_accounting);
+
+    // Cumulated statistics of fibers created with the same fiber_attribute::tag.
+    // Updated at each context switch, Adder keeps writers in thread-local
+    // agents so that workers don't contend.
+    struct fiber_tag_stat {
+        std::string tag;
+        // Cycles of cycle_clock spent on running the fibers.
+        flare::variable::Adder<int64_t> cpu_cycles;
+        // Cycles of cycle_clock spent in runqueues, namely runnable but not running.
+        flare::variable::Adder<int64_t> runnable_cycles;
+        flare::variable::Adder<int64_t> nswitch;
+        flare::variable::Adder<int64_t> nfiber;
+    };
+
+    // Get the statistics of fibers tagged with `tag', created on first use.
+    // Returns NULL if `tag' is NULL or the number of tags reaches the limit.
+    fiber_tag_stat *get_or_create_tag_stat(const char *tag);
+
+    // Print at most `n' tags with the most cpu time, one line per tag.
+    void describe_top_tags(std::ostream &os, size_t n);
+
+    inline int64_t accounting_cycles_to_ns(int64_t cycles) {
+        return static_cast<int64_t>(cycles * 1000000000.0 /
+                                    flare::times_internal::cycle_clock::frequency());
+    }
+
+}  // namespace flare::fiber_internal
+
+#endif  // FLARE_FIBER_INTERNAL_FIBER_ACCOUNTING_H_
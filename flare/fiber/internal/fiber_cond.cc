@@ -1,5 +1,6 @@
 
 #include "flare/base/static_atomic.h"
+#include "flare/memory/object_pool.h"
 #include "flare/fiber/internal/waitable_event.h"
 #include "flare/fiber/internal/types.h"                       // fiber_cond_t
 
@@ -16,12 +17,46 @@ namespace flare::fiber_internal {
     static_assert(offsetof(CondInternal, seq) ==
                   offsetof(fiber_cond_t, seq),
                   "offsetof_cond_seq_must_equal");
+
+    // State of a pending fiber_cond_wait_async().
+    struct cond_async_waiter {
+        fiber_mutex_t *m;
+        void (*on_locked)(void *);
+        void *arg;
+    };
 }
 
 extern "C" {
 
 extern int fiber_mutex_unlock(fiber_mutex_t *);
-extern int fiber_mutex_lock_contended(fiber_mutex_t *);
+extern int fiber_mutex_lock_contended(fiber_mutex_t *, bool woken);
+extern int fiber_mutex_lock_contended_async(fiber_mutex_t *, void (*)(void *), void *);
+
+// Relock the mutex after being signalled. Like fiber_cond_wait(), the lock
+// is taken in contended mode so that waiters requeued onto the mutex by
+// fiber_cond_broadcast() are woken up on unlocking. Async waiters are never
+// requeued, so they don't take a mutex handed off to its waiters.
+static void cond_async_relock(fiber_mutex_t *m, void (*on_locked)(void *), void *arg) {
+    const int rc = fiber_mutex_lock_contended_async(m, on_locked, arg);
+    if (rc == EINPROGRESS) {
+        return;
+    }
+    if (rc != 0) {
+        // Out of memory, fallback to blocking.
+        fiber_mutex_lock_contended(m, false);
+    }
+    on_locked(arg);
+}
+
+static void on_cond_async_wakeup(void *arg) {
+    flare::fiber_internal::cond_async_waiter *w =
+            static_cast<flare::fiber_internal::cond_async_waiter *>(arg);
+    fiber_mutex_t *m = w->m;
+    void (*on_locked)(void *) = w->on_locked;
+    void *on_locked_arg = w->arg;
+    flare::return_object(w);
+    cond_async_relock(m, on_locked, on_locked_arg);
+}
 
 int fiber_cond_init(fiber_cond_t *__restrict c,
                     const fiber_condattr_t *) {
@@ -76,7 +111,8 @@ int fiber_cond_wait(fiber_cond_t *__restrict c,
     }
     fiber_mutex_unlock(m);
     int rc1 = 0;
-    if (flare::fiber_internal::waitable_event_wait(ic->seq, expected_seq, NULL) < 0 &&
+    bool requeued = false;
+    if (flare::fiber_internal::waitable_event_wait(ic->seq, expected_seq, NULL, &requeued) < 0 &&
         errno != EWOULDBLOCK && errno != EINTR/*note*/) {
         // EINTR should not be returned by cond_*wait according to docs on
         // pthread, however spurious wake-up is OK, just as we do here
@@ -91,7 +127,9 @@ int fiber_cond_wait(fiber_cond_t *__restrict c,
         // soon and check the `stop' flag and other predicates.
         rc1 = errno;
     }
-    const int rc2 = fiber_mutex_lock_contended(m);
+    // Only a waiter woken up on the mutex may take the lock handed off to
+    // waiters of the mutex.
+    const int rc2 = fiber_mutex_lock_contended(m, requeued);
     return (rc2 ? rc2 : rc1);
 }
 
@@ -110,13 +148,50 @@ int fiber_cond_timedwait(fiber_cond_t *__restrict c,
     }
     fiber_mutex_unlock(m);
     int rc1 = 0;
-    if (flare::fiber_internal::waitable_event_wait(ic->seq, expected_seq, abstime) < 0 &&
+    bool requeued = false;
+    if (flare::fiber_internal::waitable_event_wait(ic->seq, expected_seq, abstime, &requeued) < 0 &&
         errno != EWOULDBLOCK && errno != EINTR/*note*/) {
         // note: see comments in fiber_cond_wait on EINTR.
         rc1 = errno;
     }
-    const int rc2 = fiber_mutex_lock_contended(m);
+    const int rc2 = fiber_mutex_lock_contended(m, requeued);
     return (rc2 ? rc2 : rc1);
 }
 
+int fiber_cond_wait_async(fiber_cond_t *__restrict c,
+                          fiber_mutex_t *__restrict m,
+                          void (*on_locked)(void *), void *arg) {
+    flare::fiber_internal::CondInternal *ic = reinterpret_cast<flare::fiber_internal::CondInternal *>(c);
+    const int expected_seq = ic->seq->load(std::memory_order_relaxed);
+    if (ic->m.load(std::memory_order_relaxed) != m) {
+        // bind m to c
+        fiber_mutex_t *expected_m = NULL;
+        if (!ic->m.compare_exchange_strong(
+                expected_m, m, std::memory_order_relaxed)) {
+            return EINVAL;
+        }
+    }
+    flare::fiber_internal::cond_async_waiter *w =
+            flare::get_object<flare::fiber_internal::cond_async_waiter>();
+    if (w == NULL) {
+        return ENOMEM;
+    }
+    w->m = m;
+    w->on_locked = on_locked;
+    w->arg = arg;
+    fiber_mutex_unlock(m);
+    if (flare::fiber_internal::waitable_event_wait_async(
+            ic->seq, expected_seq, on_cond_async_wakeup, w) == 0) {
+        return EINPROGRESS;
+    }
+    // Signalled before being queued.
+    flare::return_object(w);
+    const int rc = fiber_mutex_lock_contended_async(m, on_locked, arg);
+    if (rc == 0 || rc == EINPROGRESS) {
+        return rc;
+    }
+    fiber_mutex_lock_contended(m, false);
+    return 0;
+}
+
 }  // extern "C"
@@ -37,6 +37,15 @@ extern int fiber_cond_timedwait(
         fiber_cond_t *__restrict cond,
         fiber_mutex_t *__restrict mutex,
         const struct timespec *__restrict abstime);
+// Stackless version of fiber_cond_wait() which never blocks the caller.
+// `mutex' is unlocked and the caller is queued on `cond'. Once signalled and
+// `mutex' is locked again on behalf of the caller, `on_locked(arg)' is called
+// in the context of the signalling/unlocking thread and EINPROGRESS is
+// returned. Returns 0 if `mutex' is relocked before returning, in which
+// case `on_locked' is not called, errno otherwise.
+extern int fiber_cond_wait_async(fiber_cond_t *__restrict cond,
+                                 fiber_mutex_t *__restrict mutex,
+                                 void (*on_locked)(void *), void *arg);
 __END_DECLS
 
 #endif  // FLARE_FIBER_INTERNAL_FIBER_COND_H_
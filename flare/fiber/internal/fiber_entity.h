@@ -30,10 +30,16 @@ namespace flare::fiber_internal {
     struct fiber_statistics {
         int64_t cputime_ns;
         int64_t nswitch;
+        // Following fields are counted in cycles of cycle_clock only when
+        // -fiber_enable_accounting is on.
+        int64_t cpu_cycles;
+        int64_t runnable_cycles;
     };
 
     class KeyTable;
 
+    struct fiber_tag_stat;
+
     struct fiber_mutex_waiter;
 
     struct fiber_local_storage {
@@ -84,6 +90,11 @@ namespace flare::fiber_internal {
         // Statistics
         int64_t cpuwide_start_ns;
         fiber_statistics stat;
+        // Shared by fibers with the same attr.tag, NULL if untagged.
+        fiber_tag_stat *tag_stat;
+        // cycle_clock::now() when the fiber was pushed into a runqueue, 0 if
+        // it's not queued or not accounted.
+        int64_t ready_cycles;
 
         // fiber local storage, sync with tls_bls (defined in task_group.cpp)
         // when the fiber is created or destroyed.
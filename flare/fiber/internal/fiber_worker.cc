@@ -7,6 +7,7 @@
 #include "flare/base/scoped_lock.h"              // FLARE_SCOPED_LOCK
 #include "flare/base/fast_rand.h"
 #include <memory>
+#include <algorithm>                          // std::min
 #include "flare/hash/murmurhash3.h" // fmix64
 #include "flare/fiber/internal/errno.h"                  // ESTOP
 #include "flare/fiber/internal/waitable_event.h"                  // butex_*
@@ -15,12 +16,16 @@
 #include "flare/fiber/internal/schedule_group.h"
 #include "flare/fiber/internal/fiber_worker.h"
 #include "flare/fiber/internal/timer_thread.h"
+#include "flare/fiber/internal/io_uring.h"
 #include "flare/fiber/internal/errno.h"
 
+DECLARE_int32(task_group_yield_before_idle);
+DECLARE_bool(fiber_elastic_concurrency);
+
 namespace flare::fiber_internal {
 
     static const fiber_attribute FIBER_ATTR_TASKGROUP = {
-            FIBER_STACKTYPE_UNKNOWN, 0, nullptr};
+            FIBER_STACKTYPE_UNKNOWN, 0, nullptr, FIBER_PRIORITY_NORMAL, nullptr};
 
     static bool pass_bool(const char *, bool) { return true; }
 
@@ -37,6 +42,24 @@ namespace flare::fiber_internal {
             ::google::RegisterFlagValidator(&FLAGS_show_per_worker_usage_in_vars,
                                                pass_bool);
 
+    DEFINE_int32(fiber_worker_max_spin, 0,
+                 "Idle workers spin at most so many rounds(each round tries to "
+                 "steal a task) before parking. The actual number adapts to "
+                 "recent arrivals of tasks. 0 disables spinning");
+    DEFINE_int32(fiber_priority_aging_interval, 16,
+                 "Workers pop lower-priority fibers first once every so many "
+                 "pops so that they're not starved by higher-priority ones, "
+                 "non-positive values disable the aging");
+    DEFINE_int32(fiber_worker_short_park_us, 50,
+                 "A parking which got a task within so many microseconds "
+                 "means that spinning longer would have avoided it");
+    DEFINE_bool(fiber_worker_poll_fd, false,
+                "Idle workers poll file descriptors waited by fiber_fd_*wait "
+                "before parking, so that fibers waiting for IO are woken up "
+                "without switching to the polling fibers");
+
+    extern int poll_fd_events(unsigned hint);
+
     __thread fiber_worker *tls_task_group = nullptr;
     // Sync with fiber_entity::local_storage when a fiber is created or destroyed.
     // During running, the two fields may be inconsistent, use tls_bls as the
@@ -50,7 +73,7 @@ namespace flare::fiber_internal {
     // overhead of creation keytable, may be removed later.
     FLARE_THREAD_LOCAL void *tls_unique_user_ptr = nullptr;
 
-    const fiber_statistics EMPTY_STAT = {0, 0};
+    const fiber_statistics EMPTY_STAT = {0, 0, 0, 0};
 
     const size_t OFFSET_TABLE[] = {
 #include "flare/fiber/internal/offset_inl.list"
@@ -95,13 +118,87 @@ namespace flare::fiber_internal {
         return true;
     }
 
+    bool fiber_worker::spin_for_task(fiber_id_t *tid) {
+        const int max_spin = FLAGS_fiber_worker_max_spin;
+        if (_spin_budget > max_spin) {
+            _spin_budget = max_spin;
+        }
+        for (int i = 0; i < _spin_budget; ++i) {
+            cpu_relax();
+            if (steal_task(tid)) {
+                ++_nspin_success;
+                _spin_budget = std::min(max_spin, _spin_budget * 2);
+                return true;
+            }
+        }
+        for (int i = 0; i < FLAGS_task_group_yield_before_idle; ++i) {
+            sched_yield();
+            if (steal_task(tid)) {
+                ++_nspin_success;
+                return true;
+            }
+        }
+        return false;
+    }
+
     bool fiber_worker::wait_task(fiber_id_t *tid) {
+        // Submit I/O queued by fibers of this worker before running stolen
+        // tasks, which may take long.
+        if (io_uring_flush_and_reap() > 0 && pop_rq(tid)) {
+            return true;
+        }
         do {
 #ifndef FIBER_DONT_SAVE_PARKING_STATE
-            if (_last_pl_state.stopped()) {
+            if (_last_pl_state.stopped() ||
+                _retiring.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            if (run_timers() > 0 && pop_rq(tid)) {
+                return true;
+            }
+            // Never park before workers in other NUMA nodes are checked,
+            // otherwise tasks queued there may wait for a long time.
+            if (_numa_steal_misses != 0) {
+                cpu_relax();
+            } else if (spin_for_task(tid)) {
+                return true;
+            } else if (io_uring_flush_and_reap() > 0 && pop_rq(tid)) {
+                return true;
+            } else if (FLAGS_fiber_worker_poll_fd &&
+                       poll_fd_events(_npoll_fd++) > 0 && pop_rq(tid)) {
+                return true;
+            } else if (_control->run_overdue_timers() > 0 && pop_rq(tid)) {
+                return true;
+            } else if (_retiring.load(std::memory_order_seq_cst)) {
+                // Checked after _last_pl_state was saved in steal_task(), so
+                // the signal from remove_workers() is never missed.
                 return false;
+            } else if (_numa_steal_misses == 0) {
+                ++_npark;
+                timespec timeout;
+                const timespec *ptimeout = park_timeout(&timeout);
+                const int max_spin = FLAGS_fiber_worker_max_spin;
+                if (max_spin > 0) {
+                    const int64_t park_ns = flare::get_current_time_nanos();
+                    trace(SCHED_EVENT_PARK, 0);
+                    _pl->wait(_last_pl_state, ptimeout);
+                    trace(SCHED_EVENT_UNPARK, 0);
+                    if (steal_task(tid)) {
+                        const int64_t parked_ns = flare::get_current_time_nanos() - park_ns;
+                        if (parked_ns < FLAGS_fiber_worker_short_park_us * 1000L) {
+                            _spin_budget = std::min(max_spin, std::max(_spin_budget * 2, 1));
+                        } else {
+                            _spin_budget /= 2;
+                        }
+                        return true;
+                    }
+                    _spin_budget /= 2;
+                    continue;
+                }
+                trace(SCHED_EVENT_PARK, 0);
+                _pl->wait(_last_pl_state, ptimeout);
+                trace(SCHED_EVENT_UNPARK, 0);
             }
-            _pl->wait(_last_pl_state);
             if (steal_task(tid)) {
                 return true;
             }
@@ -110,10 +207,32 @@ namespace flare::fiber_internal {
             if (st.stopped()) {
                 return false;
             }
+            if (run_timers() > 0 && pop_rq(tid)) {
+                return true;
+            }
             if (steal_task(tid)) {
                 return true;
             }
-            _pl->wait(st);
+            if (io_uring_flush_and_reap() > 0 && pop_rq(tid)) {
+                return true;
+            }
+            if (FLAGS_fiber_worker_poll_fd &&
+                poll_fd_events(_npoll_fd++) > 0 && pop_rq(tid)) {
+                return true;
+            }
+            if (_control->run_overdue_timers() > 0 && pop_rq(tid)) {
+                return true;
+            }
+            if (_retiring.load(std::memory_order_seq_cst)) {
+                return false;
+            }
+            if (_numa_steal_misses == 0) {
+                ++_npark;
+                timespec timeout;
+                trace(SCHED_EVENT_PARK, 0);
+                _pl->wait(st, park_timeout(&timeout));
+                trace(SCHED_EVENT_UNPARK, 0);
+            }
 #endif
         } while (true);
     }
@@ -160,8 +279,12 @@ namespace flare::fiber_internal {
 #endif
             _cur_meta(nullptr), _control(c), _num_nosignal(0), _nsignaled(0),
             _last_run_ns(flare::get_current_time_nanos()),
-            _cumulated_cputime_ns(0), _nswitch(0), _last_context_remained(nullptr), _last_context_remained_arg(nullptr),
-            _pl(nullptr), _main_stack(nullptr), _main_tid(0), _remote_num_nosignal(0), _remote_nsignaled(0) {
+            _cumulated_cputime_ns(0), _last_run_cycles(0), _nswitch(0), _nspin_success(0), _npark(0),
+            _pending_us(0), _npending(0), _spin_budget(0), _npoll_fd(0),
+            _last_context_remained(nullptr), _last_context_remained_arg(nullptr),
+            _pl(nullptr), _numa_node(-1), _numa_steal_misses(0), _main_stack(nullptr), _main_tid(0),
+            _npop_rq(0), _remote_num_nosignal(0), _remote_nsignaled(0), _retiring(false),
+            _nremote_pushing(0) {
         _steal_seed = flare::base::fast_rand();
         _steal_offset = OFFSET_TABLE[_steal_seed % FLARE_ARRAY_SIZE(OFFSET_TABLE)];
         _pl = &c->_pl[flare::hash::fmix64(pthread_numeric_id()) % schedule_group::PARKING_LOT_NUM];
@@ -183,6 +306,14 @@ namespace flare::fiber_internal {
             FLARE_LOG(FATAL) << "Fail to init _rq";
             return -1;
         }
+        if (_high_rq.init(runqueue_capacity) != 0) {
+            FLARE_LOG(FATAL) << "Fail to init _high_rq";
+            return -1;
+        }
+        if (_low_rq.init(runqueue_capacity) != 0) {
+            FLARE_LOG(FATAL) << "Fail to init _low_rq";
+            return -1;
+        }
         if (_remote_rq.init(runqueue_capacity / 2) != 0) {
             FLARE_LOG(FATAL) << "Fail to init _remote_rq";
             return -1;
@@ -206,6 +337,8 @@ namespace flare::fiber_internal {
         m->local_storage = LOCAL_STORAGE_INIT;
         m->cpuwide_start_ns = flare::get_current_time_nanos();
         m->stat = EMPTY_STAT;
+        m->tag_stat = nullptr;
+        m->ready_cycles = 0;
         m->attr = FIBER_ATTR_TASKGROUP;
         m->tid = make_tid(*m->version_butex, slot);
         m->set_stack(stk);
@@ -247,12 +380,20 @@ namespace flare::fiber_internal {
             // Meta and identifier of the task is persistent in this run.
             fiber_entity *const m = g->_cur_meta;
 
-            if (FLAGS_show_fiber_creation_in_vars) {
-                // NOTE: the thread triggering exposure of pending time may spend
-                // considerable time because a single flare::variable::LatencyRecorder
-                // contains many variable.
-                g->_control->exposed_pending_time() <<
-                                                    (flare::get_current_time_nanos() - m->cpuwide_start_ns) / 1000L;
+            if (FLAGS_show_fiber_creation_in_vars || FLAGS_fiber_elastic_concurrency) {
+                const int64_t pending_us =
+                        (flare::get_current_time_nanos() - m->cpuwide_start_ns) / 1000L;
+                if (FLAGS_show_fiber_creation_in_vars) {
+                    // NOTE: the thread triggering exposure of pending time may spend
+                    // considerable time because a single flare::variable::LatencyRecorder
+                    // contains many variable.
+                    g->_control->exposed_pending_time(m->attr.priority) << pending_us;
+                }
+                if (m->attr.priority != FIBER_PRIORITY_LOW) {
+                    // Read by adjust_concurrency() to grow workers.
+                    g->_pending_us += pending_us;
+                    ++g->_npending;
+                }
             }
 
             // Not catch exceptions except ExitException which is for implementing
@@ -324,20 +465,13 @@ namespace flare::fiber_internal {
         return_resource(get_slot(m->tid));
     }
 
-    int fiber_worker::start_foreground(fiber_worker **pg,
-                                       fiber_id_t *__restrict th,
-                                       const fiber_attribute *__restrict attr,
-                                       flare::base::function<void *(void *)> &&fn,
-                                       void *__restrict arg) {
-        if (__builtin_expect(!fn, 0)) {
-            return EINVAL;
-        }
-        const int64_t start_ns = flare::get_current_time_nanos();
-        const fiber_attribute using_attr = (attr ? *attr : FIBER_ATTR_NORMAL);
+    fiber_entity *fiber_worker::create_entity(const fiber_attribute &attr,
+                                              flare::base::function<void *(void *)> &&fn,
+                                              void *arg, int64_t start_ns) {
         flare::ResourceId<fiber_entity> slot;
         fiber_entity *m = flare::get_resource(&slot);
         if (__builtin_expect(!m, 0)) {
-            return ENOMEM;
+            return nullptr;
         }
         FLARE_CHECK(m->current_waiter.load(std::memory_order_relaxed) == nullptr);
         m->stop = false;
@@ -346,18 +480,44 @@ namespace flare::fiber_internal {
         m->fn = std::move(fn);
         m->arg = arg;
         FLARE_CHECK(m->stack == nullptr);
-        m->attr = using_attr;
+        m->attr = attr;
         m->local_storage = LOCAL_STORAGE_INIT;
         m->cpuwide_start_ns = start_ns;
         m->stat = EMPTY_STAT;
+        m->tag_stat = nullptr;
+        m->ready_cycles = 0;
+        if (attr.tag != nullptr && FLAGS_fiber_enable_accounting) {
+            m->tag_stat = get_or_create_tag_stat(attr.tag);
+            if (m->tag_stat != nullptr) {
+                m->tag_stat->nfiber << 1;
+            }
+        }
         m->tid = make_tid(*m->version_butex, slot);
-        *th = m->tid;
-        if (using_attr.flags & FIBER_LOG_START_AND_FINISH) {
+        if (attr.flags & FIBER_LOG_START_AND_FINISH) {
             FLARE_LOG(INFO) << "Started fiber " << m->tid;
         }
+        return m;
+    }
+
+    int fiber_worker::start_foreground(fiber_worker **pg,
+                                       fiber_id_t *__restrict th,
+                                       const fiber_attribute *__restrict attr,
+                                       flare::base::function<void *(void *)> &&fn,
+                                       void *__restrict arg) {
+        if (__builtin_expect(!fn, 0)) {
+            return EINVAL;
+        }
+        const int64_t start_ns = flare::get_current_time_nanos();
+        const fiber_attribute using_attr = (attr ? *attr : FIBER_ATTR_NORMAL);
+        fiber_entity *m = create_entity(using_attr, std::move(fn), arg, start_ns);
+        if (__builtin_expect(!m, 0)) {
+            return ENOMEM;
+        }
+        *th = m->tid;
 
         fiber_worker *g = *pg;
         g->_control->_nfibers << 1;
+        g->trace(SCHED_EVENT_CREATE, m->tid);
         if (g->is_current_pthread_task()) {
             // never create foreground task in pthread.
             g->ready_to_run(m->tid, (using_attr.flags & FIBER_NOSIGNAL));
@@ -389,28 +549,13 @@ namespace flare::fiber_internal {
         }
         const int64_t start_ns = flare::get_current_time_nanos();
         const fiber_attribute using_attr = (attr ? *attr : FIBER_ATTR_NORMAL);
-        flare::ResourceId<fiber_entity> slot;
-        fiber_entity *m = flare::get_resource(&slot);
+        fiber_entity *m = create_entity(using_attr, std::move(fn), arg, start_ns);
         if (__builtin_expect(!m, 0)) {
             return ENOMEM;
         }
-        FLARE_CHECK(m->current_waiter.load(std::memory_order_relaxed) == nullptr);
-        m->stop = false;
-        m->interrupted = false;
-        m->about_to_quit = false;
-        m->fn = std::move(fn);
-        m->arg = arg;
-        FLARE_CHECK(m->stack == nullptr);
-        m->attr = using_attr;
-        m->local_storage = LOCAL_STORAGE_INIT;
-        m->cpuwide_start_ns = start_ns;
-        m->stat = EMPTY_STAT;
-        m->tid = make_tid(*m->version_butex, slot);
         *th = m->tid;
-        if (using_attr.flags & FIBER_LOG_START_AND_FINISH) {
-            FLARE_LOG(INFO) << "Started fiber " << m->tid;
-        }
         _control->_nfibers << 1;
+        trace(SCHED_EVENT_CREATE, m->tid);
         if (REMOTE) {
             ready_to_run_remote(m->tid, (using_attr.flags & FIBER_NOSIGNAL));
         } else {
@@ -419,6 +564,58 @@ namespace flare::fiber_internal {
         return 0;
     }
 
+    template<bool REMOTE>
+    int fiber_worker::start_background_batch(fiber_id_t *__restrict tids,
+                                             const fiber_attribute *__restrict attr,
+                                             flare::base::function<void *(void *)> *fns,
+                                             void *const *args, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            if (__builtin_expect(!fns[i], 0)) {
+                for (size_t j = 0; j < n; ++j) {
+                    tids[j] = INVALID_FIBER_ID;
+                }
+                return EINVAL;
+            }
+        }
+        const int64_t start_ns = flare::get_current_time_nanos();
+        const fiber_attribute using_attr = (attr ? *attr : FIBER_ATTR_NORMAL);
+        int rc = 0;
+        size_t ncreated = 0;
+        for (; ncreated < n; ++ncreated) {
+            fiber_entity *m = create_entity(using_attr, std::move(fns[ncreated]),
+                                            (args ? args[ncreated] : nullptr), start_ns);
+            if (__builtin_expect(!m, 0)) {
+                rc = ENOMEM;
+                break;
+            }
+            tids[ncreated] = m->tid;
+            trace(SCHED_EVENT_CREATE, m->tid);
+            // Queue without signalling, idle workers are woken up once below.
+            if (REMOTE) {
+                ready_to_run_remote(m->tid, true);
+            } else {
+                // Counted before pushing so that push_rq() signals the queued
+                // fibers to be stolen if the runqueue is full.
+                ++_num_nosignal;
+                push_rq(m->tid);
+            }
+        }
+        for (size_t i = ncreated; i < n; ++i) {
+            tids[i] = INVALID_FIBER_ID;
+        }
+        _control->_nfibers << ncreated;
+        if (REMOTE) {
+            if (!(using_attr.flags & FIBER_NOSIGNAL)) {
+                flush_nosignal_tasks_remote();
+            }
+        } else {
+            if (!(using_attr.flags & FIBER_NOSIGNAL)) {
+                flush_nosignal_tasks();
+            }
+        }
+        return rc;
+    }
+
 // Explicit instantiations.
     template int
     fiber_worker::start_background<true>(fiber_id_t *__restrict th,
@@ -432,6 +629,18 @@ namespace flare::fiber_internal {
                                           flare::base::function<void *(void *)> &&fn,
                                           void *__restrict arg);
 
+    template int
+    fiber_worker::start_background_batch<true>(fiber_id_t *__restrict tids,
+                                               const fiber_attribute *__restrict attr,
+                                               flare::base::function<void *(void *)> *fns,
+                                               void *const *args, size_t n);
+
+    template int
+    fiber_worker::start_background_batch<false>(fiber_id_t *__restrict tids,
+                                                const fiber_attribute *__restrict attr,
+                                                flare::base::function<void *(void *)> *fns,
+                                                void *const *args, size_t n);
+
     int fiber_worker::join(fiber_id_t tid, void **return_value) {
         if (__builtin_expect(!tid, 0)) {  // tid of fiber is never 0.
             return EINVAL;
@@ -474,19 +683,112 @@ namespace flare::fiber_internal {
         return m ? m->stat : EMPTY_STAT;
     }
 
-    void fiber_worker::ending_sched(fiber_worker **pg) {
-        fiber_worker *g = *pg;
-        fiber_id_t next_tid = 0;
-        // Find next task to run, if none, switch to idle thread of the group.
+    static inline bool pop_from(WorkStealingQueue<fiber_id_t> &rq, fiber_id_t *tid) {
 #ifndef FIBER_FAIR_WSQ
         // When FIBER_FAIR_WSQ is defined, profiling shows that cpu cost of
         // WSQ::steal() in example/multi_threaded_echo_c++ changes from 1.9%
         // to 2.9%
-        const bool popped = g->_rq.pop(&next_tid);
+        return rq.pop(tid);
 #else
-        const bool popped = g->_rq.steal(&next_tid);
+        return rq.steal(tid);
 #endif
-        if (!popped && !g->steal_task(&next_tid)) {
+    }
+
+    bool fiber_worker::lower_priority_first() const {
+        const int aging_interval = FLAGS_fiber_priority_aging_interval;
+        return aging_interval > 0 && _npop_rq + 1 >= aging_interval;
+    }
+
+    void fiber_worker::count_taken_task(bool lower_first) {
+        if (lower_first) {
+            _npop_rq = 0;
+        } else if (FLAGS_fiber_priority_aging_interval > 0) {
+            ++_npop_rq;
+        }
+    }
+
+    bool fiber_worker::pop_rq(fiber_id_t *tid) {
+        const bool lower_first = lower_priority_first();
+        const bool popped = lower_first ?
+                (pop_from(_low_rq, tid) || pop_from(_rq, tid) || pop_from(_high_rq, tid)) :
+                (pop_from(_high_rq, tid) || pop_from(_rq, tid) || pop_from(_low_rq, tid));
+        if (popped) {
+            count_taken_task(lower_first);
+        }
+        return popped;
+    }
+
+    bool fiber_worker::pop_remote_rq(RemoteTaskQueue &remote_rq, fiber_id_t *tid) {
+        if (!remote_rq.pop(tid)) {
+            return false;
+        }
+        if (_retiring.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        // Moved tasks stay stealable in the runqueues, wakeups for them were
+        // signaled when they were pushed into `remote_rq'. Moving stops when
+        // a runqueue is half full, leaving room for fibers created or woken
+        // by the running ones, otherwise push_rq() would wait for a runqueue
+        // filled by this worker itself.
+        size_t nmoved = 0;
+        fiber_id_t next;
+        while (remote_rq.pop(&next)) {
+            WorkStealingQueue<fiber_id_t> *rq = rq_of(address_meta(next)->attr.priority);
+            if (rq->volatile_size() >= rq->capacity() / 2 || !rq->push(next)) {
+                remote_rq.push(next);
+                break;
+            }
+            ++nmoved;
+        }
+        if (nmoved == 0) {
+            return true;
+        }
+        if (!rq_of(address_meta(*tid)->attr.priority)->push(*tid)) {
+            return true;
+        }
+        // Tasks pushed above may be stolen by other workers meanwhile.
+        return pop_rq(tid);
+    }
+
+    bool fiber_worker::hand_over_task(fiber_id_t tid) {
+        if (_control->_ngroup.load(std::memory_order_acquire) == 0) {
+            return false;
+        }
+        _control->choose_one_group()->ready_to_run_remote(tid);
+        return true;
+    }
+
+    void fiber_worker::hand_over_tasks() {
+        fiber_id_t tid;
+        while (pop_rq(&tid) || _remote_rq.pop(&tid)) {
+            if (!hand_over_task(tid)) {
+                FLARE_LOG(WARNING) << "Drop fiber=" << tid << " of stopping worker";
+            }
+        }
+    }
+
+    void fiber_worker::hand_over_timers() {
+        _timers.hand_over(get_or_create_global_timer_thread());
+    }
+
+    const timespec *fiber_worker::park_timeout(timespec *buf) const {
+        const int64_t nearest = _timers.nearest_run_time();
+        if (nearest == std::numeric_limits<int64_t>::max()) {
+            return nullptr;
+        }
+        const int64_t timeout_us = std::max(
+                nearest - flare::get_current_time_micros(), (int64_t) 0);
+        buf->tv_sec = timeout_us / 1000000L;
+        buf->tv_nsec = (timeout_us % 1000000L) * 1000L;
+        return buf;
+    }
+
+    void fiber_worker::ending_sched(fiber_worker **pg) {
+        fiber_worker *g = *pg;
+        g->run_timers();
+        fiber_id_t next_tid = 0;
+        // Find next task to run, if none, switch to idle thread of the group.
+        if (!g->pop_rq(&next_tid) && !g->steal_task(&next_tid)) {
             // Jump to main task if there's no task to run.
             next_tid = g->_main_tid;
         }
@@ -517,14 +819,11 @@ namespace flare::fiber_internal {
 
     void fiber_worker::sched(fiber_worker **pg) {
         fiber_worker *g = *pg;
+        // Expired fibers join the runqueue before the next one is chosen.
+        g->run_timers();
         fiber_id_t next_tid = 0;
         // Find next task to run, if none, switch to idle thread of the group.
-#ifndef FIBER_FAIR_WSQ
-        const bool popped = g->_rq.pop(&next_tid);
-#else
-        const bool popped = g->_rq.steal(&next_tid);
-#endif
-        if (!popped && !g->steal_task(&next_tid)) {
+        if (!g->pop_rq(&next_tid) && !g->steal_task(&next_tid)) {
             // Jump to main task if there's no task to run.
             next_tid = g->_main_tid;
         }
@@ -553,6 +852,19 @@ namespace flare::fiber_internal {
         }
         ++cur_meta->stat.nswitch;
         ++g->_nswitch;
+        if (FLAGS_fiber_enable_accounting) {
+            g->account_switch(cur_meta, next_meta);
+        } else {
+            g->_last_run_cycles = 0;
+        }
+        if (FLAGS_fiber_enable_sched_trace) {
+            if (cur_meta->tid != g->_main_tid) {
+                g->_trace.add(SCHED_EVENT_SWITCH_OUT, cur_meta->tid);
+            }
+            if (next_meta->tid != g->_main_tid) {
+                g->_trace.add(SCHED_EVENT_RUN, next_meta->tid);
+            }
+        }
         // Switch to the task
         if (__builtin_expect(next_meta != cur_meta, 1)) {
             g->_cur_meta = next_meta;
@@ -604,6 +916,27 @@ namespace flare::fiber_internal {
         *pg = g;
     }
 
+    void fiber_worker::account_switch(fiber_entity *cur_meta, fiber_entity *next_meta) {
+        const int64_t now = flare::times_internal::cycle_clock::now();
+        if (_last_run_cycles != 0 && cur_meta->tid != _main_tid) {
+            const int64_t cycles = now - _last_run_cycles;
+            cur_meta->stat.cpu_cycles += cycles;
+            if (cur_meta->tag_stat != nullptr) {
+                cur_meta->tag_stat->cpu_cycles << cycles;
+                cur_meta->tag_stat->nswitch << 1;
+            }
+        }
+        _last_run_cycles = now;
+        if (next_meta->ready_cycles != 0) {
+            const int64_t cycles = now - next_meta->ready_cycles;
+            next_meta->ready_cycles = 0;
+            next_meta->stat.runnable_cycles += cycles;
+            if (next_meta->tag_stat != nullptr) {
+                next_meta->tag_stat->runnable_cycles << cycles;
+            }
+        }
+    }
+
     void fiber_worker::destroy_self() {
         if (_control) {
             _control->_destroy_group(this);
@@ -635,36 +968,31 @@ namespace flare::fiber_internal {
     }
 
     void fiber_worker::ready_to_run_remote(fiber_id_t tid, bool nosignal) {
-        _remote_rq._mutex.lock();
-        while (!_remote_rq.push_locked(tid)) {
-            flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
-            FLARE_LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
-                                    << _remote_rq.capacity();
-            ::usleep(1000);
-            _remote_rq._mutex.lock();
+        // Paired with remove_workers() and _drain_retired_group(): either
+        // _retiring is seen here, or the drain waits for this push.
+        _nremote_pushing.fetch_add(1, std::memory_order_seq_cst);
+        if (__builtin_expect(_retiring.load(std::memory_order_seq_cst), 0)) {
+            _nremote_pushing.fetch_sub(1, std::memory_order_release);
+            if (hand_over_task(tid)) {
+                return;
+            }
+            // No peer to hand over to, the worker is stopping.
+            _nremote_pushing.fetch_add(1, std::memory_order_relaxed);
         }
+        if (FLAGS_fiber_enable_accounting) {
+            address_meta(tid)->ready_cycles = flare::times_internal::cycle_clock::now();
+        }
+        trace(SCHED_EVENT_READY, tid);
+        _remote_rq.push(tid);
         if (nosignal) {
-            ++_remote_num_nosignal;
-            _remote_rq._mutex.unlock();
+            _remote_num_nosignal.fetch_add(1, std::memory_order_relaxed);
         } else {
-            const int additional_signal = _remote_num_nosignal;
-            _remote_num_nosignal = 0;
-            _remote_nsignaled += 1 + additional_signal;
-            _remote_rq._mutex.unlock();
+            const int additional_signal =
+                    _remote_num_nosignal.exchange(0, std::memory_order_relaxed);
+            _remote_nsignaled.fetch_add(1 + additional_signal, std::memory_order_relaxed);
             _control->signal_task(1 + additional_signal);
         }
-    }
-
-    void fiber_worker::flush_nosignal_tasks_remote_locked(flare::base::Mutex &locked_mutex) {
-        const int val = _remote_num_nosignal;
-        if (!val) {
-            locked_mutex.unlock();
-            return;
-        }
-        _remote_num_nosignal = 0;
-        _remote_nsignaled += val;
-        locked_mutex.unlock();
-        _control->signal_task(val);
+        _nremote_pushing.fetch_sub(1, std::memory_order_release);
     }
 
     void fiber_worker::ready_to_run_general(fiber_id_t tid, bool nosignal) {
@@ -696,12 +1024,41 @@ namespace flare::fiber_internal {
         fiber_id_t tid;
         fiber_entity *meta;
         fiber_worker *group;
+        // `group' may be retired and destroyed before the timer runs when the
+        // timer is handed over to TimerThread, use the control instead.
+        schedule_group *control;
     };
 
-    static void ready_to_run_from_timer_thread(void *arg) {
-        FLARE_CHECK(tls_task_group == nullptr);
+    // Run by the worker owning the timer, a peer worker or TimerThread.
+    static void ready_to_run_from_timer(void *arg) {
         const SleepArgs *e = static_cast<const SleepArgs *>(arg);
-        e->group->control()->choose_one_group()->ready_to_run_remote(e->tid);
+        fiber_worker *g = tls_task_group;
+        if (g) {
+            g->ready_to_run(e->tid);
+        } else {
+            e->control->choose_one_group()->ready_to_run_remote(e->tid);
+        }
+    }
+
+    TimerThread::TaskId fiber_worker::schedule_timer(
+            void (*fn)(void *), void *arg, const timespec &abstime) {
+        if (FLAGS_fiber_worker_timer) {
+            const int64_t run_time_us =
+                    flare::time_point::from_timespec(abstime).to_unix_micros();
+            const TimerThread::TaskId id = _timers.schedule(fn, arg, run_time_us);
+            if (id) {
+                _control->watch_worker_timers(run_time_us);
+                return id;
+            }
+        }
+        return get_global_timer_thread()->schedule(fn, arg, abstime);
+    }
+
+    int fiber_worker::unschedule_timer(TimerThread::TaskId timer_id) {
+        if (WorkerTimerQueue::owns(timer_id)) {
+            return WorkerTimerQueue::unschedule(timer_id);
+        }
+        return get_global_timer_thread()->unschedule(timer_id);
     }
 
     void fiber_worker::_add_sleep_event(void *void_args) {
@@ -712,8 +1069,8 @@ namespace flare::fiber_internal {
         fiber_worker *g = e.group;
 
         TimerThread::TaskId sleep_id;
-        sleep_id = get_global_timer_thread()->schedule(
-                ready_to_run_from_timer_thread, void_args,
+        sleep_id = g->schedule_timer(
+                ready_to_run_from_timer, void_args,
                 flare::time_point::future_unix_micros(e.timeout_us).to_timespec());
 
         if (!sleep_id) {
@@ -734,7 +1091,7 @@ namespace flare::fiber_internal {
         // The thread is stopped or interrupted.
         // interrupt() always sees that current_sleep == 0. It will not schedule
         // the calling thread. The race is between current thread and timer thread.
-        if (get_global_timer_thread()->unschedule(sleep_id) == 0) {
+        if (unschedule_timer(sleep_id) == 0) {
             // added to timer, previous thread may be already woken up by timer and
             // even stopped. It's safe to schedule previous thread when unschedule()
             // returns 0 which means "the not-run-yet sleep_id is removed". If the
@@ -755,7 +1112,8 @@ namespace flare::fiber_internal {
         fiber_worker *g = *pg;
         // We have to schedule timer after we switched to next fiber otherwise
         // the timer may wake up(jump to) current still-running context.
-        SleepArgs e = {timeout_us, g->current_fid(), g->current_task(), g};
+        SleepArgs e = {timeout_us, g->current_fid(), g->current_task(), g,
+                       g->control()};
         g->set_remained(_add_sleep_event, &e);
         sched(pg);
         g = *pg;
@@ -836,7 +1194,7 @@ namespace flare::fiber_internal {
                 return rc;
             }
         } else if (sleep_id != 0) {
-            if (get_global_timer_thread()->unschedule(sleep_id) == 0) {
+            if (unschedule_timer(sleep_id) == 0) {
                 flare::fiber_internal::fiber_worker *g = flare::fiber_internal::tls_task_group;
                 if (g) {
                     g->ready_to_run(tid);
@@ -874,7 +1232,10 @@ namespace flare::fiber_internal {
         fiber_attribute attr = FIBER_ATTR_NORMAL;
         bool has_tls = false;
         int64_t cpuwide_start_ns = 0;
-        fiber_statistics stat = {0, 0};
+        fiber_statistics stat = {0, 0, 0, 0};
+        // attr.tag is owned by the creator and may be gone, print the copy
+        // kept by the tag statistics instead.
+        std::string tag;
         {
             FLARE_SCOPED_LOCK(m->version_lock);
             if (given_ver == *m->version_butex) {
@@ -888,6 +1249,9 @@ namespace flare::fiber_internal {
                 has_tls = m->local_storage.keytable;
                 cpuwide_start_ns = m->cpuwide_start_ns;
                 stat = m->stat;
+                if (m->tag_stat != nullptr) {
+                    tag = m->tag_stat->tag;
+                }
             }
         }
         if (!matched) {
@@ -901,10 +1265,14 @@ namespace flare::fiber_internal {
                << "\nattr={stack_type=" << attr.stack_type
                << " flags=" << attr.flags
                << " keytable_pool=" << attr.keytable_pool
+               << " priority=" << attr.priority
+               << " tag=" << tag
                << "}\nhas_tls=" << has_tls
                << "\nuptime_ns=" << flare::get_current_time_nanos() - cpuwide_start_ns
                << "\ncputime_ns=" << stat.cputime_ns
-               << "\nnswitch=" << stat.nswitch;
+               << "\nnswitch=" << stat.nswitch
+               << "\naccounted_cputime_ns=" << accounting_cycles_to_ns(stat.cpu_cycles)
+               << "\nrunnable_ns=" << accounting_cycles_to_ns(stat.runnable_cycles);
         }
     }
 
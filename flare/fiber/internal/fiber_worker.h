@@ -9,6 +9,9 @@
 #include "flare/fiber/internal/remote_task_queue.h"             // RemoteTaskQueue
 #include "flare/memory/resource_pool.h"                    // ResourceId
 #include "flare/fiber/internal/parking_lot.h"
+#include "flare/fiber/internal/fiber_accounting.h"
+#include "flare/fiber/internal/sched_trace.h"
+#include "flare/fiber/internal/worker_timer.h"
 
 namespace flare::fiber_internal {
 
@@ -58,6 +61,18 @@ namespace flare::fiber_internal {
                              flare::base::function<void*(void*)> && fn,
                              void *__restrict arg);
 
+        // Create `n' tasks `fns[i](args[i])' with attributes `attr' in this
+        // fiber_worker and put identifiers into `tids'. All tasks are queued
+        // before idle workers are signalled once, unless FIBER_NOSIGNAL is set.
+        // On error, tasks created so far still run, remaining `tids' are set
+        // to INVALID_FIBER_ID.
+        // Return 0 on success, errno otherwise.
+        template<bool REMOTE>
+        int start_background_batch(fiber_id_t *__restrict tids,
+                                   const fiber_attribute *__restrict attr,
+                                   flare::base::function<void*(void*)> *fns,
+                                   void *const *args, size_t n);
+
         // Suspend caller and run next fiber in fiber_worker *pg.
         static void sched(fiber_worker **pg);
 
@@ -152,8 +167,6 @@ namespace flare::fiber_internal {
         // Push a fiber into the runqueue from another non-worker thread.
         void ready_to_run_remote(fiber_id_t tid, bool nosignal = false);
 
-        void flush_nosignal_tasks_remote_locked(flare::base::Mutex &locked_mutex);
-
         void flush_nosignal_tasks_remote();
 
         // Automatically decide the caller is remote or local, and call
@@ -175,10 +188,49 @@ namespace flare::fiber_internal {
         // Get the meta associate with the task.
         static fiber_entity *address_meta(fiber_id_t tid);
 
-        // Push a task into _rq, if _rq is full, retry after some time. This
-        // process make go on indefinitely.
+        // Record a scheduling event into the ring buffer of this worker if
+        // -fiber_enable_sched_trace is on.
+        void trace(int type, fiber_id_t tid) {
+            if (FLAGS_fiber_enable_sched_trace) {
+                _trace.add(type, tid);
+            }
+        }
+
+        // Number of tasks in the runqueues, may be inaccurate when tasks are
+        // being stolen.
+        size_t rq_size() const {
+            return _high_rq.volatile_size() + _rq.volatile_size() + _low_rq.volatile_size();
+        }
+
+        // Push a task into the runqueue matching its priority, if the queue is
+        // full, retry after some time. This process make go on indefinitely.
         void push_rq(fiber_id_t tid);
 
+        // Run `fn(arg)' at realtime `abstime' in this worker, or in the global
+        // TimerThread if -fiber_worker_timer is off. Must be called in the
+        // pthread of this worker.
+        // Returns: identifier of the timer, 0 on error.
+        TimerThread::TaskId schedule_timer(void (*fn)(void *), void *arg,
+                                           const timespec &abstime);
+
+        // Prevent the timer returned by schedule_timer() of any worker from
+        // running, callable from any thread.
+        // Returns same values as TimerThread::unschedule().
+        static int unschedule_timer(TimerThread::TaskId timer_id);
+
+        // Run due timers of this worker.
+        // Returns number of timers run.
+        int run_timers() {
+            if (_timers.nearest_run_time() == std::numeric_limits<int64_t>::max()) {
+                return 0;
+            }
+            return _timers.run_timers(flare::get_current_time_micros());
+        }
+
+        // Realtime in microseconds of the earliest timer of this worker, max
+        // of int64_t if there's no timer.
+        int64_t nearest_timer() const { return _timers.nearest_run_time(); }
+
     private:
 
         friend class schedule_group;
@@ -194,6 +246,12 @@ namespace flare::fiber_internal {
 
         static void task_runner(intptr_t skip_remained);
 
+        // Get a fiber_entity from the pool and initialize it to run `fn(arg)'.
+        // Returns NULL if the pool is exhausted.
+        static fiber_entity *create_entity(const fiber_attribute &attr,
+                                           flare::base::function<void*(void*)> && fn,
+                                           void *arg, int64_t start_ns);
+
         // Callbacks for set_remained()
         static void _release_last_context(void *);
 
@@ -208,19 +266,87 @@ namespace flare::fiber_internal {
 
         static void ready_to_run_in_worker_ignoresignal(void *);
 
+        // Returns true once every -fiber_priority_aging_interval tasks popped
+        // or stolen, when lower priorities should go first so that they're
+        // not starved.
+        bool lower_priority_first() const;
+
+        // Called after a task is popped or stolen with the result of
+        // lower_priority_first().
+        void count_taken_task(bool lower_first);
+
+        // Pop a task from runqueues, higher priorities first unless
+        // lower_priority_first() is true.
+        bool pop_rq(fiber_id_t *tid);
+
+        WorkStealingQueue<fiber_id_t> *rq_of(fiber_priority_t priority) {
+            if (__builtin_expect(priority != FIBER_PRIORITY_NORMAL, 0)) {
+                return (priority == FIBER_PRIORITY_HIGH ? &_high_rq : &_low_rq);
+            }
+            return &_rq;
+        }
+
+        // Tasks in remote runqueues are in FIFO order regardless of
+        // priorities, move the ones in `remote_rq' (of this worker or a peer)
+        // into runqueues of this worker and pop by priority. Must be called
+        // in the pthread of this worker.
+        // Returns false if `remote_rq' is empty.
+        bool pop_remote_rq(RemoteTaskQueue &remote_rq, fiber_id_t *tid);
+
         // Wait for a task to run.
         // Returns true on success, false is treated as permanent error and the
         // loop calling this function should end.
         bool wait_task(fiber_id_t *tid);
 
+        // Spin and then yield for a while trying to steal a task, which is
+        // much cheaper than parking and being woken up when tasks arrive
+        // frequently. The spin budget grows when spinning or a short park
+        // got a task, and shrinks otherwise.
+        // Returns true if a task was stolen.
+        bool spin_for_task(fiber_id_t *tid);
+
+        // Count cycles of `cur_meta' being switched out and `next_meta' being
+        // queued, called by sched_to() when -fiber_enable_accounting is on.
+        void account_switch(fiber_entity *cur_meta, fiber_entity *next_meta);
+
+        // Push `tid' into the remote runqueue of a peer worker, which is done
+        // for all tasks of a retiring worker.
+        // Returns false if there's no peer to hand over to (stopping).
+        bool hand_over_task(fiber_id_t tid);
+
+        // Hand over all tasks in the runqueues to peer workers.
+        void hand_over_tasks();
+
+        // Let the global TimerThread run timers of this quitting worker.
+        void hand_over_timers();
+
+        // Timeout for parking until the earliest timer, NULL if there's no
+        // timer.
+        const timespec *park_timeout(timespec *buf) const;
+
         bool steal_task(fiber_id_t *tid) {
-            if (_remote_rq.pop(tid)) {
+            if (pop_remote_rq(_remote_rq, tid)) {
+                trace(SCHED_EVENT_STEAL, *tid);
                 return true;
             }
+            if (_retiring.load(std::memory_order_relaxed)) {
+                // Go back to the main task to quit.
+                return false;
+            }
 #ifndef FIBER_DONT_SAVE_PARKING_STATE
             _last_pl_state = _pl->get_state();
 #endif
-            return _control->steal_task(tid, &_steal_seed, _steal_offset);
+            bool stolen;
+            if (_numa_node >= 0) {
+                stolen = _control->steal_task(tid, &_steal_seed, _steal_offset,
+                                              _numa_node, &_numa_steal_misses);
+            } else {
+                stolen = _control->steal_task(tid, &_steal_seed, _steal_offset);
+            }
+            if (stolen) {
+                trace(SCHED_EVENT_STEAL, *tid);
+            }
+            return stolen;
         }
 
 #ifndef NDEBUG
@@ -236,8 +362,21 @@ namespace flare::fiber_internal {
         // last scheduling time
         int64_t _last_run_ns;
         int64_t _cumulated_cputime_ns;
+        // cycle_clock::now() at last switch, 0 if accounting was off.
+        int64_t _last_run_cycles;
 
         size_t _nswitch;
+        // # of tasks found by spinning and # of parkings in wait_task().
+        size_t _nspin_success;
+        size_t _npark;
+        // Sum of microseconds from creation to first run of non-low-priority
+        // fibers and # of such fibers, see schedule_group::adjust_concurrency().
+        int64_t _pending_us;
+        int64_t _npending;
+        // Current spin budget, within [0, -fiber_worker_max_spin].
+        int _spin_budget;
+        // Rotates the poller checked by wait_task(), see -fiber_worker_poll_fd.
+        unsigned _npoll_fd;
         RemainedFn _last_context_remained;
         void *_last_context_remained_arg;
 
@@ -247,12 +386,31 @@ namespace flare::fiber_internal {
 #endif
         size_t _steal_seed;
         size_t _steal_offset;
+        // NUMA node that this worker is bound to, -1 if unbound.
+        int _numa_node;
+        // Consecutive failures of stealing inside _numa_node. Non-zero means
+        // that workers of other nodes are not checked yet.
+        int _numa_steal_misses;
         fiber_contextual_stack *_main_stack;
         fiber_id_t _main_tid;
+        // Runqueues of FIBER_PRIORITY_NORMAL, HIGH and LOW fibers.
         WorkStealingQueue<fiber_id_t> _rq;
+        WorkStealingQueue<fiber_id_t> _high_rq;
+        WorkStealingQueue<fiber_id_t> _low_rq;
+        int _npop_rq;
         RemoteTaskQueue _remote_rq;
-        int _remote_num_nosignal;
-        int _remote_nsignaled;
+        std::atomic<int> _remote_num_nosignal;
+        std::atomic<int> _remote_nsignaled;
+        // Set by schedule_group::remove_workers(). The worker is no longer in
+        // schedule_group::_groups and quits after the running fiber yields.
+        std::atomic<bool> _retiring;
+        // Number of ready_to_run_remote() in progress. Pushes starting after
+        // _retiring is set go to peers, the retired worker waits for the
+        // others before handing over its remaining tasks.
+        std::atomic<int> _nremote_pushing;
+        SchedTraceBuffer _trace;
+        // Timers of fibers running in this worker, see schedule_timer().
+        WorkerTimerQueue _timers;
     };
 
 }  // namespace flare::fiber_internal
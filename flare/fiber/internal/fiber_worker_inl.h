@@ -60,7 +60,18 @@ namespace flare::fiber_internal {
     }
 
     inline void fiber_worker::push_rq(fiber_id_t tid) {
-        while (!_rq.push(tid)) {
+        if (__builtin_expect(_retiring.load(std::memory_order_relaxed), 0) &&
+            hand_over_task(tid)) {
+            return;
+        }
+        fiber_entity *m = address_meta(tid);
+        if (FLAGS_fiber_enable_accounting) {
+            m->ready_cycles = flare::times_internal::cycle_clock::now();
+        }
+        trace(SCHED_EVENT_READY, tid);
+        const fiber_priority_t priority = m->attr.priority;
+        WorkStealingQueue<fiber_id_t> *rq = rq_of(priority);
+        while (!rq->push(tid)) {
             // Created too many fibers: a promising approach is to insert the
             // task into another fiber_worker, but we don't use it because:
             // * There're already many fibers to run, inserting the fiber
@@ -69,7 +80,8 @@ namespace flare::fiber_internal {
             //   are busy at creating fibers (proved by test_input_messenger in
             //   flare)
             flush_nosignal_tasks();
-            FLARE_LOG_EVERY_SECOND(ERROR) << "_rq is full, capacity=" << _rq.capacity();
+            FLARE_LOG_EVERY_SECOND(ERROR) << "runqueue of priority=" << priority
+                                          << " is full, capacity=" << rq->capacity();
             // TODO(gejun): May cause deadlock when all workers are spinning here.
             // A better solution is to pop and run existing fibers, however which
             // make set_remained()-callbacks do context switches and need extensive
@@ -79,9 +91,12 @@ namespace flare::fiber_internal {
     }
 
     inline void fiber_worker::flush_nosignal_tasks_remote() {
-        if (_remote_num_nosignal) {
-            _remote_rq._mutex.lock();
-            flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+        if (_remote_num_nosignal.load(std::memory_order_relaxed)) {
+            const int val = _remote_num_nosignal.exchange(0, std::memory_order_relaxed);
+            if (val) {
+                _remote_nsignaled.fetch_add(val, std::memory_order_relaxed);
+                _control->signal_task(val);
+            }
         }
     }
 
@@ -0,0 +1,684 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/base/compat.h"
+#include <new>                                   // std::nothrow
+#include <memory>
+#include <algorithm>                             // std::min
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>                             // readv, writev
+#include <sys/socket.h>
+#include <gflags/gflags.h>
+#if defined(FLARE_PLATFORM_LINUX)
+#include <sys/epoll.h>
+#if __has_include(<linux/io_uring.h>)
+#define FIBER_HAS_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#elif defined(FLARE_PLATFORM_OSX)
+#include <sys/event.h>
+#endif
+#include "flare/log/logging.h"
+#include "flare/base/errno.h"
+#include "flare/base/scoped_lock.h"
+#include "flare/variable/reducer.h"
+#include "flare/fiber/internal/waitable_event.h"
+#include "flare/fiber/internal/fiber_worker.h"
+#include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/internal/mutex.h"
+#include "flare/fiber/internal/unstable.h"
+#include "flare/fiber/internal/io_uring.h"
+
+namespace flare::fiber_internal {
+
+    DEFINE_bool(fiber_io_uring, false,
+                "fiber_io_* called in fibers are submitted through io_uring of "
+                "the worker if io_uring is available, otherwise syscalls are "
+                "called directly");
+    DEFINE_int32(fiber_io_uring_entries, 256,
+                 "Number of submission queue entries of io_uring of each "
+                 "worker, read when the ring is created");
+    DEFINE_int32(fiber_io_uring_submit_batch, 1,
+                 "Operations queued by fibers of a worker are submitted in one "
+                 "io_uring_enter once so many are queued or no other fiber is "
+                 "runnable in the worker. Values larger than 1 save syscalls "
+                 "at the cost of latency when fibers run long without I/O");
+
+    extern FLARE_THREAD_LOCAL fiber_worker *tls_task_group;
+
+    static flare::variable::Adder<int64_t> variable_io_uring_ops("fiber_io_uring_ops");
+    static flare::variable::Adder<int64_t> variable_io_uring_enters("fiber_io_uring_enters");
+    static flare::variable::Adder<int64_t> variable_io_uring_rings("fiber_io_uring_rings");
+
+    enum io_kind {
+        IO_READ, IO_WRITE, IO_READV, IO_WRITEV, IO_ACCEPT, IO_CONNECT, IO_FSYNC
+    };
+
+#if defined(FLARE_PLATFORM_LINUX)
+    static const unsigned IO_EVENT_IN = EPOLLIN;
+    static const unsigned IO_EVENT_OUT = EPOLLOUT;
+#elif defined(FLARE_PLATFORM_OSX)
+    static const unsigned IO_EVENT_IN = EVFILT_READ;
+    static const unsigned IO_EVENT_OUT = EVFILT_WRITE;
+#endif
+
+    // Max bytes of a read(2)/write(2), same as MAX_RW_COUNT of linux.
+    static const size_t IO_MAX_RW_COUNT = 0x7ffff000;
+
+    static inline uint64_t io_offset(off_t offset) {
+        return offset < 0 ? (uint64_t) -1 : (uint64_t) offset;
+    }
+
+    static inline bool in_fiber() {
+        fiber_worker *g = tls_task_group;
+        return g != NULL && !g->is_current_pthread_task();
+    }
+
+#if defined(FIBER_HAS_IO_URING)
+
+    // An operation submitted by a fiber which is suspended until `butex' is
+    // set to 1 by reaping of the completion.
+    struct io_uring_op {
+        std::atomic<int> *butex;
+        int res;
+    };
+
+    // io_uring of a worker pthread. Submission entries are only filled by
+    // fibers running on the worker thus lock-free, while any thread may
+    // submit the filled entries, so that entries deferred for batching are
+    // not stuck behind a fiber blocking the worker. The completion queue is
+    // reaped by a fiber waiting on an eventfd registered to the ring, or by
+    // the worker before parking, whoever gets there first. After the worker
+    // quits, the fiber reaps remaining completions and destroys the ring.
+    class IoUring {
+    public:
+        IoUring()
+                : _fd(-1), _efd(-1), _ring(NULL), _ring_size(0), _sqes(NULL),
+                  _sqes_size(0), _features(0), _batched(false), _reaping(false),
+                  _retired(false), _inflight(0) {
+        }
+
+        ~IoUring() {
+            if (_sqes != NULL) {
+                munmap(_sqes, _sqes_size);
+            }
+            if (_ring != NULL) {
+                munmap(_ring, _ring_size);
+            }
+            if (_efd >= 0) {
+                close(_efd);
+            }
+            if (_fd >= 0) {
+                close(_fd);
+            }
+        }
+
+        // Returns 0 on success, -1 otherwise and errno is set.
+        int init(unsigned entries) {
+            io_uring_params p;
+            memset(&p, 0, sizeof(p));
+            // Completions of parked fibers may outnumber submission entries.
+            p.flags = IORING_SETUP_CQSIZE;
+            p.cq_entries = entries * 4;
+            _fd = syscall(__NR_io_uring_setup, entries, &p);
+            if (_fd < 0) {
+                return -1;
+            }
+            if (!(p.features & IORING_FEAT_NODROP) ||
+                !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+                errno = ENOTSUP;
+                return -1;
+            }
+            _features = p.features;
+            _ring_size = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                                  p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+            void *ring = mmap(NULL, _ring_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+            if (ring == MAP_FAILED) {
+                return -1;
+            }
+            _ring = static_cast<char *>(ring);
+            _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+            void *sqes = mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED) {
+                return -1;
+            }
+            _sqes = static_cast<io_uring_sqe *>(sqes);
+            _sq_head = reinterpret_cast<unsigned *>(_ring + p.sq_off.head);
+            _sq_tail = reinterpret_cast<unsigned *>(_ring + p.sq_off.tail);
+            _sq_mask = *reinterpret_cast<unsigned *>(_ring + p.sq_off.ring_mask);
+            _sq_entries = p.sq_entries;
+            // SQEs are submitted in order, map slots to themselves once.
+            unsigned *array = reinterpret_cast<unsigned *>(_ring + p.sq_off.array);
+            for (unsigned i = 0; i < _sq_entries; ++i) {
+                array[i] = i;
+            }
+            _cq_head = reinterpret_cast<unsigned *>(_ring + p.cq_off.head);
+            _cq_tail = reinterpret_cast<unsigned *>(_ring + p.cq_off.tail);
+            _cq_mask = *reinterpret_cast<unsigned *>(_ring + p.cq_off.ring_mask);
+            _cqes = reinterpret_cast<io_uring_cqe *>(_ring + p.cq_off.cqes);
+
+            const size_t probe_size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+            std::unique_ptr<char[]> probe_buf(new(std::nothrow) char[probe_size]());
+            if (probe_buf == nullptr) {
+                errno = ENOMEM;
+                return -1;
+            }
+            io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probe_buf.get());
+            if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+                return -1;
+            }
+            const int required_ops[] = {IORING_OP_READ, IORING_OP_WRITE,
+                                        IORING_OP_READV, IORING_OP_WRITEV,
+                                        IORING_OP_ACCEPT, IORING_OP_CONNECT,
+                                        IORING_OP_FSYNC};
+            for (int op : required_ops) {
+                if (op > probe->last_op ||
+                    !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                    errno = ENOTSUP;
+                    return -1;
+                }
+            }
+
+            _efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (_efd < 0) {
+                return -1;
+            }
+            if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_EVENTFD, &_efd, 1) < 0) {
+                return -1;
+            }
+            fiber_id_t tid;
+            const int rc = fiber_start_background(&tid, NULL, run_reaper, this);
+            if (rc != 0) {
+                errno = rc;
+                return -1;
+            }
+            return 0;
+        }
+
+        // True if io_uring uses the file offset for `offset' of -1.
+        bool support_current_pos() const {
+            return _features & IORING_FEAT_RW_CUR_POS;
+        }
+
+        // Get an entry to fill, NULL if the submission queue is full even
+        // after submitting queued operations.
+        io_uring_sqe *get_sqe() {
+            const unsigned tail = *_sq_tail;
+            if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries) {
+                flush();
+                if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries) {
+                    return NULL;
+                }
+            }
+            io_uring_sqe *sqe = &_sqes[tail & _sq_mask];
+            memset(sqe, 0, sizeof(*sqe));
+            return sqe;
+        }
+
+        // Queue the entry returned by last get_sqe() and submit queued
+        // operations if the batch is large enough or the worker is going to
+        // be idle. Operations completed during the submission, e.g. reads
+        // hitting page cache, are reaped at once.
+        void commit_sqe(fiber_worker *g) {
+            _inflight.fetch_add(1, std::memory_order_relaxed);
+            __atomic_store_n(_sq_tail, *_sq_tail + 1, __ATOMIC_RELEASE);
+            // Operations of rings not flushed by idle workers can't wait.
+            const int batch = _batched ? FLAGS_fiber_io_uring_submit_batch : 1;
+            if ((int) pending() >= batch || g->rq_size() == 0) {
+                flush();
+                reap();
+            }
+        }
+
+        // Number of operations queued but not submitted.
+        unsigned pending() const {
+            return __atomic_load_n(_sq_tail, __ATOMIC_ACQUIRE) -
+                   __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+        }
+
+        // Submit queued operations, called from any thread. Concurrent
+        // callers are serialized by the kernel, which submits no more than
+        // queued.
+        void flush() {
+            bool reaped = false;
+            unsigned n;
+            while ((n = pending()) != 0) {
+                const int rc = syscall(__NR_io_uring_enter, _fd, n, 0, 0, NULL, 0);
+                if (rc > 0) {
+                    variable_io_uring_enters << 1;
+                    continue;
+                }
+                if (rc < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (rc < 0 && (errno == EBUSY || errno == EAGAIN) && !reaped) {
+                    // Completions overflowed, make room and try again. Still
+                    // queued operations are submitted by next flush().
+                    reap();
+                    reaped = true;
+                    continue;
+                }
+                FLARE_PLOG_IF(ERROR, rc < 0 && errno != EBUSY && errno != EAGAIN)
+                    << "Fail to submit to io_uring fd=" << _fd;
+                break;
+            }
+        }
+
+        // Returns number of completions reaped.
+        int reap() {
+            const int MAX_BATCH = 64;
+            std::atomic<int> *butexes[MAX_BATCH];
+            int nreaped = 0;
+            while (true) {
+                if (_reaping.exchange(true, std::memory_order_acquire)) {
+                    break;
+                }
+                unsigned head = *_cq_head;
+                const unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+                int n = 0;
+                for (; head != tail && n < MAX_BATCH; ++head) {
+                    const io_uring_cqe *cqe = &_cqes[head & _cq_mask];
+                    io_uring_op *op = reinterpret_cast<io_uring_op *>(cqe->user_data);
+                    // `op' is on stack of the waiter, which may return as soon
+                    // as the butex is set.
+                    std::atomic<int> *butex = op->butex;
+                    op->res = cqe->res;
+                    butex->store(1, std::memory_order_release);
+                    butexes[n++] = butex;
+                }
+                __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+                _reaping.store(false, std::memory_order_release);
+                // Never switch to the woken fibers here: reap() is called
+                // between get_sqe() and commit_sqe() by flush(), where the
+                // caller must keep running on this worker, and switching
+                // halfway would delay the remaining wakeups.
+                for (int i = 0; i < n; ++i) {
+                    waitable_event_wake(butexes[i], true);
+                }
+                _inflight.fetch_sub(n, std::memory_order_relaxed);
+                nreaped += n;
+                // Completions arriving after the batch was taken and before
+                // _reaping was cleared are missed by concurrent callers which
+                // gave up above, check again. The fence orders the clearing
+                // before the load of the tail.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (n < MAX_BATCH &&
+                    __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) == head) {
+                    break;
+                }
+            }
+            if (nreaped > 0) {
+                fiber_flush();
+            }
+            return nreaped;
+        }
+
+        // Whether queued operations are flushed by idle workers, set before
+        // the ring is used.
+        void set_batched(bool batched) {
+            _batched = batched;
+        }
+
+        // Called by the worker when it quits, no operations are queued any
+        // more. The reaper destroys the ring after operations in flight
+        // complete, which are cancelled by the kernel if they need the
+        // quitting thread.
+        void retire() {
+            flush();
+            _retired.store(true, std::memory_order_release);
+            const uint64_t one = 1;
+            while (write(_efd, &one, sizeof(one)) < 0 && errno == EINTR) {
+            }
+        }
+
+    private:
+        FLARE_DISALLOW_COPY_AND_ASSIGN(IoUring);
+
+        static void *run_reaper(void *arg) {
+            IoUring *r = static_cast<IoUring *>(arg);
+            while (true) {
+                // Consume the eventfd before reaping, so that completions
+                // after reaping are notified.
+                uint64_t count;
+                while (read(r->_efd, &count, sizeof(count)) < 0 && errno == EINTR) {
+                }
+                r->reap();
+                if (r->_retired.load(std::memory_order_acquire)) {
+                    r->flush();
+                    r->reap();
+                    if (r->_inflight.load(std::memory_order_relaxed) == 0) {
+                        fiber_fd_close(r->_efd);
+                        r->_efd = -1;
+                        delete r;
+                        variable_io_uring_rings << -1;
+                        return NULL;
+                    }
+                }
+                if (fiber_fd_wait(r->_efd, EPOLLIN) < 0 && errno != EINTR) {
+                    FLARE_PLOG(ERROR) << "Fail to wait eventfd of io_uring fd=" << r->_fd;
+                    return NULL;
+                }
+            }
+        }
+
+        int _fd;
+        int _efd;
+        char *_ring;
+        size_t _ring_size;
+        io_uring_sqe *_sqes;
+        size_t _sqes_size;
+        unsigned _features;
+        unsigned *_sq_head;
+        unsigned *_sq_tail;
+        unsigned _sq_mask;
+        unsigned _sq_entries;
+        unsigned *_cq_head;
+        unsigned *_cq_tail;
+        unsigned _cq_mask;
+        io_uring_cqe *_cqes;
+        bool _batched;
+        std::atomic<bool> _reaping;
+        std::atomic<bool> _retired;
+        // Operations committed but not reaped.
+        std::atomic<int> _inflight;
+    };
+
+    static FLARE_THREAD_LOCAL IoUring *tls_io_uring = NULL;
+    static FLARE_THREAD_LOCAL bool tls_io_uring_failed = false;
+    static std::atomic<bool> io_uring_unsupported{false};
+
+    // Rings of running workers, flushed by idle workers.
+    static const int MAX_IO_URING_NUM = 1024;
+    static internal::FastPthreadMutex io_urings_mutex;
+    static IoUring *io_urings[MAX_IO_URING_NUM];
+    static int io_uring_num = 0;
+
+    static bool add_io_uring(IoUring *r) {
+        FLARE_SCOPED_LOCK(io_urings_mutex);
+        if (io_uring_num >= MAX_IO_URING_NUM) {
+            return false;
+        }
+        io_urings[io_uring_num++] = r;
+        return true;
+    }
+
+    static void remove_io_uring(IoUring *r) {
+        FLARE_SCOPED_LOCK(io_urings_mutex);
+        for (int i = 0; i < io_uring_num; ++i) {
+            if (io_urings[i] == r) {
+                io_urings[i] = io_urings[--io_uring_num];
+                return;
+            }
+        }
+    }
+
+    static IoUring *get_io_uring() {
+        IoUring *r = tls_io_uring;
+        if (r != NULL) {
+            return r;
+        }
+        if (tls_io_uring_failed ||
+            io_uring_unsupported.load(std::memory_order_relaxed)) {
+            return NULL;
+        }
+        r = new(std::nothrow) IoUring;
+        if (r == NULL) {
+            return NULL;
+        }
+        const unsigned entries = std::min(std::max(FLAGS_fiber_io_uring_entries, 1), 32768);
+        if (r->init(entries) != 0) {
+            const int saved_errno = errno;
+            delete r;
+            if (saved_errno == ENOSYS || saved_errno == EPERM ||
+                saved_errno == ENOTSUP || saved_errno == EINVAL) {
+                if (!io_uring_unsupported.exchange(true, std::memory_order_relaxed)) {
+                    FLARE_LOG(WARNING) << "io_uring is unavailable(" << flare_error(saved_errno)
+                                       << "), fiber_io_* call syscalls directly";
+                }
+            } else {
+                FLARE_LOG(WARNING) << "Fail to create io_uring, " << flare_error(saved_errno);
+                tls_io_uring_failed = true;
+            }
+            return NULL;
+        }
+        variable_io_uring_rings << 1;
+        if (add_io_uring(r)) {
+            r->set_batched(true);
+        } else {
+            FLARE_LOG_FIRST_N(WARNING, 1) << "Too many io_uring, operations are not batched";
+        }
+        tls_io_uring = r;
+        return r;
+    }
+
+    static const uint8_t io_uring_opcodes[] = {
+            IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV, IORING_OP_WRITEV,
+            IORING_OP_ACCEPT, IORING_OP_CONNECT, IORING_OP_FSYNC
+    };
+
+    // Submit the operation through io_uring of current worker and suspend
+    // the calling fiber until it completes. `addr', `len' and `off' are the
+    // fields of io_uring_sqe.
+    // Returns false if the operation can't be done by io_uring, otherwise
+    // the result(negative errno on error) is stored into *res.
+    static bool submit_and_wait(io_kind kind, int fd, const void *addr,
+                                size_t len, uint64_t off, int *res) {
+        if (!FLAGS_fiber_io_uring || !in_fiber()) {
+            return false;
+        }
+        fiber_worker *g = tls_task_group;
+        IoUring *r = get_io_uring();
+        if (r == NULL) {
+            return false;
+        }
+        if ((kind == IO_READ || kind == IO_WRITE || kind == IO_READV ||
+             kind == IO_WRITEV) && off == (uint64_t) -1 && !r->support_current_pos()) {
+            return false;
+        }
+        io_uring_op op;
+        op.butex = waitable_event_create_checked<std::atomic<int> >();
+        if (op.butex == NULL) {
+            return false;
+        }
+        op.butex->store(0, std::memory_order_relaxed);
+        op.res = 0;
+        io_uring_sqe *sqe = r->get_sqe();
+        if (sqe == NULL) {
+            waitable_event_destroy(op.butex);
+            return false;
+        }
+        sqe->opcode = io_uring_opcodes[kind];
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(addr);
+        sqe->len = static_cast<uint32_t>(len);
+        sqe->off = off;
+        sqe->user_data = reinterpret_cast<uint64_t>(&op);
+        r->commit_sqe(g);
+        variable_io_uring_ops << 1;
+        // The kernel may still write into buffers of the operation, never
+        // return before the completion even if the fiber is interrupted.
+        while (op.butex->load(std::memory_order_acquire) == 0) {
+            waitable_event_wait(op.butex, 0, NULL);
+        }
+        waitable_event_destroy(op.butex);
+        *res = op.res;
+        return true;
+    }
+
+#else
+
+    static bool submit_and_wait(io_kind, int, const void *, size_t, uint64_t, int *) {
+        return false;
+    }
+
+#endif  // FIBER_HAS_IO_URING
+
+    int io_uring_flush_and_reap() {
+#if defined(FIBER_HAS_IO_URING)
+        // One idle worker flushing all rings is enough.
+        if (FLAGS_fiber_io_uring_submit_batch > 1 && io_urings_mutex.try_lock()) {
+            for (int i = 0; i < io_uring_num; ++i) {
+                if (io_urings[i]->pending() != 0) {
+                    io_urings[i]->flush();
+                }
+            }
+            io_urings_mutex.unlock();
+        }
+        IoUring *r = tls_io_uring;
+        if (r == NULL) {
+            return 0;
+        }
+        r->flush();
+        return r->reap();
+#else
+        return 0;
+#endif
+    }
+
+    void io_uring_release() {
+#if defined(FIBER_HAS_IO_URING)
+        IoUring *r = tls_io_uring;
+        if (r == NULL) {
+            return;
+        }
+        tls_io_uring = NULL;
+        remove_io_uring(r);
+        r->retire();
+#endif
+    }
+
+    // Do the operation through io_uring if possible, otherwise call
+    // `fallback'. EAGAIN of non-blocking fds is waited by fiber_fd_wait in
+    // fibers and the operation is retried.
+    template<typename Fallback>
+    static ssize_t do_io(io_kind kind, int fd, const void *addr, size_t len,
+                         uint64_t off, unsigned wait_events, Fallback &&fallback) {
+        while (true) {
+            int res;
+            if (submit_and_wait(kind, fd, addr, len, off, &res)) {
+                if (res >= 0) {
+                    return res;
+                }
+                if (res == -ECANCELED) {
+                    // The submitting thread quit, nothing was done.
+                    continue;
+                }
+                errno = -res;
+            } else {
+                const ssize_t rc = fallback();
+                if (rc >= 0) {
+                    return rc;
+                }
+            }
+            if ((errno != EAGAIN && errno != EWOULDBLOCK) || !in_fiber() ||
+                fiber_fd_wait(fd, wait_events) < 0) {
+                return -1;
+            }
+        }
+    }
+
+}  // namespace flare::fiber_internal
+
+using flare::fiber_internal::do_io;
+using flare::fiber_internal::io_offset;
+using flare::fiber_internal::IO_MAX_RW_COUNT;
+
+extern "C" {
+
+ssize_t fiber_io_read(int fd, void *buf, size_t count, off_t offset) {
+    count = std::min(count, IO_MAX_RW_COUNT);
+    return do_io(flare::fiber_internal::IO_READ, fd, buf, count, io_offset(offset),
+                 flare::fiber_internal::IO_EVENT_IN, [=] {
+                return offset < 0 ? ::read(fd, buf, count) : ::pread(fd, buf, count, offset);
+            });
+}
+
+ssize_t fiber_io_write(int fd, const void *buf, size_t count, off_t offset) {
+    count = std::min(count, IO_MAX_RW_COUNT);
+    return do_io(flare::fiber_internal::IO_WRITE, fd, buf, count, io_offset(offset),
+                 flare::fiber_internal::IO_EVENT_OUT, [=] {
+                return offset < 0 ? ::write(fd, buf, count) : ::pwrite(fd, buf, count, offset);
+            });
+}
+
+ssize_t fiber_io_readv(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    return do_io(flare::fiber_internal::IO_READV, fd, iov, iovcnt, io_offset(offset),
+                 flare::fiber_internal::IO_EVENT_IN, [=] {
+                return offset < 0 ? ::readv(fd, iov, iovcnt) : ::preadv(fd, iov, iovcnt, offset);
+            });
+}
+
+ssize_t fiber_io_writev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    return do_io(flare::fiber_internal::IO_WRITEV, fd, iov, iovcnt, io_offset(offset),
+                 flare::fiber_internal::IO_EVENT_OUT, [=] {
+                return offset < 0 ? ::writev(fd, iov, iovcnt) : ::pwritev(fd, iov, iovcnt, offset);
+            });
+}
+
+int fiber_io_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
+    return do_io(flare::fiber_internal::IO_ACCEPT, sockfd, addr, 0,
+                 reinterpret_cast<uint64_t>(addrlen),
+                 flare::fiber_internal::IO_EVENT_IN, [=] {
+                return ::accept(sockfd, addr, addrlen);
+            });
+}
+
+int fiber_io_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
+    int res;
+    if (!flare::fiber_internal::submit_and_wait(flare::fiber_internal::IO_CONNECT, sockfd,
+                                                addr, 0, addrlen, &res)) {
+        return fiber_connect(sockfd, addr, addrlen);
+    }
+    if (res == 0) {
+        return 0;
+    }
+    if (res != -EINPROGRESS) {
+        errno = -res;
+        return -1;
+    }
+    // Non-blocking socket, wait for the connection like fiber_connect.
+    if (fiber_fd_wait(sockfd, flare::fiber_internal::IO_EVENT_OUT) < 0) {
+        return -1;
+    }
+    int err;
+    socklen_t errlen = sizeof(err);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0) {
+        return -1;
+    }
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int fiber_io_fsync(int fd) {
+    return do_io(flare::fiber_internal::IO_FSYNC, fd, NULL, 0, 0,
+                 flare::fiber_internal::IO_EVENT_OUT, [=] {
+                return ::fsync(fd);
+            });
+}
+
+}  // extern "C"
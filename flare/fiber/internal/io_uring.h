@@ -0,0 +1,39 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_FIBER_INTERNAL_IO_URING_H_
+#define FLARE_FIBER_INTERNAL_IO_URING_H_
+
+#include <gflags/gflags_declare.h>
+
+namespace flare::fiber_internal {
+
+    DECLARE_bool(fiber_io_uring);
+
+    // Called by an idle worker before parking: submit io_uring operations
+    // queued by fibers of this worker and reap completions of its ring.
+    // Returns number of completions reaped.
+    int io_uring_flush_and_reap();
+
+    // Called by a worker when it quits. Its ring is destroyed after
+    // operations in flight complete.
+    void io_uring_release();
+
+}  // namespace flare::fiber_internal
+
+#endif  // FLARE_FIBER_INTERNAL_IO_URING_H_
@@ -20,11 +20,13 @@
 // Date: Sun Aug  3 12:46:15 CST 2014
 
 #include <pthread.h>
+#include <algorithm>
 #include "flare/base/profile.h"
 #include "flare/base/static_atomic.h"
 #include "flare/variable/passive_status.h"
 #include "flare/fiber/internal/errno.h"                       // EAGAIN
 #include "flare/fiber/internal/fiber_worker.h"                  // fiber_worker
+#include "flare/fiber/internal/key.h"
 
 // Implement fiber_local_key related functions
 
@@ -34,7 +36,6 @@ namespace flare::fiber_internal {
 
 // defined in task_group.cpp
     extern __thread fiber_worker *tls_task_group;
-    extern thread_local fiber_local_storage tls_bls;
     static __thread bool tls_ever_created_keytable = false;
 
 // We keep thread specific data in a two-level array. The top-level array
@@ -44,7 +45,7 @@ namespace flare::fiber_internal {
 // memory footprint smaller and we can change KEY_1STLEVEL_SIZE to a
 // bigger number more freely. The tradeoff is an additional memory indirection:
 // negligible at most time.
-    static const uint32_t KEY_2NDLEVEL_SIZE = 32;
+    static const uint32_t KEY_2NDLEVEL_SIZE = KEY_INLINE_SIZE;
 
 // Notice that we're trying to make the memory of second level and first
 // level both 256 bytes to make memory allocator happier.
@@ -116,6 +117,8 @@ namespace flare::fiber_internal {
             return true;
         }
 
+        const KeySlot *slots() const { return _data; }
+
         inline void *get_data(uint32_t index, uint32_t version) const {
             if (_data[index].version == version) {
                 return _data[index].ptr;
@@ -129,20 +132,20 @@ namespace flare::fiber_internal {
         }
 
     private:
-        struct Data {
-            uint32_t version;
-            void *ptr;
-        };
-        Data _data[KEY_2NDLEVEL_SIZE];
+        KeySlot _data[KEY_2NDLEVEL_SIZE];
     };
 
     // The first-level array.
     // Align with cacheline to avoid false sharing.
+    // The first second-level array is embedded at the beginning, which is
+    // what fast_getspecific() reads.
     class FLARE_CACHELINE_ALIGNMENT KeyTable {
     public:
         KeyTable() : next(nullptr) {
             memset(_subs, 0, sizeof(_subs));
+            _subs[0] = &_inline_sub;
             nkeytable.fetch_add(1, std::memory_order_relaxed);
+            FLARE_DCHECK_EQ((const void *) this, (const void *) _inline_sub.slots());
         }
 
         ~KeyTable() {
@@ -161,7 +164,7 @@ namespace flare::fiber_internal {
                     }
                 }
                 if (all_cleared) {
-                    for (uint32_t i = 0; i < KEY_1STLEVEL_SIZE; ++i) {
+                    for (uint32_t i = 1; i < KEY_1STLEVEL_SIZE; ++i) {
                         delete _subs[i];
                     }
                     return;
@@ -171,6 +174,9 @@ namespace flare::fiber_internal {
         }
 
         inline void *get_data(fiber_local_key key) const {
+            if (key.index < KEY_INLINE_SIZE) {
+                return _inline_sub.get_data(key.index, key.version);
+            }
             const uint32_t subidx = key.index / KEY_2NDLEVEL_SIZE;
             if (subidx < KEY_1STLEVEL_SIZE) {
                 const SubKeyTable *sub_kt = _subs[subidx];
@@ -203,6 +209,9 @@ namespace flare::fiber_internal {
             return EINVAL;
         }
 
+    private:
+        // Must be the first member.
+        SubKeyTable _inline_sub;
     public:
         KeyTable *next;
     private:
@@ -267,7 +276,8 @@ namespace flare::fiber_internal {
     static size_t get_keytable_memory(void *) {
         const size_t n = nkeytable.load(std::memory_order_relaxed);
         const size_t nsub = nsubkeytable.load(std::memory_order_relaxed);
-        return n * sizeof(KeyTable) + nsub * sizeof(SubKeyTable);
+        // Inline SubKeyTables are counted in nsubkeytable as well.
+        return n * sizeof(KeyTable) + (nsub - n) * sizeof(SubKeyTable);
     }
 
     static flare::variable::PassiveStatus<int> s_fiber_key_count(
@@ -393,7 +403,12 @@ int fiber_key_create2(fiber_local_key *key,
     {
         FLARE_SCOPED_LOCK(flare::fiber_internal::s_key_mutex);
         if (flare::fiber_internal::nfreekey > 0) {
-            index = flare::fiber_internal::s_free_keys[--flare::fiber_internal::nfreekey];
+            // Take the smallest index so that keys are likely to be in the
+            // inline slots of KeyTable.
+            uint32_t *const free_keys = flare::fiber_internal::s_free_keys;
+            const size_t n = flare::fiber_internal::nfreekey;
+            std::swap(*std::min_element(free_keys, free_keys + n), free_keys[n - 1]);
+            index = free_keys[--flare::fiber_internal::nfreekey];
         } else if (flare::fiber_internal::nkey < flare::fiber_internal::KEYS_MAX) {
             index = flare::fiber_internal::nkey++;
         } else {
@@ -0,0 +1,56 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_FIBER_INTERNAL_KEY_H_
+#define FLARE_FIBER_INTERNAL_KEY_H_
+
+#include "flare/base/profile.h"
+#include "flare/fiber/internal/fiber.h"           // fiber_getspecific
+#include "flare/fiber/internal/fiber_entity.h"    // fiber_local_storage
+
+namespace flare::fiber_internal {
+
+    // A slot of KeyTable.
+    struct KeySlot {
+        uint32_t version;
+        void *ptr;
+    };
+
+    // Slots of the first KEY_INLINE_SIZE keys are placed at the very
+    // beginning of KeyTable, so that they can be read with an indexed load
+    // instead of calling fiber_getspecific.
+    static const uint32_t KEY_INLINE_SIZE = 32;
+
+    // defined in fiber_worker.cc
+    extern thread_local fiber_local_storage tls_bls;
+
+    // Same as fiber_getspecific, inlined for keys of the inline slots.
+    inline void *fast_getspecific(fiber_local_key key) {
+        const KeySlot *slots = reinterpret_cast<const KeySlot *>(tls_bls.keytable);
+        if (FLARE_LIKELY(slots != nullptr && key.index < KEY_INLINE_SIZE)) {
+            const KeySlot &slot = slots[key.index];
+            return slot.version == key.version ? slot.ptr : nullptr;
+        }
+        // No keytable yet (may be borrowed from the keytable pool) or an
+        // out-of-line key.
+        return fiber_getspecific(key);
+    }
+
+}  // namespace flare::fiber_internal
+
+#endif  // FLARE_FIBER_INTERNAL_KEY_H_
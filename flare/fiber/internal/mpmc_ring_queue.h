@@ -0,0 +1,150 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#ifndef FLARE_FIBER_INTERNAL_MPMC_RING_QUEUE_H_
+#define FLARE_FIBER_INTERNAL_MPMC_RING_QUEUE_H_
+
+#include <stdint.h>                              // intptr_t
+#include <utility>                               // std::move
+#include "flare/base/profile.h"
+#include "flare/base/static_atomic.h"
+#include "flare/log/logging.h"
+
+namespace flare::fiber_internal {
+
+    // A bounded lock-free queue allowing any number of concurrent producers
+    // and consumers (Dmitry Vyukov's algorithm). Each slot carries a sequence
+    // number telling whether it's ready to be written or read in current lap,
+    // so push() and pop() only contend on one CAS of their own index.
+    // T must be default-constructible and movable, values are moved in and out
+    // of the slots.
+    template<typename T>
+    class MPMCRingQueue {
+    public:
+        MPMCRingQueue() : _cells(NULL), _mask(0), _enqueue_pos(0), _dequeue_pos(0) {}
+
+        ~MPMCRingQueue() {
+            delete[] _cells;
+            _cells = NULL;
+        }
+
+        // `capacity' is rounded up to power of 2 (at least 2).
+        int init(size_t capacity) {
+            if (_cells != NULL) {
+                FLARE_LOG(ERROR) << "Already initialized";
+                return -1;
+            }
+            if (capacity == 0) {
+                FLARE_LOG(ERROR) << "Invalid capacity=" << capacity;
+                return -1;
+            }
+            // A single cell can't tell a full queue from an empty one.
+            size_t cap = 2;
+            while (cap < capacity) {
+                cap <<= 1;
+            }
+            _cells = new(std::nothrow) Cell[cap];
+            if (NULL == _cells) {
+                return -1;
+            }
+            for (size_t i = 0; i < cap; ++i) {
+                _cells[i].seq.store(i, std::memory_order_relaxed);
+            }
+            _mask = cap - 1;
+            return 0;
+        }
+
+        // Returns false if the queue is full.
+        bool push(const T &x) {
+            T copy(x);
+            return push(std::move(copy));
+        }
+
+        // Returns false if the queue is full, |x| is not moved in that case.
+        bool push(T &&x) {
+            Cell *cell;
+            size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &_cells[pos & _mask];
+                const size_t seq = cell->seq.load(std::memory_order_acquire);
+                const intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+                if (diff == 0) {
+                    if (_enqueue_pos.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = _enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            cell->data = std::move(x);
+            cell->seq.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Returns false if the queue is empty.
+        bool pop(T *x) {
+            Cell *cell;
+            size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &_cells[pos & _mask];
+                const size_t seq = cell->seq.load(std::memory_order_acquire);
+                const intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+                if (diff == 0) {
+                    if (_dequeue_pos.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = _dequeue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            *x = std::move(cell->data);
+            cell->seq.store(pos + _mask + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Not accurate when the queue is being modified.
+        size_t volatile_size() const {
+            const size_t e = _enqueue_pos.load(std::memory_order_relaxed);
+            const size_t d = _dequeue_pos.load(std::memory_order_relaxed);
+            return e > d ? e - d : 0;
+        }
+
+        size_t capacity() const { return _mask + 1; }
+
+    private:
+        FLARE_DISALLOW_COPY_AND_ASSIGN(MPMCRingQueue);
+
+        struct Cell {
+            std::atomic<size_t> seq;
+            T data;
+        };
+
+        Cell *_cells;
+        size_t _mask;
+        std::atomic<size_t> FLARE_CACHELINE_ALIGNMENT _enqueue_pos;
+        std::atomic<size_t> FLARE_CACHELINE_ALIGNMENT _dequeue_pos;
+    };
+
+}  // namespace flare::fiber_internal
+
+#endif  // FLARE_FIBER_INTERNAL_MPMC_RING_QUEUE_H_
@@ -21,6 +21,8 @@
 
 #include <pthread.h>
 #include <execinfo.h>
+#include <unistd.h>                              // sysconf
+#include <gflags/gflags.h>
 #include "flare/files/filesystem.h"
 #include <dlfcn.h>                               // dlsym
 #include <fcntl.h>                               // O_RDONLY
@@ -37,6 +39,7 @@
 #include "flare/fiber/internal/waitable_event.h"                       // waitable_event_*
 #include "flare/fiber/internal/processor.h"                   // cpu_relax, barrier
 #include "flare/fiber/internal/mutex.h"                       // fiber_mutex_t
+#include "flare/fiber/internal/fiber_worker.h"                // fiber_worker
 #include "flare/fiber/internal/sys_futex.h"
 #include "flare/fiber/internal/log.h"
 
@@ -45,6 +48,17 @@ extern void *_dl_sym(void *handle, const char *symbol, void *caller);
 }
 
 namespace flare::fiber_internal {
+
+    DEFINE_int32(fiber_mutex_max_spin, 16, "Max rounds a contended "
+                 "fiber_mutex_lock() spins while the owner is running on "
+                 "another worker before sleeping, 0 to disable spinning");
+    DEFINE_int32(fiber_mutex_starvation_threshold_us, 0, "Once a waiter of a "
+                 "fiber_mutex has waited longer than so many microseconds, the "
+                 "mutex is handed over to its waiters in FIFO order until "
+                 "the waiters catch up, 0 to disable");
+
+    extern FLARE_THREAD_LOCAL fiber_worker *tls_task_group;
+
 // Warm up backtrace before main().
     void *dummy_buf[4];
     const int FLARE_ALLOW_UNUSED dummy_bt = backtrace(dummy_buf, FLARE_ARRAY_SIZE(dummy_buf));
@@ -590,43 +604,249 @@ namespace flare::fiber_internal {
     struct MutexInternal {
         flare::static_atomic<unsigned char> locked;
         flare::static_atomic<unsigned char> contended;
-        unsigned short padding;
+        // Set by waiters waited longer than FLAGS_fiber_mutex_starvation_threshold_us,
+        // unlock() hands the mutex over to waiters instead of releasing it.
+        flare::static_atomic<unsigned char> starving;
+        // Set by unlock() to pass the ownership to a woken waiter. `locked'
+        // stays 1 in the meantime so that newcomers can't barge in.
+        flare::static_atomic<unsigned char> handoff;
     };
 
-    const MutexInternal MUTEX_CONTENDED_RAW = {{1}, {1}, 0};
-    const MutexInternal MUTEX_LOCKED_RAW = {{1}, {0}, 0};
+    const MutexInternal MUTEX_CONTENDED_RAW = {{1}, {1}, {0}, {0}};
+    const MutexInternal MUTEX_LOCKED_RAW = {{1}, {0}, {0}, {0}};
+    const MutexInternal MUTEX_STARVING_RAW = {{0}, {0}, {1}, {0}};
+    const MutexInternal MUTEX_HANDOFF_RAW = {{0}, {0}, {0}, {1}};
 // Define as macros rather than constants which can't be put in read-only
 // section and affected by initialization-order fiasco.
 #define FIBER_MUTEX_CONTENDED (*(const unsigned*)&flare::fiber_internal::MUTEX_CONTENDED_RAW)
 #define FIBER_MUTEX_LOCKED (*(const unsigned*)&flare::fiber_internal::MUTEX_LOCKED_RAW)
+#define FIBER_MUTEX_STARVING (*(const unsigned*)&flare::fiber_internal::MUTEX_STARVING_RAW)
+#define FIBER_MUTEX_HANDOFF (*(const unsigned*)&flare::fiber_internal::MUTEX_HANDOFF_RAW)
 
     static_assert(sizeof(unsigned) == sizeof(MutexInternal),
                   "sizeof_mutex_internal_must_equal_unsigned");
 
-    inline int mutex_lock_contended(fiber_mutex_t *m) {
+    // Owner fields are written by the owner and read by spinners concurrently.
+    template<typename T>
+    inline std::atomic<T> *mutex_owner_field(T *p) {
+        return reinterpret_cast<std::atomic<T> *>(p);
+    }
+
+    inline void mutex_set_owner(fiber_mutex_t *m) {
+        fiber_worker *g = tls_task_group;
+        fiber_entity *cur = (g ? g->current_task() : NULL);
+        mutex_owner_field(&m->owner_tid)->store(
+                cur ? cur->tid : 0, std::memory_order_relaxed);
+        mutex_owner_field(&m->owner_nswitch)->store(
+                cur ? cur->stat.nswitch : 0, std::memory_order_relaxed);
+    }
+
+    // Returns false if the fiber owning `m' is known to be switched out or
+    // ended. Fiber metas are never freed, so unlike workers which may retire,
+    // they're safe to read with an id of any version.
+    inline bool mutex_owner_running(fiber_mutex_t *m) {
+        const fiber_id_t tid = mutex_owner_field(&m->owner_tid)->load(std::memory_order_relaxed);
+        if (tid == 0) {
+            // Owned by a pthread.
+            return true;
+        }
+        fiber_entity *owner = fiber_worker::address_meta(tid);
+        return owner != NULL &&
+               mutex_owner_field(&owner->tid)->load(std::memory_order_relaxed) == tid &&
+               mutex_owner_field(&owner->stat.nswitch)->load(std::memory_order_relaxed) ==
+               mutex_owner_field(&m->owner_nswitch)->load(std::memory_order_relaxed);
+    }
+
+    static int get_ncpu() {
+        static const int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        return ncpu;
+    }
+
+    // Spin a while before sleeping if the owner is running on another worker
+    // (or is a pthread), since it's likely to release the mutex soon. Stops as
+    // soon as the owner is switched out, which can't release the mutex before
+    // being scheduled again, or the mutex is being handed over to waiters.
+    // Returns true if the mutex is acquired.
+    static bool mutex_spin(fiber_mutex_t *m) {
+        const int max_spin = FLAGS_fiber_mutex_max_spin;
+        if (max_spin <= 0 || get_ncpu() < 2) {
+            return false;
+        }
+        MutexInternal *split = (MutexInternal *) m->event;
         std::atomic<unsigned> *whole = (std::atomic<unsigned> *) m->event;
-        while (whole->exchange(FIBER_MUTEX_CONTENDED) & FIBER_MUTEX_LOCKED) {
-            if (flare::fiber_internal::waitable_event_wait(whole, FIBER_MUTEX_CONTENDED, NULL) < 0 &&
-                errno != EWOULDBLOCK && errno != EINTR/*note*/) {
-                // a mutex lock should ignore interrruptions in general since
-                // user code is unlikely to check the return value.
-                return errno;
+        int npause = 1;
+        for (int i = 0; i < max_spin; ++i) {
+            if (!mutex_owner_running(m)) {
+                return false;
+            }
+            for (int j = 0; j < npause; ++j) {
+                cpu_relax();
+            }
+            if (npause < 16) {
+                npause <<= 1;
+            }
+            const unsigned value = whole->load(std::memory_order_relaxed);
+            if (value & (FIBER_MUTEX_STARVING | FIBER_MUTEX_HANDOFF)) {
+                return false;
+            }
+            if (!(value & FIBER_MUTEX_LOCKED) &&
+                !split->locked.exchange(1, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Returns the start time of a contended locking if starvation of waiters
+    // is checked, 0 otherwise.
+    inline int64_t starvation_clock() {
+        return FLAGS_fiber_mutex_starvation_threshold_us > 0 ?
+               flare::get_current_time_micros() : 0;
+    }
+
+    inline bool is_starving(int64_t start_us) {
+        const int32_t threshold = FLAGS_fiber_mutex_starvation_threshold_us;
+        return start_us && threshold > 0 &&
+               flare::get_current_time_micros() - start_us >= threshold;
+    }
+
+    // Acquire the mutex or mark it as contended (and starving). `woken' is
+    // true if the caller has slept on the mutex before, or is relocking after
+    // being signalled by fiber_cond which may requeue it onto the mutex. Only
+    // such callers can take over a mutex handed off by unlock(), newcomers
+    // queue up behind them.
+    // Returns 0 if the mutex is acquired, otherwise the value to wait for.
+    static unsigned mutex_acquire_or_mark(std::atomic<unsigned> *whole,
+                                          bool woken, int64_t start_us) {
+        unsigned expected = whole->load(std::memory_order_relaxed);
+        while (true) {
+            unsigned desired = expected;
+            if (expected & FIBER_MUTEX_HANDOFF) {
+                if (woken) {
+                    desired &= ~FIBER_MUTEX_HANDOFF;
+                    if (!is_starving(start_us)) {
+                        // Waiters have caught up.
+                        desired &= ~FIBER_MUTEX_STARVING;
+                    }
+                    if (whole->compare_exchange_weak(
+                            expected, desired, std::memory_order_acquire)) {
+                        return 0;
+                    }
+                    continue;
+                }
+            } else if (!(expected & FIBER_MUTEX_LOCKED)) {
+                if (whole->compare_exchange_weak(
+                        expected, expected | FIBER_MUTEX_CONTENDED,
+                        std::memory_order_acquire)) {
+                    return 0;
+                }
+                continue;
+            } else {
+                desired |= FIBER_MUTEX_CONTENDED;
+                if (woken && is_starving(start_us)) {
+                    desired |= FIBER_MUTEX_STARVING;
+                }
+                if (desired != expected && !whole->compare_exchange_weak(
+                        expected, desired, std::memory_order_relaxed)) {
+                    continue;
+                }
+            }
+            return desired;
+        }
+    }
+
+    // Wake up one waiter after the mutex is released or handed off. If the
+    // mutex was handed off but no waiter is there to take it, release the
+    // mutex unless someone in slow path took it meanwhile.
+    static void mutex_wake(std::atomic<unsigned> *whole, bool handoff) {
+        if (flare::fiber_internal::waitable_event_wake(whole) || !handoff) {
+            return;
+        }
+        unsigned expected = whole->load(std::memory_order_relaxed);
+        while (expected & FIBER_MUTEX_HANDOFF) {
+            if (whole->compare_exchange_weak(expected, 0, std::memory_order_release)) {
+                // Newcomers queued after the handoff was published.
+                flare::fiber_internal::waitable_event_wake(whole);
+                return;
             }
         }
-        return 0;
     }
 
     inline int mutex_timedlock_contended(
-            fiber_mutex_t *m, const struct timespec *__restrict abstime) {
+            fiber_mutex_t *m, const struct timespec *__restrict abstime, bool woken = false) {
         std::atomic<unsigned> *whole = (std::atomic<unsigned> *) m->event;
-        while (whole->exchange(FIBER_MUTEX_CONTENDED) & FIBER_MUTEX_LOCKED) {
-            if (flare::fiber_internal::waitable_event_wait(whole, FIBER_MUTEX_CONTENDED, abstime) < 0 &&
-                errno != EWOULDBLOCK && errno != EINTR/*note*/) {
+        const int64_t start_us = starvation_clock();
+        unsigned expected;
+        while ((expected = mutex_acquire_or_mark(whole, woken, start_us)) != 0) {
+            if (flare::fiber_internal::waitable_event_wait(whole, expected, abstime) == 0) {
+                woken = true;
+            } else if (errno != EWOULDBLOCK && errno != EINTR/*note*/) {
                 // a mutex lock should ignore interrruptions in general since
                 // user code is unlikely to check the return value.
                 return errno;
             }
         }
+        mutex_set_owner(m);
+        return 0;
+    }
+
+    inline int mutex_lock_contended(fiber_mutex_t *m, bool woken = false) {
+        return mutex_timedlock_contended(m, NULL, woken);
+    }
+
+    // State of a pending fiber_mutex_lock_async().
+    struct mutex_async_locker {
+        fiber_mutex_t *m;
+        void (*on_locked)(void *);
+        void *arg;
+        int64_t start_us;
+        bool woken;
+    };
+
+    static void on_mutex_async_wakeup(void *arg);
+
+    // Same as mutex_lock_contended() but queues `l' rather than blocking.
+    // Returns true if the lock is acquired, false if `l' is queued in which
+    // case `l' must not be touched any more.
+    static bool mutex_lock_async_contended(mutex_async_locker *l) {
+        std::atomic<unsigned> *whole = (std::atomic<unsigned> *) l->m->event;
+        unsigned expected;
+        while ((expected = mutex_acquire_or_mark(whole, l->woken, l->start_us)) != 0) {
+            if (flare::fiber_internal::waitable_event_wait_async(
+                    whole, expected, on_mutex_async_wakeup, l) == 0) {
+                return false;
+            }
+        }
+        mutex_set_owner(l->m);
+        return true;
+    }
+
+    static void on_mutex_async_wakeup(void *arg) {
+        mutex_async_locker *l = static_cast<mutex_async_locker *>(arg);
+        l->woken = true;
+        if (mutex_lock_async_contended(l)) {
+            void (*on_locked)(void *) = l->on_locked;
+            void *on_locked_arg = l->arg;
+            flare::return_object(l);
+            on_locked(on_locked_arg);
+        }
+    }
+
+    static int mutex_lock_async(fiber_mutex_t *m, void (*on_locked)(void *),
+                                void *arg, bool woken) {
+        mutex_async_locker *l = flare::get_object<mutex_async_locker>();
+        if (l == NULL) {
+            return ENOMEM;
+        }
+        l->m = m;
+        l->on_locked = on_locked;
+        l->arg = arg;
+        l->start_us = starvation_clock();
+        l->woken = woken;
+        if (!mutex_lock_async_contended(l)) {
+            return EINPROGRESS;
+        }
+        flare::return_object(l);
         return 0;
     }
 
@@ -678,6 +898,8 @@ int fiber_mutex_init(fiber_mutex_t *__restrict m,
         return ENOMEM;
     }
     *m->event = 0;
+    m->owner_tid = 0;
+    m->owner_nswitch = 0;
     return 0;
 }
 
@@ -689,18 +911,24 @@ int fiber_mutex_destroy(fiber_mutex_t *m) {
 int fiber_mutex_trylock(fiber_mutex_t *m) {
     flare::fiber_internal::MutexInternal *split = (flare::fiber_internal::MutexInternal *) m->event;
     if (!split->locked.exchange(1, std::memory_order_acquire)) {
+        flare::fiber_internal::mutex_set_owner(m);
         return 0;
     }
     return EBUSY;
 }
 
-int fiber_mutex_lock_contended(fiber_mutex_t *m) {
-    return flare::fiber_internal::mutex_lock_contended(m);
+// Used by fiber_cond to relock the mutex after being signalled. Only a waiter
+// requeued onto the mutex and woken up there is `woken' and may take a
+// handoff, others queue behind the waiters as newcomers.
+int fiber_mutex_lock_contended(fiber_mutex_t *m, bool woken) {
+    return flare::fiber_internal::mutex_lock_contended(m, woken);
 }
 
 int fiber_mutex_lock(fiber_mutex_t *m) {
     flare::fiber_internal::MutexInternal *split = (flare::fiber_internal::MutexInternal *) m->event;
-    if (!split->locked.exchange(1, std::memory_order_acquire)) {
+    if (!split->locked.exchange(1, std::memory_order_acquire) ||
+        flare::fiber_internal::mutex_spin(m)) {
+        flare::fiber_internal::mutex_set_owner(m);
         return 0;
     }
     // Don't sample when contention profiler is off.
@@ -724,10 +952,25 @@ int fiber_mutex_lock(fiber_mutex_t *m) {
     return rc;
 }
 
+int fiber_mutex_lock_contended_async(fiber_mutex_t *m, void (*on_locked)(void *), void *arg) {
+    return flare::fiber_internal::mutex_lock_async(m, on_locked, arg, false);
+}
+
+int fiber_mutex_lock_async(fiber_mutex_t *m, void (*on_locked)(void *), void *arg) {
+    flare::fiber_internal::MutexInternal *split = (flare::fiber_internal::MutexInternal *) m->event;
+    if (!split->locked.exchange(1, std::memory_order_acquire)) {
+        flare::fiber_internal::mutex_set_owner(m);
+        return 0;
+    }
+    return flare::fiber_internal::mutex_lock_async(m, on_locked, arg, false);
+}
+
 int fiber_mutex_timedlock(fiber_mutex_t *__restrict m,
                           const struct timespec *__restrict abstime) {
     flare::fiber_internal::MutexInternal *split = (flare::fiber_internal::MutexInternal *) m->event;
-    if (!split->locked.exchange(1, std::memory_order_acquire)) {
+    if (!split->locked.exchange(1, std::memory_order_acquire) ||
+        flare::fiber_internal::mutex_spin(m)) {
+        flare::fiber_internal::mutex_set_owner(m);
         return 0;
     }
     // Don't sample when contention profiler is off.
@@ -763,18 +1006,25 @@ int fiber_mutex_unlock(fiber_mutex_t *m) {
         saved_csite = m->csite;
         flare::fiber_internal::make_contention_site_invalid(&m->csite);
     }
-    const unsigned prev = whole->exchange(0, std::memory_order_release);
-    // CAUTION: the mutex may be destroyed, check comments before waitable_event_create
-    if (prev == FIBER_MUTEX_LOCKED) {
-        return 0;
+    // Waiters are starving, hand the mutex over to the first of them rather
+    // than releasing it.
+    const bool handoff = whole->load(std::memory_order_relaxed) & FIBER_MUTEX_STARVING;
+    if (handoff) {
+        whole->fetch_or(FIBER_MUTEX_HANDOFF, std::memory_order_release);
+    } else {
+        const unsigned prev = whole->exchange(0, std::memory_order_release);
+        // CAUTION: the mutex may be destroyed, check comments before waitable_event_create
+        if (prev == FIBER_MUTEX_LOCKED) {
+            return 0;
+        }
     }
     // Wakeup one waiter
     if (!flare::fiber_internal::is_contention_site_valid(saved_csite)) {
-        flare::fiber_internal::waitable_event_wake(whole);
+        flare::fiber_internal::mutex_wake(whole, handoff);
         return 0;
     }
     const int64_t unlock_start_ns = flare::get_current_time_nanos();
-    flare::fiber_internal::waitable_event_wake(whole);
+    flare::fiber_internal::mutex_wake(whole, handoff);
     const int64_t unlock_end_ns = flare::get_current_time_nanos();
     saved_csite.duration_ns += unlock_end_ns - unlock_start_ns;
     flare::fiber_internal::submit_contention(saved_csite, unlock_end_ns);
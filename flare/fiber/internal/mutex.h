@@ -35,6 +35,13 @@ extern int fiber_mutex_lock(fiber_mutex_t *mutex);
 extern int fiber_mutex_timedlock(fiber_mutex_t *__restrict mutex,
                                  const struct timespec *__restrict abstime);
 extern int fiber_mutex_unlock(fiber_mutex_t *mutex);
+// Lock `mutex' without blocking the caller, for stackless waiters.
+// Returns 0 if the mutex is locked immediately, EINPROGRESS if the caller
+// is queued and `on_locked(arg)' will be called in the context of the
+// unlocking thread once the mutex is locked on behalf of the caller,
+// errno otherwise.
+extern int fiber_mutex_lock_async(fiber_mutex_t *mutex,
+                                  void (*on_locked)(void *), void *arg);
 __END_DECLS
 
 namespace flare::fiber_internal {
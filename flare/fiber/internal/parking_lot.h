@@ -45,12 +45,18 @@ namespace flare::fiber_internal {
             int val;
         };
 
-        ParkingLot() : _pending_signal(0) {}
+        ParkingLot() : _pending_signal(0), _nwaiters(0) {}
 
         // Wake up at most `num_task' workers.
         // Returns #workers woken up.
         int signal(int num_task) {
-            _pending_signal.fetch_add((num_task << 1), std::memory_order_release);
+            _pending_signal.fetch_add((num_task << 1), std::memory_order_seq_cst);
+            // Skip the syscall when nobody is parked. Paired with wait(): either
+            // the waiter is seen here, or futex_wait() sees the changed
+            // _pending_signal and returns immediately.
+            if (_nwaiters.load(std::memory_order_seq_cst) == 0) {
+                return 0;
+            }
             return futex_wake_private(&_pending_signal, num_task);
         }
 
@@ -59,10 +65,12 @@ namespace flare::fiber_internal {
             return _pending_signal.load(std::memory_order_acquire);
         }
 
-        // Wait for tasks.
+        // Wait for tasks, at most for relative `timeout' if it's not NULL.
         // If the `expected_state' does not match, wait() may finish directly.
-        void wait(const State &expected_state) {
-            futex_wait_private(&_pending_signal, expected_state.val, NULL);
+        void wait(const State &expected_state, const timespec *timeout = NULL) {
+            _nwaiters.fetch_add(1, std::memory_order_seq_cst);
+            futex_wait_private(&_pending_signal, expected_state.val, timeout);
+            _nwaiters.fetch_sub(1, std::memory_order_relaxed);
         }
 
         // Wakeup suspended wait() and make them unwaitable ever.
@@ -74,6 +82,8 @@ namespace flare::fiber_internal {
     private:
         // higher 31 bits for signalling, LSB for stopping.
         std::atomic<int> _pending_signal;
+        // # of workers in wait().
+        std::atomic<int> _nwaiters;
     };
 
 }  // namespace flare::fiber_internal
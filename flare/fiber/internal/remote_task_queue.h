@@ -3,62 +3,88 @@
 #ifndef FLARE_FIBER_INTERNAL_REMOTE_TASK_QUEUE_H_
 #define FLARE_FIBER_INTERNAL_REMOTE_TASK_QUEUE_H_
 
-#include "flare/container/bounded_queue.h"
+#include <deque>
 #include "flare/base/profile.h"
+#include "flare/base/static_atomic.h"
+#include "flare/base/scoped_lock.h"
+#include "flare/fiber/internal/types.h"                 // fiber_id_t
+#include "flare/fiber/internal/mpmc_ring_queue.h"
 
 namespace flare::fiber_internal {
 
     class fiber_worker;
 
-    // A queue for storing fibers created by non-workers. Since non-workers
-    // randomly choose a fiber_worker to push which distributes the contentions,
-    // this queue is simply implemented as a queue protected with a lock.
+    // A queue for storing fibers created by non-workers. Non-workers push
+    // and workers(the owner and stealers) pop concurrently through a
+    // lock-free ring. When the ring is full, tasks go to an overflow list
+    // protected with a lock instead of blocking the pushing pthread, which is
+    // rare and only costs a lock until the list is drained. Tasks pushed while
+    // the list is not empty go to the list as well and the list is moved back
+    // to the ring as it drains, so overflowed tasks are not starved by newer
+    // ones taking the ring.
     // The function names should be self-explanatory.
     class RemoteTaskQueue {
     public:
-        RemoteTaskQueue() {}
+        RemoteTaskQueue() : _noverflow(0) {}
 
         int init(size_t cap) {
-            const size_t memsize = sizeof(fiber_id_t) * cap;
-            void *q_mem = malloc(memsize);
-            if (q_mem == NULL) {
-                return -1;
-            }
-            flare::container::bounded_queue<fiber_id_t> q(q_mem, memsize, flare::container::OWNS_STORAGE);
-            _tasks.swap(q);
-            return 0;
+            return _tasks.init(cap);
         }
 
         bool pop(fiber_id_t *task) {
-            if (_tasks.empty()) {
+            if (_tasks.pop(task)) {
+                return true;
+            }
+            if (_noverflow.load(std::memory_order_acquire) == 0) {
                 return false;
             }
-            _mutex.lock();
-            const bool result = _tasks.pop(task);
-            _mutex.unlock();
-            return result;
-        }
-
-        bool push(fiber_id_t task) {
-            _mutex.lock();
-            const bool res = push_locked(task);
-            _mutex.unlock();
-            return res;
+            return pop_overflow(task);
         }
 
-        bool push_locked(fiber_id_t task) {
-            return _tasks.push(task);
+        // Always succeed, overflowing tasks are kept in a list.
+        void push(fiber_id_t task) {
+            if (_noverflow.load(std::memory_order_acquire) != 0 || !_tasks.push(task)) {
+                push_overflow(task);
+            }
         }
 
         size_t capacity() const { return _tasks.capacity(); }
 
-    private:
+        size_t volatile_size() const {
+            return _tasks.volatile_size() + _noverflow.load(std::memory_order_relaxed);
+        }
 
-        friend class fiber_worker;
+    private:
         FLARE_DISALLOW_COPY_AND_ASSIGN(RemoteTaskQueue);
 
-        flare::container::bounded_queue<fiber_id_t> _tasks;
-        flare::base::Mutex _mutex;
+        void push_overflow(fiber_id_t task) {
+            FLARE_SCOPED_LOCK(_overflow_mutex);
+            _overflow.push_back(task);
+            _noverflow.fetch_add(1, std::memory_order_release);
+        }
+
+        bool pop_overflow(fiber_id_t *task) {
+            FLARE_SCOPED_LOCK(_overflow_mutex);
+            if (_overflow.empty()) {
+                return false;
+            }
+            *task = _overflow.front();
+            _overflow.pop_front();
+            size_t n = 1;
+            // Refill the ring in order, pushers don't touch the ring until
+            // the list is empty.
+            while (!_overflow.empty() && _tasks.push(_overflow.front())) {
+                _overflow.pop_front();
+                ++n;
+            }
+            _noverflow.fetch_sub(n, std::memory_order_release);
+            return true;
+        }
+
+        MPMCRingQueue<fiber_id_t> _tasks;
+        std::atomic<size_t> _noverflow;
+        flare::base::Mutex _overflow_mutex;
+        std::deque<fiber_id_t> _overflow;
     };
 
 }  // namespace flare::fiber_internal
@@ -0,0 +1,274 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <pthread.h>
+#include "flare/fiber/internal/waitable_event.h"
+#include "flare/fiber/internal/mutex.h"                       // fiber_mutex_*
+#include "flare/fiber/internal/fiber.h"                       // fiber_rwlock_t
+
+namespace flare::fiber_internal {
+
+    // Writers are serialized by `write_queue'. A writer sets the pending
+    // bit and bumps the epoch in `state' atomically, which blocks new
+    // readers and tells it how many readers are active. Active readers
+    // decrement `writer_event' when unlocking while a writer is pending, the
+    // last of them wakes the writer up. Readers blocked by the writer of
+    // epoch E wait until `reader_event' reaches E.
+    struct RwlockInternal {
+        std::atomic<uint64_t> state;
+        std::atomic<unsigned> wlocked;
+        std::atomic<unsigned> *reader_event;
+        std::atomic<int> *writer_event;
+        fiber_mutex_t write_queue;
+    };
+
+    static_assert(sizeof(RwlockInternal) == sizeof(fiber_rwlock_t),
+                  "sizeof_innerrwlock_must_equal_rwlock");
+    static_assert(offsetof(RwlockInternal, writer_event) ==
+                  offsetof(fiber_rwlock_t, writer_event),
+                  "offsetof_rwlock_writer_event_must_equal");
+    static_assert(offsetof(RwlockInternal, write_queue) ==
+                  offsetof(fiber_rwlock_t, write_queue),
+                  "offsetof_rwlock_write_queue_must_equal");
+
+    const uint64_t RWLOCK_WRITER_PENDING = 1u << 31;
+    const uint64_t RWLOCK_READER_MASK = RWLOCK_WRITER_PENDING - 1;
+    const uint64_t RWLOCK_EPOCH_ONE = 1ull << 32;
+    // Added to `writer_event' by a writer giving up on timeout, the last
+    // reader finishes the unlocking on behalf of the writer then.
+    const int RWLOCK_WRITER_ABANDONED = 1 << 30;
+
+    inline unsigned writer_epoch(uint64_t state) {
+        return static_cast<unsigned>(state >> 32);
+    }
+
+    inline RwlockInternal *internal_rwlock(fiber_rwlock_t *rw) {
+        return reinterpret_cast<RwlockInternal *>(rw);
+    }
+
+    // Wait until the writer of `epoch' unlocks.
+    static int rwlock_wait_writer(RwlockInternal *rw, unsigned epoch,
+                                  const struct timespec *abstime) {
+        while (true) {
+            const unsigned released = rw->reader_event->load(std::memory_order_acquire);
+            if (static_cast<int>(released - epoch) >= 0) {
+                return 0;
+            }
+            if (waitable_event_wait(rw->reader_event, released, abstime) < 0 &&
+                errno != EWOULDBLOCK && errno != EINTR) {
+                return errno;
+            }
+        }
+    }
+
+    static void rwlock_release_writer(RwlockInternal *rw) {
+        const uint64_t prev = rw->state.fetch_sub(RWLOCK_WRITER_PENDING,
+                                                  std::memory_order_release);
+        rw->reader_event->store(writer_epoch(prev), std::memory_order_release);
+        waitable_event_wake_all(rw->reader_event);
+        fiber_mutex_unlock(&rw->write_queue);
+    }
+
+    // Called by readers unlocking while a writer is pending, which counted
+    // them as active readers.
+    static void rwlock_reader_left(RwlockInternal *rw) {
+        const int left = rw->writer_event->fetch_sub(1, std::memory_order_acq_rel) - 1;
+        if (left == 0) {
+            waitable_event_wake(rw->writer_event);
+        } else if (left == RWLOCK_WRITER_ABANDONED) {
+            rw->writer_event->store(0, std::memory_order_relaxed);
+            rwlock_release_writer(rw);
+        }
+    }
+
+    static int rwlock_rdlock(RwlockInternal *rw, const struct timespec *abstime) {
+        const uint64_t prev = rw->state.fetch_add(1, std::memory_order_acquire);
+        if (!(prev & RWLOCK_WRITER_PENDING)) {
+            return 0;
+        }
+        const unsigned epoch = writer_epoch(prev);
+        const int rc = rwlock_wait_writer(rw, epoch, abstime);
+        if (rc == 0) {
+            return 0;
+        }
+        // Give up. A writer pending now other than the one blocking us
+        // counted us as an active reader.
+        const uint64_t now = rw->state.fetch_sub(1, std::memory_order_relaxed);
+        if ((now & RWLOCK_WRITER_PENDING) && writer_epoch(now) != epoch) {
+            rwlock_reader_left(rw);
+        }
+        return rc;
+    }
+
+    static int rwlock_wrlock(RwlockInternal *rw, const struct timespec *abstime) {
+        const int rc = abstime ? fiber_mutex_timedlock(&rw->write_queue, abstime)
+                               : fiber_mutex_lock(&rw->write_queue);
+        if (rc != 0) {
+            return rc;
+        }
+        const uint64_t prev = rw->state.fetch_add(
+                RWLOCK_EPOCH_ONE | RWLOCK_WRITER_PENDING, std::memory_order_acquire);
+        const int nreader = static_cast<int>(prev & RWLOCK_READER_MASK);
+        // Readers may have left before being added.
+        if (nreader != 0 &&
+            rw->writer_event->fetch_add(nreader, std::memory_order_acq_rel) + nreader != 0) {
+            while (true) {
+                const int left = rw->writer_event->load(std::memory_order_acquire);
+                if (left == 0) {
+                    break;
+                }
+                if (waitable_event_wait(rw->writer_event, left, abstime) < 0 &&
+                    errno != EWOULDBLOCK && errno != EINTR) {
+                    const int saved_errno = errno;
+                    if (rw->writer_event->fetch_add(RWLOCK_WRITER_ABANDONED,
+                                                    std::memory_order_acq_rel) == 0) {
+                        // The last reader left just now.
+                        rw->writer_event->store(0, std::memory_order_relaxed);
+                        break;
+                    }
+                    return saved_errno;
+                }
+            }
+        }
+        rw->wlocked.store(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+}  // namespace flare::fiber_internal
+
+extern "C" {
+
+int fiber_rwlock_init(fiber_rwlock_t *__restrict rwlock,
+                      const fiber_rwlockattr_t *__restrict) {
+    flare::fiber_internal::RwlockInternal *rw = flare::fiber_internal::internal_rwlock(rwlock);
+    rw->reader_event = flare::fiber_internal::waitable_event_create_checked<std::atomic<unsigned>>();
+    if (!rw->reader_event) {
+        return ENOMEM;
+    }
+    rw->writer_event = flare::fiber_internal::waitable_event_create_checked<std::atomic<int>>();
+    if (!rw->writer_event) {
+        flare::fiber_internal::waitable_event_destroy(rw->reader_event);
+        return ENOMEM;
+    }
+    const int rc = fiber_mutex_init(&rw->write_queue, NULL);
+    if (rc != 0) {
+        flare::fiber_internal::waitable_event_destroy(rw->writer_event);
+        flare::fiber_internal::waitable_event_destroy(rw->reader_event);
+        return rc;
+    }
+    rw->state.store(0, std::memory_order_relaxed);
+    rw->wlocked.store(0, std::memory_order_relaxed);
+    rw->reader_event->store(0, std::memory_order_relaxed);
+    rw->writer_event->store(0, std::memory_order_relaxed);
+    return 0;
+}
+
+int fiber_rwlock_destroy(fiber_rwlock_t *rwlock) {
+    flare::fiber_internal::RwlockInternal *rw = flare::fiber_internal::internal_rwlock(rwlock);
+    fiber_mutex_destroy(&rw->write_queue);
+    flare::fiber_internal::waitable_event_destroy(rw->writer_event);
+    flare::fiber_internal::waitable_event_destroy(rw->reader_event);
+    return 0;
+}
+
+int fiber_rwlock_rdlock(fiber_rwlock_t *rwlock) {
+    return flare::fiber_internal::rwlock_rdlock(
+            flare::fiber_internal::internal_rwlock(rwlock), NULL);
+}
+
+int fiber_rwlock_tryrdlock(fiber_rwlock_t *rwlock) {
+    flare::fiber_internal::RwlockInternal *rw = flare::fiber_internal::internal_rwlock(rwlock);
+    uint64_t state = rw->state.load(std::memory_order_relaxed);
+    do {
+        if (state & flare::fiber_internal::RWLOCK_WRITER_PENDING) {
+            return EBUSY;
+        }
+    } while (!rw->state.compare_exchange_weak(state, state + 1, std::memory_order_acquire));
+    return 0;
+}
+
+int fiber_rwlock_timedrdlock(fiber_rwlock_t *__restrict rwlock,
+                             const struct timespec *__restrict abstime) {
+    return flare::fiber_internal::rwlock_rdlock(
+            flare::fiber_internal::internal_rwlock(rwlock), abstime);
+}
+
+int fiber_rwlock_wrlock(fiber_rwlock_t *rwlock) {
+    return flare::fiber_internal::rwlock_wrlock(
+            flare::fiber_internal::internal_rwlock(rwlock), NULL);
+}
+
+int fiber_rwlock_trywrlock(fiber_rwlock_t *rwlock) {
+    flare::fiber_internal::RwlockInternal *rw = flare::fiber_internal::internal_rwlock(rwlock);
+    if (fiber_mutex_trylock(&rw->write_queue) != 0) {
+        return EBUSY;
+    }
+    uint64_t state = rw->state.load(std::memory_order_relaxed);
+    do {
+        if (state & flare::fiber_internal::RWLOCK_READER_MASK) {
+            fiber_mutex_unlock(&rw->write_queue);
+            return EBUSY;
+        }
+    } while (!rw->state.compare_exchange_weak(
+            state, state + (flare::fiber_internal::RWLOCK_EPOCH_ONE |
+                            flare::fiber_internal::RWLOCK_WRITER_PENDING),
+            std::memory_order_acquire));
+    rw->wlocked.store(1, std::memory_order_relaxed);
+    return 0;
+}
+
+int fiber_rwlock_timedwrlock(fiber_rwlock_t *__restrict rwlock,
+                             const struct timespec *__restrict abstime) {
+    return flare::fiber_internal::rwlock_wrlock(
+            flare::fiber_internal::internal_rwlock(rwlock), abstime);
+}
+
+int fiber_rwlock_unlock(fiber_rwlock_t *rwlock) {
+    flare::fiber_internal::RwlockInternal *rw = flare::fiber_internal::internal_rwlock(rwlock);
+    // No reader holds the lock while a writer does.
+    if (rw->wlocked.load(std::memory_order_relaxed)) {
+        rw->wlocked.store(0, std::memory_order_relaxed);
+        flare::fiber_internal::rwlock_release_writer(rw);
+        return 0;
+    }
+    const uint64_t prev = rw->state.fetch_sub(1, std::memory_order_release);
+    if (prev & flare::fiber_internal::RWLOCK_WRITER_PENDING) {
+        flare::fiber_internal::rwlock_reader_left(rw);
+    }
+    return 0;
+}
+
+int fiber_rwlockattr_init(fiber_rwlockattr_t *) {
+    return 0;
+}
+
+int fiber_rwlockattr_destroy(fiber_rwlockattr_t *) {
+    return 0;
+}
+
+// Writers are always preferred.
+int fiber_rwlockattr_getkind_np(const fiber_rwlockattr_t *, int *pref) {
+    *pref = PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP;
+    return 0;
+}
+
+int fiber_rwlockattr_setkind_np(fiber_rwlockattr_t *, int pref) {
+    return pref == PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP ? 0 : ENOTSUP;
+}
+
+}  // extern "C"
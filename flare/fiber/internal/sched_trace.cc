@@ -0,0 +1,179 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/fiber/internal/sched_trace.h"
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+#include <gflags/gflags.h>
+#include "flare/log/logging.h"
+#include "flare/times/internal/cycle_clock.h"             // cycle_clock
+
+namespace flare::fiber_internal {
+
+    DEFINE_bool(fiber_enable_sched_trace, false,
+                "Record scheduling events of fibers into per-worker ring "
+                "buffers, which can be dumped by fiber_dump_sched_trace()");
+    DEFINE_int32(fiber_sched_trace_capacity, 16384,
+                 "# of events kept in each worker when -fiber_enable_sched_trace "
+                 "is on, rounded up to power of 2");
+
+    static const char *const SCHED_EVENT_NAMES[] = {
+            "create", "ready", "run", "switch_out", "steal",
+            "park", "unpark", "butex_wait", "butex_wake"
+    };
+    static_assert(sizeof(SCHED_EVENT_NAMES) / sizeof(SCHED_EVENT_NAMES[0]) == SCHED_EVENT_TYPE_NUM,
+                  "sched_event_names_match");
+
+    const char *sched_event_name(int type) {
+        if (type < 0 || type >= SCHED_EVENT_TYPE_NUM) {
+            return "unknown";
+        }
+        return SCHED_EVENT_NAMES[type];
+    }
+
+    SchedTraceBuffer::~SchedTraceBuffer() {
+        ring *r = _ring.exchange(NULL, std::memory_order_relaxed);
+        if (r != NULL) {
+            delete[] r->slots;
+            delete r;
+        }
+    }
+
+    int64_t SchedTraceBuffer::now_cycles() {
+        return flare::times_internal::cycle_clock::now();
+    }
+
+    SchedTraceBuffer::ring *SchedTraceBuffer::allocate() {
+        size_t capacity = 64;
+        while (capacity < (size_t) FLAGS_fiber_sched_trace_capacity) {
+            capacity *= 2;
+        }
+        ring *r = new(std::nothrow) ring;
+        if (r == NULL) {
+            return NULL;
+        }
+        r->slots = new(std::nothrow) slot[capacity];
+        if (r->slots == NULL) {
+            delete r;
+            return NULL;
+        }
+        r->mask = capacity - 1;
+        for (size_t i = 0; i < capacity; ++i) {
+            r->slots[i].seq.store(0, std::memory_order_relaxed);
+        }
+        ring *expected = NULL;
+        // Multiple threads may add the first events concurrently, the flag
+        // may be changed in between so the losers' capacity is discarded
+        // along with their slots.
+        if (!_ring.compare_exchange_strong(expected, r, std::memory_order_acq_rel)) {
+            delete[] r->slots;
+            delete r;
+            return expected;
+        }
+        return r;
+    }
+
+    void SchedTraceBuffer::snapshot(std::vector<sched_event> *out) const {
+        const ring *r = _ring.load(std::memory_order_acquire);
+        if (r == NULL) {
+            return;
+        }
+        const uint64_t end = _pos.load(std::memory_order_acquire);
+        const uint64_t begin = (end > r->mask + 1 ? end - r->mask - 1 : 0);
+        for (uint64_t pos = begin; pos < end; ++pos) {
+            const slot &s = r->slots[pos & r->mask];
+            const uint64_t seq = s.seq.load(std::memory_order_acquire);
+            if (seq != pos * 2 + 2) {
+                // Being written or already overwritten.
+                continue;
+            }
+            sched_event e;
+            memcpy(&e, &s.event, sizeof(e));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) == seq) {
+                out->push_back(e);
+            }
+        }
+    }
+
+    void write_chrome_trace(std::ostream &os,
+                            const std::vector<std::vector<sched_event> > &worker_events) {
+        int64_t base = INT64_MAX;
+        for (size_t i = 0; i < worker_events.size(); ++i) {
+            for (size_t j = 0; j < worker_events[i].size(); ++j) {
+                base = std::min(base, worker_events[i][j].cycles);
+            }
+        }
+        const double us_per_cycle = 1000000.0 / flare::times_internal::cycle_clock::frequency();
+        char buf[256];
+        bool first = true;
+        os << "{\"traceEvents\":[";
+        for (size_t i = 0; i < worker_events.size(); ++i) {
+            snprintf(buf, sizeof(buf),
+                     "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%zu,"
+                     "\"args\":{\"name\":\"worker %zu\"}}", first ? "" : ",", i, i);
+            os << buf;
+            first = false;
+            const std::vector<sched_event> &events = worker_events[i];
+            // Events of a worker are mostly ordered, except those added by
+            // other threads concurrently.
+            std::vector<sched_event> sorted(events);
+            std::stable_sort(sorted.begin(), sorted.end(),
+                             [](const sched_event &a, const sched_event &b) {
+                                 return a.cycles < b.cycles;
+                             });
+            const sched_event *running = NULL;
+            const sched_event *parked = NULL;
+            for (size_t j = 0; j < sorted.size(); ++j) {
+                const sched_event &e = sorted[j];
+                const double ts = (e.cycles - base) * us_per_cycle;
+                if (e.type == SCHED_EVENT_RUN) {
+                    running = &e;
+                } else if (e.type == SCHED_EVENT_PARK) {
+                    parked = &e;
+                } else if (e.type == SCHED_EVENT_SWITCH_OUT && running != NULL &&
+                           running->tid == e.tid) {
+                    const double start = (running->cycles - base) * us_per_cycle;
+                    snprintf(buf, sizeof(buf),
+                             ",\n{\"name\":\"fiber %" PRIu64 "\",\"cat\":\"run\",\"ph\":\"X\","
+                             "\"pid\":0,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+                             e.tid, i, start, ts - start);
+                    os << buf;
+                    running = NULL;
+                } else if (e.type == SCHED_EVENT_UNPARK && parked != NULL) {
+                    const double start = (parked->cycles - base) * us_per_cycle;
+                    snprintf(buf, sizeof(buf),
+                             ",\n{\"name\":\"park\",\"cat\":\"idle\",\"ph\":\"X\","
+                             "\"pid\":0,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+                             i, start, ts - start);
+                    os << buf;
+                    parked = NULL;
+                } else {
+                    snprintf(buf, sizeof(buf),
+                             ",\n{\"name\":\"%s\",\"cat\":\"sched\",\"ph\":\"i\",\"s\":\"t\","
+                             "\"pid\":0,\"tid\":%zu,\"ts\":%.3f,\"args\":{\"fiber\":%" PRIu64 "}}",
+                             sched_event_name(e.type), i, ts, e.tid);
+                    os << buf;
+                }
+            }
+        }
+        os << "\n]}";
+    }
+
+}  // namespace flare::fiber_internal
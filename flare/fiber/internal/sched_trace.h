@@ -0,0 +1,119 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_FIBER_INTERNAL_SCHED_TRACE_H_
+#define FLARE_FIBER_INTERNAL_SCHED_TRACE_H_
+
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+#include <gflags/gflags_declare.h>
+#include "flare/base/static_atomic.h"
+#include "flare/fiber/internal/types.h"                  // fiber_id_t
+
+namespace flare::fiber_internal {
+
+    DECLARE_bool(fiber_enable_sched_trace);
+
+    enum sched_event_type {
+        SCHED_EVENT_CREATE = 0,
+        SCHED_EVENT_READY,       // pushed into a runqueue
+        SCHED_EVENT_RUN,         // switched in
+        SCHED_EVENT_SWITCH_OUT,
+        SCHED_EVENT_STEAL,       // taken from another worker or a remote runqueue
+        SCHED_EVENT_PARK,        // worker has nothing to run
+        SCHED_EVENT_UNPARK,
+        SCHED_EVENT_BUTEX_WAIT,
+        SCHED_EVENT_BUTEX_WAKE,
+        SCHED_EVENT_TYPE_NUM
+    };
+
+    const char *sched_event_name(int type);
+
+    struct sched_event {
+        // cycle_clock::now() when the event happened.
+        int64_t cycles;
+        // 0 for events of the worker itself(park/unpark).
+        fiber_id_t tid;
+        int type;
+    };
+
+    // Fixed-size ring buffer of scheduling events of a worker, oldest events
+    // are overwritten. Events are mostly added by the owner worker and
+    // occasionally by other threads readying fibers into the worker, so slots
+    // are claimed by fetch_add and published with a sequence number for
+    // readers taking snapshots concurrently.
+    class SchedTraceBuffer {
+    public:
+        SchedTraceBuffer() : _ring(NULL), _pos(0) {}
+
+        ~SchedTraceBuffer();
+
+        void add(int type, fiber_id_t tid) {
+            ring *r = _ring.load(std::memory_order_acquire);
+            if (__builtin_expect(r == NULL, 0)) {
+                r = allocate();
+                if (r == NULL) {
+                    return;
+                }
+            }
+            const uint64_t pos = _pos.fetch_add(1, std::memory_order_relaxed);
+            slot &s = r->slots[pos & r->mask];
+            // Odd sequence marks the slot as being written.
+            s.seq.store(pos * 2 + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            s.event.cycles = now_cycles();
+            s.event.tid = tid;
+            s.event.type = type;
+            s.seq.store(pos * 2 + 2, std::memory_order_release);
+        }
+
+        // Append completed events in the buffer to `out' from oldest to newest.
+        void snapshot(std::vector<sched_event> *out) const;
+
+    private:
+        struct slot {
+            std::atomic<uint64_t> seq;
+            sched_event event;
+        };
+
+        // Slots and their number are published together, so that threads
+        // seeing the slots never see a mask of another allocation.
+        struct ring {
+            size_t mask;
+            slot *slots;
+        };
+
+        static int64_t now_cycles();
+
+        // Allocate slots of -fiber_sched_trace_capacity once.
+        ring *allocate();
+
+        std::atomic<ring *> _ring;
+        std::atomic<uint64_t> _pos;
+    };
+
+    // Write events of workers as Chrome trace-event JSON, which can be loaded
+    // in chrome://tracing or Perfetto. Running fibers and parkings are shown
+    // as durations in the row of each worker, other events are instants.
+    void write_chrome_trace(std::ostream &os,
+                            const std::vector<std::vector<sched_event> > &worker_events);
+
+}  // namespace flare::fiber_internal
+
+#endif  // FLARE_FIBER_INTERNAL_SCHED_TRACE_H_
@@ -19,6 +19,8 @@
 
 // Date: Tue Jul 10 17:40:58 CST 2012
 
+#include <sched.h>                               // sched_yield
+#include <algorithm>                            // std::min
 #include "flare/base/scoped_lock.h"             // FLARE_SCOPED_LOCK
 #include "flare/base/errno.h"                    // flare_error
 #include "flare/log/logging.h"
@@ -29,6 +31,8 @@
 #include "flare/fiber/internal/fiber_worker.h"           // fiber_worker
 #include "flare/fiber/internal/schedule_group.h"
 #include "flare/fiber/internal/timer_thread.h"         // global_timer_thread
+#include "flare/fiber/internal/io_uring.h"             // io_uring_release
+#include "flare/thread/affinity.h"                     // core_affinity
 #include <gflags/gflags.h>
 #include "flare/fiber/internal/log.h"
 
@@ -38,6 +42,25 @@ DEFINE_int32(task_group_runqueue_capacity, 4096,
              "capacity of runqueue in each fiber_worker");
 DEFINE_int32(task_group_yield_before_idle, 0,
              "fiber_worker yields so many times before idle");
+DEFINE_bool(fiber_numa_aware, false,
+            "Bind worker pthreads to NUMA nodes round-robin and steal tasks "
+            "from workers of the same node first");
+DEFINE_int32(fiber_numa_steal_miss_threshold, 4,
+             "Workers steal tasks from other NUMA nodes after failing to steal "
+             "from the same node for so many times in a row");
+DEFINE_bool(fiber_elastic_concurrency, false,
+            "Shrink workers towards -fiber_min_concurrency when they're mostly "
+            "idle and grow them towards -fiber_concurrency when fibers wait "
+            "long to run. Only effective when -fiber_min_concurrency > 0 and "
+            "set before the first fiber is created");
+DEFINE_int32(fiber_elastic_interval_ms, 1000,
+             "Interval of adjusting workers when -fiber_elastic_concurrency is on");
+DEFINE_double(fiber_elastic_shrink_usage, 0.5,
+              "Retire one worker when fiber_worker_usage is less than "
+              "concurrency multiplied by this ratio");
+DEFINE_int32(fiber_elastic_grow_pending_us, 1000,
+             "Add one worker when fibers wait for so many microseconds in "
+             "average before running");
 
 namespace flare::fiber_internal {
 
@@ -60,35 +83,59 @@ namespace flare::fiber_internal {
         run_worker_startfn();
 
         schedule_group *c = static_cast<schedule_group *>(arg);
-        fiber_worker *g = c->create_group();
+        const int numa_node = c->bind_worker_to_numa_node();
+        fiber_worker *g = c->create_group(numa_node);
         fiber_statistics stat;
         if (NULL == g) {
             FLARE_LOG(ERROR) << "Fail to create fiber_worker in pthread=" << pthread_self();
             return NULL;
         }
         BT_VLOG << "Created worker=" << pthread_self()
-                << " fiber=" << g->main_tid();
+                << " fiber=" << g->main_tid() << " numa_node=" << numa_node;
 
         tls_task_group = g;
         c->_nworkers << 1;
         g->run_main_task();
+        g->hand_over_timers();
+        io_uring_release();
 
         stat = g->main_stat();
         BT_VLOG << "Destroying worker=" << pthread_self() << " fiber="
                 << g->main_tid() << " idle=" << stat.cputime_ns / 1000000.0
                 << "ms uptime=" << g->current_uptime_ns() / 1000000.0 << "ms";
         tls_task_group = NULL;
+        const bool retired = g->_retiring.load(std::memory_order_relaxed);
+        if (retired) {
+            c->_drain_retired_group(g);
+        }
         g->destroy_self();
         c->_nworkers << -1;
+        if (retired) {
+            // Nobody joins retired workers, unless stop_and_join() has
+            // taken them over.
+            FLARE_SCOPED_LOCK(c->_modify_group_mutex);
+            if (!c->_stop) {
+                const pthread_t self = pthread_self();
+                for (size_t i = 0; i < c->_workers.size(); ++i) {
+                    if (pthread_equal(c->_workers[i], self)) {
+                        c->_workers[i] = c->_workers.back();
+                        c->_workers.pop_back();
+                        pthread_detach(self);
+                        break;
+                    }
+                }
+            }
+        }
         return NULL;
     }
 
-    fiber_worker *schedule_group::create_group() {
+    fiber_worker *schedule_group::create_group(int numa_node) {
         fiber_worker *g = new(std::nothrow) fiber_worker(this);
         if (NULL == g) {
             FLARE_LOG(FATAL) << "Fail to new fiber_worker";
             return NULL;
         }
+        g->_numa_node = numa_node;
         if (g->init(FLAGS_task_group_runqueue_capacity) != 0) {
             FLARE_LOG(ERROR) << "Fail to init fiber_worker";
             delete g;
@@ -118,10 +165,25 @@ namespace flare::fiber_internal {
         return static_cast<schedule_group *>(arg)->get_cumulated_signal_count();
     }
 
+    static int64_t get_cumulated_spin_success_count_from_this(void *arg) {
+        return static_cast<schedule_group *>(arg)->get_cumulated_spin_success_count();
+    }
+
+    static int64_t get_cumulated_park_count_from_this(void *arg) {
+        return static_cast<schedule_group *>(arg)->get_cumulated_park_count();
+    }
+
     schedule_group::schedule_group()
     // NOTE: all fileds must be initialized before the vars.
             : _ngroup(0), _groups((fiber_worker **) calloc(FIBER_MAX_CONCURRENCY, sizeof(fiber_worker *))),
-              _stop(false), _concurrency(0), _nworkers("fiber_worker_count"), _pending_time(NULL)
+              _stop(false), _concurrency(0), _nretired(0), _adjust_concurrency_task(TimerThread::INVALID_TASK_ID),
+              _watched_run_time(std::numeric_limits<int64_t>::max()),
+              _watch_timers_task(TimerThread::INVALID_TASK_ID),
+              _nretire_unstarted(0),
+              _retired_cputime_ns(0), _retired_nswitch(0), _retired_nsignaled(0),
+              _retired_nspin_success(0), _retired_npark(0), _retired_pending_us(0),
+              _retired_npending(0), _last_pending_us(0), _last_npending(0),
+              _nworkers("fiber_worker_count")
             // Delay exposure of following two vars because they rely on TC which
             // is not initialized yet.
             , _cumulated_worker_time(get_cumulated_worker_time_from_this, this),
@@ -129,10 +191,17 @@ namespace flare::fiber_internal {
               _cumulated_switch_count(get_cumulated_switch_count_from_this, this),
               _switch_per_second(&_cumulated_switch_count),
               _cumulated_signal_count(get_cumulated_signal_count_from_this, this),
-              _signal_per_second(&_cumulated_signal_count), _status(print_rq_sizes_in_the_tc, this),
-              _nfibers("fiber_count") {
+              _signal_per_second(&_cumulated_signal_count),
+              _cumulated_spin_success_count(get_cumulated_spin_success_count_from_this, this),
+              _spin_success_per_second(&_cumulated_spin_success_count),
+              _cumulated_park_count(get_cumulated_park_count_from_this, this),
+              _park_per_second(&_cumulated_park_count), _status(print_rq_sizes_in_the_tc, this),
+              _nfibers("fiber_count"), _nnodes(1), _next_worker_index(0) {
         // calloc shall set memory to zero
         FLARE_CHECK(_groups) << "Fail to create array of groups";
+        for (size_t i = 0; i < FIBER_PRIORITY_NUM; ++i) {
+            _pending_time[i].store(NULL, std::memory_order_relaxed);
+        }
     }
 
     int schedule_group::init(int concurrency) {
@@ -146,6 +215,27 @@ namespace flare::fiber_internal {
         }
         _concurrency = concurrency;
 
+        if (FLAGS_fiber_numa_aware) {
+            _nnodes = std::min(flare::core_affinity::num_numa_nodes(), (int) MAX_NUMA_NODES);
+        }
+        if (_nnodes > 1) {
+            for (int i = 0; i < _nnodes; ++i) {
+                numa_domain &d = _domains[i];
+                d.groups = (fiber_worker **) calloc(FIBER_MAX_CONCURRENCY, sizeof(fiber_worker *));
+                if (d.groups == NULL) {
+                    FLARE_LOG(ERROR) << "Fail to create array of groups for numa_node=" << i;
+                    return -1;
+                }
+                char name[64];
+                snprintf(name, sizeof(name), "fiber_numa_node%d_local_steal", i);
+                d.local_steal.expose(name);
+                snprintf(name, sizeof(name), "fiber_numa_node%d_remote_steal", i);
+                d.remote_steal.expose(name);
+            }
+        } else {
+            _nnodes = 1;
+        }
+
         // Make sure TimerThread is ready.
         if (get_or_create_global_timer_thread() == NULL) {
             FLARE_LOG(ERROR) << "Fail to get global_timer_thread";
@@ -163,6 +253,8 @@ namespace flare::fiber_internal {
         _worker_usage_second.expose("fiber_worker_usage");
         _switch_per_second.expose("fiber_switch_second");
         _signal_per_second.expose("fiber_signal_second");
+        _spin_success_per_second.expose("fiber_spin_success_second");
+        _park_per_second.expose("fiber_park_second");
         _status.expose("fiber_group_status");
 
         // Wait for at least one group is added so that choose_one_group()
@@ -171,6 +263,9 @@ namespace flare::fiber_internal {
         while (_ngroup == 0) {
             usleep(100);  // TODO: Elaborate
         }
+        if (FLAGS_fiber_elastic_concurrency) {
+            schedule_adjust_concurrency();
+        }
         return 0;
     }
 
@@ -178,30 +273,167 @@ namespace flare::fiber_internal {
         if (num <= 0) {
             return 0;
         }
-        try {
-            _workers.resize(_concurrency + num);
-        } catch (...) {
-            return 0;
-        }
         const int old_concurency = _concurrency.load(std::memory_order_relaxed);
         for (int i = 0; i < num; ++i) {
             // Worker will add itself to _idle_workers, so we have to add
             // _concurrency before create a worker.
             _concurrency.fetch_add(1);
-            const int rc = pthread_create(
-                    &_workers[i + old_concurency], NULL, worker_thread, this);
+            // Hold the lock so that the worker, if retired before it starts,
+            // finds itself in _workers.
+            std::unique_lock<flare::base::Mutex> mu(_modify_group_mutex);
+            pthread_t th;
+            const int rc = pthread_create(&th, NULL, worker_thread, this);
             if (rc) {
-                FLARE_LOG(WARNING) << "Fail to create _workers[" << i + old_concurency
+                mu.unlock();
+                FLARE_LOG(WARNING) << "Fail to create _workers[" << _workers.size()
                              << "], " << flare_error(rc);
                 _concurrency.fetch_sub(1, std::memory_order_release);
                 break;
             }
+            _workers.push_back(th);
         }
-        // Cannot fail
-        _workers.resize(_concurrency.load(std::memory_order_relaxed));
         return _concurrency.load(std::memory_order_relaxed) - old_concurency;
     }
 
+    int schedule_group::remove_workers(int num) {
+        if (num <= 0) {
+            return 0;
+        }
+        std::vector<fiber_worker *> retired;
+        int nunstarted = 0;
+        {
+            FLARE_SCOPED_LOCK(_modify_group_mutex);
+            if (_stop) {
+                return 0;
+            }
+            // Workers just added by add_workers() may not have created their
+            // groups, they're retired first since they have nothing to hand
+            // over. _add_group() retires them as soon as they start.
+            const size_t ngroup = _ngroup.load(std::memory_order_relaxed);
+            nunstarted = std::max(0, _concurrency.load(std::memory_order_relaxed) -
+                                     (int) ngroup - _nretire_unstarted);
+            nunstarted = std::min(num, nunstarted);
+            _nretire_unstarted += nunstarted;
+            // The last started worker is never retired.
+            num = std::min(num - nunstarted, (int) ngroup - 1);
+            for (int i = 0; i < num; ++i) {
+                fiber_worker *g = _groups[ngroup - 1 - i];
+                g->_retiring.store(true, std::memory_order_seq_cst);
+                _remove_group(g);
+                _add_retired_stats(g);
+                retired.push_back(g);
+            }
+            _nretired.fetch_add(retired.size(), std::memory_order_release);
+        }
+        _concurrency.fetch_sub(nunstarted + retired.size(), std::memory_order_release);
+        for (size_t i = 0; i < retired.size(); ++i) {
+            // Wake up all workers in the parking lot since we can't wake up
+            // the retired one specifically, others just go back to park.
+            retired[i]->_pl->signal(FIBER_MAX_CONCURRENCY);
+        }
+        return nunstarted + retired.size();
+    }
+
+    void schedule_group::_drain_retired_group(fiber_worker *g) {
+        // Producers may have chosen `g' right before it was removed from
+        // _groups and are pushing tasks into it, which is rare and short.
+        // Pushes starting later see _retiring and go to peers.
+        while (g->_nremote_pushing.load(std::memory_order_seq_cst) != 0) {
+            sched_yield();
+        }
+        g->hand_over_tasks();
+    }
+
+    void schedule_group::_add_retired_stats(fiber_worker *g) {
+        _retired_cputime_ns += g->_cumulated_cputime_ns;
+        _retired_nswitch += g->_nswitch;
+        _retired_nsignaled += g->_nsignaled +
+                              g->_remote_nsignaled.load(std::memory_order_relaxed);
+        _retired_nspin_success += g->_nspin_success;
+        _retired_npark += g->_npark;
+        _retired_pending_us += g->_pending_us;
+        _retired_npending += g->_npending;
+    }
+
+    void schedule_group::get_cumulated_pending(int64_t *pending_us, int64_t *npending) {
+        FLARE_SCOPED_LOCK(_modify_group_mutex);
+        *pending_us = _retired_pending_us;
+        *npending = _retired_npending;
+        const size_t ngroup = _ngroup.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < ngroup; ++i) {
+            if (_groups[i]) {
+                *pending_us += _groups[i]->_pending_us;
+                *npending += _groups[i]->_npending;
+            }
+        }
+    }
+
+    void schedule_group::schedule_adjust_concurrency() {
+        const int interval_ms = std::max(FLAGS_fiber_elastic_interval_ms, 10);
+        _adjust_concurrency_task = get_global_timer_thread()->schedule(
+                adjust_concurrency, this,
+                flare::time_point::future_unix_millis(interval_ms).to_timespec());
+    }
+
+    void schedule_group::adjust_concurrency(void *arg) {
+        schedule_group *c = static_cast<schedule_group *>(arg);
+        if (FLAGS_fiber_min_concurrency > 0 && FLAGS_fiber_elastic_concurrency) {
+            // Usage is the # of workers busy running fibers in last second.
+            const double usage = c->_worker_usage_second.get_value(1);
+            // Average pending time of fibers started since last check.
+            int64_t sum_pending_us = 0;
+            int64_t npending = 0;
+            c->get_cumulated_pending(&sum_pending_us, &npending);
+            const int64_t pending_us = (npending > c->_last_npending ?
+                    (sum_pending_us - c->_last_pending_us) / (npending - c->_last_npending) : 0);
+            c->_last_pending_us = sum_pending_us;
+            c->_last_npending = npending;
+            FLARE_SCOPED_LOCK(g_task_control_mutex);
+            const int concurrency = c->concurrency();
+            if (pending_us > FLAGS_fiber_elastic_grow_pending_us &&
+                concurrency < FLAGS_fiber_concurrency) {
+                if (c->add_workers(1) == 1) {
+                    FLARE_LOG(INFO) << "Added one worker, concurrency=" << concurrency + 1
+                                    << " pending_us=" << pending_us;
+                }
+            } else if (usage < concurrency * FLAGS_fiber_elastic_shrink_usage &&
+                       concurrency > FLAGS_fiber_min_concurrency) {
+                if (c->remove_workers(1) == 1) {
+                    FLARE_LOG(INFO) << "Retired one worker, concurrency=" << concurrency - 1
+                                    << " usage=" << usage;
+                }
+            }
+        }
+        FLARE_SCOPED_LOCK(c->_modify_group_mutex);
+        if (!c->_stop) {
+            c->schedule_adjust_concurrency();
+        }
+    }
+
+    int schedule_group::bind_worker_to_numa_node() {
+        if (_nnodes <= 1) {
+            return -1;
+        }
+        // Node ids may be sparse, skip the ones without cores.
+        int node = 0;
+        flare::core_affinity cores;
+        for (int i = 0; i < _nnodes; ++i) {
+            node = _next_worker_index.fetch_add(1, std::memory_order_relaxed) % _nnodes;
+            cores = flare::core_affinity::numa_node_cores(node);
+            if (cores.count() != 0) {
+                break;
+            }
+        }
+        const int rc = cores.bind_current_thread();
+        if (rc != 0) {
+            // Still steal as a member of the node, the worker is just not
+            // guaranteed to be local to memory of the node.
+            FLARE_LOG(WARNING) << "Fail to bind worker=" << pthread_self()
+                               << " to numa_node=" << node << ", " << flare_error(rc);
+        }
+        return node;
+    }
+
     fiber_worker *schedule_group::choose_one_group() {
         const size_t ngroup = _ngroup.load(std::memory_order_acquire);
         if (ngroup != 0) {
@@ -219,37 +451,54 @@ namespace flare::fiber_internal {
         FLARE_CHECK_EQ(0, stop_and_join_epoll_threads());
 
         // Stop workers
+        TimerThread::TaskId adjust_concurrency_task;
+        std::vector<pthread_t> workers;
         {
             FLARE_SCOPED_LOCK(_modify_group_mutex);
             _stop = true;
+            // Retired workers quitting from now on don't detach themselves.
+            workers.swap(_workers);
             _ngroup.exchange(0, std::memory_order_relaxed);
+            adjust_concurrency_task = _adjust_concurrency_task;
+            _adjust_concurrency_task = TimerThread::INVALID_TASK_ID;
+        }
+        if (adjust_concurrency_task != TimerThread::INVALID_TASK_ID) {
+            get_global_timer_thread()->unschedule(adjust_concurrency_task);
         }
         for (int i = 0; i < PARKING_LOT_NUM; ++i) {
             _pl[i].stop();
         }
         // Interrupt blocking operations.
-        for (size_t i = 0; i < _workers.size(); ++i) {
-            interrupt_pthread(_workers[i]);
+        for (size_t i = 0; i < workers.size(); ++i) {
+            interrupt_pthread(workers[i]);
         }
         // Join workers
-        for (size_t i = 0; i < _workers.size(); ++i) {
-            pthread_join(_workers[i], NULL);
+        for (size_t i = 0; i < workers.size(); ++i) {
+            pthread_join(workers[i], NULL);
         }
     }
 
     schedule_group::~schedule_group() {
         // NOTE: g_task_control is not destructed now because the situation
         //       is extremely racy.
-        delete _pending_time.exchange(NULL, std::memory_order_relaxed);
+        for (size_t i = 0; i < FIBER_PRIORITY_NUM; ++i) {
+            delete _pending_time[i].exchange(NULL, std::memory_order_relaxed);
+        }
         _worker_usage_second.hide();
         _switch_per_second.hide();
         _signal_per_second.hide();
+        _spin_success_per_second.hide();
+        _park_per_second.hide();
         _status.hide();
 
         stop_and_join();
 
         free(_groups);
         _groups = NULL;
+        for (int i = 0; i < MAX_NUMA_NODES; ++i) {
+            free(_domains[i].groups);
+            _domains[i].groups = NULL;
+        }
     }
 
     int schedule_group::_add_group(fiber_worker *g) {
@@ -260,11 +509,27 @@ namespace flare::fiber_internal {
         if (_stop) {
             return -1;
         }
+        if (_nretire_unstarted > 0) {
+            // Retired by remove_workers() before started, the worker quits
+            // once it finds nothing to run.
+            --_nretire_unstarted;
+            g->_retiring.store(true, std::memory_order_seq_cst);
+            _nretired.fetch_add(1, std::memory_order_release);
+            return 0;
+        }
         size_t ngroup = _ngroup.load(std::memory_order_relaxed);
         if (ngroup < (size_t) FIBER_MAX_CONCURRENCY) {
             _groups[ngroup] = g;
             _ngroup.store(ngroup + 1, std::memory_order_release);
         }
+        if (g->_numa_node >= 0) {
+            numa_domain &d = _domains[g->_numa_node];
+            const size_t nlocal = d.ngroup.load(std::memory_order_relaxed);
+            if (nlocal < (size_t) FIBER_MAX_CONCURRENCY) {
+                d.groups[nlocal] = g;
+                d.ngroup.store(nlocal + 1, std::memory_order_release);
+            }
+        }
         mu.unlock();
         // See the comments in _destroy_group
         // TODO: Not needed anymore since non-worker pthread cannot have fiber_worker
@@ -289,25 +554,12 @@ namespace flare::fiber_internal {
         bool erased = false;
         {
             FLARE_SCOPED_LOCK(_modify_group_mutex);
-            const size_t ngroup = _ngroup.load(std::memory_order_relaxed);
-            for (size_t i = 0; i < ngroup; ++i) {
-                if (_groups[i] == g) {
-                    // No need for atomic_thread_fence because lock did it.
-                    _groups[i] = _groups[ngroup - 1];
-                    // Change _ngroup and keep _groups unchanged at last so that:
-                    //  - If steal_task sees the newest _ngroup, it would not touch
-                    //    _groups[ngroup -1]
-                    //  - If steal_task sees old _ngroup and is still iterating on
-                    //    _groups, it would not miss _groups[ngroup - 1] which was
-                    //    swapped to _groups[i]. Although adding new group would
-                    //    overwrite it, since we do signal_task in _add_group(),
-                    //    we think the pending tasks of _groups[ngroup - 1] would
-                    //    not miss.
-                    _ngroup.store(ngroup - 1, std::memory_order_release);
-                    //_groups[ngroup - 1] = NULL;
-                    erased = true;
-                    break;
-                }
+            // Retired groups were removed and accounted in remove_workers().
+            if (_remove_group(g)) {
+                _add_retired_stats(g);
+                erased = true;
+            } else {
+                erased = g->_retiring.load(std::memory_order_relaxed);
             }
         }
 
@@ -324,33 +576,114 @@ namespace flare::fiber_internal {
         return 0;
     }
 
-    bool schedule_group::steal_task(fiber_id_t *tid, size_t *seed, size_t offset) {
-        // 1: Acquiring fence is paired with releasing fence in _add_group to
-        // avoid accessing uninitialized slot of _groups.
-        const size_t ngroup = _ngroup.load(std::memory_order_acquire/*1*/);
-        if (0 == ngroup) {
-            return false;
+    bool schedule_group::_remove_group(fiber_worker *g) {
+        const size_t ngroup = _ngroup.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < ngroup; ++i) {
+            if (_groups[i] == g) {
+                // No need for atomic_thread_fence because lock did it.
+                _groups[i] = _groups[ngroup - 1];
+                // Change _ngroup and keep _groups unchanged at last so that:
+                //  - If steal_task sees the newest _ngroup, it would not touch
+                //    _groups[ngroup -1]
+                //  - If steal_task sees old _ngroup and is still iterating on
+                //    _groups, it would not miss _groups[ngroup - 1] which was
+                //    swapped to _groups[i]. Although adding new group would
+                //    overwrite it, since we do signal_task in _add_group(),
+                //    we think the pending tasks of _groups[ngroup - 1] would
+                //    not miss.
+                _ngroup.store(ngroup - 1, std::memory_order_release);
+                //_groups[ngroup - 1] = NULL;
+                if (g->_numa_node >= 0) {
+                    // Same swap-with-last strategy as above.
+                    numa_domain &d = _domains[g->_numa_node];
+                    const size_t nlocal = d.ngroup.load(std::memory_order_relaxed);
+                    for (size_t j = 0; j < nlocal; ++j) {
+                        if (d.groups[j] == g) {
+                            d.groups[j] = d.groups[nlocal - 1];
+                            d.ngroup.store(nlocal - 1, std::memory_order_release);
+                            break;
+                        }
+                    }
+                }
+                return true;
+            }
         }
+        return false;
+    }
 
+    bool schedule_group::steal_from(fiber_worker **groups, size_t ngroup,
+                                    fiber_id_t *tid, size_t *seed, size_t offset,
+                                    fiber_worker **victim) {
         // NOTE: Don't return inside `for' iteration since we need to update |seed|
-        bool stolen = false;
+        fiber_worker *stolen = NULL;
         size_t s = *seed;
+        // Called by workers only, which age priorities and take remote tasks
+        // by priority as they do for their own runqueues.
+        fiber_worker *const self = tls_task_group;
+        const bool lower_first = (self != nullptr && self->lower_priority_first());
         for (size_t i = 0; i < ngroup; ++i, s += offset) {
-            fiber_worker *g = _groups[s % ngroup];
+            fiber_worker *g = groups[s % ngroup];
             // g is possibly NULL because of concurrent _destroy_group
             if (g) {
-                if (g->_rq.steal(tid)) {
-                    stolen = true;
+                if (lower_first ? (g->_low_rq.steal(tid) || g->_rq.steal(tid) ||
+                                   g->_high_rq.steal(tid))
+                                : (g->_high_rq.steal(tid) || g->_rq.steal(tid) ||
+                                   g->_low_rq.steal(tid))) {
+                    stolen = g;
                     break;
                 }
-                if (g->_remote_rq.pop(tid)) {
-                    stolen = true;
+                if (self != nullptr ? self->pop_remote_rq(g->_remote_rq, tid)
+                                    : g->_remote_rq.pop(tid)) {
+                    stolen = g;
                     break;
                 }
             }
         }
         *seed = s;
-        return stolen;
+        if (stolen && self != nullptr) {
+            self->count_taken_task(lower_first);
+        }
+        if (stolen && victim != nullptr) {
+            *victim = stolen;
+        }
+        return stolen != NULL;
+    }
+
+    bool schedule_group::steal_task(fiber_id_t *tid, size_t *seed, size_t offset,
+                                    fiber_worker **victim) {
+        // 1: Acquiring fence is paired with releasing fence in _add_group to
+        // avoid accessing uninitialized slot of _groups.
+        const size_t ngroup = _ngroup.load(std::memory_order_acquire/*1*/);
+        if (0 == ngroup) {
+            return false;
+        }
+        return steal_from(_groups, ngroup, tid, seed, offset, victim);
+    }
+
+    bool schedule_group::steal_task(fiber_id_t *tid, size_t *seed, size_t offset,
+                                    int numa_node, int *nmiss) {
+        numa_domain &d = _domains[numa_node];
+        const size_t nlocal = d.ngroup.load(std::memory_order_acquire);
+        if (nlocal != 0 && steal_from(d.groups, nlocal, tid, seed, offset)) {
+            *nmiss = 0;
+            d.local_steal << 1;
+            return true;
+        }
+        if (++*nmiss < FLAGS_fiber_numa_steal_miss_threshold) {
+            return false;
+        }
+        *nmiss = 0;
+        fiber_worker *victim = NULL;
+        if (steal_task(tid, seed, offset, &victim)) {
+            // Groups of this node are visited as well.
+            if (victim->_numa_node != numa_node) {
+                d.remote_steal << 1;
+            } else {
+                d.local_steal << 1;
+            }
+            return true;
+        }
+        return false;
     }
 
     void schedule_group::signal_task(int num_task) {
@@ -385,6 +718,70 @@ namespace flare::fiber_internal {
         }
     }
 
+    int schedule_group::run_overdue_timers(int64_t *nearest) {
+        const size_t ngroup = _ngroup.load(std::memory_order_acquire);
+        const int64_t now_us = flare::get_current_time_micros();
+        const int64_t overdue_us = now_us - FLAGS_fiber_worker_timer_rescue_us;
+        int nrun = 0;
+        if (nearest != NULL) {
+            *nearest = std::numeric_limits<int64_t>::max();
+        }
+        for (size_t i = 0; i < ngroup; ++i) {
+            fiber_worker *g = _groups[i];
+            if (g == NULL) {
+                continue;
+            }
+            // Don't wait for the owner or other rescuers.
+            if (g->_timers.nearest_run_time() <= overdue_us) {
+                nrun += g->_timers.run_timers(now_us, true);
+            }
+            if (nearest != NULL) {
+                *nearest = std::min(*nearest, g->_timers.nearest_run_time());
+            }
+        }
+        return nrun;
+    }
+
+    void schedule_group::start_watching_timers(int64_t run_time_us) {
+        TimerThread::TaskId old_task = TimerThread::INVALID_TASK_ID;
+        {
+            FLARE_SCOPED_LOCK(_watch_timers_mutex);
+            if (run_time_us >= _watched_run_time.load(std::memory_order_relaxed)) {
+                return;
+            }
+            const int64_t rescue_us = std::max(FLAGS_fiber_worker_timer_rescue_us, 100);
+            const TimerThread::TaskId task = get_global_timer_thread()->schedule(
+                    check_worker_timers, this,
+                    flare::time_point::from_unix_micros(run_time_us + rescue_us).to_timespec());
+            if (task == TimerThread::INVALID_TASK_ID) {
+                return;
+            }
+            old_task = _watch_timers_task;
+            _watch_timers_task = task;
+            _watched_run_time.store(run_time_us, std::memory_order_relaxed);
+        }
+        if (old_task != TimerThread::INVALID_TASK_ID) {
+            get_global_timer_thread()->unschedule(old_task);
+        }
+    }
+
+    void schedule_group::check_worker_timers(void *arg) {
+        schedule_group *c = static_cast<schedule_group *>(arg);
+        {
+            // Cleared before checking, so that timers added during the check
+            // re-arm the watching. Nothing is pending after stop_and_join().
+            FLARE_SCOPED_LOCK(c->_watch_timers_mutex);
+            c->_watched_run_time.store(std::numeric_limits<int64_t>::max(),
+                                       std::memory_order_seq_cst);
+            c->_watch_timers_task = TimerThread::INVALID_TASK_ID;
+        }
+        int64_t nearest = std::numeric_limits<int64_t>::max();
+        c->run_overdue_timers(&nearest);
+        if (nearest != std::numeric_limits<int64_t>::max()) {
+            c->start_watching_timers(nearest);
+        }
+    }
+
     void schedule_group::print_rq_sizes(std::ostream &os) {
         const size_t ngroup = _ngroup.load(std::memory_order_relaxed);
         DEFINE_SMALL_ARRAY(int, nums, ngroup, 128);
@@ -393,7 +790,9 @@ namespace flare::fiber_internal {
             // ngroup > _ngroup: nums[_ngroup ... ngroup-1] = 0
             // ngroup < _ngroup: just ignore _groups[_ngroup ... ngroup-1]
             for (size_t i = 0; i < ngroup; ++i) {
-                nums[i] = (_groups[i] ? _groups[i]->_rq.volatile_size() : 0);
+                fiber_worker *g = _groups[i];
+                nums[i] = (g ? g->_rq.volatile_size() + g->_high_rq.volatile_size() +
+                               g->_low_rq.volatile_size() : 0);
             }
         }
         for (size_t i = 0; i < ngroup; ++i) {
@@ -401,9 +800,24 @@ namespace flare::fiber_internal {
         }
     }
 
+    void schedule_group::dump_sched_trace(std::ostream &os) {
+        std::vector<std::vector<sched_event> > worker_events;
+        {
+            FLARE_SCOPED_LOCK(_modify_group_mutex);
+            const size_t ngroup = _ngroup.load(std::memory_order_relaxed);
+            worker_events.resize(ngroup);
+            for (size_t i = 0; i < ngroup; ++i) {
+                if (_groups[i]) {
+                    _groups[i]->_trace.snapshot(&worker_events[i]);
+                }
+            }
+        }
+        write_chrome_trace(os, worker_events);
+    }
+
     double schedule_group::get_cumulated_worker_time() {
-        int64_t cputime_ns = 0;
         FLARE_SCOPED_LOCK(_modify_group_mutex);
+        int64_t cputime_ns = _retired_cputime_ns;
         const size_t ngroup = _ngroup.load(std::memory_order_relaxed);
         for (size_t i = 0; i < ngroup; ++i) {
             if (_groups[i]) {
@@ -414,8 +828,8 @@ namespace flare::fiber_internal {
     }
 
     int64_t schedule_group::get_cumulated_switch_count() {
-        int64_t c = 0;
         FLARE_SCOPED_LOCK(_modify_group_mutex);
+        int64_t c = _retired_nswitch;
         const size_t ngroup = _ngroup.load(std::memory_order_relaxed);
         for (size_t i = 0; i < ngroup; ++i) {
             if (_groups[i]) {
@@ -426,30 +840,65 @@ namespace flare::fiber_internal {
     }
 
     int64_t schedule_group::get_cumulated_signal_count() {
-        int64_t c = 0;
         FLARE_SCOPED_LOCK(_modify_group_mutex);
+        int64_t c = _retired_nsignaled;
         const size_t ngroup = _ngroup.load(std::memory_order_relaxed);
         for (size_t i = 0; i < ngroup; ++i) {
             fiber_worker *g = _groups[i];
             if (g) {
-                c += g->_nsignaled + g->_remote_nsignaled;
+                c += g->_nsignaled + g->_remote_nsignaled.load(std::memory_order_relaxed);
+            }
+        }
+        return c;
+    }
+
+    int64_t schedule_group::get_cumulated_spin_success_count() {
+        FLARE_SCOPED_LOCK(_modify_group_mutex);
+        int64_t c = _retired_nspin_success;
+        const size_t ngroup = _ngroup.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < ngroup; ++i) {
+            if (_groups[i]) {
+                c += _groups[i]->_nspin_success;
             }
         }
         return c;
     }
 
-    flare::variable::LatencyRecorder *schedule_group::create_exposed_pending_time() {
+    int64_t schedule_group::get_cumulated_park_count() {
+        FLARE_SCOPED_LOCK(_modify_group_mutex);
+        int64_t c = _retired_npark;
+        const size_t ngroup = _ngroup.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < ngroup; ++i) {
+            if (_groups[i]) {
+                c += _groups[i]->_npark;
+            }
+        }
+        return c;
+    }
+
+    flare::variable::LatencyRecorder *schedule_group::create_exposed_pending_time(
+            fiber_priority_t priority) {
         bool is_creator = false;
         _pending_time_mutex.lock();
-        flare::variable::LatencyRecorder *pt = _pending_time.load(std::memory_order_consume);
+        flare::variable::LatencyRecorder *pt = _pending_time[priority].load(std::memory_order_consume);
         if (!pt) {
             pt = new flare::variable::LatencyRecorder;
-            _pending_time.store(pt, std::memory_order_release);
+            _pending_time[priority].store(pt, std::memory_order_release);
             is_creator = true;
         }
         _pending_time_mutex.unlock();
         if (is_creator) {
-            pt->expose("fiber_creation");
+            switch (priority) {
+                case FIBER_PRIORITY_HIGH:
+                    pt->expose("fiber_creation_high");
+                    break;
+                case FIBER_PRIORITY_LOW:
+                    pt->expose("fiber_creation_low");
+                    break;
+                default:
+                    pt->expose("fiber_creation");
+                    break;
+            }
         }
         return pt;
     }
@@ -16,6 +16,7 @@
 #include "flare/memory/resource_pool.h"                 // ResourcePool
 #include "flare/fiber/internal/work_stealing_queue.h"        // WorkStealingQueue
 #include "flare/fiber/internal/parking_lot.h"
+#include "flare/fiber/internal/timer_thread.h"       // TimerThread
 
 namespace flare::fiber_internal {
 
@@ -33,15 +34,45 @@ namespace flare::fiber_internal {
         // Must be called before using. `nconcurrency' is # of worker pthreads.
         int init(int nconcurrency);
 
-        // Create a fiber_worker in this control.
-        fiber_worker *create_group();
+        // Create a fiber_worker in this control. `numa_node' is the NUMA node
+        // the calling worker pthread is bound to, -1 for unbound workers.
+        fiber_worker *create_group(int numa_node = -1);
 
-        // Steal a task from a "random" group.
-        bool steal_task(fiber_id_t *tid, size_t *seed, size_t offset);
+        // Steal a task from a "random" group, the group stolen from is stored
+        // in *victim if `victim' is not NULL.
+        bool steal_task(fiber_id_t *tid, size_t *seed, size_t offset,
+                        fiber_worker **victim = NULL);
+
+        // Steal a task from a "random" group in NUMA node `numa_node' first.
+        // Groups in other nodes are tried only after *nmiss reaches
+        // -fiber_numa_steal_miss_threshold consecutive failures, *nmiss is
+        // reset to 0 once they're tried. Steals are counted in
+        // fiber_numa_node<N>_local_steal or _remote_steal by the node of the
+        // victim.
+        bool steal_task(fiber_id_t *tid, size_t *seed, size_t offset,
+                        int numa_node, int *nmiss);
 
         // Tell other groups that `n' tasks was just added to caller's runqueue
         void signal_task(int num_task);
 
+        // Run timers of workers overdue for -fiber_worker_timer_rescue_us,
+        // which are probably busy running a fiber or blocked in a syscall.
+        // Called by idle workers before parking. *nearest is set to the
+        // realtime in microseconds of the earliest remaining timer, max of
+        // int64_t if there's none.
+        // Returns number of timers run.
+        int run_overdue_timers(int64_t *nearest = NULL);
+
+        // Check overdue timers of workers in TimerThread when the earliest of
+        // them is overdue, which covers the case that all other workers are
+        // parked. Called by workers after adding a timer running at
+        // `run_time_us', the check is re-armed only if the timer is nearer.
+        void watch_worker_timers(int64_t run_time_us) {
+            if (run_time_us < _watched_run_time.load(std::memory_order_relaxed)) {
+                start_watching_timers(run_time_us);
+            }
+        }
+
         // Stop and join worker threads in schedule_group.
         void stop_and_join();
 
@@ -50,16 +81,39 @@ namespace flare::fiber_internal {
 
         void print_rq_sizes(std::ostream &os);
 
+        // Write scheduling events recorded in all workers as Chrome
+        // trace-event JSON. See -fiber_enable_sched_trace.
+        void dump_sched_trace(std::ostream &os);
+
         double get_cumulated_worker_time();
 
         int64_t get_cumulated_switch_count();
 
         int64_t get_cumulated_signal_count();
 
+        int64_t get_cumulated_spin_success_count();
+
+        int64_t get_cumulated_park_count();
+
         // [Not thread safe] Add more worker threads.
         // Return the number of workers actually added, which may be less than |num|
         int add_workers(int num);
 
+        // [Not thread safe] Retire worker threads. Retired workers are removed
+        // from the groups immediately, they hand over queued fibers to other
+        // workers and quit after the running fibers yield. Workers added but
+        // not started yet quit as soon as they start. Never blocks.
+        // Return the number of workers actually retired, which may be less
+        // than |num| since at least one worker is kept.
+        int remove_workers(int num);
+
+        // # of workers ever retired. A fiber_worker remembered by the caller is
+        // possibly retired if this value changed since it was chosen.
+        int64_t retired_count() const { return _nretired.load(std::memory_order_acquire); }
+
+        // # of NUMA nodes that workers are bound to, 1 if not NUMA-aware.
+        int numa_nodes() const { return _nnodes; }
+
         // Choose one fiber_worker (randomly right now).
         // If this method is called after init(), it never returns NULL.
         fiber_worker *choose_one_group();
@@ -72,13 +126,54 @@ namespace flare::fiber_internal {
 
         int _destroy_group(fiber_worker *);
 
+        // Remove `g' from _groups and its NUMA domain with _modify_group_mutex
+        // held. Returns true if `g' was found.
+        bool _remove_group(fiber_worker *g);
+
         static void delete_task_group(void *arg);
 
         static void *worker_thread(void *task_control);
 
-        flare::variable::LatencyRecorder &exposed_pending_time();
+        // Hand over tasks of a retired worker `g' until producers who chose
+        // `g' before its removal are done.
+        void _drain_retired_group(fiber_worker *g);
+
+        // Accumulate statistics of `g' removed from _groups, so that sums
+        // over workers don't drop. _modify_group_mutex must be held.
+        void _add_retired_stats(fiber_worker *g);
 
-        flare::variable::LatencyRecorder *create_exposed_pending_time();
+        // Sum pending time and # of fibers started by all workers ever
+        // existed, see fiber_worker::_pending_us.
+        void get_cumulated_pending(int64_t *pending_us, int64_t *npending);
+
+        // Grow or shrink workers between -fiber_min_concurrency and
+        // -fiber_concurrency according to worker usage and pending time of
+        // fibers. Run in TimerThread every -fiber_elastic_interval_ms.
+        static void adjust_concurrency(void *task_control);
+
+        void schedule_adjust_concurrency();
+
+        // Run in TimerThread -fiber_worker_timer_rescue_us after the
+        // earliest timer of workers, see watch_worker_timers().
+        static void check_worker_timers(void *task_control);
+
+        void start_watching_timers(int64_t run_time_us);
+
+        // Pick the NUMA node for a new worker and bind the calling pthread to it.
+        // Returns -1 if workers are not NUMA-aware.
+        int bind_worker_to_numa_node();
+
+        // Steal a task from one of `groups', the group stolen from is stored
+        // in *victim if `victim' is not NULL.
+        static bool steal_from(fiber_worker **groups, size_t ngroup,
+                               fiber_id_t *tid, size_t *seed, size_t offset,
+                               fiber_worker **victim = NULL);
+
+        // Time from creation to first run of fibers with `priority'.
+        flare::variable::LatencyRecorder &exposed_pending_time(
+                fiber_priority_t priority = FIBER_PRIORITY_NORMAL);
+
+        flare::variable::LatencyRecorder *create_exposed_pending_time(fiber_priority_t priority);
 
         std::atomic<size_t> _ngroup;
         fiber_worker **_groups;
@@ -86,28 +181,76 @@ namespace flare::fiber_internal {
 
         bool _stop;
         std::atomic<int> _concurrency;
+        std::atomic<int64_t> _nretired;
+        // Workers not retired yet, retired ones detach themselves when they
+        // quit. Protected by _modify_group_mutex.
         std::vector<pthread_t> _workers;
+        // # of workers retired by remove_workers() before they started.
+        // Protected by _modify_group_mutex.
+        int _nretire_unstarted;
+        TimerThread::TaskId _adjust_concurrency_task;
+        // Run time of the earliest worker timer which the scheduled
+        // check_worker_timers() covers, max of int64_t if not scheduled.
+        std::atomic<int64_t> _watched_run_time;
+        flare::base::Mutex _watch_timers_mutex;
+        TimerThread::TaskId _watch_timers_task;
+
+        // Stats of destroyed workers, so that cumulated values never go back.
+        int64_t _retired_cputime_ns;
+        int64_t _retired_nswitch;
+        int64_t _retired_nsignaled;
+        int64_t _retired_nspin_success;
+        int64_t _retired_npark;
+        int64_t _retired_pending_us;
+        int64_t _retired_npending;
+        // Values of get_cumulated_pending() in last adjust_concurrency().
+        int64_t _last_pending_us;
+        int64_t _last_npending;
 
         flare::variable::Adder<int64_t> _nworkers;
         flare::base::Mutex _pending_time_mutex;
-        std::atomic<flare::variable::LatencyRecorder *> _pending_time;
+        std::atomic<flare::variable::LatencyRecorder *> _pending_time[FIBER_PRIORITY_NUM];
         flare::variable::PassiveStatus<double> _cumulated_worker_time;
         flare::variable::PerSecond<flare::variable::PassiveStatus<double> > _worker_usage_second;
         flare::variable::PassiveStatus<int64_t> _cumulated_switch_count;
         flare::variable::PerSecond<flare::variable::PassiveStatus<int64_t> > _switch_per_second;
         flare::variable::PassiveStatus<int64_t> _cumulated_signal_count;
         flare::variable::PerSecond<flare::variable::PassiveStatus<int64_t> > _signal_per_second;
+        flare::variable::PassiveStatus<int64_t> _cumulated_spin_success_count;
+        flare::variable::PerSecond<flare::variable::PassiveStatus<int64_t> > _spin_success_per_second;
+        flare::variable::PassiveStatus<int64_t> _cumulated_park_count;
+        flare::variable::PerSecond<flare::variable::PassiveStatus<int64_t> > _park_per_second;
         flare::variable::PassiveStatus<std::string> _status;
         flare::variable::Adder<int64_t> _nfibers;
 
         static const int PARKING_LOT_NUM = 4;
         ParkingLot _pl[PARKING_LOT_NUM];
+
+        // Workers bound to the same NUMA node, stealing inside a domain does not
+        // touch remote memory.
+        struct numa_domain {
+            std::atomic<size_t> ngroup;
+            fiber_worker **groups;
+            flare::variable::Adder<int64_t> local_steal;
+            flare::variable::Adder<int64_t> remote_steal;
+
+            numa_domain() : ngroup(0), groups(NULL) {}
+        };
+
+        static const int MAX_NUMA_NODES = 16;
+        int _nnodes;
+        std::atomic<int> _next_worker_index;
+        numa_domain _domains[MAX_NUMA_NODES];
     };
 
-    inline flare::variable::LatencyRecorder &schedule_group::exposed_pending_time() {
-        flare::variable::LatencyRecorder *pt = _pending_time.load(std::memory_order_consume);
+    inline flare::variable::LatencyRecorder &schedule_group::exposed_pending_time(
+            fiber_priority_t priority) {
+        if (priority >= FIBER_PRIORITY_NUM) {
+            priority = FIBER_PRIORITY_NORMAL;
+        }
+        flare::variable::LatencyRecorder *pt = _pending_time[priority].load(std::memory_order_consume);
         if (!pt) {
-            pt = create_exposed_pending_time();
+            pt = create_exposed_pending_time(priority);
         }
         return *pt;
     }
@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/fiber/internal/sharded_execution_queue.h"
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include "flare/base/hardware.h"
+
+namespace flare::fiber_internal {
+
+    void ShardedExecutionQueueBase::init_buckets(size_t nshard) {
+        _nshard = nshard ? nshard : std::max(flare::num_cpus(), 1);
+        _nbucket = _nshard * BUCKETS_PER_SHARD;
+        _buckets.reset(new Bucket[_nbucket]);
+        for (size_t i = 0; i < _nbucket; ++i) {
+            _buckets[i].shard.store(i % _nshard, std::memory_order_relaxed);
+            _buckets[i].hits.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    int ShardedExecutionQueueBase::move_bucket(size_t bucket, size_t shard) {
+        if (bucket >= _nbucket || shard >= _nshard) {
+            return EINVAL;
+        }
+        Bucket &b = _buckets[bucket];
+        std::unique_lock<flare::fiber_shared_mutex> lk(b.mutex);
+        const size_t from = b.shard.load(std::memory_order_relaxed);
+        if (from == shard) {
+            return 0;
+        }
+        // No more tasks of the bucket can be pushed now, wait for the ones in
+        // the old shard to be executed.
+        flare::fiber_latch barrier(1);
+        const int rc = push_barrier(from, &barrier);
+        if (rc != 0) {
+            return rc;
+        }
+        barrier.wait();
+        b.shard.store(shard, std::memory_order_relaxed);
+        return 0;
+    }
+
+    int ShardedExecutionQueueBase::rebalance() {
+        if (_nshard < 2) {
+            return 0;
+        }
+        std::unique_lock<flare::fiber_mutex> lk(_rebalance_mutex);
+        std::vector<int64_t> hits(_nbucket);
+        std::vector<int64_t> load(_nshard, 0);
+        for (size_t i = 0; i < _nbucket; ++i) {
+            hits[i] = _buckets[i].hits.exchange(0, std::memory_order_relaxed);
+            load[_buckets[i].shard.load(std::memory_order_relaxed)] += hits[i];
+        }
+        const size_t hot = std::max_element(load.begin(), load.end()) - load.begin();
+        const size_t cold = std::min_element(load.begin(), load.end()) - load.begin();
+        const int64_t diff = load[hot] - load[cold];
+        if (diff <= load[hot] / 4) {
+            return 0;
+        }
+        // Moving a bucket with |h| hits makes the loads of the two shards
+        // closer as long as 0 < h < diff, the best is diff / 2.
+        size_t best = _nbucket;
+        int64_t best_distance = diff;
+        for (size_t i = 0; i < _nbucket; ++i) {
+            if (hits[i] <= 0 || hits[i] >= diff ||
+                _buckets[i].shard.load(std::memory_order_relaxed) != hot) {
+                continue;
+            }
+            const int64_t distance = std::abs(hits[i] - diff / 2);
+            if (distance < best_distance) {
+                best = i;
+                best_distance = distance;
+            }
+        }
+        if (best == _nbucket) {
+            return 0;
+        }
+        return move_bucket(best, cold) == 0 ? 1 : 0;
+    }
+
+}  // namespace flare::fiber_internal
@@ -0,0 +1,356 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_FIBER_INTERNAL_SHARDED_EXECUTION_QUEUE_H_
+#define FLARE_FIBER_INTERNAL_SHARDED_EXECUTION_QUEUE_H_
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <vector>
+#include "flare/fiber/internal/execution_queue.h"
+#include "flare/fiber/fiber_latch.h"
+#include "flare/fiber/fiber_mutex.h"
+#include "flare/fiber/fiber_shared_mutex.h"
+#include "flare/hash/murmurhash3.h"            // fmix64
+
+namespace flare::fiber_internal {
+
+    // A group of ExecutionQueues, each task goes to the queue its key maps to.
+    // Tasks with the same key are executed in the order they were pushed while
+    // tasks with different keys may run concurrently on different queues
+    // (shards), so the total throughput is not limited by a single consumer.
+    //
+    // Keys are hashed into a fixed number of buckets, each bucket is assigned
+    // to a shard. Buckets can be moved to other shards at run time (see
+    // move_bucket() and rebalance()) without breaking the per-key order.
+    //
+    // Example:
+    //   int demo_execute(void* meta, ShardedTaskIterator<T>& iter) {
+    //       if (iter.is_queue_stopped()) {
+    //           // Called once after all shards are stopped.
+    //           return 0;
+    //       }
+    //       for (; iter; ++iter) {
+    //           // do_something(*iter)
+    //       }
+    //       return 0;
+    //   }
+    //
+    //   ShardedExecutionQueue<T> queue;
+    //   queue.start(8, NULL, demo_execute, NULL);
+    //   queue.execute(key, task);
+    //   ...
+    //   queue.stop();
+    //   queue.join();
+
+    template<typename T>
+    class ShardedExecutionQueue;
+
+    // What a shard actually stores: either a task of the user or a barrier
+    // used to drain the tasks of a bucket being moved.
+    template<typename T>
+    class ShardedTask {
+    public:
+        explicit ShardedTask(typename flare::base::add_const_reference<T>::type task)
+                : _barrier(NULL) { new(&_storage) T(task); }
+
+        explicit ShardedTask(flare::fiber_latch *barrier) : _barrier(barrier) {}
+
+        ShardedTask(const ShardedTask &rhs) : _barrier(rhs._barrier) {
+            if (!_barrier) {
+                new(&_storage) T(rhs.task());
+            }
+        }
+
+        ~ShardedTask() {
+            if (!_barrier) {
+                task().~T();
+            }
+        }
+
+        T &task() { return *reinterpret_cast<T *>(&_storage); }
+
+        const T &task() const { return *reinterpret_cast<const T *>(&_storage); }
+
+        flare::fiber_latch *barrier() const { return _barrier; }
+
+    private:
+        void operator=(const ShardedTask &);
+
+        flare::fiber_latch *_barrier;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type _storage;
+    };
+
+    // Iterate over the tasks of a shard, barriers are skipped and signaled
+    // after |execute| returns, when the tasks before them are done.
+    template<typename T>
+    class ShardedTaskIterator {
+        FLARE_DISALLOW_COPY_AND_ASSIGN(ShardedTaskIterator);
+
+        friend class ShardedExecutionQueue<T>;
+
+    public:
+        typedef T *pointer;
+        typedef T &reference;
+
+        // Returns true when all the shards are stopped.
+        bool is_queue_stopped() const { return _it.is_queue_stopped(); }
+
+        operator bool() const { return _it; }
+
+        reference operator*() const { return _it->task(); }
+
+        pointer operator->() const { return &(operator*()); }
+
+        ShardedTaskIterator &operator++() {
+            ++_it;
+            skip_barriers();
+            return *this;
+        }
+
+        void operator++(int) { operator++(); }
+
+    private:
+        explicit ShardedTaskIterator(TaskIterator<ShardedTask<T> > &it) : _it(it) {
+            skip_barriers();
+        }
+
+        void skip_barriers() {
+            while (_it && _it->barrier() != NULL) {
+                _barriers.push_back(_it->barrier());
+                ++_it;
+            }
+        }
+
+        void signal_barriers() {
+            for (size_t i = 0; i < _barriers.size(); ++i) {
+                _barriers[i]->signal();
+            }
+            _barriers.clear();
+        }
+
+        TaskIterator<ShardedTask<T> > &_it;
+        std::vector<flare::fiber_latch *> _barriers;
+    };
+
+    class ShardedExecutionQueueBase {
+        FLARE_DISALLOW_COPY_AND_ASSIGN(ShardedExecutionQueueBase);
+
+    public:
+        // Number of buckets per shard.
+        static const size_t BUCKETS_PER_SHARD = 16;
+
+        size_t shard_count() const { return _nshard; }
+
+        size_t bucket_count() const { return _nbucket; }
+
+        size_t bucket_of(uint64_t key) const {
+            return flare::hash::fmix64(key) % _nbucket;
+        }
+
+        // The shard which tasks of |key| currently go to.
+        size_t shard_of(uint64_t key) const {
+            return _buckets[bucket_of(key)].shard.load(std::memory_order_relaxed);
+        }
+
+        // Move |bucket| to |shard|. Tasks of the bucket which are already in the
+        // old shard are executed before the new ones, pushing to the bucket
+        // blocks meanwhile.
+        // NOTE: Don't call this in |execute|, which deadlocks if the bucket is
+        // in the very shard.
+        // Returns 0 on success, errno otherwise.
+        int move_bucket(size_t bucket, size_t shard);
+
+        // Move a bucket from the busiest shard to the idlest one if the number
+        // of tasks pushed to them since the last call differs by more than 25%.
+        // Call this periodically to spread hot keys.
+        // Returns the number of buckets moved.
+        int rebalance();
+
+    protected:
+        ShardedExecutionQueueBase() : _nshard(0), _nbucket(0) {}
+
+        virtual ~ShardedExecutionQueueBase() {}
+
+        void init_buckets(size_t nshard);
+
+        // Push a task which signals |barrier| when executed into |shard|.
+        virtual int push_barrier(size_t shard, flare::fiber_latch *barrier) = 0;
+
+        struct FLARE_CACHELINE_ALIGNMENT Bucket {
+            // Held shared by producers, exclusively when the bucket is moved.
+            flare::fiber_shared_mutex mutex;
+            std::atomic<size_t> shard;
+            // Tasks pushed since the last rebalance().
+            std::atomic<int64_t> hits;
+        };
+
+        size_t _nshard;
+        size_t _nbucket;
+        std::unique_ptr<Bucket[]> _buckets;
+        flare::fiber_mutex _rebalance_mutex;
+    };
+
+    template<typename T>
+    class ShardedExecutionQueue : public ShardedExecutionQueueBase {
+    public:
+        typedef ShardedTaskIterator<T> iterator;
+        typedef int (*execute_func_t)(void *meta, iterator &iter);
+
+        ShardedExecutionQueue() : _execute(NULL), _meta(NULL), _nrunning(0) {}
+
+        // Stop and join the shards if not yet.
+        ~ShardedExecutionQueue() {
+            stop();
+            join();
+        }
+
+        // Start |nshard| ExecutionQueues with |options|, 0 means number of
+        // CPUs. |execute| is called once with is_queue_stopped() being true
+        // after all of the shards are stopped.
+        // Returns 0 on success, errno otherwise.
+        int start(size_t nshard, const ExecutionQueueOptions *options,
+                  execute_func_t execute, void *meta);
+
+        // Stop all the shards.
+        int stop();
+
+        // Wait until all the shards are stopped.
+        int join();
+
+        // Execute |task| in the shard that |key| maps to.
+        // Returns 0 on success, errno otherwise.
+        int execute(uint64_t key, typename flare::base::add_const_reference<T>::type task) {
+            return execute(key, task, NULL, NULL);
+        }
+
+        int execute(uint64_t key, typename flare::base::add_const_reference<T>::type task,
+                    const TaskOptions *options, TaskHandle *handle) {
+            return execute_impl(key, task, options, handle, true);
+        }
+
+        // Returns EAGAIN instead of blocking when the shard is full.
+        int try_execute(uint64_t key, typename flare::base::add_const_reference<T>::type task,
+                        const TaskOptions *options = NULL, TaskHandle *handle = NULL) {
+            return execute_impl(key, task, options, handle, false);
+        }
+
+    private:
+        typedef ExecutionQueueId<ShardedTask<T> > shard_id_t;
+
+        int push_barrier(size_t shard, flare::fiber_latch *barrier) override {
+            return execution_queue_execute(_shards[shard], ShardedTask<T>(barrier));
+        }
+
+        int execute_impl(uint64_t key, typename flare::base::add_const_reference<T>::type task,
+                         const TaskOptions *options, TaskHandle *handle, bool blocking);
+
+        static int execute_shard(void *meta, TaskIterator<ShardedTask<T> > &it);
+
+        execute_func_t _execute;
+        void *_meta;
+        std::vector<shard_id_t> _shards;
+        std::atomic<size_t> _nrunning;
+    };
+
+    template<typename T>
+    int ShardedExecutionQueue<T>::start(size_t nshard, const ExecutionQueueOptions *options,
+                                        execute_func_t execute, void *meta) {
+        if (execute == NULL || !_shards.empty()) {
+            return EINVAL;
+        }
+        init_buckets(nshard);
+        _execute = execute;
+        _meta = meta;
+        _nrunning.store(_nshard, std::memory_order_relaxed);
+        _shards.resize(_nshard);
+        for (size_t i = 0; i < _nshard; ++i) {
+            const int rc = execution_queue_start(&_shards[i], options, execute_shard, this);
+            if (rc != 0) {
+                // |execute| is not told about the stopping as _nrunning never
+                // drops to 0 here.
+                for (size_t j = 0; j < i; ++j) {
+                    execution_queue_stop(_shards[j]);
+                    execution_queue_join(_shards[j]);
+                }
+                _shards.clear();
+                return rc;
+            }
+        }
+        return 0;
+    }
+
+    template<typename T>
+    int ShardedExecutionQueue<T>::stop() {
+        int ret = 0;
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            const int rc = execution_queue_stop(_shards[i]);
+            if (rc != 0 && ret == 0) {
+                ret = rc;
+            }
+        }
+        return ret;
+    }
+
+    template<typename T>
+    int ShardedExecutionQueue<T>::join() {
+        int ret = 0;
+        for (size_t i = 0; i < _shards.size(); ++i) {
+            const int rc = execution_queue_join(_shards[i]);
+            if (rc != 0 && ret == 0) {
+                ret = rc;
+            }
+        }
+        return ret;
+    }
+
+    template<typename T>
+    int ShardedExecutionQueue<T>::execute_impl(
+            uint64_t key, typename flare::base::add_const_reference<T>::type task,
+            const TaskOptions *options, TaskHandle *handle, bool blocking) {
+        if (FLARE_UNLIKELY(_shards.empty())) {
+            return EINVAL;
+        }
+        Bucket &bucket = _buckets[bucket_of(key)];
+        bucket.mutex.lock_shared();
+        bucket.hits.fetch_add(1, std::memory_order_relaxed);
+        const shard_id_t id = _shards[bucket.shard.load(std::memory_order_relaxed)];
+        const int rc = blocking
+                       ? execution_queue_execute(id, ShardedTask<T>(task), options, handle)
+                       : execution_queue_try_execute(id, ShardedTask<T>(task), options, handle);
+        bucket.mutex.unlock_shared();
+        return rc;
+    }
+
+    template<typename T>
+    int ShardedExecutionQueue<T>::execute_shard(void *meta, TaskIterator<ShardedTask<T> > &it) {
+        ShardedExecutionQueue *q = static_cast<ShardedExecutionQueue *>(meta);
+        if (it.is_queue_stopped() &&
+            q->_nrunning.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return 0;
+        }
+        iterator iter(it);
+        const int rc = q->_execute(q->_meta, iter);
+        iter.signal_barriers();
+        return rc;
+    }
+
+}  // namespace flare::fiber_internal
+
+#endif  // FLARE_FIBER_INTERNAL_SHARDED_EXECUTION_QUEUE_H_
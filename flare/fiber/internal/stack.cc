@@ -23,10 +23,13 @@
 #include <sys/mman.h>                             // mmap, munmap, mprotect
 #include <algorithm>                              // std::max
 #include <stdlib.h>                               // posix_memalign
+#include <errno.h>
+#include <atomic>
 #include "flare/base/singleton_on_pthread_once.h"
 #include "flare/base/dynamic_annotations/dynamic_annotations.h" // RunningOnValgrind
 #include "flare/base/valgrind/valgrind.h"   // VALGRIND_STACK_REGISTER
 #include "flare/variable/passive_status.h"
+#include "flare/variable/reducer.h"
 #include "flare/fiber/internal/types.h"                        // FIBER_STACKTYPE_*
 #include "flare/fiber/internal/stack.h"
 
@@ -36,6 +39,13 @@ DEFINE_int32(stack_size_large, 8388608, "size of large stacks");
 DEFINE_int32(guard_page_size, 4096, "size of guard page, allocate stacks by malloc if it's 0(not recommended)");
 DEFINE_int32(tc_stack_small, 32, "maximum small stacks cached by each thread");
 DEFINE_int32(tc_stack_normal, 8, "maximum normal stacks cached by each thread");
+DEFINE_int32(stack_idle_budget_mb, 0, "trim unused pages of stacks returned to the pool "
+                                      "once idle stacks possibly occupy more memory than this, "
+                                      "0 means never");
+DEFINE_bool(stack_trim_dontneed, false, "trim stacks with MADV_DONTNEED rather than MADV_FREE, "
+                                        "which reduces RSS immediately but page-faults on reuse");
+DEFINE_bool(stack_measure_usage, false, "measure high-water marks of stacks returned to the pool, "
+                                        "see fiber_stack_usage_*");
 
 namespace flare::fiber_internal {
 
@@ -76,6 +86,7 @@ namespace flare::fiber_internal {
             s->bottom = (char *) mem + stacksize;
             s->stacksize = stacksize;
             s->guardsize = 0;
+            s->idle_resident = 0;
             if (RunningOnValgrind()) {
                 s->valgrind_stack_id = VALGRIND_STACK_REGISTER(
                         s->bottom, (char *) s->bottom - stacksize);
@@ -121,6 +132,7 @@ namespace flare::fiber_internal {
             s->bottom = (char *) mem + memsize;
             s->stacksize = stacksize;
             s->guardsize = guardsize;
+            s->idle_resident = 0;
             if (RunningOnValgrind()) {
                 s->valgrind_stack_id = VALGRIND_STACK_REGISTER(
                         s->bottom, (char *) s->bottom - stacksize);
@@ -147,6 +159,140 @@ namespace flare::fiber_internal {
         }
     }
 
+    // Idle stacks accounting and usage histograms, indexed by fiber_stack_type.
+    static const int STACK_TYPE_COUNT = STACK_TYPE_LARGE + 1;
+    // Bucket i counts stacks using (2^(i-1), 2^i] pages.
+    static const int STACK_USAGE_BUCKETS = 16;
+
+    static std::atomic<int64_t> s_idle_resident(0);
+    static std::atomic<int64_t> s_stack_usage[STACK_TYPE_COUNT][STACK_USAGE_BUCKETS];
+    static std::atomic<int64_t> s_stack_usage_max[STACK_TYPE_COUNT];
+    static std::atomic<bool> s_madv_free_unsupported(false);
+
+    static int64_t get_idle_resident(void *) {
+        return s_idle_resident.load(std::memory_order_relaxed);
+    }
+
+    static flare::variable::PassiveStatus<int64_t> variable_stack_idle_resident(
+            "fiber_stack_idle_resident", get_idle_resident, NULL);
+
+    static flare::variable::Adder<int64_t> variable_stack_trimmed("fiber_stack_trimmed");
+
+    static void describe_stack_usage(std::ostream &os, void *arg) {
+        const int type = (int) (intptr_t) arg;
+        const int64_t pagesize = getpagesize();
+        bool first = true;
+        for (int i = 0; i < STACK_USAGE_BUCKETS; ++i) {
+            const int64_t n = s_stack_usage[type][i].load(std::memory_order_relaxed);
+            if (n == 0) {
+                continue;
+            }
+            if (!first) {
+                os << ' ';
+            }
+            first = false;
+            os << ((pagesize << i) >> 10) << "K:" << n;
+        }
+        if (first) {
+            os << "none";
+        } else {
+            os << " max:" << (s_stack_usage_max[type].load(std::memory_order_relaxed) >> 10) << 'K';
+        }
+    }
+
+    static flare::variable::PassiveStatus<std::string> variable_stack_usage_small(
+            "fiber_stack_usage_small", describe_stack_usage, (void *) (intptr_t) STACK_TYPE_SMALL);
+    static flare::variable::PassiveStatus<std::string> variable_stack_usage_normal(
+            "fiber_stack_usage_normal", describe_stack_usage, (void *) (intptr_t) STACK_TYPE_NORMAL);
+    static flare::variable::PassiveStatus<std::string> variable_stack_usage_large(
+            "fiber_stack_usage_large", describe_stack_usage, (void *) (intptr_t) STACK_TYPE_LARGE);
+
+    // Returns bytes between `top' and the lowest resident page in [low, live).
+    // Stacks grow downwards, so that's the deepest the stack has ever been
+    // since allocated or trimmed by MADV_DONTNEED.
+    static int64_t measure_stack_usage(char *low, char *live, char *top) {
+        const static int PAGESIZE = getpagesize();
+        // Runs on stack of another fiber which may be small, scan in chunks.
+        unsigned char vec[256];
+        for (char *p = low; p < live;) {
+            const size_t npages = std::min<size_t>(sizeof(vec), (live - p) / PAGESIZE);
+            if (mincore(p, npages * PAGESIZE, vec) != 0) {
+                return top - low;
+            }
+            for (size_t i = 0; i < npages; ++i) {
+                if (vec[i] & 1) {
+                    return top - (p + i * PAGESIZE);
+                }
+            }
+            p += npages * PAGESIZE;
+        }
+        return top - live;
+    }
+
+    static int trim_stack_pages(char *mem, size_t len) {
+#ifdef MADV_FREE
+        if (!FLAGS_stack_trim_dontneed &&
+            !s_madv_free_unsupported.load(std::memory_order_relaxed)) {
+            if (madvise(mem, len, MADV_FREE) == 0) {
+                return 0;
+            }
+            if (errno != EINVAL) {
+                return -1;
+            }
+            // Kernel before 4.5.
+            s_madv_free_unsupported.store(true, std::memory_order_relaxed);
+        }
+#endif
+        return madvise(mem, len, MADV_DONTNEED);
+    }
+
+    void recycle_stack(fiber_contextual_stack *s) {
+        const static int PAGESIZE = getpagesize();
+        fiber_stack_storage *const st = &s->storage;
+        // Stacks allocated by malloc are not page-aligned.
+        if (st->guardsize <= 0 || s->context == NULL) {
+            return;
+        }
+        char *const top = (char *) st->bottom;
+        char *const low = top - st->stacksize;
+        // The saved context and everything above it are needed to resume
+        // the stack, pages below are garbage.
+        char *const live = (char *) ((uintptr_t) s->context & ~(uintptr_t) (PAGESIZE - 1));
+        if (live <= low || live > top) {
+            return;
+        }
+        // Without measuring, assume the whole stack is resident.
+        int64_t used = st->stacksize;
+        if (FLAGS_stack_measure_usage) {
+            used = measure_stack_usage(low, live, top);
+            const int64_t pages = (used + PAGESIZE - 1) / PAGESIZE;
+            int bucket = (pages <= 1 ? 0 : 64 - __builtin_clzll(pages - 1));
+            bucket = std::min(bucket, STACK_USAGE_BUCKETS - 1);
+            const int type = s->stacktype;
+            if (type > 0 && type < STACK_TYPE_COUNT) {
+                s_stack_usage[type][bucket].fetch_add(1, std::memory_order_relaxed);
+                int64_t cur_max = s_stack_usage_max[type].load(std::memory_order_relaxed);
+                while (used > cur_max && !s_stack_usage_max[type].compare_exchange_weak(
+                        cur_max, used, std::memory_order_relaxed)) {
+                }
+            }
+        }
+        const int64_t budget = (int64_t) FLAGS_stack_idle_budget_mb << 20;
+        if (budget > 0 && used > top - live &&
+            s_idle_resident.load(std::memory_order_relaxed) + used > budget &&
+            trim_stack_pages(low, live - low) == 0) {
+            variable_stack_trimmed << 1;
+            used = top - live;
+        }
+        st->idle_resident = used;
+        s_idle_resident.fetch_add(used, std::memory_order_relaxed);
+    }
+
+    void reuse_stack(fiber_contextual_stack *s) {
+        s_idle_resident.fetch_sub(s->storage.idle_resident, std::memory_order_relaxed);
+        s->storage.idle_resident = 0;
+    }
+
     int *SmallStackClass::stack_size_flag = &FLAGS_stack_size_small;
     int *NormalStackClass::stack_size_flag = &FLAGS_stack_size_normal;
     int *LargeStackClass::stack_size_flag = &FLAGS_stack_size_large;
@@ -17,6 +17,9 @@ namespace flare::fiber_internal {
         // http://www.boost.org/doc/libs/1_55_0/libs/context/doc/html/context/stack.html
         void *bottom;
         unsigned valgrind_stack_id;
+        // Bytes which are possibly resident while the stack is cached in the
+        // pool, 0 if the stack is in use or not accounted.
+        int idle_resident;
 
         // Clears all members.
         void zeroize() {
@@ -24,6 +27,7 @@ namespace flare::fiber_internal {
             guardsize = 0;
             bottom = NULL;
             valgrind_stack_id = 0;
+            idle_resident = 0;
         }
     };
 
@@ -55,6 +59,15 @@ namespace flare::fiber_internal {
     // Recycle a stack. NULL does nothing.
     void return_stack(fiber_contextual_stack *);
 
+    // Called before a stack is cached in the pool when -stack_idle_budget_mb
+    // or -stack_measure_usage is on. Records the high-water mark of the
+    // stack and trims unused pages of the stack if idle stacks in the pool
+    // occupy more memory than the budget.
+    void recycle_stack(fiber_contextual_stack *s);
+
+    // Called when a cached stack accounted by recycle_stack() is reused.
+    void reuse_stack(fiber_contextual_stack *s);
+
     // Jump from stack `from' to stack `to'. `from' must be the stack of callsite
     // (to save contexts before jumping)
     void jump_stack(fiber_contextual_stack *from, fiber_contextual_stack *to);
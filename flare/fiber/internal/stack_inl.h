@@ -6,6 +6,8 @@
 DECLARE_int32(guard_page_size);
 DECLARE_int32(tc_stack_small);
 DECLARE_int32(tc_stack_normal);
+DECLARE_int32(stack_idle_budget_mb);
+DECLARE_bool(stack_measure_usage);
 
 namespace flare::fiber_internal {
 
@@ -52,10 +54,17 @@ namespace flare::fiber_internal {
         };
 
         static fiber_contextual_stack *get_stack(void (*entry)(intptr_t)) {
-            return flare::get_object<Wrapper>(entry);
+            fiber_contextual_stack *sc = flare::get_object<Wrapper>(entry);
+            if (sc != NULL && sc->storage.idle_resident != 0) {
+                reuse_stack(sc);
+            }
+            return sc;
         }
 
         static void return_stack(fiber_contextual_stack *sc) {
+            if (FLAGS_stack_idle_budget_mb > 0 || FLAGS_stack_measure_usage) {
+                recycle_stack(sc);
+            }
             flare::return_object(static_cast<Wrapper *>(sc));
         }
     };
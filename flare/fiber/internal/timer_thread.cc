@@ -19,6 +19,10 @@
 
 
 #include <queue>                           // heap functions
+#include <memory>                          // std::unique_ptr
+#include <algorithm>                       // std::min
+#include <string.h>                        // memset
+#include <gflags/gflags.h>
 #include "flare/base/scoped_lock.h"
 #include "flare/log/logging.h"
 #include "flare/hash/murmurhash3.h"   // fmix64
@@ -30,13 +34,18 @@
 
 namespace flare::fiber_internal {
 
+DEFINE_bool(fiber_timer_wheel, false, "Keep timers of the global TimerThread "
+            "in a hierarchical timing wheel, read when the thread starts");
+
 // Defined in task_control.cpp
 void run_worker_startfn();
 
 const TimerThread::TaskId TimerThread::INVALID_TASK_ID = 0;
 
 TimerThreadOptions::TimerThreadOptions()
-    : num_buckets(13) {
+    : num_buckets(13)
+    , use_timing_wheel(false)
+    , wheel_tick_us(1000) {
 }
 
 // A task contains the necessary information for running fn(arg).
@@ -83,8 +92,7 @@ public:
     
     // Schedule a task into this bucket.
     // Returns the TaskId and if it has the nearest run time.
-    ScheduleResult schedule(void (*fn)(void*), void* arg,
-                            const timespec& abstime);
+    ScheduleResult schedule(void (*fn)(void*), void* arg, int64_t run_time);
 
     // Pull all scheduled tasks.
     // This function is called in timer thread.
@@ -116,6 +124,148 @@ inline bool task_greater(const TimerThread::Task* a, const TimerThread::Task* b)
     return a->run_time > b->run_time;
 }
 
+// Round `run_time' up to a multiple of the largest power of 2 not greater
+// than `slack_us', so that tasks tolerating slack expire together.
+static int64_t coalesce_run_time(int64_t run_time, int64_t slack_us) {
+    if (slack_us <= 1) {
+        return run_time;
+    }
+    const int64_t granularity = int64_t(1) << (63 - __builtin_clzll(slack_us));
+    if (run_time > std::numeric_limits<int64_t>::max() - granularity) {
+        return run_time;
+    }
+    return (run_time + granularity - 1) & ~(granularity - 1);
+}
+
+// Hierarchical timing wheel used by the timer thread only. Level i has 256
+// slots spanning 256^i ticks each. Tasks are cascaded into lower levels as
+// time goes by and handed to the heap when their ticks come, thus only tasks
+// due in the current tick are ordered. Unscheduled tasks are recycled when
+// their slots are visited without any heap operation.
+class TimingWheel {
+public:
+    TimingWheel(int64_t tick_us, int64_t now_us)
+        : _tick_us(tick_us), _cur(now_us / tick_us), _size(0) {
+        memset(_slots, 0, sizeof(_slots));
+        memset(_bitmap, 0, sizeof(_bitmap));
+    }
+
+    // Add a task not due in the current tick.
+    // Returns false if the task is due, which should be put into the heap.
+    bool add(TimerThread::Task* task) {
+        int64_t due = task->run_time / _tick_us;
+        if (due <= _cur) {
+            return false;
+        }
+        if (due - _cur >= MAX_TICKS) {
+            // Cascaded from the last slot again when it comes.
+            due = _cur + MAX_TICKS - 1;
+        }
+        const int64_t delta = due - _cur;
+        int level = 0;
+        while (delta >= (int64_t(1) << (SLOT_BITS * (level + 1)))) {
+            ++level;
+        }
+        push(level, (due >> (SLOT_BITS * level)) & SLOT_MASK, task);
+        return true;
+    }
+
+    // Advance to the tick of `now_us' and call on_due(task) for tasks whose
+    // ticks come, unscheduled tasks are deleted instead.
+    template <typename OnDue>
+    void advance(int64_t now_us, OnDue&& on_due) {
+        const int64_t target = now_us / _tick_us;
+        while (_cur < target) {
+            if (_size == 0) {
+                _cur = target;
+                break;
+            }
+            ++_cur;
+            // Cascade higher levels when lower levels wrap.
+            for (int level = 1; level < NUM_LEVELS; ++level) {
+                const int64_t shift = SLOT_BITS * level;
+                if ((_cur & ((int64_t(1) << shift) - 1)) != 0) {
+                    break;
+                }
+                TimerThread::Task* p = take(level, (_cur >> shift) & SLOT_MASK);
+                while (p != NULL) {
+                    TimerThread::Task* next = p->next;
+                    if (!p->try_delete() && !add(p)) {
+                        on_due(p);
+                    }
+                    p = next;
+                }
+            }
+            TimerThread::Task* p = take(0, _cur & SLOT_MASK);
+            while (p != NULL) {
+                TimerThread::Task* next = p->next;
+                if (!p->try_delete()) {
+                    on_due(p);
+                }
+                p = next;
+            }
+        }
+    }
+
+    // Realtime that advance() should be called at, which is the tick of the
+    // nearest non-empty slot of level 0 or the next cascading.
+    int64_t next_run_time() const {
+        if (_size == 0) {
+            return std::numeric_limits<int64_t>::max();
+        }
+        const int start = (_cur + 1) & SLOT_MASK;
+        if (start != 0) {
+            for (int w = start / 64; w < SLOTS / 64; ++w) {
+                uint64_t bits = _bitmap[w];
+                if (w == start / 64) {
+                    bits &= ~uint64_t(0) << (start % 64);
+                }
+                if (bits != 0) {
+                    const int64_t index = w * 64 + __builtin_ctzll(bits);
+                    return ((_cur & ~int64_t(SLOT_MASK)) + index) * _tick_us;
+                }
+            }
+        }
+        return ((_cur | SLOT_MASK) + 1) * _tick_us;
+    }
+
+    size_t size() const { return _size; }
+
+private:
+    static const int SLOT_BITS = 8;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int SLOT_MASK = SLOTS - 1;
+    static const int NUM_LEVELS = 4;
+    static const int64_t MAX_TICKS = int64_t(1) << (SLOT_BITS * NUM_LEVELS);
+
+    void push(int level, int slot, TimerThread::Task* task) {
+        task->next = _slots[level][slot];
+        _slots[level][slot] = task;
+        if (level == 0) {
+            _bitmap[slot / 64] |= uint64_t(1) << (slot % 64);
+        }
+        ++_size;
+    }
+
+    TimerThread::Task* take(int level, int slot) {
+        TimerThread::Task* head = _slots[level][slot];
+        _slots[level][slot] = NULL;
+        if (level == 0) {
+            _bitmap[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+        }
+        for (TimerThread::Task* p = head; p != NULL; p = p->next) {
+            --_size;
+        }
+        return head;
+    }
+
+    int64_t _tick_us;
+    int64_t _cur;       // current tick
+    size_t _size;       // number of tasks in the wheel
+    TimerThread::Task* _slots[NUM_LEVELS][SLOTS];
+    uint64_t _bitmap[SLOTS / 64];  // non-empty slots of level 0
+};
+
 void* TimerThread::run_this(void* arg) {
     static_cast<TimerThread*>(arg)->run();
     return NULL;
@@ -151,6 +301,10 @@ int TimerThread::start(const TimerThreadOptions* options_in) {
         FLARE_LOG(ERROR) << "num_buckets=" << _options.num_buckets << " is too big";
         return EINVAL;
     }
+    if (_options.use_timing_wheel && _options.wheel_tick_us <= 0) {
+        FLARE_LOG(ERROR) << "wheel_tick_us=" << _options.wheel_tick_us << " must be positive";
+        return EINVAL;
+    }
     _buckets = new (std::nothrow) Bucket[_options.num_buckets];
     if (NULL == _buckets) {
         FLARE_LOG(ERROR) << "Fail to new _buckets";
@@ -181,8 +335,7 @@ TimerThread::Task* TimerThread::Bucket::consume_tasks() {
 }
 
 TimerThread::Bucket::ScheduleResult
-TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
-                              const timespec& abstime) {
+TimerThread::Bucket::schedule(void (*fn)(void*), void* arg, int64_t run_time) {
     flare::ResourceId<Task> slot_id;
     Task* task = flare::get_resource<Task>(&slot_id);
     if (task == NULL) {
@@ -192,7 +345,7 @@ TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
     task->next = NULL;
     task->fn = fn;
     task->arg = arg;
-    task->run_time = flare::time_point::from_timespec(abstime).to_unix_micros();
+    task->run_time = run_time;
     uint32_t version = task->version.load(std::memory_order_relaxed);
     if (version == 0) {  // skip 0.
         task->version.fetch_add(2, std::memory_order_relaxed);
@@ -215,18 +368,19 @@ TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
 }
 
 TimerThread::TaskId TimerThread::schedule(
-    void (*fn)(void*), void* arg, const timespec& abstime) {
+    void (*fn)(void*), void* arg, const timespec& abstime, int64_t slack_us) {
     if (_stop.load(std::memory_order_relaxed) || !_started) {
         // Not add tasks when TimerThread is about to stop.
         return INVALID_TASK_ID;
     }
+    const int64_t run_time = coalesce_run_time(
+        flare::time_point::from_timespec(abstime).to_unix_micros(), slack_us);
     // Hashing by pthread id is better for cache locality.
     const Bucket::ScheduleResult result = 
         _buckets[flare::hash::fmix64(pthread_numeric_id()) % _options.num_buckets]
-        .schedule(fn, arg, abstime);
+        .schedule(fn, arg, run_time);
     if (result.earlier) {
         bool earlier = false;
-        const int64_t run_time =  flare::time_point::from_timespec(abstime).to_unix_micros();
         {
             FLARE_SCOPED_LOCK(_mutex);
             if (run_time < _nearest_run_time) {
@@ -318,6 +472,16 @@ void TimerThread::run() {
     // min heap of tasks (ordered by run_time)
     std::vector<Task*> tasks;
     tasks.reserve(4096);
+    // tasks not due in current tick if the timing wheel is used.
+    std::unique_ptr<TimingWheel> wheel;
+    if (_options.use_timing_wheel) {
+        wheel.reset(new TimingWheel(_options.wheel_tick_us,
+                                    flare::get_current_time_micros()));
+    }
+    auto push_task = [&tasks](Task* task) {
+        tasks.push_back(task);
+        std::push_heap(tasks.begin(), tasks.end(), task_greater);
+    };
 
     // vars
     size_t nscheduled = 0;
@@ -353,12 +517,16 @@ void TimerThread::run() {
                 Task* next_task = p->next;
 
                 if (!p->try_delete()) { // remove the task if it's unscheduled
-                    tasks.push_back(p);
-                    std::push_heap(tasks.begin(), tasks.end(), task_greater);
+                    if (wheel == nullptr || !wheel->add(p)) {
+                        push_task(p);
+                    }
                 }
                 p = next_task;
             }
         }
+        if (wheel != nullptr) {
+            wheel->advance(flare::get_current_time_micros(), push_task);
+        }
 
         bool pull_again = false;
         while (!tasks.empty()) {
@@ -400,6 +568,9 @@ void TimerThread::run() {
         if (!tasks.empty()) {
             next_run_time = tasks[0]->run_time;
         }
+        if (wheel != nullptr) {
+            next_run_time = std::min(next_run_time, wheel->next_run_time());
+        }
         // Similarly with the situation before running tasks, we check
         // _nearest_run_time to prevent us from waiting on a non-earliest
         // task. We also use the _nsignal to make sure that if new task 
@@ -458,6 +629,7 @@ static void init_global_timer_thread() {
     }
     TimerThreadOptions options;
     options.variable_prefix = "fiber_timer";
+    options.use_timing_wheel = FLAGS_fiber_timer_wheel;
     const int rc = g_timer_thread->start(&options);
     if (rc != 0) {
         FLARE_LOG(FATAL) << "Fail to start timer_thread, " << flare_error(rc);
@@ -24,6 +24,19 @@ struct TimerThreadOptions {
     // Default: ""
     std::string variable_prefix;
 
+    // Keep tasks which are not due in the current tick in a hierarchical
+    // timing wheel instead of the heap. Scheduling and cancelling are O(1),
+    // and tasks unscheduled before their ticks (most RPC timeouts) never
+    // touch the heap.
+    // Default: false
+    bool use_timing_wheel;
+
+    // Length of a tick of the timing wheel in microseconds. Tasks are still
+    // run at their exact time, ticks only decide how often the timer thread
+    // wakes up to move tasks from the wheel into the heap.
+    // Default: 1000
+    int64_t wheel_tick_us;
+
     // Constructed with default options.
     TimerThreadOptions();
 };
@@ -51,8 +64,12 @@ public:
     void stop_and_join();
 
     // Schedule |fn(arg)| to run at realtime |abstime| approximately.
+    // If |slack_us| is positive, the task may run at most so many
+    // microseconds later, tasks tolerating slack are rounded up to common
+    // expiration times so that they run in fewer wakeups.
     // Returns: identifier of the scheduled task, INVALID_TASK_ID on error.
-    TaskId schedule(void (*fn)(void*), void* arg, const timespec& abstime);
+    TaskId schedule(void (*fn)(void*), void* arg, const timespec& abstime,
+                    int64_t slack_us = 0);
 
     // Prevent the task denoted by `task_id' from running. `task_id' must be
     // returned by schedule() ever.
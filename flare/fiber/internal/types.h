@@ -50,6 +50,15 @@ static const fiber_attribute_flag FIBER_LOG_CONTEXT_SWITCH = 16;
 static const fiber_attribute_flag FIBER_NOSIGNAL = 32;
 static const fiber_attribute_flag FIBER_NEVER_QUIT = 64;
 
+// Runnable fibers of higher priority are run and stolen first. Lower
+// priorities are aged so that they're not starved, see
+// -fiber_priority_aging_interval.
+typedef unsigned fiber_priority_t;
+static const fiber_priority_t FIBER_PRIORITY_NORMAL = 0;
+static const fiber_priority_t FIBER_PRIORITY_HIGH = 1;
+static const fiber_priority_t FIBER_PRIORITY_LOW = 2;
+static const fiber_priority_t FIBER_PRIORITY_NUM = 3;
+
 // Key of thread-local data, created by fiber_key_create.
 typedef struct {
     uint32_t index;    // index in KeyTable
@@ -100,6 +109,12 @@ typedef struct fiber_attribute {
     fiber_stack_type_t stack_type;
     fiber_attribute_flag flags;
     fiber_keytable_pool_t *keytable_pool;
+    // One of FIBER_PRIORITY_*.
+    fiber_priority_t priority;
+    // Fibers with the same tag are accounted together when
+    // -fiber_enable_accounting is on. Must be a NUL-terminated string, NULL
+    // means untagged.
+    const char *tag;
 
 #if defined(__cplusplus)
 
@@ -107,6 +122,8 @@ typedef struct fiber_attribute {
         stack_type = (stacktype_and_flags & 7);
         flags = (stacktype_and_flags & ~(unsigned) 7u);
         keytable_pool = NULL;
+        priority = FIBER_PRIORITY_NORMAL;
+        tag = NULL;
     }
 
     fiber_attribute operator|(unsigned other_flags) const {
@@ -126,22 +143,24 @@ typedef struct fiber_attribute {
 // obvious drawback is that you need more worker pthreads when you have a lot
 // of such fibers.
 static const fiber_attribute FIBER_ATTR_PTHREAD =
-        {FIBER_STACKTYPE_PTHREAD, 0, NULL};
+        {FIBER_STACKTYPE_PTHREAD, 0, NULL, FIBER_PRIORITY_NORMAL, NULL};
 
 // fibers created with following attributes will have different size of
 // stacks. Default is FIBER_ATTR_NORMAL.
 static const fiber_attribute FIBER_ATTR_SMALL =
-        {FIBER_STACKTYPE_SMALL, 0, NULL};
+        {FIBER_STACKTYPE_SMALL, 0, NULL, FIBER_PRIORITY_NORMAL, NULL};
 static const fiber_attribute FIBER_ATTR_NORMAL =
-        {FIBER_STACKTYPE_NORMAL, 0, NULL};
+        {FIBER_STACKTYPE_NORMAL, 0, NULL, FIBER_PRIORITY_NORMAL, NULL};
 static const fiber_attribute FIBER_ATTR_LARGE =
-        {FIBER_STACKTYPE_LARGE, 0, NULL};
+        {FIBER_STACKTYPE_LARGE, 0, NULL, FIBER_PRIORITY_NORMAL, NULL};
 
 // fibers created with this attribute will print log when it's started,
 // context-switched, finished.
 static const fiber_attribute FIBER_ATTR_DEBUG = {
         FIBER_STACKTYPE_NORMAL,
         FIBER_LOG_START_AND_FINISH | FIBER_LOG_CONTEXT_SWITCH,
+        NULL,
+        FIBER_PRIORITY_NORMAL,
         NULL
 };
 
@@ -170,6 +189,11 @@ typedef struct {
 typedef struct {
     unsigned *event;
     fiber_contention_site_t csite;
+    // Fiber that acquired the mutex most recently(0 for pthreads) and its
+    // number of context switches then. Only used as a hint by contended
+    // lockers to decide whether spinning is worthwhile.
+    fiber_id_t owner_tid;
+    int64_t owner_nswitch;
 } fiber_mutex_t;
 
 typedef struct {
@@ -184,6 +208,12 @@ typedef struct {
 } fiber_condattr_t;
 
 typedef struct {
+    // Epoch of the last writer << 32 | writer pending bit | number of readers.
+    uint64_t state;
+    unsigned wlocked;           // non-zero while a writer holds the lock
+    unsigned *reader_event;     // epoch of the last writer unlocked
+    int *writer_event;          // readers that the pending writer waits for
+    fiber_mutex_t write_queue;  // serializes writers
 } fiber_rwlock_t;
 
 typedef struct {
@@ -4,6 +4,7 @@
 
 #include <pthread.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include "flare/fiber/internal/types.h"
 #include "flare/fiber/internal/errno.h"
 
@@ -29,6 +30,13 @@ extern int fiber_about_to_quit();
 extern int fiber_timer_add(fiber_timer_id *id, timespec abstime,
                            void (*on_timer)(void *), void *arg);
 
+// Same as fiber_timer_add() except that `on_timer' may run at most
+// `slack_us' microseconds later, so that timers tolerating slack(e.g.
+// timeouts) are coalesced and run in fewer wakeups of the timer thread.
+extern int fiber_timer_add_with_slack(fiber_timer_id *id, timespec abstime,
+                                      int64_t slack_us,
+                                      void (*on_timer)(void *), void *arg);
+
 // Unschedule the timer associated with `id'.
 // Returns: 0 - exist & not-run; 1 - still running; EINVAL - not exist.
 extern int fiber_timer_del(fiber_timer_id id);
@@ -37,8 +45,10 @@ extern int fiber_timer_del(fiber_timer_id id);
 // Returns 0 on success, -1 otherwise and errno is set.
 // NOTE: Due to an epoll bug(https://patchwork.kernel.org/patch/1970231),
 // current implementation relies on EPOLL_CTL_ADD and EPOLL_CTL_DEL which
-// are not scalable, don't use fiber_fd_*wait functions in performance
-// critical scenario.
+// are not scalable by default. Turn on -fiber_fd_edge_triggered to register
+// fds once with EPOLLET(fds must be closed by fiber_fd_close then), shard fds
+// among -fiber_epoll_thread_num pollers, and turn on -fiber_worker_poll_fd to
+// let idle workers poll before parking.
 extern int fiber_fd_wait(int fd, unsigned events);
 
 // Suspend caller thread until the file descriptor `fd' has `epoll_events'
@@ -59,6 +69,31 @@ extern int fiber_fd_close(int fd);
 extern int fiber_connect(int sockfd, const sockaddr *serv_addr,
                            socklen_t addrlen);
 
+// Replacements of read/pread(2), write/pwrite(2), readv/preadv(2),
+// writev/pwritev(2), accept(2), connect(2) and fsync(2) which suspend the
+// calling fiber instead of blocking the worker pthread. In fibers, operations
+// are submitted through io_uring of the worker when -fiber_io_uring is on and
+// io_uring is available, otherwise syscalls are called directly. EAGAIN of
+// non-blocking fds is waited by fiber_fd_wait in both cases.
+// Negative `offset' means the current file offset.
+// Returns same values as the syscalls, -1 with errno set on error.
+extern ssize_t fiber_io_read(int fd, void *buf, size_t count, off_t offset);
+
+extern ssize_t fiber_io_write(int fd, const void *buf, size_t count, off_t offset);
+
+extern ssize_t fiber_io_readv(int fd, const struct iovec *iov, int iovcnt,
+                              off_t offset);
+
+extern ssize_t fiber_io_writev(int fd, const struct iovec *iov, int iovcnt,
+                               off_t offset);
+
+extern int fiber_io_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+
+extern int fiber_io_connect(int sockfd, const struct sockaddr *addr,
+                            socklen_t addrlen);
+
+extern int fiber_io_fsync(int fd);
+
 // Add a startup function that each pthread worker will run at the beginning
 // To run code at the end, use flare::thread::atexit()
 // Returns 0 on success, error code otherwise.
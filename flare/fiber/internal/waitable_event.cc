@@ -71,6 +71,10 @@ namespace flare::fiber_internal {
         // Erasing node from middle of linked_list is thread-unsafe, we need
         // to hold its container's lock.
         std::atomic<waitable_event *> container;
+
+        // Set by waitable_event_requeue() under locks of both events when the
+        // waiter is moved to another event.
+        bool requeued;
     };
 
     // non_pthread_task allocates this structure on stack and queue it in
@@ -79,6 +83,8 @@ namespace flare::fiber_internal {
         fiber_entity *task_meta;
         TimerThread::TaskId sleep_id;
         WaiterState waiter_state;
+        // Set by wait_for_event() under waiter_lock when the waiter is queued.
+        bool queued;
         int expected_value;
         waitable_event *initial_event;
         schedule_group *control;
@@ -90,6 +96,18 @@ namespace flare::fiber_internal {
         std::atomic<int> sig;
     };
 
+    // tid of event_callback_waiter, never equals a valid fiber id.
+    static const fiber_id_t CALLBACK_WAITER_TID = (fiber_id_t) -1;
+
+    // Stackless waiters(coroutines) have no stack to suspend, waitable_event_wait_async
+    // allocates this structure from ObjectPool and queues it in waitable_event::waiters.
+    // Waking it up calls `on_wakeup(arg)`. Such waiters can't time out or be
+    // interrupted, thus are never erased by erase_from_event().
+    struct event_callback_waiter : public fiber_mutex_waiter {
+        void (*on_wakeup)(void *);
+        void *arg;
+    };
+
     typedef flare::container::linked_list<fiber_mutex_waiter> event_waiter_list;
 
     enum event_pthread_signal {
@@ -119,6 +137,24 @@ namespace flare::fiber_internal {
         futex_wake_private(&pw->sig, 1);
     }
 
+    static void wakeup_callback(event_callback_waiter *cw) {
+        void (*on_wakeup)(void *) = cw->on_wakeup;
+        void *arg = cw->arg;
+        flare::return_object(cw);
+        on_wakeup(arg);
+    }
+
+    static int wakeup_callbacks(event_waiter_list *callback_waiters) {
+        int nwakeup = 0;
+        while (!callback_waiters->empty()) {
+            fiber_mutex_waiter *bw = callback_waiters->head()->value();
+            bw->remove_from_list();
+            wakeup_callback(static_cast<event_callback_waiter *>(bw));
+            ++nwakeup;
+        }
+        return nwakeup;
+    }
+
     bool erase_from_event(fiber_mutex_waiter *, bool, WaiterState);
 
     int wait_pthread(event_pthread_waiter &pw, timespec *ptimeout) {
@@ -154,12 +190,11 @@ namespace flare::fiber_internal {
 
 // Returns 0 when no need to unschedule or successfully unscheduled,
 // -1 otherwise.
-    inline int unsleep_if_necessary(event_fiber_waiter *w,
-                                    TimerThread *timer_thread) {
+    inline int unsleep_if_necessary(event_fiber_waiter *w) {
         if (!w->sleep_id) {
             return 0;
         }
-        if (timer_thread->unschedule(w->sleep_id) > 0) {
+        if (fiber_worker::unschedule_timer(w->sleep_id) > 0) {
             // the callback is running.
             return -1;
         }
@@ -246,7 +281,15 @@ namespace flare::fiber_internal {
         return g ? g : c->choose_one_group();
     }
 
-    int waitable_event_wake(void *arg) {
+    // Wakeups from non-worker threads are only traced as being ready.
+    inline void trace_event_wake(fiber_id_t tid) {
+        fiber_worker *g = tls_task_group;
+        if (g) {
+            g->trace(SCHED_EVENT_BUTEX_WAKE, tid);
+        }
+    }
+
+    int waitable_event_wake(void *arg, bool nosignal) {
         waitable_event *b = FLARE_CONTAINER_OF(static_cast<std::atomic<int> *>(arg), waitable_event, value);
         fiber_mutex_waiter *front = NULL;
         {
@@ -262,11 +305,20 @@ namespace flare::fiber_internal {
             wakeup_pthread(static_cast<event_pthread_waiter *>(front));
             return 1;
         }
+        if (front->tid == CALLBACK_WAITER_TID) {
+            wakeup_callback(static_cast<event_callback_waiter *>(front));
+            return 1;
+        }
         event_fiber_waiter *bbw = static_cast<event_fiber_waiter *>(front);
-        unsleep_if_necessary(bbw, get_global_timer_thread());
+        unsleep_if_necessary(bbw);
+        trace_event_wake(bbw->tid);
         fiber_worker *g = tls_task_group;
         if (g) {
-            fiber_worker::exchange(&g, bbw->tid);
+            if (nosignal) {
+                g->ready_to_run(bbw->tid, true);
+            } else {
+                fiber_worker::exchange(&g, bbw->tid);
+            }
         } else {
             bbw->control->choose_one_group()->ready_to_run_remote(bbw->tid);
         }
@@ -278,13 +330,16 @@ namespace flare::fiber_internal {
 
         event_waiter_list fiber_waiters;
         event_waiter_list pthread_waiters;
+        event_waiter_list callback_waiters;
         {
             FLARE_SCOPED_LOCK(b->waiter_lock);
             while (!b->waiters.empty()) {
                 fiber_mutex_waiter *bw = b->waiters.head()->value();
                 bw->remove_from_list();
                 bw->container.store(NULL, std::memory_order_relaxed);
-                if (bw->tid) {
+                if (bw->tid == CALLBACK_WAITER_TID) {
+                    callback_waiters.append(bw);
+                } else if (bw->tid) {
                     fiber_waiters.append(bw);
                 } else {
                     pthread_waiters.append(bw);
@@ -292,7 +347,7 @@ namespace flare::fiber_internal {
             }
         }
 
-        int nwakeup = 0;
+        int nwakeup = wakeup_callbacks(&callback_waiters);
         while (!pthread_waiters.empty()) {
             event_pthread_waiter *bw = static_cast<event_pthread_waiter *>(
                     pthread_waiters.head()->value());
@@ -307,7 +362,8 @@ namespace flare::fiber_internal {
         event_fiber_waiter *next = static_cast<event_fiber_waiter *>(
                 fiber_waiters.head()->value());
         next->remove_from_list();
-        unsleep_if_necessary(next, get_global_timer_thread());
+        unsleep_if_necessary(next);
+        trace_event_wake(next->tid);
         ++nwakeup;
         fiber_worker *g = get_task_group(next->control);
         const int saved_nwakeup = nwakeup;
@@ -316,7 +372,8 @@ namespace flare::fiber_internal {
             event_fiber_waiter *w = static_cast<event_fiber_waiter *>(
                     fiber_waiters.tail()->value());
             w->remove_from_list();
-            unsleep_if_necessary(w, get_global_timer_thread());
+            unsleep_if_necessary(w);
+            trace_event_wake(w->tid);
             g->ready_to_run_general(w->tid, true);
             ++nwakeup;
         }
@@ -336,6 +393,7 @@ namespace flare::fiber_internal {
 
         event_waiter_list fiber_waiters;
         event_waiter_list pthread_waiters;
+        event_waiter_list callback_waiters;
         {
             fiber_mutex_waiter *excluded_waiter = NULL;
             FLARE_SCOPED_LOCK(b->waiter_lock);
@@ -343,7 +401,10 @@ namespace flare::fiber_internal {
                 fiber_mutex_waiter *bw = b->waiters.head()->value();
                 bw->remove_from_list();
 
-                if (bw->tid) {
+                if (bw->tid == CALLBACK_WAITER_TID) {
+                    bw->container.store(NULL, std::memory_order_relaxed);
+                    callback_waiters.append(bw);
+                } else if (bw->tid) {
                     if (bw->tid != excluded_fiber) {
                         fiber_waiters.append(bw);
                         bw->container.store(NULL, std::memory_order_relaxed);
@@ -361,7 +422,7 @@ namespace flare::fiber_internal {
             }
         }
 
-        int nwakeup = 0;
+        int nwakeup = wakeup_callbacks(&callback_waiters);
         while (!pthread_waiters.empty()) {
             event_pthread_waiter *bw = static_cast<event_pthread_waiter *>(
                     pthread_waiters.head()->value());
@@ -383,7 +444,8 @@ namespace flare::fiber_internal {
             event_fiber_waiter *w = static_cast<event_fiber_waiter *>(
                     fiber_waiters.tail()->value());
             w->remove_from_list();
-            unsleep_if_necessary(w, get_global_timer_thread());
+            unsleep_if_necessary(w);
+            trace_event_wake(w->tid);
             g->ready_to_run_general(w->tid, true);
             ++nwakeup;
         } while (!fiber_waiters.empty());
@@ -398,6 +460,9 @@ namespace flare::fiber_internal {
         waitable_event *m = FLARE_CONTAINER_OF(static_cast<std::atomic<int> *>(arg2), waitable_event, value);
 
         fiber_mutex_waiter *front = NULL;
+        // Callbacks can't tell that they're woken up on `m', wake them up
+        // now as well.
+        event_waiter_list callback_waiters;
         {
             std::unique_lock<internal::FastPthreadMutex> lck1(b->waiter_lock, std::defer_lock);
             std::unique_lock<internal::FastPthreadMutex> lck2(m->waiter_lock, std::defer_lock);
@@ -413,29 +478,56 @@ namespace flare::fiber_internal {
             while (!b->waiters.empty()) {
                 fiber_mutex_waiter *bw = b->waiters.head()->value();
                 bw->remove_from_list();
+                if (bw->tid == CALLBACK_WAITER_TID) {
+                    callback_waiters.append(bw);
+                    bw->container.store(NULL, std::memory_order_relaxed);
+                    continue;
+                }
                 m->waiters.append(bw);
                 bw->container.store(m, std::memory_order_relaxed);
+                bw->requeued = true;
             }
         }
 
+        const int nwakeup = 1 + wakeup_callbacks(&callback_waiters);
         if (front->tid == 0) {  // which is a pthread
             wakeup_pthread(static_cast<event_pthread_waiter *>(front));
-            return 1;
+            return nwakeup;
+        }
+        if (front->tid == CALLBACK_WAITER_TID) {
+            wakeup_callback(static_cast<event_callback_waiter *>(front));
+            return nwakeup;
         }
         event_fiber_waiter *bbw = static_cast<event_fiber_waiter *>(front);
-        unsleep_if_necessary(bbw, get_global_timer_thread());
+        unsleep_if_necessary(bbw);
+        trace_event_wake(bbw->tid);
         fiber_worker *g = tls_task_group;
         if (g) {
             fiber_worker::exchange(&g, front->tid);
         } else {
             bbw->control->choose_one_group()->ready_to_run_remote(front->tid);
         }
-        return 1;
+        return nwakeup;
     }
 
 // Callable from multiple threads, at most one thread may wake up the waiter.
     static void erase_from_event_and_wakeup(void *arg) {
-        erase_from_event(static_cast<fiber_mutex_waiter *>(arg), true, WAITER_STATE_TIMEDOUT);
+        event_fiber_waiter *const bw = static_cast<event_fiber_waiter *>(arg);
+        while (!erase_from_event(bw, true, WAITER_STATE_TIMEDOUT)) {
+            // The timer may fire before wait_for_event() queues the waiter,
+            // e.g. timers of the worker run by sched() before the remained
+            // function. Mark the waiter timed out so that it's not queued.
+            waitable_event *const b = bw->initial_event;
+            FLARE_SCOPED_LOCK(b->waiter_lock);
+            if (bw->container.load(std::memory_order_relaxed) == NULL) {
+                if (!bw->queued && bw->waiter_state == WAITER_STATE_READY) {
+                    bw->waiter_state = WAITER_STATE_TIMEDOUT;
+                }
+                // Otherwise the waiter was woken up already.
+                return;
+            }
+            // Queued just now, erase it again.
+        }
     }
 
 // Used in task_group.cpp
@@ -490,9 +582,9 @@ namespace flare::fiber_internal {
         //                                      tt_lock { get task }
         //                                      waiter_lock { waiter_state=TIMEDOUT }
         //    waiter_lock { use waiter_state }
-        // tt_lock represents TimerThread::_mutex. Visibility of waiter_state is
-        // sequenced by two locks, both threads are guaranteed to see the correct
-        // value.
+        // tt_lock represents TimerThread::_mutex or WorkerTimerQueue::_mutex.
+        // Visibility of waiter_state is sequenced by two locks, both threads
+        // are guaranteed to see the correct value.
         {
             FLARE_SCOPED_LOCK(b->waiter_lock);
             if (b->value.load(std::memory_order_relaxed) != bw->expected_value) {
@@ -501,6 +593,7 @@ namespace flare::fiber_internal {
                        !bw->task_meta->interrupted) {
                 b->waiters.append(bw);
                 bw->container.store(b, std::memory_order_relaxed);
+                bw->queued = true;
                 return;
             }
         }
@@ -509,7 +602,7 @@ namespace flare::fiber_internal {
         // fiber_worker::interrupt() no-op, there's no race between following code and
         // the two functions. The on-stack event_fiber_waiter is safe to use and
         // bw->waiter_state will not change again.
-        unsleep_if_necessary(bw, get_global_timer_thread());
+        unsleep_if_necessary(bw);
         tls_task_group->ready_to_run(bw->tid);
         // FIXME: jump back to original thread is buggy.
 
@@ -524,7 +617,7 @@ namespace flare::fiber_internal {
     }
 
     static int event_wait_from_pthread(fiber_worker *g, waitable_event *b, int expected_value,
-                                       const timespec *abstime) {
+                                       const timespec *abstime, bool *requeued) {
         // sys futex needs relative timeout.
         // Compute diff between abstime and now.
         timespec *ptimeout = NULL;
@@ -543,6 +636,7 @@ namespace flare::fiber_internal {
         fiber_entity *task = NULL;
         event_pthread_waiter pw;
         pw.tid = 0;
+        pw.requeued = false;
         pw.sig.store(PTHREAD_NOT_SIGNALLED, std::memory_order_relaxed);
         int rc = 0;
 
@@ -574,6 +668,9 @@ namespace flare::fiber_internal {
 #ifdef SHOW_FIBER_EVENT_WAITER_COUNT_IN_VARS
             num_waiters << -1;
 #endif
+            if (requeued != NULL) {
+                *requeued = (rc == 0 && pw.requeued);
+            }
         }
         if (task) {
             // If current_waiter is NULL, fiber_worker::interrupt() is running and
@@ -592,7 +689,42 @@ namespace flare::fiber_internal {
         return rc;
     }
 
-    int waitable_event_wait(void *arg, int expected_value, const timespec *abstime) {
+    int waitable_event_wait_async(void *arg, int expected_value,
+                                  void (*on_wakeup)(void *), void *on_wakeup_arg) {
+        waitable_event *b = FLARE_CONTAINER_OF(static_cast<std::atomic<int> *>(arg), waitable_event, value);
+        if (b->value.load(std::memory_order_relaxed) != expected_value) {
+            errno = EWOULDBLOCK;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return -1;
+        }
+        event_callback_waiter *cw = flare::get_object<event_callback_waiter>();
+        if (cw == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        cw->tid = CALLBACK_WAITER_TID;
+        cw->requeued = false;
+        cw->on_wakeup = on_wakeup;
+        cw->arg = on_wakeup_arg;
+        {
+            FLARE_SCOPED_LOCK(b->waiter_lock);
+            if (b->value.load(std::memory_order_relaxed) == expected_value) {
+                b->waiters.append(cw);
+                cw->container.store(b, std::memory_order_relaxed);
+                // `cw' may be woken up and returned from now on.
+                return 0;
+            }
+        }
+        flare::return_object(cw);
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    int waitable_event_wait(void *arg, int expected_value, const timespec *abstime,
+                            bool *requeued) {
+        if (requeued != NULL) {
+            *requeued = false;
+        }
         waitable_event *b = FLARE_CONTAINER_OF(static_cast<std::atomic<int> *>(arg), waitable_event, value);
         if (b->value.load(std::memory_order_relaxed) != expected_value) {
             errno = EWOULDBLOCK;
@@ -603,15 +735,17 @@ namespace flare::fiber_internal {
         }
         fiber_worker *g = tls_task_group;
         if (NULL == g || g->is_current_pthread_task()) {
-            return event_wait_from_pthread(g, b, expected_value, abstime);
+            return event_wait_from_pthread(g, b, expected_value, abstime, requeued);
         }
         event_fiber_waiter bbw;
         // tid is 0 iff the thread is non-fiber
         bbw.tid = g->current_fid();
         bbw.container.store(NULL, std::memory_order_relaxed);
+        bbw.requeued = false;
         bbw.task_meta = g->current_task();
         bbw.sleep_id = 0;
         bbw.waiter_state = WAITER_STATE_READY;
+        bbw.queued = false;
         bbw.expected_value = expected_value;
         bbw.initial_event = b;
         bbw.control = g->control();
@@ -625,7 +759,7 @@ namespace flare::fiber_internal {
                 errno = ETIMEDOUT;
                 return -1;
             }
-            bbw.sleep_id = get_global_timer_thread()->schedule(
+            bbw.sleep_id = g->schedule_timer(
                     erase_from_event_and_wakeup, &bbw, *abstime);
             if (!bbw.sleep_id) {  // TimerThread stopped.
                 errno = ESTOP;
@@ -640,12 +774,13 @@ namespace flare::fiber_internal {
         // release fence matches with acquire fence in interrupt_and_consume_waiters
         // in task_group.cpp to guarantee visibility of `interrupted'.
         bbw.task_meta->current_waiter.store(&bbw, std::memory_order_release);
+        g->trace(SCHED_EVENT_BUTEX_WAIT, bbw.tid);
         g->set_remained(wait_for_event, &bbw);
         fiber_worker::sched(&g);
 
-        // erase_from_event_and_wakeup (called by TimerThread) is possibly still
+        // erase_from_event_and_wakeup (called by the timer) is possibly still
         // running and using bbw. The chance is small, just spin until it's done.
-        BT_LOOP_WHEN(unsleep_if_necessary(&bbw, get_global_timer_thread()) < 0,
+        BT_LOOP_WHEN(unsleep_if_necessary(&bbw) < 0,
                      30/*nops before sched_yield*/);
 
         // If current_waiter is NULL, fiber_worker::interrupt() is running and using bbw.
@@ -674,6 +809,9 @@ namespace flare::fiber_internal {
             errno = EINTR;
             return -1;
         }
+        if (requeued != NULL) {
+            *requeued = bbw.requeued;
+        }
         return 0;
     }
 
@@ -24,9 +24,12 @@ namespace flare::fiber_internal {
     // Destroy the event.
     void waitable_event_destroy(void *event);
 
-    // Wake up at most 1 thread waiting on |event|.
+    // Wake up at most 1 thread waiting on |event|. A fiber woken in a worker
+    // runs at once, the caller is queued instead. If |nosignal| is true,
+    // the woken fiber is queued without switching to it or signaling other
+    // workers, call fiber_flush() to signal them after waking a batch.
     // Returns # of threads woken up.
-    int waitable_event_wake(void *event);
+    int waitable_event_wake(void *event, bool nosignal = false);
 
     // Wake up all threads waiting on |event|.
     // Returns # of threads woken up.
@@ -38,7 +41,8 @@ namespace flare::fiber_internal {
     int waitable_event_wake_except(void *event, fiber_id_t excluded_fiber);
 
     // Wake up at most 1 thread waiting on |butex1|, let all other threads wait
-    // on |butex2| instead.
+    // on |butex2| instead. Stackless waiters (waitable_event_wait_async) are
+    // woken up rather than moved.
     // Returns # of threads woken up.
     int waitable_event_requeue(void *event1, void *event2);
 
@@ -47,8 +51,21 @@ namespace flare::fiber_internal {
     // abstime is not NULL.
     // About |abstime|:
     //   Different from FUTEX_WAIT, waitable_event_wait uses absolute time.
+    // If |requeued| is not NULL, it's set to true when the waiter is woken up
+    // on the event it was moved to by waitable_event_requeue().
     // Returns 0 on success, -1 otherwise and errno is set.
-    int waitable_event_wait(void *event, int expected_value, const timespec *abstime);
+    int waitable_event_wait(void *event, int expected_value, const timespec *abstime,
+                            bool *requeued = NULL);
+
+    // Stackless version of waitable_event_wait() for waiters that can't block,
+    // e.g. coroutines. If *event equals |expected_value|, queue a waiter which
+    // calls `on_wakeup(arg)' once woken up by waitable_event_wake*, in the
+    // context of the waking thread, and return 0. The waiter does not time out
+    // and is not affected by fiber_interrupt().
+    // Returns -1 and sets errno to EWOULDBLOCK if *event does not match, in
+    // which case `on_wakeup' is never called.
+    int waitable_event_wait_async(void *event, int expected_value,
+                                  void (*on_wakeup)(void *), void *arg);
 
 }  // namespace flare::fiber_internal
 
@@ -0,0 +1,196 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>                            // std::push_heap
+#include <gflags/gflags.h>
+#include "flare/base/scoped_lock.h"
+#include "flare/log/logging.h"
+#include "flare/memory/resource_pool.h"
+#include "flare/fiber/internal/worker_timer.h"
+
+namespace flare::fiber_internal {
+
+    DEFINE_bool(fiber_worker_timer, true, "Timers of fibers sleeping or waiting "
+                "with timeouts are run by the workers running the fibers, "
+                "otherwise by the global TimerThread");
+    DEFINE_int32(fiber_worker_timer_rescue_us, 1000, "Timers overdue for so "
+                 "many microseconds are run by idle workers or TimerThread "
+                 "instead, since their worker is busy or blocked");
+
+    struct FLARE_CACHELINE_ALIGNMENT WorkerTimerQueue::Task {
+        int64_t run_time;           // run the task at this realtime
+        void (*fn)(void *);         // the fn(arg) to run
+        void *arg;
+        // Current TaskId, see TimerThread::Task.
+        TaskId task_id;
+        // Same as TimerThread::Task::version except that versions are odd,
+        // which distinguishes the TaskIds from ones of TimerThread.
+        std::atomic<uint32_t> version;
+
+        Task() : version(1) {}
+
+        // Run this task and delete this struct.
+        // Returns true if fn(arg) did run.
+        bool run_and_delete();
+    };
+
+    inline WorkerTimerQueue::TaskId make_worker_task_id(
+            flare::ResourceId<WorkerTimerQueue::Task> slot, uint32_t version) {
+        return WorkerTimerQueue::TaskId((((uint64_t) version) << 32) | slot.value);
+    }
+
+    inline flare::ResourceId<WorkerTimerQueue::Task>
+    slot_of_worker_task_id(WorkerTimerQueue::TaskId id) {
+        flare::ResourceId<WorkerTimerQueue::Task> slot = {(id & 0xFFFFFFFFul)};
+        return slot;
+    }
+
+    inline uint32_t version_of_worker_task_id(WorkerTimerQueue::TaskId id) {
+        return (uint32_t) (id >> 32);
+    }
+
+    inline bool worker_task_greater(const WorkerTimerQueue::Task *a,
+                                    const WorkerTimerQueue::Task *b) {
+        return a->run_time > b->run_time;
+    }
+
+    bool WorkerTimerQueue::Task::run_and_delete() {
+        const uint32_t id_version = version_of_worker_task_id(task_id);
+        uint32_t expected_version = id_version;
+        if (version.compare_exchange_strong(
+                expected_version, id_version + 1, std::memory_order_relaxed)) {
+            fn(arg);
+            // Paired with the acquire fence in WorkerTimerQueue::unschedule.
+            version.store(id_version + 2, std::memory_order_release);
+            flare::return_resource(slot_of_worker_task_id(task_id));
+            return true;
+        } else if (expected_version == id_version + 2) {
+            // already unscheduled.
+            flare::return_resource(slot_of_worker_task_id(task_id));
+            return false;
+        } else {
+            // Impossible.
+            FLARE_LOG(ERROR) << "Invalid version=" << expected_version
+                             << ", expecting " << id_version + 2;
+            return false;
+        }
+    }
+
+    WorkerTimerQueue::WorkerTimerQueue()
+            : _nearest_run_time(std::numeric_limits<int64_t>::max()) {
+    }
+
+    WorkerTimerQueue::~WorkerTimerQueue() {
+        FLARE_DLOG_IF(WARNING, !_tasks.empty())
+            << "Destroy WorkerTimerQueue with " << _tasks.size() << " timers";
+    }
+
+    WorkerTimerQueue::TaskId WorkerTimerQueue::schedule(
+            void (*fn)(void *), void *arg, int64_t run_time) {
+        flare::ResourceId<Task> slot_id;
+        Task *task = flare::get_resource<Task>(&slot_id);
+        if (task == nullptr) {
+            return TimerThread::INVALID_TASK_ID;
+        }
+        task->run_time = run_time;
+        task->fn = fn;
+        task->arg = arg;
+        const uint32_t version = task->version.load(std::memory_order_relaxed);
+        const TaskId id = make_worker_task_id(slot_id, version);
+        task->task_id = id;
+        FLARE_SCOPED_LOCK(_mutex);
+        _tasks.push_back(task);
+        std::push_heap(_tasks.begin(), _tasks.end(), worker_task_greater);
+        if (_tasks[0] == task) {
+            _nearest_run_time.store(run_time, std::memory_order_relaxed);
+        }
+        return id;
+    }
+
+    int WorkerTimerQueue::run_timers(int64_t now_us, bool try_lock) {
+        int nrun = 0;
+        while (nearest_run_time() <= now_us) {
+            Task *task = nullptr;
+            {
+                std::unique_lock<internal::FastPthreadMutex> lk(_mutex, std::defer_lock);
+                if (!try_lock) {
+                    lk.lock();
+                } else if (!lk.try_lock()) {
+                    break;
+                }
+                if (_tasks.empty() || _tasks[0]->run_time > now_us) {
+                    break;
+                }
+                std::pop_heap(_tasks.begin(), _tasks.end(), worker_task_greater);
+                task = _tasks.back();
+                _tasks.pop_back();
+                _nearest_run_time.store(
+                        _tasks.empty() ? std::numeric_limits<int64_t>::max()
+                                       : _tasks[0]->run_time,
+                        std::memory_order_relaxed);
+            }
+            // Run without the lock, fn may wake up fibers which take long.
+            nrun += task->run_and_delete();
+        }
+        return nrun;
+    }
+
+    static void run_handed_over_task(void *arg) {
+        static_cast<WorkerTimerQueue::Task *>(arg)->run_and_delete();
+    }
+
+    void WorkerTimerQueue::hand_over(TimerThread *timer_thread) {
+        std::vector<Task *> tasks;
+        {
+            FLARE_SCOPED_LOCK(_mutex);
+            tasks.swap(_tasks);
+            _nearest_run_time.store(std::numeric_limits<int64_t>::max(),
+                                    std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            // TaskIds are unchanged, unschedule() still works on the tasks.
+            Task *task = tasks[i];
+            if (!timer_thread->schedule(
+                    run_handed_over_task, task,
+                    flare::time_point::from_unix_micros(task->run_time).to_timespec())) {
+                task->run_and_delete();
+            }
+        }
+    }
+
+    int WorkerTimerQueue::unschedule(TaskId task_id) {
+        const flare::ResourceId<Task> slot_id = slot_of_worker_task_id(task_id);
+        Task *const task = flare::address_resource(slot_id);
+        if (task == nullptr) {
+            FLARE_LOG(ERROR) << "Invalid task_id=" << task_id;
+            return -1;
+        }
+        const uint32_t id_version = version_of_worker_task_id(task_id);
+        uint32_t expected_version = id_version;
+        // The acquire fence is paired with release fence in
+        // Task::run_and_delete to make sure that we see all changes brought
+        // by fn(arg).
+        if (task->version.compare_exchange_strong(
+                expected_version, id_version + 2,
+                std::memory_order_acquire)) {
+            return 0;
+        }
+        return (expected_version == id_version + 1) ? 1 : -1;
+    }
+
+}  // namespace flare::fiber_internal
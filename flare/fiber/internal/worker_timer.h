@@ -0,0 +1,87 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_FIBER_INTERNAL_WORKER_TIMER_H_
+#define FLARE_FIBER_INTERNAL_WORKER_TIMER_H_
+
+#include <vector>                               // std::vector
+#include <limits>                               // std::numeric_limits
+#include <gflags/gflags_declare.h>
+#include "flare/base/static_atomic.h"
+#include "flare/fiber/internal/mutex.h"
+#include "flare/fiber/internal/timer_thread.h"
+
+namespace flare::fiber_internal {
+
+    DECLARE_bool(fiber_worker_timer);
+    DECLARE_int32(fiber_worker_timer_rescue_us);
+
+    // Timers owned by a fiber_worker. Fibers sleeping or waiting with timeouts
+    // add timers into the queue of the worker running them, and the worker runs
+    // the timers in its scheduling loop, so that expired fibers are pushed into
+    // the local runqueue instead of being woken up by TimerThread remotely.
+    // Timers are only added by the owner, but can be unscheduled from any
+    // thread, and run by peer workers when the owner is busy or blocked.
+    class WorkerTimerQueue {
+    public:
+        struct Task;
+        typedef TimerThread::TaskId TaskId;
+
+        WorkerTimerQueue();
+
+        ~WorkerTimerQueue();
+
+        // Realtime in microseconds of the earliest timer, max of int64_t if
+        // there's no timer. The timer may be unscheduled already.
+        int64_t nearest_run_time() const {
+            return _nearest_run_time.load(std::memory_order_relaxed);
+        }
+
+        // Schedule `fn(arg)' to run at realtime `run_time' in microseconds.
+        // Called by the owner worker only.
+        // Returns: identifier of the timer, INVALID_TASK_ID on error.
+        TaskId schedule(void (*fn)(void *), void *arg, int64_t run_time);
+
+        // Run timers whose run times are not after `now_us'. If `try_lock' is
+        // true, give up when the queue is being accessed by another thread.
+        // Returns number of timers run.
+        int run_timers(int64_t now_us, bool try_lock = false);
+
+        // Move all timers into `timer_thread', called when the owner quits.
+        void hand_over(TimerThread *timer_thread);
+
+        // Same as TimerThread::unschedule(), callable from any thread.
+        static int unschedule(TaskId task_id);
+
+        // True if `task_id' was returned by WorkerTimerQueue::schedule()
+        // rather than TimerThread::schedule().
+        static bool owns(TaskId task_id) {
+            // Versions of tasks in TimerThread are always even.
+            return (task_id >> 32) & 1;
+        }
+
+    private:
+        internal::FastPthreadMutex _mutex;
+        std::atomic<int64_t> _nearest_run_time;
+        // Min-heap on run times.
+        std::vector<Task *> _tasks;
+    };
+
+}  // namespace flare::fiber_internal
+
+#endif  // FLARE_FIBER_INTERNAL_WORKER_TIMER_H_
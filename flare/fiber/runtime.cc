@@ -2,7 +2,14 @@
 // Created by liyinbin on 2022/2/21.
 //
 
+#include "flare/fiber/runtime.h"
+#include <errno.h>
 #include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/internal/schedule_group.h"
+
+namespace flare::fiber_internal {
+    extern schedule_group *g_task_control;
+}  // namespace flare::fiber_internal
 
 namespace flare {
 
@@ -14,4 +21,13 @@ namespace flare {
         return ::fiber_setconcurrency(num);
     }
 
+    int fiber_dump_sched_trace(std::ostream &os) {
+        fiber_internal::schedule_group *c = fiber_internal::g_task_control;
+        if (c == nullptr) {
+            return EPERM;
+        }
+        c->dump_sched_trace(os);
+        return 0;
+    }
+
 }  // namespace flare
@@ -5,6 +5,8 @@
 #ifndef FLARE_FIBER_RUNTIME_H_
 #define FLARE_FIBER_RUNTIME_H_
 
+#include <ostream>
+
 namespace flare {
 
 
@@ -18,8 +20,15 @@ namespace flare {
     // Set number of worker pthreads to `num'. After a successful call,
     // fiber_getconcurrency() shall return new set number, but workers may
     // take some time to quit or create.
-    // NOTE: currently concurrency cannot be reduced after any fiber created.
+    // Reducing concurrency retires workers, which hand over their queued fibers
+    // to others and quit after the fibers running on them yield.
     int fiber_setconcurrency(int num);
 
+    // Write scheduling events recently recorded by workers as Chrome
+    // trace-event JSON, which can be opened in chrome://tracing or Perfetto.
+    // Events are recorded only when -fiber_enable_sched_trace is on.
+    // Returns 0 on success, EPERM if no fiber was ever created.
+    int fiber_dump_sched_trace(std::ostream &os);
+
 }  // namespace flare
 #endif // FLARE_FIBER_RUNTIME_H_
@@ -5,6 +5,8 @@
 #include "flare/files/random_access_file.h"
 #include "flare/log/logging.h"
 #include "flare/base/errno.h"
+#include "flare/io/reader_writer.h"
+#include "flare/fiber/internal/unstable.h"
 #include <cstdio>
 #include <unistd.h>
 #include <fcntl.h>
@@ -13,6 +15,21 @@
 
 namespace flare {
 
+    namespace {
+        // Reads at the given offset without blocking the fiber worker.
+        class fiber_pread_reader : public base_reader {
+        public:
+            fiber_pread_reader(int fd, off_t offset) : _fd(fd), _offset(offset) {}
+
+            ssize_t readv(const iovec *iov, int iovcnt) override {
+                return fiber_io_readv(_fd, iov, iovcnt, _offset);
+            }
+
+        private:
+            int _fd;
+            off_t _offset;
+        };
+    }  // namespace
 
     random_access_file::~random_access_file() {
         if (_fd > 0) {
@@ -48,7 +65,8 @@ namespace flare {
         flare_status frs;
         off_t cur_off = offset;
         while (left > 0) {
-            ssize_t read_len = portal.pappend_from_file_descriptor(_fd, cur_off, static_cast<size_t>(left));
+            fiber_pread_reader reader(_fd, cur_off);
+            ssize_t read_len = portal.append_from_reader(&reader, static_cast<size_t>(left));
             if (read_len > 0) {
                 left -= read_len;
                 cur_off += read_len;
@@ -5,6 +5,8 @@
 #include "flare/files/sequential_read_file.h"
 #include "flare/log/logging.h"
 #include "flare/base/errno.h"
+#include "flare/io/reader_writer.h"
+#include "flare/fiber/internal/unstable.h"
 #include <cstdio>
 #include <unistd.h>
 #include <fcntl.h>
@@ -13,6 +15,21 @@
 
 namespace flare {
 
+    namespace {
+        // Reads from the current offset without blocking the fiber worker.
+        class fiber_fd_reader : public base_reader {
+        public:
+            explicit fiber_fd_reader(int fd) : _fd(fd) {}
+
+            ssize_t readv(const iovec *iov, int iovcnt) override {
+                return fiber_io_readv(_fd, iov, iovcnt, -1);
+            }
+
+        private:
+            int _fd;
+        };
+    }  // namespace
+
     sequential_read_file::~sequential_read_file() {
         if (_fd > 0) {
             ::close(_fd);
@@ -45,8 +62,9 @@ namespace flare {
         ssize_t left = n;
         flare::IOPortal portal;
         flare_status frs;
+        fiber_fd_reader reader(_fd);
         while (left > 0) {
-            ssize_t read_len = portal.append_from_file_descriptor(_fd, static_cast<size_t>(left));
+            ssize_t read_len = portal.append_from_reader(&reader, static_cast<size_t>(left));
             if (read_len > 0) {
                 left -= read_len;
             } else if (read_len == 0) {
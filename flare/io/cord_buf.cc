@@ -25,6 +25,7 @@
 #include <errno.h>                         // errno
 #include <limits.h>                        // CHAR_BIT
 #include <stdexcept>                       // std::invalid_argument
+#include <gflags/gflags.h>
 #include "flare/base/static_atomic.h"                // std::atomic
 #include "flare/thread/thread.h"             // thread_atexit
 #include "flare/log/logging.h"                  // FLARE_CHECK, FLARE_LOG
@@ -32,6 +33,10 @@
 #include "flare/io/cord_buf.h"
 #include "flare/base/profile.h"
 
+DEFINE_int32(cord_buf_max_blocks_per_thread, 8,
+             "Max number of non-full cord_buf blocks cached by each thread for "
+             "appending. This is a soft limit.");
+
 namespace flare {
 
     namespace iobuf {
@@ -185,11 +190,17 @@ namespace flare {
     }
 
     const uint16_t CORD_BUF_BLOCK_FLAGS_USER_DATA = 0x1;
+    // Set along with CORD_BUF_BLOCK_FLAGS_USER_DATA, the deleter takes meta.
+    const uint16_t CORD_BUF_BLOCK_FLAGS_USER_DATA_META = 0x2;
 
     typedef void (*UserDataDeleter)(void *);
 
+    typedef void (*UserDataMetaDeleter)(void *, void *);
+
     struct UserDataExtension {
         UserDataDeleter deleter;
+        UserDataMetaDeleter meta_deleter;
+        void *meta;
     };
 
     struct cord_buf::Block {
@@ -217,6 +228,13 @@ namespace flare {
             get_user_data_extension()->deleter = deleter;
         }
 
+        Block(char *data_in, uint32_t data_size, UserDataMetaDeleter deleter, void *meta)
+                : nshared(1), flags(CORD_BUF_BLOCK_FLAGS_USER_DATA | CORD_BUF_BLOCK_FLAGS_USER_DATA_META),
+                  abi_check(0), size(data_size), cap(data_size), portal_next(NULL), data(data_in) {
+            get_user_data_extension()->meta_deleter = deleter;
+            get_user_data_extension()->meta = meta;
+        }
+
         // Undefined behavior when (flags & CORD_BUF_BLOCK_FLAGS_USER_DATA) is 0.
         UserDataExtension *get_user_data_extension() {
             char *p = (char *) this;
@@ -247,6 +265,10 @@ namespace flare {
                                                 std::memory_order_relaxed);
                     this->~Block();
                     iobuf::blockmem_deallocate(this);
+                } else if (flags & CORD_BUF_BLOCK_FLAGS_USER_DATA_META) {
+                    get_user_data_extension()->meta_deleter(data, get_user_data_extension()->meta);
+                    this->~Block();
+                    free(this);
                 } else if (flags & CORD_BUF_BLOCK_FLAGS_USER_DATA) {
                     get_user_data_extension()->deleter(data);
                     this->~Block();
@@ -299,9 +321,9 @@ namespace flare {
         }
 
         // === Share TLS blocks between appending operations ===
-        // Max number of blocks in each TLS. This is a soft limit namely
-        // release_tls_block_chain() may exceed this limit sometimes.
-        const int MAX_BLOCKS_PER_THREAD = 8;
+        // Max number of blocks in each TLS is -cord_buf_max_blocks_per_thread.
+        // This is a soft limit namely release_tls_block_chain() may exceed this
+        // limit sometimes.
 
         struct TLSData {
             // Head of the TLS block chain.
@@ -385,7 +407,7 @@ namespace flare {
             TLSData &tls_data = g_tls_data;
             if (b->full()) {
                 b->dec_ref();
-            } else if (tls_data.num_blocks >= MAX_BLOCKS_PER_THREAD) {
+            } else if (tls_data.num_blocks >= FLAGS_cord_buf_max_blocks_per_thread) {
                 b->dec_ref();
                 g_num_hit_tls_threshold.fetch_add(1, std::memory_order_relaxed);
             } else {
@@ -404,7 +426,7 @@ namespace flare {
         void release_tls_block_chain(cord_buf::Block *b) {
             TLSData &tls_data = g_tls_data;
             size_t n = 0;
-            if (tls_data.num_blocks >= MAX_BLOCKS_PER_THREAD) {
+            if (tls_data.num_blocks >= FLAGS_cord_buf_max_blocks_per_thread) {
                 do {
                     ++n;
                     cord_buf::Block *const saved_next = b->portal_next;
@@ -849,61 +871,28 @@ namespace flare {
     }
 
     int cord_buf::_cut_by_char(cord_buf *out, char d) {
-        const size_t nref = _ref_num();
-        size_t n = 0;
-
-        for (size_t i = 0; i < nref; ++i) {
-            cord_buf::BlockRef const &r = _ref_at(i);
-            char const *const s = r.block->data + r.offset;
-            for (uint32_t j = 0; j < r.length; ++j, ++n) {
-                if (s[j] == d) {
-                    // There's no way cutn/pop_front fails
-                    cutn(out, n);
-                    pop_front(1);
-                    return 0;
-                }
-            }
+        const size_t n = find(d);
+        if (n == npos) {
+            return -1;
         }
-
-        return -1;
+        // There's no way cutn/pop_front fails
+        cutn(out, n);
+        pop_front(1);
+        return 0;
     }
 
     int cord_buf::_cut_by_delim(cord_buf *out, char const *dbegin, size_t ndelim) {
-        typedef unsigned long SigType;
-        const size_t NMAX = sizeof(SigType);
-
-        if (ndelim > NMAX || ndelim > length()) {
+        if (ndelim == 0) {
             return -1;
         }
-
-        SigType dsig = 0;
-        for (size_t i = 0; i < ndelim; ++i) {
-            dsig = (dsig << CHAR_BIT) | static_cast<SigType>(dbegin[i]);
-        }
-
-        const SigType SIGMASK =
-                (ndelim == NMAX ? (SigType) -1 : (((SigType) 1 << (ndelim * CHAR_BIT)) - 1));
-
-        const size_t nref = _ref_num();
-        SigType sig = 0;
-        size_t n = 0;
-
-        for (size_t i = 0; i < nref; ++i) {
-            cord_buf::BlockRef const &r = _ref_at(i);
-            char const *const s = r.block->data + r.offset;
-
-            for (uint32_t j = 0; j < r.length; ++j, ++n) {
-                sig = ((sig << CHAR_BIT) | static_cast<SigType>(s[j])) & SIGMASK;
-                if (sig == dsig) {
-                    // There's no way cutn/pop_front fails
-                    cutn(out, n + 1 - ndelim);
-                    pop_front(ndelim);
-                    return 0;
-                }
-            }
+        const size_t n = find(std::string_view(dbegin, ndelim));
+        if (n == npos) {
+            return -1;
         }
-
-        return -1;
+        // There's no way cutn/pop_front fails
+        cutn(out, n);
+        pop_front(ndelim);
+        return 0;
     }
 
 // Since cut_into_file_descriptor() allocates iovec on stack, IOV_MAX=1024
@@ -1212,6 +1201,26 @@ namespace flare {
         return 0;
     }
 
+    int cord_buf::append_user_data_with_meta(void *data, size_t size,
+                                             void (*deleter)(void *, void *), void *meta) {
+        if (size > 0xFFFFFFFFULL - 100) {
+            FLARE_LOG(FATAL) << "data_size=" << size << " is too large";
+            return -1;
+        }
+        if (deleter == NULL) {
+            FLARE_LOG(ERROR) << "deleter is NULL";
+            return -1;
+        }
+        char *mem = (char *) malloc(sizeof(cord_buf::Block) + sizeof(UserDataExtension));
+        if (mem == NULL) {
+            return -1;
+        }
+        cord_buf::Block *b = new(mem) cord_buf::Block((char *) data, size, deleter, meta);
+        const cord_buf::BlockRef r = {0, b->cap, b};
+        _move_back_ref(r);
+        return 0;
+    }
+
     int cord_buf::resize(size_t n, char c) {
         const size_t saved_len = length();
         if (n < saved_len) {
@@ -1474,6 +1483,17 @@ namespace flare {
         return std::string_view();
     }
 
+    void *cord_buf::backing_block_meta(size_t i, void (*deleter)(void *, void *)) const {
+        if (i < _ref_num()) {
+            Block *b = _ref_at(i).block;
+            if ((b->flags & CORD_BUF_BLOCK_FLAGS_USER_DATA_META) &&
+                b->get_user_data_extension()->meta_deleter == deleter) {
+                return b->get_user_data_extension()->meta;
+            }
+        }
+        return NULL;
+    }
+
     bool cord_buf::equals(const flare::cord_buf &other) const {
         const size_t sz1 = size();
         if (sz1 != other.size()) {
@@ -66,6 +66,7 @@ namespace flare {
     public:
         static const size_t DEFAULT_BLOCK_SIZE = 8192;
         static const size_t INITIAL_CAP = 32; // must be power of 2
+        static constexpr size_t npos = (size_t) -1;
 
         struct Block;
 
@@ -259,6 +260,12 @@ namespace flare {
         // deleted using the deleter func when no cord_buf references it anymore.
         int append_user_data(void *data, size_t size, void (*deleter)(void *));
 
+        // Like append_user_data, but `deleter' is called with `data' and
+        // `meta', which can be read back by backing_block_meta().
+        // Returns 0 on success, -1 otherwise.
+        int append_user_data_with_meta(void *data, size_t size,
+                                       void (*deleter)(void *data, void *meta), void *meta);
+
         // Resizes the buf to a length of n characters.
         // If n is smaller than the current length, all bytes after n will be
         // truncated.
@@ -361,6 +368,33 @@ namespace flare {
 
         static size_t block_count_hit_tls_threshold();
 
+        // Stats of the block pool, see flare/io/cord_buf_block_pool.h
+        // Memory of slabs mapped.
+        static size_t block_pool_memory();
+
+        // Memory of slabs backed by MAP_HUGETLB.
+        static size_t block_pool_huge_page_memory();
+
+        // Number of free blocks in the pool, not including the ones cached by
+        // threads.
+        static size_t block_pool_free_count();
+
+        // Number of blocks freed by threads on other NUMA nodes than the blocks.
+        static size_t block_pool_remote_free_count();
+
+        // Find the first byte equal to `c' at or after offset `pos'.
+        // Returns offset of the byte, npos when not found.
+        size_t find(char c, size_t pos = 0) const;
+
+        // Find the first occurrence of `delim' at or after offset `pos',
+        // the occurrence may span backing blocks.
+        // Returns offset of the occurrence, npos when not found.
+        size_t find(const std::string_view &delim, size_t pos = 0) const;
+
+        // Find the first byte equal to any byte in `chars' at or after offset
+        // `pos'. Returns offset of the byte, npos when not found.
+        size_t find_first_of(const std::string_view &chars, size_t pos = 0) const;
+
         // Equal with a string/cord_buf or not.
         bool equals(const std::string_view &) const;
 
@@ -372,6 +406,11 @@ namespace flare {
         // Get #i backing_block, an empty std::string_view is returned if no such block
         std::string_view backing_block(size_t i) const;
 
+        // Get `meta' of the user-data referenced by #i backing_block if it's
+        // appended by append_user_data_with_meta() with `deleter', NULL
+        // otherwise.
+        void *backing_block_meta(size_t i, void (*deleter)(void *, void *)) const;
+
         // Make a movable version of self
         Movable movable() { return Movable(*this); }
 
@@ -779,6 +818,11 @@ namespace flare {
 
         bool forward_one_block(const void **data, size_t *size);
 
+        // Forward this iterator to the first byte equal to `c'. If there's
+        // no such byte, all bytes are forwarded.
+        // Returns bytes forwarded.
+        size_t forward_to(char c);
+
         size_t bytes_left() const { return _bytes_left; }
 
     private:
@@ -0,0 +1,379 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/io/cord_buf_block_pool.h"
+#include <sys/mman.h>                      // mmap
+#include <sched.h>                         // sched_getcpu
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>                        // malloc
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include "flare/base/profile.h"
+#include "flare/io/cord_buf.h"
+#include "flare/log/logging.h"
+#include "flare/thread/affinity.h"         // flare::core_affinity
+#include "flare/thread/thread.h"           // flare::thread::atexit
+
+namespace flare::iobuf {
+
+    extern void *(*blockmem_allocate)(size_t);
+
+    extern void (*blockmem_deallocate)(void *);
+
+    namespace {
+
+        const size_t SLAB_SIZE = 2 * 1024 * 1024;
+        const size_t BLOCKS_PER_SLAB = SLAB_SIZE / cord_buf::DEFAULT_BLOCK_SIZE;
+        const int MAX_NUMA_NODES = 16;
+
+        // Free blocks are linked through their first bytes.
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        struct FLARE_CACHELINE_ALIGNMENT NodeFreeList {
+            std::mutex mutex;
+            FreeBlock *head = nullptr;
+            // Modified with mutex held, atomic for the stats.
+            std::atomic<size_t> count{0};
+        };
+
+        struct BlockPool {
+            block_pool_options options;
+            // Reserved address space of max_slabs slabs starting at base.
+            char *base = nullptr;
+            size_t max_slabs = 0;
+            std::atomic<size_t> next_slab{0};
+            // NUMA node of each slab.
+            uint8_t *slab_node = nullptr;
+            // NUMA node of each CPU, all 0 if there's only one node.
+            uint8_t cpu_node[CPU_SETSIZE] = {};
+            bool numa = false;
+            NodeFreeList nodes[MAX_NUMA_NODES];
+            std::atomic<size_t> nslab{0};
+            std::atomic<size_t> nhuge_page_slab{0};
+            std::atomic<size_t> nremote_free{0};
+
+            bool owns(const void *p) const {
+                return (const char *) p >= base &&
+                       (const char *) p < base + max_slabs * SLAB_SIZE;
+            }
+
+            int node_of(const void *p) const {
+                return slab_node[((const char *) p - base) / SLAB_SIZE];
+            }
+        };
+
+        std::atomic<BlockPool *> g_pool{nullptr};
+        std::mutex g_enable_mutex;
+
+        struct TLSCache {
+            FreeBlock *head;
+            int count;
+            bool registered;
+            // Set when the thread is exiting, blocks freed after that go to
+            // the pool directly.
+            bool exiting;
+        };
+
+        __thread TLSCache tls_cache = {nullptr, 0, false, false};
+
+        int current_numa_node(const BlockPool *pool) {
+            if (!pool->numa) {
+                return 0;
+            }
+            const int cpu = sched_getcpu();
+            if (cpu < 0 || cpu >= CPU_SETSIZE) {
+                return 0;
+            }
+            return pool->cpu_node[cpu];
+        }
+
+        void init_cpu_node(BlockPool *pool) {
+            // CPUs not found in any node stay in node 0.
+            for (int node = 1; node < MAX_NUMA_NODES; ++node) {
+                const core_affinity cores = core_affinity::numa_node_cores(node);
+                for (size_t i = 0; i < cores.count(); ++i) {
+                    const int cpu = cores[i].index;
+                    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                        pool->cpu_node[cpu] = node;
+                        pool->numa = true;
+                    }
+                }
+            }
+        }
+
+        // Map a new slab and return its blocks, NULL if address space is used up.
+        FreeBlock *allocate_slab(BlockPool *pool, int node) {
+            const size_t index = pool->next_slab.fetch_add(1, std::memory_order_relaxed);
+            if (index >= pool->max_slabs) {
+                return nullptr;
+            }
+            char *const slab = pool->base + index * SLAB_SIZE;
+            void *mem = MAP_FAILED;
+            if (pool->options.use_huge_pages) {
+                mem = mmap(slab, SLAB_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0);
+            }
+            if (mem != MAP_FAILED) {
+                pool->nhuge_page_slab.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                mem = mmap(slab, SLAB_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+                if (mem == MAP_FAILED) {
+                    FLARE_PLOG(ERROR) << "Fail to map slab of cord_buf blocks";
+                    return nullptr;
+                }
+                if (pool->options.use_huge_pages) {
+                    // Transparent huge pages, fine to fail.
+                    madvise(slab, SLAB_SIZE, MADV_HUGEPAGE);
+                }
+            }
+            pool->slab_node[index] = node;
+            pool->nslab.fetch_add(1, std::memory_order_relaxed);
+            // Linking the blocks touches all pages of the slab in this thread,
+            // so they're placed on the NUMA node of it.
+            FreeBlock *head = nullptr;
+            for (size_t i = BLOCKS_PER_SLAB; i > 0; --i) {
+                FreeBlock *b = (FreeBlock *) (slab + (i - 1) * cord_buf::DEFAULT_BLOCK_SIZE);
+                b->next = head;
+                head = b;
+            }
+            return head;
+        }
+
+        // Return a chain of |n| blocks of |node| to the pool.
+        void return_blocks(BlockPool *pool, int node, FreeBlock *head, FreeBlock *tail, size_t n) {
+            NodeFreeList &list = pool->nodes[node];
+            std::unique_lock<std::mutex> lk(list.mutex);
+            tail->next = list.head;
+            list.head = head;
+            list.count.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        // Return |n| blocks cached by the calling thread to their nodes.
+        void flush_tls_cache(BlockPool *pool, TLSCache *c, int n) {
+            FreeBlock *heads[MAX_NUMA_NODES] = {};
+            FreeBlock *tails[MAX_NUMA_NODES] = {};
+            size_t counts[MAX_NUMA_NODES] = {};
+            for (int i = 0; i < n && c->head; ++i) {
+                FreeBlock *b = c->head;
+                c->head = b->next;
+                --c->count;
+                const int node = pool->node_of(b);
+                b->next = heads[node];
+                heads[node] = b;
+                if (tails[node] == nullptr) {
+                    tails[node] = b;
+                }
+                ++counts[node];
+            }
+            const int current = current_numa_node(pool);
+            for (int node = 0; node < MAX_NUMA_NODES; ++node) {
+                if (counts[node] == 0) {
+                    continue;
+                }
+                if (node != current) {
+                    pool->nremote_free.fetch_add(counts[node], std::memory_order_relaxed);
+                }
+                return_blocks(pool, node, heads[node], tails[node], counts[node]);
+            }
+        }
+
+        void flush_tls_cache_at_exit() {
+            TLSCache &c = tls_cache;
+            c.exiting = true;
+            BlockPool *pool = g_pool.load(std::memory_order_acquire);
+            if (pool != nullptr) {
+                flush_tls_cache(pool, &c, c.count);
+            }
+        }
+
+        // Flush the cache when the calling thread exits, called before the
+        // first block goes into the cache.
+        inline void register_tls_cache(TLSCache *c) {
+            if (FLARE_UNLIKELY(!c->registered)) {
+                c->registered = true;
+                flare::thread::atexit(flush_tls_cache_at_exit);
+            }
+        }
+
+        // Move blocks of the NUMA node of the calling thread to its cache.
+        bool refill_tls_cache(BlockPool *pool, TLSCache *c) {
+            register_tls_cache(c);
+            const int node = current_numa_node(pool);
+            // Nothing is flushed after the thread started exiting, take just
+            // the one to return.
+            const size_t n = c->exiting ? 1 : std::max(pool->options.tls_cache_size / 2, 1);
+            NodeFreeList &list = pool->nodes[node];
+            std::unique_lock<std::mutex> lk(list.mutex);
+            if (list.head == nullptr) {
+                // Mapping and touching a slab is slow, don't block threads
+                // returning or taking blocks of the node meanwhile.
+                lk.unlock();
+                FreeBlock *slab = allocate_slab(pool, node);
+                if (slab == nullptr) {
+                    return false;
+                }
+                FreeBlock *tail = (FreeBlock *) ((char *) slab +
+                        (BLOCKS_PER_SLAB - 1) * cord_buf::DEFAULT_BLOCK_SIZE);
+                lk.lock();
+                tail->next = list.head;
+                list.head = slab;
+                list.count.fetch_add(BLOCKS_PER_SLAB, std::memory_order_relaxed);
+            }
+            size_t taken = 0;
+            while (taken < n && list.head != nullptr) {
+                FreeBlock *b = list.head;
+                list.head = b->next;
+                b->next = c->head;
+                c->head = b;
+                ++taken;
+            }
+            list.count.fetch_sub(taken, std::memory_order_relaxed);
+            c->count += taken;
+            return true;
+        }
+
+    }  // namespace
+
+    block_pool_options::block_pool_options()
+            : max_memory(16ULL * 1024 * 1024 * 1024), use_huge_pages(true), tls_cache_size(64) {}
+
+    int enable_block_pool(const block_pool_options *options) {
+        std::unique_lock<std::mutex> lk(g_enable_mutex);
+        if (g_pool.load(std::memory_order_relaxed) != nullptr) {
+            return 0;
+        }
+        BlockPool *pool = new BlockPool;
+        if (options) {
+            pool->options = *options;
+        }
+        pool->max_slabs = pool->options.max_memory / SLAB_SIZE;
+        if (pool->max_slabs == 0 || pool->options.tls_cache_size < 0) {
+            delete pool;
+            return EINVAL;
+        }
+        // Reserve one more slab to align the base.
+        void *mem = mmap(nullptr, (pool->max_slabs + 1) * SLAB_SIZE, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED) {
+            const int rc = errno;
+            delete pool;
+            return rc;
+        }
+        pool->base = (char *) (((uintptr_t) mem + SLAB_SIZE - 1) & ~(uintptr_t) (SLAB_SIZE - 1));
+        pool->slab_node = new uint8_t[pool->max_slabs]();
+        init_cpu_node(pool);
+        g_pool.store(pool, std::memory_order_release);
+        blockmem_allocate = block_pool_allocate;
+        blockmem_deallocate = block_pool_deallocate;
+        return 0;
+    }
+
+    bool block_pool_enabled() {
+        return g_pool.load(std::memory_order_acquire) != nullptr;
+    }
+
+    void *block_pool_allocate(size_t size) {
+        BlockPool *pool = g_pool.load(std::memory_order_acquire);
+        if (pool == nullptr || size != cord_buf::DEFAULT_BLOCK_SIZE) {
+            return ::malloc(size);
+        }
+        TLSCache &c = tls_cache;
+        if (FLARE_UNLIKELY(c.head == nullptr) && !refill_tls_cache(pool, &c)) {
+            return ::malloc(size);
+        }
+        FreeBlock *b = c.head;
+        c.head = b->next;
+        --c.count;
+        return b;
+    }
+
+    void block_pool_deallocate(void *mem) {
+        BlockPool *pool = g_pool.load(std::memory_order_acquire);
+        if (pool == nullptr || !pool->owns(mem)) {
+            ::free(mem);
+            return;
+        }
+        FreeBlock *b = (FreeBlock *) mem;
+        TLSCache &c = tls_cache;
+        if (FLARE_UNLIKELY(c.exiting)) {
+            return_blocks(pool, pool->node_of(b), b, b, 1);
+            return;
+        }
+        if (pool->numa) {
+            // Blocks of other nodes go back to their nodes instead of being
+            // handed out by this thread again.
+            const int node = pool->node_of(b);
+            if (node != current_numa_node(pool)) {
+                pool->nremote_free.fetch_add(1, std::memory_order_relaxed);
+                return_blocks(pool, node, b, b, 1);
+                return;
+            }
+        }
+        // Threads only freeing blocks never refill the cache.
+        register_tls_cache(&c);
+        b->next = c.head;
+        c.head = b;
+        if (++c.count > pool->options.tls_cache_size) {
+            flush_tls_cache(pool, &c, c.count - pool->options.tls_cache_size / 2);
+        }
+    }
+
+    void block_pool_flush_tls_cache() {
+        BlockPool *pool = g_pool.load(std::memory_order_acquire);
+        if (pool != nullptr) {
+            flush_tls_cache(pool, &tls_cache, tls_cache.count);
+        }
+    }
+
+}  // namespace flare::iobuf
+
+namespace flare {
+
+    size_t cord_buf::block_pool_memory() {
+        iobuf::BlockPool *pool = iobuf::g_pool.load(std::memory_order_acquire);
+        return pool ? pool->nslab.load(std::memory_order_relaxed) * iobuf::SLAB_SIZE : 0;
+    }
+
+    size_t cord_buf::block_pool_huge_page_memory() {
+        iobuf::BlockPool *pool = iobuf::g_pool.load(std::memory_order_acquire);
+        return pool ? pool->nhuge_page_slab.load(std::memory_order_relaxed) * iobuf::SLAB_SIZE : 0;
+    }
+
+    size_t cord_buf::block_pool_free_count() {
+        iobuf::BlockPool *pool = iobuf::g_pool.load(std::memory_order_acquire);
+        if (pool == nullptr) {
+            return 0;
+        }
+        size_t n = 0;
+        for (int i = 0; i < iobuf::MAX_NUMA_NODES; ++i) {
+            n += pool->nodes[i].count.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    size_t cord_buf::block_pool_remote_free_count() {
+        iobuf::BlockPool *pool = iobuf::g_pool.load(std::memory_order_acquire);
+        return pool ? pool->nremote_free.load(std::memory_order_relaxed) : 0;
+    }
+
+}  // namespace flare
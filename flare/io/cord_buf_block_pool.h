@@ -0,0 +1,72 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_IO_CORD_BUF_BLOCK_POOL_H_
+#define FLARE_IO_CORD_BUF_BLOCK_POOL_H_
+
+#include <stddef.h>                              // size_t
+
+namespace flare::iobuf {
+
+    // Memory of cord_buf blocks is allocated by the function pointers
+    // iobuf::blockmem_allocate/blockmem_deallocate (malloc/free by default).
+    // The block pool is an alternative carving blocks of
+    // cord_buf::DEFAULT_BLOCK_SIZE out of 2MB slabs:
+    //  - Slabs are backed by huge pages if possible (MAP_HUGETLB, otherwise
+    //    transparent huge pages), which reduces TLB misses.
+    //  - Free blocks are kept in per-NUMA-node lists and go back to the node
+    //    they were allocated on no matter which thread frees them. Slabs are
+    //    first touched by a thread on the node they belong to.
+    //  - Each thread caches up to `tls_cache_size' free blocks of its own
+    //    node so that most allocations take no lock.
+    // Blocks of other sizes are still allocated by malloc.
+    struct block_pool_options {
+        block_pool_options();
+
+        // Virtual address space reserved for slabs, blocks are allocated by
+        // malloc when it's used up.
+        // default: 16GB
+        size_t max_memory;
+
+        // default: true
+        bool use_huge_pages;
+
+        // Max number of free blocks cached by each thread.
+        // default: 64
+        int tls_cache_size;
+    };
+
+    // Install the block pool as the allocator of cord_buf blocks. Blocks
+    // allocated before are still freed correctly. The pool can't be disabled
+    // once enabled as long as any block allocated from it is alive.
+    // Returns 0 on success, errno otherwise.
+    int enable_block_pool(const block_pool_options *options);
+
+    bool block_pool_enabled();
+
+    // The allocation functions installed by enable_block_pool().
+    void *block_pool_allocate(size_t size);
+
+    void block_pool_deallocate(void *mem);
+
+    // Return the free blocks cached by the calling thread to the pool.
+    void block_pool_flush_tls_cache();
+
+}  // namespace flare::iobuf
+
+#endif  // FLARE_IO_CORD_BUF_BLOCK_POOL_H_
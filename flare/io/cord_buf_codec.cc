@@ -0,0 +1,723 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/io/cord_buf_codec.h"
+#include <string.h>                        // memcmp
+#include <algorithm>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "flare/base/crc32c.h"
+#include "flare/io/snappy/snappy.h"
+#include "flare/io/snappy/snappy-internal.h"
+#include "flare/io/snappy/snappy-stubs-internal.h"
+#ifdef FLARE_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#ifdef FLARE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace flare {
+
+    namespace {
+
+        // Chunk types of flare/io/snappy/framing_format.txt
+        const uint8_t CHUNK_COMPRESSED = 0x00;
+        const uint8_t CHUNK_UNCOMPRESSED = 0x01;
+        const uint8_t CHUNK_MAX_UNSKIPPABLE = 0x7f;
+        const uint8_t CHUNK_STREAM_IDENTIFIER = 0xff;
+
+        const char SNAPPY_STREAM_IDENTIFIER[] = "\xff\x06\x00\x00sNaPpY";
+        const size_t SNAPPY_STREAM_IDENTIFIER_SIZE = sizeof(SNAPPY_STREAM_IDENTIFIER) - 1;
+
+        // Max uncompressed bytes of a chunk.
+        const size_t MAX_CHUNK_DATA = snappy::kBlockSize;
+
+        // Masked crc32c of bytes of `buf'.
+        uint32_t masked_crc32c(const cord_buf &buf) {
+            uint32_t crc = 0;
+            for (size_t i = 0; i < buf.backing_block_num(); ++i) {
+                const std::string_view block = buf.backing_block(i);
+                crc = base::extend(crc, block.data(), block.size());
+            }
+            return base::mask(crc);
+        }
+
+        void append_chunk_header(cord_buf *out, uint8_t type, size_t data_size, uint32_t crc) {
+            const size_t len = data_size + 4;
+            const char header[8] = {
+                    (char) type, (char) len, (char) (len >> 8), (char) (len >> 16),
+                    (char) crc, (char) (crc >> 8), (char) (crc >> 16), (char) (crc >> 24)};
+            out->append(header, sizeof(header));
+        }
+
+        class snappy_compressor : public stream_compressor {
+        public:
+            snappy_compressor()
+                    : _started(false), _input(new char[MAX_CHUNK_DATA]),
+                      _output(new char[snappy::Varint::kMax32 + snappy::MaxCompressedLength(MAX_CHUNK_DATA)]) {}
+
+            int compress(const cord_buf &in, cord_buf *out) override {
+                _pending.append(in);
+                while (_pending.size() >= MAX_CHUNK_DATA) {
+                    compress_chunk(MAX_CHUNK_DATA, out);
+                }
+                return 0;
+            }
+
+            int flush(cord_buf *out) override {
+                if (!_pending.empty()) {
+                    compress_chunk(_pending.size(), out);
+                }
+                return 0;
+            }
+
+            int finish(cord_buf *out) override {
+                // An empty stream still has the identifier.
+                start(out);
+                return flush(out);
+            }
+
+            void reset() override {
+                _started = false;
+                _pending.clear();
+            }
+
+        private:
+            void start(cord_buf *out) {
+                if (!_started) {
+                    _started = true;
+                    out->append(SNAPPY_STREAM_IDENTIFIER, SNAPPY_STREAM_IDENTIFIER_SIZE);
+                }
+            }
+
+            void compress_chunk(size_t n, cord_buf *out);
+
+            bool _started;
+            // Input not compressed yet, less than a chunk after compress().
+            cord_buf _pending;
+            snappy::internal::WorkingMemory _wmem;
+            std::unique_ptr<char[]> _input;
+            std::unique_ptr<char[]> _output;
+        };
+
+        void snappy_compressor::compress_chunk(size_t n, cord_buf *out) {
+            start(out);
+            cord_buf chunk;
+            _pending.cutn(&chunk, n);
+            // Snappy compresses flat memory, copy only if the chunk is split.
+            const char *input = NULL;
+            if (chunk.backing_block_num() == 1) {
+                input = chunk.backing_block(0).data();
+            } else {
+                chunk.copy_to(_input.get(), n);
+                input = _input.get();
+            }
+            const uint32_t crc = base::mask(base::value(input, n));
+            char *op = snappy::Varint::Encode32(_output.get(), n);
+            int table_size = 0;
+            uint16_t *table = _wmem.GetHashTable(n, &table_size);
+            op = snappy::internal::CompressFragment(input, n, op, table, table_size);
+            const size_t compressed_size = op - _output.get();
+            if (compressed_size < n) {
+                append_chunk_header(out, CHUNK_COMPRESSED, compressed_size, crc);
+                out->append(_output.get(), compressed_size);
+            } else {
+                // Incompressible, reference the input.
+                append_chunk_header(out, CHUNK_UNCOMPRESSED, n, crc);
+                out->append(chunk);
+            }
+        }
+
+        class snappy_decompressor : public stream_decompressor {
+        public:
+            snappy_decompressor() : _started(false), _failed(false) {}
+
+            int decompress(const cord_buf &in, cord_buf *out) override;
+
+            bool at_frame_boundary() const override { return _pending.empty(); }
+
+            void reset() override {
+                _started = false;
+                _failed = false;
+                _pending.clear();
+            }
+
+        private:
+            int fail() {
+                _failed = true;
+                return -1;
+            }
+
+            int decompress_chunk(const cord_buf &data, uint32_t crc, cord_buf *out);
+
+            bool _started;
+            bool _failed;
+            // Input of incomplete chunks.
+            cord_buf _pending;
+            std::vector<snappy::iovec> _iov;
+        };
+
+        int snappy_decompressor::decompress(const cord_buf &in, cord_buf *out) {
+            if (_failed) {
+                return -1;
+            }
+            _pending.append(in);
+            while (_pending.size() >= 4) {
+                unsigned char header[4];
+                _pending.copy_to(header, sizeof(header));
+                const uint8_t type = header[0];
+                const size_t len = header[1] | (header[2] << 8) | (header[3] << 16);
+                if (_pending.size() < sizeof(header) + len) {
+                    break;
+                }
+                if (!_started && type != CHUNK_STREAM_IDENTIFIER) {
+                    return fail();
+                }
+                if (type == CHUNK_STREAM_IDENTIFIER) {
+                    char id[SNAPPY_STREAM_IDENTIFIER_SIZE];
+                    if (len != SNAPPY_STREAM_IDENTIFIER_SIZE - sizeof(header)) {
+                        return fail();
+                    }
+                    _pending.cutn(id, sizeof(id));
+                    if (memcmp(id, SNAPPY_STREAM_IDENTIFIER, sizeof(id)) != 0) {
+                        return fail();
+                    }
+                    _started = true;
+                } else if (type == CHUNK_COMPRESSED || type == CHUNK_UNCOMPRESSED) {
+                    if (len < 4) {
+                        return fail();
+                    }
+                    _pending.pop_front(sizeof(header));
+                    unsigned char crc_bytes[4];
+                    _pending.cutn(crc_bytes, sizeof(crc_bytes));
+                    const uint32_t crc = crc_bytes[0] | (crc_bytes[1] << 8) |
+                                         (crc_bytes[2] << 16) | ((uint32_t) crc_bytes[3] << 24);
+                    cord_buf data;
+                    _pending.cutn(&data, len - 4);
+                    if (type == CHUNK_COMPRESSED) {
+                        if (decompress_chunk(data, crc, out) != 0) {
+                            return fail();
+                        }
+                    } else {
+                        if (data.size() > MAX_CHUNK_DATA || masked_crc32c(data) != crc) {
+                            return fail();
+                        }
+                        out->append(data);
+                    }
+                } else if (type <= CHUNK_MAX_UNSKIPPABLE) {
+                    // Reserved unskippable chunks.
+                    return fail();
+                } else {
+                    // Padding and reserved skippable chunks.
+                    _pending.pop_front(sizeof(header) + len);
+                }
+            }
+            return 0;
+        }
+
+        int snappy_decompressor::decompress_chunk(const cord_buf &data, uint32_t crc, cord_buf *out) {
+            uint32_t n = 0;
+            {
+                cord_buf_as_snappy_source source(data);
+                if (!snappy::GetUncompressedLength(&source, &n) || n > MAX_CHUNK_DATA) {
+                    return -1;
+                }
+            }
+            const size_t old_size = out->size();
+            bool ok = true;
+            {
+                // Uncompress into blocks of `out' directly.
+                cord_buf_as_zero_copy_output_stream stream(out);
+                _iov.clear();
+                size_t total = 0;
+                while (total < n) {
+                    void *p = NULL;
+                    int size = 0;
+                    if (!stream.Next(&p, &size)) {
+                        ok = false;
+                        break;
+                    }
+                    _iov.push_back({p, (size_t) size});
+                    total += size;
+                }
+                if (total > n) {
+                    stream.BackUp(total - n);
+                    _iov.back().iov_len -= total - n;
+                }
+                if (ok) {
+                    cord_buf_as_snappy_source source(data);
+                    ok = snappy::RawUncompressToIOVec(&source, _iov.data(), _iov.size());
+                }
+            }
+            if (ok) {
+                // Only bytes just uncompressed, not the whole `out'.
+                uint32_t actual_crc = 0;
+                for (const snappy::iovec &iov : _iov) {
+                    actual_crc = base::extend(actual_crc, static_cast<const char *>(iov.iov_base),
+                                              iov.iov_len);
+                }
+                ok = (base::mask(actual_crc) == crc);
+            }
+            if (!ok) {
+                out->pop_back(out->size() - old_size);
+                return -1;
+            }
+            return 0;
+        }
+
+        class snappy_codec : public compression_codec {
+        public:
+            std::string_view name() const override { return "snappy"; }
+
+            std::unique_ptr<stream_compressor> new_compressor() const override {
+                return std::make_unique<snappy_compressor>();
+            }
+
+            std::unique_ptr<stream_decompressor> new_decompressor() const override {
+                return std::make_unique<snappy_decompressor>();
+            }
+        };
+
+#ifdef FLARE_HAVE_LZ4
+
+        // Max uncompressed bytes passed to LZ4F_compressUpdate() at a time,
+        // which bounds the output buffer.
+        const size_t LZ4_MAX_UPDATE = 64 * 1024;
+
+        // The LZ4 frame format, with content checksum.
+        class lz4_compressor : public stream_compressor {
+        public:
+            lz4_compressor() : _ctx(NULL), _started(false) {
+                memset(&_prefs, 0, sizeof(_prefs));
+                _prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+                _prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+                _output_size = std::max(LZ4F_compressBound(LZ4_MAX_UPDATE, &_prefs),
+                                        (size_t) LZ4F_HEADER_SIZE_MAX);
+                _output.reset(new char[_output_size]);
+                if (LZ4F_isError(LZ4F_createCompressionContext(&_ctx, LZ4F_VERSION))) {
+                    _ctx = NULL;
+                }
+            }
+
+            ~lz4_compressor() override {
+                LZ4F_freeCompressionContext(_ctx);
+            }
+
+            int compress(const cord_buf &in, cord_buf *out) override {
+                if (start(out) != 0) {
+                    return -1;
+                }
+                for (size_t i = 0; i < in.backing_block_num(); ++i) {
+                    const std::string_view block = in.backing_block(i);
+                    for (size_t off = 0; off < block.size(); off += LZ4_MAX_UPDATE) {
+                        const size_t n = std::min(block.size() - off, LZ4_MAX_UPDATE);
+                        const size_t rc = LZ4F_compressUpdate(
+                                _ctx, _output.get(), _output_size, block.data() + off, n, NULL);
+                        if (LZ4F_isError(rc)) {
+                            return -1;
+                        }
+                        out->append(_output.get(), rc);
+                    }
+                }
+                return 0;
+            }
+
+            int flush(cord_buf *out) override {
+                if (start(out) != 0) {
+                    return -1;
+                }
+                const size_t rc = LZ4F_flush(_ctx, _output.get(), _output_size, NULL);
+                if (LZ4F_isError(rc)) {
+                    return -1;
+                }
+                out->append(_output.get(), rc);
+                return 0;
+            }
+
+            int finish(cord_buf *out) override {
+                if (start(out) != 0) {
+                    return -1;
+                }
+                const size_t rc = LZ4F_compressEnd(_ctx, _output.get(), _output_size, NULL);
+                if (LZ4F_isError(rc)) {
+                    return -1;
+                }
+                out->append(_output.get(), rc);
+                return 0;
+            }
+
+            // LZ4F_compressBegin() restarts the context.
+            void reset() override { _started = false; }
+
+        private:
+            int start(cord_buf *out) {
+                if (_ctx == NULL) {
+                    return -1;
+                }
+                if (!_started) {
+                    const size_t rc = LZ4F_compressBegin(_ctx, _output.get(), _output_size, &_prefs);
+                    if (LZ4F_isError(rc)) {
+                        return -1;
+                    }
+                    _started = true;
+                    out->append(_output.get(), rc);
+                }
+                return 0;
+            }
+
+            LZ4F_cctx *_ctx;
+            LZ4F_preferences_t _prefs;
+            bool _started;
+            size_t _output_size;
+            std::unique_ptr<char[]> _output;
+        };
+
+        class lz4_decompressor : public stream_decompressor {
+        public:
+            lz4_decompressor() : _ctx(NULL), _failed(false), _hint(0) {
+                if (LZ4F_isError(LZ4F_createDecompressionContext(&_ctx, LZ4F_VERSION))) {
+                    _ctx = NULL;
+                }
+            }
+
+            ~lz4_decompressor() override {
+                LZ4F_freeDecompressionContext(_ctx);
+            }
+
+            int decompress(const cord_buf &in, cord_buf *out) override;
+
+            // LZ4F_decompress() returns 0 once a frame is fully decoded.
+            bool at_frame_boundary() const override { return _hint == 0; }
+
+            void reset() override {
+                if (_ctx != NULL) {
+                    LZ4F_resetDecompressionContext(_ctx);
+                }
+                _failed = false;
+                _hint = 0;
+            }
+
+        private:
+            LZ4F_dctx *_ctx;
+            bool _failed;
+            size_t _hint;
+        };
+
+        int lz4_decompressor::decompress(const cord_buf &in, cord_buf *out) {
+            if (_failed || _ctx == NULL) {
+                return -1;
+            }
+            // Decompress into blocks of `out' directly.
+            cord_buf_as_zero_copy_output_stream stream(out);
+            for (size_t i = 0; i < in.backing_block_num(); ++i) {
+                const std::string_view block = in.backing_block(i);
+                size_t off = 0;
+                // Output may be pending in the context after all input is
+                // consumed, call until the output space is not used up.
+                for (;;) {
+                    void *p = NULL;
+                    int size = 0;
+                    if (!stream.Next(&p, &size)) {
+                        _failed = true;
+                        return -1;
+                    }
+                    size_t dst_size = size;
+                    size_t src_size = block.size() - off;
+                    const size_t rc = LZ4F_decompress(_ctx, p, &dst_size, block.data() + off,
+                                                      &src_size, NULL);
+                    stream.BackUp(size - dst_size);
+                    if (LZ4F_isError(rc)) {
+                        _failed = true;
+                        return -1;
+                    }
+                    _hint = rc;
+                    off += src_size;
+                    if (off == block.size() && dst_size < (size_t) size) {
+                        break;
+                    }
+                }
+            }
+            return 0;
+        }
+
+        class lz4_codec : public compression_codec {
+        public:
+            std::string_view name() const override { return "lz4"; }
+
+            std::unique_ptr<stream_compressor> new_compressor() const override {
+                return std::make_unique<lz4_compressor>();
+            }
+
+            std::unique_ptr<stream_decompressor> new_decompressor() const override {
+                return std::make_unique<lz4_decompressor>();
+            }
+        };
+
+#endif  // FLARE_HAVE_LZ4
+
+#ifdef FLARE_HAVE_ZSTD
+
+        // zstd frames at the default level, with content checksum.
+        class zstd_compressor : public stream_compressor {
+        public:
+            zstd_compressor() : _ctx(ZSTD_createCCtx()) {
+                if (_ctx != NULL) {
+                    ZSTD_CCtx_setParameter(_ctx, ZSTD_c_checksumFlag, 1);
+                }
+            }
+
+            ~zstd_compressor() override { ZSTD_freeCCtx(_ctx); }
+
+            int compress(const cord_buf &in, cord_buf *out) override {
+                for (size_t i = 0; i < in.backing_block_num(); ++i) {
+                    const std::string_view block = in.backing_block(i);
+                    if (compress_stream(block, ZSTD_e_continue, out) != 0) {
+                        return -1;
+                    }
+                }
+                return 0;
+            }
+
+            int flush(cord_buf *out) override {
+                return compress_stream(std::string_view(), ZSTD_e_flush, out);
+            }
+
+            int finish(cord_buf *out) override {
+                return compress_stream(std::string_view(), ZSTD_e_end, out);
+            }
+
+            void reset() override {
+                if (_ctx != NULL) {
+                    ZSTD_CCtx_reset(_ctx, ZSTD_reset_session_only);
+                }
+            }
+
+        private:
+            int compress_stream(std::string_view data, ZSTD_EndDirective op, cord_buf *out);
+
+            ZSTD_CCtx *_ctx;
+        };
+
+        int zstd_compressor::compress_stream(std::string_view data, ZSTD_EndDirective op,
+                                             cord_buf *out) {
+            if (_ctx == NULL) {
+                return -1;
+            }
+            // Compress into blocks of `out' directly.
+            cord_buf_as_zero_copy_output_stream stream(out);
+            ZSTD_inBuffer input = {data.data(), data.size(), 0};
+            for (;;) {
+                void *p = NULL;
+                int size = 0;
+                if (!stream.Next(&p, &size)) {
+                    return -1;
+                }
+                ZSTD_outBuffer output = {p, (size_t) size, 0};
+                const size_t rc = ZSTD_compressStream2(_ctx, &output, &input, op);
+                stream.BackUp(size - output.pos);
+                if (ZSTD_isError(rc)) {
+                    return -1;
+                }
+                // For ZSTD_e_continue all input is consumed, otherwise rc is
+                // the size of output still in the context.
+                if (op == ZSTD_e_continue ? input.pos == input.size : rc == 0) {
+                    return 0;
+                }
+            }
+        }
+
+        class zstd_decompressor : public stream_decompressor {
+        public:
+            zstd_decompressor() : _ctx(ZSTD_createDCtx()), _failed(false), _hint(0) {}
+
+            ~zstd_decompressor() override { ZSTD_freeDCtx(_ctx); }
+
+            int decompress(const cord_buf &in, cord_buf *out) override;
+
+            // ZSTD_decompressStream() returns 0 once a frame is fully decoded
+            // and flushed.
+            bool at_frame_boundary() const override { return _hint == 0; }
+
+            void reset() override {
+                if (_ctx != NULL) {
+                    ZSTD_DCtx_reset(_ctx, ZSTD_reset_session_only);
+                }
+                _failed = false;
+                _hint = 0;
+            }
+
+        private:
+            ZSTD_DCtx *_ctx;
+            bool _failed;
+            size_t _hint;
+        };
+
+        int zstd_decompressor::decompress(const cord_buf &in, cord_buf *out) {
+            if (_failed || _ctx == NULL) {
+                return -1;
+            }
+            // Decompress into blocks of `out' directly.
+            cord_buf_as_zero_copy_output_stream stream(out);
+            for (size_t i = 0; i < in.backing_block_num(); ++i) {
+                const std::string_view block = in.backing_block(i);
+                ZSTD_inBuffer input = {block.data(), block.size(), 0};
+                // Output may be pending in the context after all input is
+                // consumed, call until the output space is not used up.
+                for (;;) {
+                    void *p = NULL;
+                    int size = 0;
+                    if (!stream.Next(&p, &size)) {
+                        _failed = true;
+                        return -1;
+                    }
+                    ZSTD_outBuffer output = {p, (size_t) size, 0};
+                    const size_t rc = ZSTD_decompressStream(_ctx, &output, &input);
+                    stream.BackUp(size - output.pos);
+                    if (ZSTD_isError(rc)) {
+                        _failed = true;
+                        return -1;
+                    }
+                    _hint = rc;
+                    if (input.pos == input.size && output.pos < output.size) {
+                        break;
+                    }
+                }
+            }
+            return 0;
+        }
+
+        class zstd_codec : public compression_codec {
+        public:
+            std::string_view name() const override { return "zstd"; }
+
+            std::unique_ptr<stream_compressor> new_compressor() const override {
+                return std::make_unique<zstd_compressor>();
+            }
+
+            std::unique_ptr<stream_decompressor> new_decompressor() const override {
+                return std::make_unique<zstd_decompressor>();
+            }
+        };
+
+#endif  // FLARE_HAVE_ZSTD
+
+        class codec_registry {
+        public:
+            codec_registry() {
+                static const snappy_codec s_snappy;
+                _codecs.push_back(&s_snappy);
+#ifdef FLARE_HAVE_LZ4
+                static const lz4_codec s_lz4;
+                _codecs.push_back(&s_lz4);
+#endif
+#ifdef FLARE_HAVE_ZSTD
+                static const zstd_codec s_zstd;
+                _codecs.push_back(&s_zstd);
+#endif
+            }
+
+            int add(const compression_codec *codec) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                for (auto c : _codecs) {
+                    if (c->name() == codec->name()) {
+                        return -1;
+                    }
+                }
+                _codecs.push_back(codec);
+                return 0;
+            }
+
+            const compression_codec *find(std::string_view name) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                for (auto c : _codecs) {
+                    if (c->name() == name) {
+                        return c;
+                    }
+                }
+                return NULL;
+            }
+
+        private:
+            std::mutex _mutex;
+            std::vector<const compression_codec *> _codecs;
+        };
+
+        codec_registry &get_codec_registry() {
+            static codec_registry s_registry;
+            return s_registry;
+        }
+
+        struct thread_contexts {
+            std::vector<std::pair<const compression_codec *, std::unique_ptr<stream_compressor>>> compressors;
+            std::vector<std::pair<const compression_codec *, std::unique_ptr<stream_decompressor>>> decompressors;
+        };
+
+        thread_local thread_contexts tls_contexts;
+
+        template<typename T, typename New>
+        T *get_thread_local_context(
+                std::vector<std::pair<const compression_codec *, std::unique_ptr<T>>> &contexts,
+                const compression_codec *codec, const New &new_context) {
+            for (auto &c : contexts) {
+                if (c.first == codec) {
+                    c.second->reset();
+                    return c.second.get();
+                }
+            }
+            contexts.emplace_back(codec, new_context());
+            return contexts.back().second.get();
+        }
+
+    }  // namespace
+
+    int register_compression_codec(const compression_codec *codec) {
+        return get_codec_registry().add(codec);
+    }
+
+    const compression_codec *find_compression_codec(std::string_view name) {
+        return get_codec_registry().find(name);
+    }
+
+    stream_compressor *thread_local_compressor(const compression_codec *codec) {
+        return get_thread_local_context(tls_contexts.compressors, codec,
+                                        [codec] { return codec->new_compressor(); });
+    }
+
+    stream_decompressor *thread_local_decompressor(const compression_codec *codec) {
+        return get_thread_local_context(tls_contexts.decompressors, codec,
+                                        [codec] { return codec->new_decompressor(); });
+    }
+
+    int compress_cord_buf(const compression_codec *codec, const cord_buf &in, cord_buf *out) {
+        stream_compressor *c = thread_local_compressor(codec);
+        const int rc = (c->compress(in, out) == 0 && c->finish(out) == 0) ? 0 : -1;
+        c->reset();
+        return rc;
+    }
+
+    int decompress_cord_buf(const compression_codec *codec, const cord_buf &in, cord_buf *out) {
+        stream_decompressor *d = thread_local_decompressor(codec);
+        // A truncated stream is an error as a whole.
+        const int rc = (d->decompress(in, out) == 0 && d->at_frame_boundary()) ? 0 : -1;
+        d->reset();
+        return rc;
+    }
+
+}  // namespace flare
@@ -0,0 +1,128 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_IO_CORD_BUF_CODEC_H_
+#define FLARE_IO_CORD_BUF_CODEC_H_
+
+#include <memory>
+#include <string_view>
+#include "flare/io/cord_buf.h"
+
+namespace flare {
+
+    // Streaming compression over cord_buf. Input is consumed block by block
+    // and output is appended to cord_buf, neither side is flattened into a
+    // std::string.
+    //
+    //   const compression_codec *codec = find_compression_codec("snappy");
+    //   std::unique_ptr<stream_compressor> c = codec->new_compressor();
+    //   c->compress(part1, &out);
+    //   c->compress(part2, &out);
+    //   c->finish(&out);
+    //
+    // Compressors and decompressors hold working memory which is reused by
+    // the next stream after reset(). thread_local_compressor() and
+    // thread_local_decompressor() return such contexts cached by the
+    // calling thread.
+    //
+    // Contexts are cached per pthread, not per fiber. A fiber blocking(e.g.
+    // on fiber_mutex or I/O) may be resumed by another worker, and another
+    // fiber on the old worker gets the same context, so a thread-local
+    // context must not be used across anything that may suspend the calling
+    // fiber. Create contexts with new_compressor()/new_decompressor() for
+    // streams fed across blocking calls.
+
+    class stream_compressor {
+    public:
+        virtual ~stream_compressor() = default;
+
+        // Compress `in' and append the result to `out'. Part of the input may
+        // be buffered(by reference) until more input comes or flush().
+        // Returns 0 on success, -1 otherwise.
+        virtual int compress(const cord_buf &in, cord_buf *out) = 0;
+
+        // Append output of all input so far to `out', the stream continues.
+        // Returns 0 on success, -1 otherwise.
+        virtual int flush(cord_buf *out) = 0;
+
+        // Flush and end the stream. The compressor must be reset() before
+        // starting another stream.
+        // Returns 0 on success, -1 otherwise.
+        virtual int finish(cord_buf *out) = 0;
+
+        // Drop buffered input and start a new stream.
+        virtual void reset() = 0;
+    };
+
+    class stream_decompressor {
+    public:
+        virtual ~stream_decompressor() = default;
+
+        // Decompress `in' and append the result to `out'. `in' may end in the
+        // middle of a frame, the rest is expected in following calls.
+        // Returns 0 on success, -1 on corrupted input, after which the
+        // decompressor must be reset().
+        virtual int decompress(const cord_buf &in, cord_buf *out) = 0;
+
+        // True if the input so far ends at a frame boundary.
+        virtual bool at_frame_boundary() const = 0;
+
+        // Drop buffered input and start a new stream.
+        virtual void reset() = 0;
+    };
+
+    class compression_codec {
+    public:
+        virtual ~compression_codec() = default;
+
+        // Name to find the codec by, e.g. "snappy".
+        virtual std::string_view name() const = 0;
+
+        virtual std::unique_ptr<stream_compressor> new_compressor() const = 0;
+
+        virtual std::unique_ptr<stream_decompressor> new_decompressor() const = 0;
+    };
+
+    // Register `codec' which must be valid until the program exits. The
+    // snappy framing format(flare/io/snappy/framing_format.txt) is
+    // registered as "snappy". The LZ4 frame format and zstd frames are
+    // registered as "lz4" and "zstd" if flare is built with the libraries
+    // (FLARE_HAVE_LZ4 and FLARE_HAVE_ZSTD).
+    // Returns 0 on success, -1 if a codec of the same name exists.
+    int register_compression_codec(const compression_codec *codec);
+
+    // Returns the codec registered as `name', NULL if not found.
+    const compression_codec *find_compression_codec(std::string_view name);
+
+    // Contexts of `codec' cached by the calling pthread, reset() before
+    // being returned. They're invalidated by the next call of the same
+    // function with the same codec in the pthread, see above for fibers.
+    stream_compressor *thread_local_compressor(const compression_codec *codec);
+
+    stream_decompressor *thread_local_decompressor(const compression_codec *codec);
+
+    // Compress/decompress `in' as a whole stream with the thread-local
+    // context of `codec' and append the result to `out'.
+    // Returns 0 on success, -1 otherwise.
+    int compress_cord_buf(const compression_codec *codec, const cord_buf &in, cord_buf *out);
+
+    int decompress_cord_buf(const compression_codec *codec, const cord_buf &in, cord_buf *out);
+
+}  // namespace flare
+
+#endif  // FLARE_IO_CORD_BUF_CODEC_H_
@@ -400,6 +400,25 @@ namespace flare {
         return nc;
     }
 
+    inline size_t cord_buf_bytes_iterator::forward_to(char c) {
+        size_t nc = 0;
+        while (_bytes_left != 0) {
+            const char *p = (const char *) memchr(_block_begin, c, _block_end - _block_begin);
+            if (p != NULL) {
+                nc += p - _block_begin;
+                _bytes_left -= p - _block_begin;
+                _block_begin = p;
+                break;
+            }
+            const size_t block_size = _block_end - _block_begin;
+            _block_begin = _block_end;
+            _bytes_left -= block_size;
+            nc += block_size;
+            try_next_block();
+        }
+        return nc;
+    }
+
     inline size_t cord_buf_bytes_iterator::forward(size_t n) {
         size_t nc = 0;
         while (nc < n && _bytes_left != 0) {
@@ -0,0 +1,157 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/io/cord_buf_mapped_file.h"
+#include <sys/mman.h>                      // mmap
+#include <sys/stat.h>                      // fstat
+#include <fcntl.h>                         // F_DUPFD_CLOEXEC
+#include <unistd.h>                        // sysconf
+#include <errno.h>
+#include <algorithm>
+#include <atomic>
+
+namespace flare {
+
+    namespace {
+
+        // Size of a block is 32-bit.
+        const size_t MAX_MAPPED_BLOCK_SIZE = 1024 * 1024 * 1024;
+
+        struct file_mapping {
+            char *addr;
+            size_t length;
+            // Offset in the file of `addr'.
+            off_t offset;
+            int fd;
+            // Number of blocks referencing the mapping.
+            std::atomic<int> nref;
+        };
+
+        void release_file_mapping(void *, void *meta) {
+            file_mapping *m = static_cast<file_mapping *>(meta);
+            if (m->nref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                munmap(m->addr, m->length);
+                close(m->fd);
+                delete m;
+            }
+        }
+
+    }  // namespace
+
+    mapped_file_options::mapped_file_options() : prefetch(false), populate(false) {}
+
+    int append_mapped_file(cord_buf *out, int fd, off_t offset, size_t count,
+                           const mapped_file_options *options) {
+        if (offset < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (count == 0) {
+            return 0;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return -1;
+        }
+        if ((size_t) offset > (size_t) st.st_size || count > (size_t) st.st_size - offset) {
+            // Pages beyond end of the file can't be accessed.
+            errno = EINVAL;
+            return -1;
+        }
+        const mapped_file_options default_options;
+        if (options == NULL) {
+            options = &default_options;
+        }
+
+        static const off_t page_size = sysconf(_SC_PAGESIZE);
+        const off_t aligned_offset = offset / page_size * page_size;
+        const size_t length = count + (offset - aligned_offset);
+        const int flags = MAP_SHARED | (options->populate ? MAP_POPULATE : 0);
+        void *addr = mmap(NULL, length, PROT_READ, flags, fd, aligned_offset);
+        if (addr == MAP_FAILED) {
+            return -1;
+        }
+        if (options->prefetch) {
+            madvise(addr, length, MADV_WILLNEED);
+        }
+        const int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (dup_fd < 0) {
+            const int saved_errno = errno;
+            munmap(addr, length);
+            errno = saved_errno;
+            return -1;
+        }
+
+        file_mapping *m = new file_mapping;
+        m->addr = static_cast<char *>(addr);
+        m->length = length;
+        m->offset = aligned_offset;
+        m->fd = dup_fd;
+        const size_t nblock = (count + MAX_MAPPED_BLOCK_SIZE - 1) / MAX_MAPPED_BLOCK_SIZE;
+        m->nref.store(nblock, std::memory_order_relaxed);
+
+        char *data = m->addr + (offset - aligned_offset);
+        // Blocks are appended to `out' only if all of them are created, the
+        // ones created before a failure are released along with `blocks'.
+        cord_buf blocks;
+        for (size_t i = 0; i < nblock; ++i) {
+            const size_t len = std::min(count - i * MAX_MAPPED_BLOCK_SIZE, MAX_MAPPED_BLOCK_SIZE);
+            if (blocks.append_user_data_with_meta(data + i * MAX_MAPPED_BLOCK_SIZE, len,
+                                                  release_file_mapping, m) != 0) {
+                // Drop references of the blocks not appended.
+                for (size_t j = i; j < nblock; ++j) {
+                    release_file_mapping(NULL, m);
+                }
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+        out->append(cord_buf::Movable(blocks));
+        return 0;
+    }
+
+    size_t mapped_file_front(const cord_buf &buf, int *fd, off_t *offset) {
+        file_mapping *m = static_cast<file_mapping *>(
+                buf.backing_block_meta(0, release_file_mapping));
+        if (m == NULL) {
+            return 0;
+        }
+        std::string_view block = buf.backing_block(0);
+        *fd = m->fd;
+        *offset = m->offset + (block.data() - m->addr);
+        size_t length = block.size();
+        const char *end = block.data() + block.size();
+        for (size_t i = 1; i < buf.backing_block_num(); ++i) {
+            if (buf.backing_block_meta(i, release_file_mapping) != m) {
+                break;
+            }
+            block = buf.backing_block(i);
+            if (block.data() != end) {
+                break;
+            }
+            length += block.size();
+            end += block.size();
+        }
+        return length;
+    }
+
+    bool is_mapped_file_block(const cord_buf &buf, size_t i) {
+        return buf.backing_block_meta(i, release_file_mapping) != NULL;
+    }
+
+}  // namespace flare
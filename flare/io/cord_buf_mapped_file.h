@@ -0,0 +1,65 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_IO_CORD_BUF_MAPPED_FILE_H_
+#define FLARE_IO_CORD_BUF_MAPPED_FILE_H_
+
+#include <sys/types.h>                           // off_t
+#include "flare/io/cord_buf.h"
+
+namespace flare {
+
+    struct mapped_file_options {
+        mapped_file_options();
+
+        // madvise(MADV_WILLNEED) the range so that the kernel starts reading
+        // it ahead asynchronously.
+        // default: false
+        bool prefetch;
+
+        // Read all pages in(MAP_POPULATE) before returning, so that readers
+        // of the cord_buf never block on page faults.
+        // default: false
+        bool populate;
+    };
+
+    // Append [offset, offset + count) of file `fd' to `out' WITHOUT copying
+    // by mapping the range into memory(read-only, shared). Pages are read
+    // on first access unless `prefetch' or `populate' is set. The mapping
+    // is released when no cord_buf references any part of it.
+    // `fd' is duplicated so that the data can be sent by sendfile(2)(see
+    // mapped_file_front()), the caller may close it after return. The file
+    // must not be truncated while mapped, accessing the truncated part gets
+    // SIGBUS.
+    // Returns 0 on success, -1 otherwise and errno is set, `out' is left
+    // unchanged on failure.
+    int append_mapped_file(cord_buf *out, int fd, off_t offset, size_t count,
+                           const mapped_file_options *options = NULL);
+
+    // If `buf' starts with data appended by append_mapped_file(), set `*fd'
+    // and `*offset' to the position of it in the file and return the length
+    // of the data contiguous in the file. Returns 0 otherwise.
+    // `*fd' is valid as long as the data is referenced by `buf'.
+    size_t mapped_file_front(const cord_buf &buf, int *fd, off_t *offset);
+
+    // Whether #i backing block of `buf' is appended by append_mapped_file().
+    bool is_mapped_file_block(const cord_buf &buf, size_t i);
+
+}  // namespace flare
+
+#endif  // FLARE_IO_CORD_BUF_MAPPED_FILE_H_
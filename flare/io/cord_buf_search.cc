@@ -0,0 +1,311 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// Search primitives of cord_buf. Bytes in each backing block are scanned
+// with SSE2, or AVX2 when the CPU supports it, matches spanning blocks are
+// checked separately.
+
+#include <string.h>                        // memchr
+#include <algorithm>
+#include "flare/base/profile.h"
+#include "flare/io/cord_buf.h"
+
+#if FLARE_HAVE_SSE2 && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define FLARE_CORD_BUF_SEARCH_AVX2 1
+#include <immintrin.h>
+#else
+#define FLARE_CORD_BUF_SEARCH_AVX2 0
+#endif
+
+namespace flare {
+
+    namespace {
+
+        // find_first_of() with more bytes than this uses the lookup table.
+        const size_t MAX_SIMD_SET_SIZE = 16;
+
+        const char *find_first_of_scalar(const char *s, const char *e,
+                                         const char *set, size_t nset) {
+            if (e - s <= 64) {
+                for (; s != e; ++s) {
+                    if (memchr(set, *s, nset) != NULL) {
+                        return s;
+                    }
+                }
+                return NULL;
+            }
+            bool table[256] = {};
+            for (size_t i = 0; i < nset; ++i) {
+                table[static_cast<unsigned char>(set[i])] = true;
+            }
+            for (; s != e; ++s) {
+                if (table[static_cast<unsigned char>(*s)]) {
+                    return s;
+                }
+            }
+            return NULL;
+        }
+
+        // First position in [s, e) where the `nd' bytes at `d' match,
+        // `nd' >= 2.
+        const char *find_delim_scalar(const char *s, const char *e, const char *d, size_t nd) {
+            const char *const last = e - nd;
+            for (; s <= last; ++s) {
+                s = (const char *) memchr(s, d[0], last - s + 1);
+                if (s == NULL) {
+                    return NULL;
+                }
+                if (memcmp(s + 1, d + 1, nd - 1) == 0) {
+                    return s;
+                }
+            }
+            return NULL;
+        }
+
+#if FLARE_HAVE_SSE2
+
+        const char *find_first_of_sse2(const char *s, const char *e,
+                                       const char *set, size_t nset) {
+            __m128i sets[MAX_SIMD_SET_SIZE];
+            for (size_t i = 0; i < nset; ++i) {
+                sets[i] = _mm_set1_epi8(set[i]);
+            }
+            for (; s + 16 <= e; s += 16) {
+                const __m128i v = _mm_loadu_si128((const __m128i *) s);
+                __m128i eq = _mm_cmpeq_epi8(v, sets[0]);
+                for (size_t i = 1; i < nset; ++i) {
+                    eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, sets[i]));
+                }
+                const int mask = _mm_movemask_epi8(eq);
+                if (mask != 0) {
+                    return s + __builtin_ctz(mask);
+                }
+            }
+            return find_first_of_scalar(s, e, set, nset);
+        }
+
+        // Compare the first and the last bytes of the delimiter at 16
+        // positions at once, and memcmp the rest on candidates only.
+        const char *find_delim_sse2(const char *s, const char *e, const char *d, size_t nd) {
+            const __m128i first = _mm_set1_epi8(d[0]);
+            const __m128i last = _mm_set1_epi8(d[nd - 1]);
+            for (; s + nd - 1 + 16 <= e; s += 16) {
+                const __m128i vf = _mm_loadu_si128((const __m128i *) s);
+                const __m128i vl = _mm_loadu_si128((const __m128i *) (s + nd - 1));
+                int mask = _mm_movemask_epi8(
+                        _mm_and_si128(_mm_cmpeq_epi8(vf, first), _mm_cmpeq_epi8(vl, last)));
+                while (mask != 0) {
+                    const int i = __builtin_ctz(mask);
+                    if (memcmp(s + i + 1, d + 1, nd - 2) == 0) {
+                        return s + i;
+                    }
+                    mask &= mask - 1;
+                }
+            }
+            return find_delim_scalar(s, e, d, nd);
+        }
+
+#endif  // FLARE_HAVE_SSE2
+
+#if FLARE_CORD_BUF_SEARCH_AVX2
+
+        __attribute__((target("avx2")))
+        const char *find_first_of_avx2(const char *s, const char *e,
+                                       const char *set, size_t nset) {
+            __m256i sets[MAX_SIMD_SET_SIZE];
+            for (size_t i = 0; i < nset; ++i) {
+                sets[i] = _mm256_set1_epi8(set[i]);
+            }
+            for (; s + 32 <= e; s += 32) {
+                const __m256i v = _mm256_loadu_si256((const __m256i *) s);
+                __m256i eq = _mm256_cmpeq_epi8(v, sets[0]);
+                for (size_t i = 1; i < nset; ++i) {
+                    eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(v, sets[i]));
+                }
+                const uint32_t mask = _mm256_movemask_epi8(eq);
+                if (mask != 0) {
+                    return s + __builtin_ctz(mask);
+                }
+            }
+            return find_first_of_sse2(s, e, set, nset);
+        }
+
+        __attribute__((target("avx2")))
+        const char *find_delim_avx2(const char *s, const char *e, const char *d, size_t nd) {
+            const __m256i first = _mm256_set1_epi8(d[0]);
+            const __m256i last = _mm256_set1_epi8(d[nd - 1]);
+            for (; s + nd - 1 + 32 <= e; s += 32) {
+                const __m256i vf = _mm256_loadu_si256((const __m256i *) s);
+                const __m256i vl = _mm256_loadu_si256((const __m256i *) (s + nd - 1));
+                uint32_t mask = _mm256_movemask_epi8(
+                        _mm256_and_si256(_mm256_cmpeq_epi8(vf, first), _mm256_cmpeq_epi8(vl, last)));
+                while (mask != 0) {
+                    const int i = __builtin_ctz(mask);
+                    if (memcmp(s + i + 1, d + 1, nd - 2) == 0) {
+                        return s + i;
+                    }
+                    mask &= mask - 1;
+                }
+            }
+            return find_delim_sse2(s, e, d, nd);
+        }
+
+#endif  // FLARE_CORD_BUF_SEARCH_AVX2
+
+        typedef const char *(*find_function)(const char *, const char *, const char *, size_t);
+
+        struct search_functions {
+            find_function find_first_of;
+            find_function find_delim;
+
+            search_functions() {
+#if FLARE_CORD_BUF_SEARCH_AVX2
+                if (__builtin_cpu_supports("avx2")) {
+                    find_first_of = find_first_of_avx2;
+                    find_delim = find_delim_avx2;
+                    return;
+                }
+#endif
+#if FLARE_HAVE_SSE2
+                find_first_of = find_first_of_sse2;
+                find_delim = find_delim_sse2;
+#else
+                find_first_of = find_first_of_scalar;
+                find_delim = find_delim_scalar;
+#endif
+            }
+        };
+
+        const search_functions &get_search_functions() {
+            static const search_functions s_functions;
+            return s_functions;
+        }
+
+    }  // namespace
+
+    size_t cord_buf::find(char c, size_t pos) const {
+        const size_t nref = _ref_num();
+        size_t n = 0;
+        for (size_t i = 0; i < nref; ++i) {
+            const std::string_view block = backing_block(i);
+            if (n + block.size() > pos) {
+                const size_t skip = pos > n ? pos - n : 0;
+                char const *const s = block.data();
+                // memchr of glibc is vectorized already.
+                const char *p = (const char *) memchr(s + skip, c, block.size() - skip);
+                if (p != NULL) {
+                    return n + (p - s);
+                }
+            }
+            n += block.size();
+        }
+        return npos;
+    }
+
+    size_t cord_buf::find_first_of(const std::string_view &chars, size_t pos) const {
+        if (chars.size() == 1) {
+            return find(chars[0], pos);
+        }
+        if (chars.empty()) {
+            return npos;
+        }
+        const find_function find_first_of_in_block =
+                chars.size() <= MAX_SIMD_SET_SIZE ? get_search_functions().find_first_of
+                                                  : find_first_of_scalar;
+        const size_t nref = _ref_num();
+        size_t n = 0;
+        for (size_t i = 0; i < nref; ++i) {
+            const std::string_view block = backing_block(i);
+            if (n + block.size() > pos) {
+                const size_t skip = pos > n ? pos - n : 0;
+                char const *const s = block.data();
+                const char *p = find_first_of_in_block(s + skip, s + block.size(),
+                                                       chars.data(), chars.size());
+                if (p != NULL) {
+                    return n + (p - s);
+                }
+            }
+            n += block.size();
+        }
+        return npos;
+    }
+
+    size_t cord_buf::find(const std::string_view &delim, size_t pos) const {
+        const size_t nd = delim.size();
+        if (nd == 1) {
+            return find(delim[0], pos);
+        }
+        const size_t total = length();
+        if (pos > total || nd > total - pos) {
+            return npos;
+        }
+        if (nd == 0) {
+            return pos;
+        }
+        const find_function find_delim_in_block = get_search_functions().find_delim;
+        const size_t nref = _ref_num();
+        size_t n = 0;
+        for (size_t i = 0; i < nref; ++i) {
+            const std::string_view block = backing_block(i);
+            if (n + block.size() <= pos) {
+                n += block.size();
+                continue;
+            }
+            const size_t skip = pos > n ? pos - n : 0;
+            char const *const s = block.data();
+            char const *const e = s + block.size();
+            // Matches inside the block.
+            if (block.size() >= skip + nd) {
+                const char *p = find_delim_in_block(s + skip, e, delim.data(), nd);
+                if (p != NULL) {
+                    return n + (p - s);
+                }
+            }
+            // Matches starting in the last nd-1 bytes and spanning following
+            // blocks, which are after the ones above.
+            for (const char *p = std::max(s + skip, e - std::min(nd - 1, block.size())); p < e; ++p) {
+                p = (const char *) memchr(p, delim[0], e - p);
+                if (p == NULL) {
+                    break;
+                }
+                if (n + (p - s) + nd > total) {
+                    return npos;
+                }
+                // Compare the rest of the block and then the following ones.
+                size_t matched = e - p;
+                if (memcmp(p, delim.data(), matched) != 0) {
+                    continue;
+                }
+                for (size_t j = i + 1; matched < nd; ++j) {
+                    const std::string_view next = backing_block(j);
+                    const size_t len = std::min(next.size(), nd - matched);
+                    if (memcmp(next.data(), delim.data() + matched, len) != 0) {
+                        break;
+                    }
+                    matched += len;
+                }
+                if (matched == nd) {
+                    return n + (p - s);
+                }
+            }
+            n += block.size();
+        }
+        return npos;
+    }
+
+}  // namespace flare
@@ -0,0 +1,231 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/io/cord_buf_zero_copy.h"
+#include "flare/io/cord_buf_mapped_file.h"
+#include <sys/socket.h>                    // sendmsg, recvmsg
+#include <sys/sendfile.h>                  // sendfile
+#include <sys/uio.h>                       // writev
+#include <netinet/in.h>                    // IPPROTO_IP
+#include <linux/errqueue.h>                // sock_extended_err
+#include <poll.h>                          // poll
+#include <unistd.h>                        // usleep
+#include <errno.h>
+#include <algorithm>
+#include "flare/log/logging.h"
+#include "flare/times/time.h"
+
+// Not defined by glibc older than 2.27
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+namespace flare {
+
+    // Same as the one of cord_buf::cut_into_file_descriptor, iovec is on stack.
+    static const size_t ZERO_COPY_IOV_MAX = 256;
+
+    zero_copy_sender_options::zero_copy_sender_options()
+            : min_zero_copy_size(16384), max_pending_bytes(64 * 1024 * 1024),
+              max_destroy_wait_ms(1000) {}
+
+    cord_buf_zero_copy_sender::cord_buf_zero_copy_sender()
+            : cord_buf_zero_copy_sender(zero_copy_sender_options()) {}
+
+    cord_buf_zero_copy_sender::cord_buf_zero_copy_sender(
+            const zero_copy_sender_options &options)
+            : _fd(-1), _zero_copy(false), _options(options), _next_seq(0), _pending_bytes(0), _completed(0),
+              _copied(0) {}
+
+    cord_buf_zero_copy_sender::~cord_buf_zero_copy_sender() {
+        if (_pending.empty()) {
+            return;
+        }
+        const int64_t deadline_us =
+                flare::get_current_time_micros() + _options.max_destroy_wait_ms * 1000L;
+        while (reap_completions() >= 0 && !_pending.empty()) {
+            const int64_t left_ms = (deadline_us - flare::get_current_time_micros() + 999) / 1000;
+            if (left_ms <= 0) {
+                break;
+            }
+            // POLLERR is always polled, set when the error queue is not empty.
+            struct pollfd pfd = {_fd, 0, 0};
+            const int rc = ::poll(&pfd, 1, (int) left_ms);
+            if (rc < 0 && errno != EINTR) {
+                break;
+            }
+            if (rc > 0 && (pfd.revents & POLLNVAL)) {
+                break;
+            }
+            if (rc > 0 && (pfd.revents & POLLHUP)) {
+                // Stays set, don't spin while completions are on their way.
+                usleep(1000);
+            }
+        }
+        if (!_pending.empty()) {
+            FLARE_LOG(WARNING) << "Leak " << _pending_bytes << " bytes of " << _pending.size()
+                               << " zero-copy sends not completed in "
+                               << _options.max_destroy_wait_ms << "ms, fd=" << _fd;
+            // The NIC may still be reading them.
+            new std::deque<pending_send>(std::move(_pending));
+        }
+    }
+
+    int cord_buf_zero_copy_sender::init(int fd) {
+        _fd = fd;
+        const int one = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0) {
+            _zero_copy = false;
+            return errno;
+        }
+        _zero_copy = true;
+        return 0;
+    }
+
+    ssize_t cord_buf_zero_copy_sender::cut_from(cord_buf *buf, size_t size_hint) {
+        if (buf->empty()) {
+            return 0;
+        }
+        if (!_pending.empty()) {
+            reap_completions();
+        }
+
+        // Data of mapped files goes from page cache to the socket directly.
+        int file_fd = -1;
+        off_t file_offset = 0;
+        const size_t file_len = mapped_file_front(*buf, &file_fd, &file_offset);
+        if (file_len > 0) {
+            const ssize_t nw = ::sendfile(_fd, file_fd, &file_offset,
+                                          std::min(file_len, size_hint));
+            if (nw > 0) {
+                buf->pop_front(nw);
+            }
+            return nw;
+        }
+
+        const size_t nref = std::min(buf->backing_block_num(), ZERO_COPY_IOV_MAX);
+        struct iovec vec[nref];
+        size_t nvec = 0;
+        size_t cur_len = 0;
+        do {
+            std::string_view block = buf->backing_block(nvec);
+            vec[nvec].iov_base = const_cast<char *>(block.data());
+            vec[nvec].iov_len = block.size();
+            ++nvec;
+            cur_len += block.size();
+            // Leave mapped files to sendfile.
+        } while (nvec < nref && cur_len < size_hint && !is_mapped_file_block(*buf, nvec));
+
+        if (_zero_copy && cur_len >= _options.min_zero_copy_size &&
+            _pending_bytes + cur_len <= _options.max_pending_bytes) {
+            struct msghdr msg = {};
+            msg.msg_iov = vec;
+            msg.msg_iovlen = nvec;
+            const ssize_t nw = ::sendmsg(_fd, &msg, MSG_ZEROCOPY);
+            if (nw > 0) {
+                _pending.emplace_back();
+                pending_send &p = _pending.back();
+                p.seq = _next_seq++;
+                p.done = false;
+                buf->cutn(&p.data, nw);
+                _pending_bytes += nw;
+                return nw;
+            }
+            // ENOBUFS means pages pinned by the socket exceed optmem_max,
+            // copy this time.
+            if (nw == 0 || errno != ENOBUFS) {
+                return nw;
+            }
+        }
+
+        const ssize_t nw = ::writev(_fd, vec, nvec);
+        if (nw > 0) {
+            buf->pop_front(nw);
+        }
+        return nw;
+    }
+
+    ssize_t cord_buf_zero_copy_sender::send_file(int file_fd, off_t offset, size_t count) {
+        return ::sendfile(_fd, file_fd, &offset, count);
+    }
+
+    int cord_buf_zero_copy_sender::reap_completions() {
+        int ncompleted = 0;
+        while (!_pending.empty()) {
+            char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+            struct msghdr msg = {};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (::recvmsg(_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                return -1;
+            }
+            for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+                 cm = CMSG_NXTHDR(&msg, cm)) {
+                if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                    !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                    continue;
+                }
+                const struct sock_extended_err *serr =
+                        (const struct sock_extended_err *) CMSG_DATA(cm);
+                if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+                    continue;
+                }
+                // Sends [ee_info, ee_data] are completed, both inclusive.
+                complete(serr->ee_info, serr->ee_data,
+                         serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+                ncompleted += serr->ee_data - serr->ee_info + 1;
+            }
+        }
+        return ncompleted;
+    }
+
+    void cord_buf_zero_copy_sender::complete(uint32_t lo, uint32_t hi, bool copied) {
+        const uint32_t n = hi - lo + 1;
+        _completed += n;
+        if (copied) {
+            _copied += n;
+        }
+        // Completions are reported in order in practice, but the ranges may
+        // be coalesced.
+        for (auto &p : _pending) {
+            if (p.seq - lo < n) {
+                p.done = true;
+            }
+        }
+        while (!_pending.empty() && _pending.front().done) {
+            _pending_bytes -= _pending.front().data.size();
+            _pending.pop_front();
+        }
+    }
+
+}  // namespace flare
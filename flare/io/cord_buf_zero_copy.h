@@ -0,0 +1,136 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FLARE_IO_CORD_BUF_ZERO_COPY_H_
+#define FLARE_IO_CORD_BUF_ZERO_COPY_H_
+
+#include <sys/types.h>                           // ssize_t, off_t
+#include <stdint.h>
+#include <deque>
+#include "flare/io/cord_buf.h"
+
+namespace flare {
+
+    struct zero_copy_sender_options {
+        zero_copy_sender_options();
+
+        // Sends shorter than this are written by writev. Pinning pages and
+        // reading the completion cost more than copying small sends.
+        // default: 16KB
+        size_t min_zero_copy_size;
+
+        // Max bytes referenced by sends not completed by the kernel yet.
+        // Beyond that data is copied by writev until completions come back.
+        // default: 64MB
+        size_t max_pending_bytes;
+
+        // Max milliseconds the destructor waits for completions of pending
+        // sends. Blocks of sends still not completed after that are leaked
+        // rather than being reused while the NIC may still read them.
+        // default: 1000
+        int max_destroy_wait_ms;
+    };
+
+    // Writes cord_buf into a socket with MSG_ZEROCOPY: the kernel sends the
+    // pages of blocks directly instead of copying them into socket buffers.
+    // Blocks of each send are referenced until the kernel reports the send
+    // completed through the error queue of the socket, so that they're never
+    // reused while the NIC is still reading them.
+    // Falls back to writev when the socket or the kernel (< 4.14) does not
+    // support zero copy. Not thread-safe, one sender per socket.
+    //
+    //   cord_buf_zero_copy_sender sender;
+    //   sender.init(fd);
+    //   while (!buf.empty()) {
+    //       ssize_t nw = sender.cut_from(&buf);
+    //       ...  // handle EAGAIN like cut_into_file_descriptor
+    //   }
+    //   ...
+    //   // poll()-ing POLLERR of fd and then:
+    //   sender.reap_completions();
+    class cord_buf_zero_copy_sender {
+    public:
+        cord_buf_zero_copy_sender();
+
+        explicit cord_buf_zero_copy_sender(const zero_copy_sender_options &options);
+
+        // Wait at most `max_destroy_wait_ms' for completions of pending
+        // sends, blocking the calling thread. Close the socket after the
+        // sender is destroyed, completions can't be read from a closed
+        // socket.
+        ~cord_buf_zero_copy_sender();
+
+        // Enable SO_ZEROCOPY on `fd'.
+        // Returns 0 on success, errno otherwise(and the sender copies).
+        int init(int fd);
+
+        // Whether sends bypass the copy.
+        bool zero_copy_enabled() const { return _zero_copy; }
+
+        // Cut at most `size_hint' bytes(approximately) from `buf' into the
+        // socket. Reaps available completions first. Data appended by
+        // append_mapped_file() is sent by sendfile(2).
+        // Returns bytes cut on success, -1 otherwise and errno is set.
+        ssize_t cut_from(cord_buf *buf, size_t size_hint = 1024 * 1024);
+
+        // Send `count' bytes of regular file `file_fd' starting at `offset'
+        // by sendfile(2), data is moved from page cache to the socket without
+        // entering user space. Data cut by cut_from() before is sent first.
+        // Returns bytes sent on success, -1 otherwise and errno is set.
+        ssize_t send_file(int file_fd, off_t offset, size_t count);
+
+        // Read completions from the error queue without blocking and release
+        // blocks of completed sends.
+        // Returns number of sends completed, -1 on error.
+        int reap_completions();
+
+        // Number of sends waiting for completions.
+        size_t pending_count() const { return _pending.size(); }
+
+        size_t pending_bytes() const { return _pending_bytes; }
+
+        // Number of zero-copy sends completed, and the ones among them that
+        // the kernel copied anyway(e.g. over loopback or a NIC without
+        // scatter-gather), in which case zero copy only adds overhead.
+        size_t completed_count() const { return _completed; }
+
+        size_t copied_count() const { return _copied; }
+
+    private:
+        struct pending_send {
+            uint32_t seq;
+            bool done;
+            cord_buf data;
+        };
+
+        void complete(uint32_t lo, uint32_t hi, bool copied);
+
+        int _fd;
+        bool _zero_copy;
+        zero_copy_sender_options _options;
+        // Sequence number the kernel assigns to the next zero-copy send.
+        uint32_t _next_seq;
+        std::deque<pending_send> _pending;
+        size_t _pending_bytes;
+        size_t _completed;
+        size_t _copied;
+    };
+
+}  // namespace flare
+
+#endif  // FLARE_IO_CORD_BUF_ZERO_COPY_H_
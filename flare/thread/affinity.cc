@@ -7,6 +7,9 @@
 #include <unistd.h>
 #include <thread>
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 
 #if defined(__APPLE__)
 
@@ -180,4 +183,116 @@ namespace flare {
         return affinity;
     }
 
+    bool core_affinity::parse_cpu_list(const char *list, std::vector<int> *ids) {
+#if defined(__linux__) && !defined(__ANDROID__)
+        const long max_id = CPU_SETSIZE;
+#else
+        const long max_id = 1024;
+#endif
+        ids->clear();
+        const char *p = list;
+        while (*p != '\0' && *p != '\n') {
+            char *end = nullptr;
+            const long first = strtol(p, &end, 10);
+            if (end == p || first < 0) {
+                return false;
+            }
+            long last = first;
+            p = end;
+            if (*p == '-') {
+                ++p;
+                last = strtol(p, &end, 10);
+                if (end == p || last < first) {
+                    return false;
+                }
+                p = end;
+            }
+            // CPU_SET() on an id out of the set is undefined.
+            if (last >= max_id) {
+                return false;
+            }
+            for (long i = first; i <= last; ++i) {
+                ids->push_back(static_cast<int>(i));
+            }
+            if (*p == ',') {
+                ++p;
+            } else if (*p != '\0' && *p != '\n') {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int core_affinity::num_numa_nodes() {
+#if defined(__linux__) && !defined(__ANDROID__)
+        // Node ids may be sparse, e.g. "0,2" after a node is offlined, so
+        // probing node0, node1, ... until one is missing undercounts.
+        FILE *fp = fopen("/sys/devices/system/node/online", "r");
+        if (fp == nullptr) {
+            return 1;
+        }
+        char buf[1024];
+        std::vector<int> nodes;
+        const bool ok = fgets(buf, sizeof(buf), fp) != nullptr &&
+                        parse_cpu_list(buf, &nodes) && !nodes.empty();
+        fclose(fp);
+        if (!ok) {
+            return 1;
+        }
+        return *std::max_element(nodes.begin(), nodes.end()) + 1;
+#else
+        return 1;
+#endif
+    }
+
+    core_affinity core_affinity::numa_node_cores(int node_id) {
+#if defined(__linux__) && !defined(__ANDROID__)
+        core_affinity affinity;
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node_id);
+        FILE *fp = fopen(path, "r");
+        if (fp == nullptr) {
+            return node_id == 0 ? all() : affinity;
+        }
+        // cpulist looks like "0-23,48-71".
+        char buf[1024];
+        std::vector<int> ids;
+        if (fgets(buf, sizeof(buf), fp) != nullptr && parse_cpu_list(buf, &ids)) {
+            for (int id : ids) {
+                core_node core;
+                core.index = id;
+                core.group = node_id;
+                affinity.cores.push_back(core);
+            }
+        }
+        fclose(fp);
+        return affinity;
+#else
+        return node_id == 0 ? all() : core_affinity();
+#endif
+    }
+
+    int core_affinity::bind_current_thread() const {
+        if (cores.empty()) {
+            return EINVAL;
+        }
+#if defined(__linux__) && !defined(__ANDROID__)
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (auto core : cores) {
+            CPU_SET(core.index, &cpuset);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+#elif defined(__FreeBSD__)
+        cpuset_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (auto core : cores) {
+            CPU_SET(core.index, &cpuset);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpuset_t), &cpuset);
+#else
+        return ENOTSUP;
+#endif
+    }
+
 }  // namespace flare
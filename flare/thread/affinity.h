@@ -98,6 +98,24 @@ namespace flare {
 
         static core_affinity group_cores(int node_id, const std::vector<int> &cores);
 
+        // num_numa_nodes() returns the number of NUMA nodes of the system, i.e.
+        // the highest online node id plus one, 1 if the topology can not be
+        // detected on this platform.
+        static int num_numa_nodes();
+
+        // parse_cpu_list() parses a list in the kernel's cpulist format such as
+        // "0-23,48-71" into `ids`. Returns false if the list is malformed or
+        // contains an id not less than CPU_SETSIZE.
+        static bool parse_cpu_list(const char *list, std::vector<int> *ids);
+
+        // numa_node_cores() returns the cores belonging to NUMA node `node_id`,
+        // the group of each returned core is set to `node_id`.
+        static core_affinity numa_node_cores(int node_id);
+
+        // bind_current_thread() restricts the calling thread to the cores of this
+        // affinity. Returns 0 on success, errno otherwise.
+        int bind_current_thread() const;
+
     private:
 
         std::vector<core_node> cores;
@@ -7,9 +7,18 @@
 #include "testing/gtest_wrap.h"
 #include "flare/fiber/future.h"
 #include "flare/fiber/this_fiber.h"
+#include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/internal/unstable.h"
+#include "flare/times/time.h"
+#include "flare/log/logging.h"
 
 using namespace std::literals;
 
+namespace flare::fiber_internal {
+    class fiber_worker;
+    extern __thread fiber_worker *tls_task_group_nosignal;
+}
+
 namespace flare {
 
     TEST(Async, Execute) {
@@ -31,4 +40,139 @@ namespace flare {
             }
         }
 
+    TEST(Async, ExecuteBatch) {
+        for (int i = 0; i != 100; ++i) {
+            std::atomic<int> nrun{0};
+            std::vector<future<std::size_t>> fs = fiber_async_batch(100, [&](std::size_t i) {
+                nrun.fetch_add(1);
+                return i * 2;
+            });
+            ASSERT_EQ(100u, fs.size());
+            for (std::size_t j = 0; j != fs.size(); ++j) {
+                ASSERT_EQ(j * 2, fiber_future_get(&fs[j]));
+            }
+            ASSERT_EQ(100, nrun);
+        }
+        std::vector<future<>> fs = fiber_async_batch(0, [](std::size_t) {});
+        ASSERT_TRUE(fs.empty());
+    }
+
+    static std::atomic<int> nfinished{0};
+
+    static void *count_finished(void *) {
+        nfinished.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    static void *start_fibers(void *arg) {
+        const bool batch = (arg != nullptr);
+        const size_t N = 128;
+        fiber_id_t tids[N];
+        if (batch) {
+            flare::base::function<void *(void *)> fns[N];
+            for (size_t i = 0; i < N; ++i) {
+                fns[i] = count_finished;
+            }
+            EXPECT_EQ(0, fiber_start_batch(tids, nullptr, fns, nullptr, N));
+        } else {
+            for (size_t i = 0; i < N; ++i) {
+                EXPECT_EQ(0, fiber_start_background(&tids[i], nullptr, count_finished, nullptr));
+            }
+        }
+        for (size_t i = 0; i < N; ++i) {
+            fiber_join(tids[i], nullptr);
+        }
+        return nullptr;
+    }
+
+    TEST(Async, StartBatchInvalid) {
+        const size_t N = 4;
+        fiber_id_t tids[N] = {1, 2, 3, 4};
+        flare::base::function<void *(void *)> fns[N];
+        fns[0] = count_finished;
+        fns[1] = count_finished;
+        ASSERT_EQ(EINVAL, fiber_start_batch(tids, nullptr, fns, nullptr, N));
+        for (size_t i = 0; i < N; ++i) {
+            ASSERT_EQ(INVALID_FIBER_ID, tids[i]);
+        }
+    }
+
+    TEST(Async, StartBatchNosignal) {
+        nfinished = 0;
+        fiber_flush();
+        const size_t N = 16;
+        fiber_id_t tids[N];
+        flare::base::function<void *(void *)> fns[N];
+        fiber_attribute attr = FIBER_ATTR_NORMAL;
+        attr.flags |= FIBER_NOSIGNAL;
+        for (int round = 0; round < 2; ++round) {
+            for (size_t i = 0; i < N; ++i) {
+                fns[i] = count_finished;
+            }
+            ASSERT_EQ(0, fiber_start_batch(tids, &attr, fns, nullptr, N));
+        }
+        // Both batches went to the worker remembered for fiber_flush().
+        ASSERT_TRUE(flare::fiber_internal::tls_task_group_nosignal != nullptr);
+        fiber_flush();
+        for (size_t i = 0; i < N; ++i) {
+            fiber_join(tids[i], nullptr);
+        }
+        const int64_t start_us = flare::get_current_time_micros();
+        while (nfinished != 2 * N &&
+               flare::get_current_time_micros() - start_us < 1000000) {
+            usleep(1000);
+        }
+        ASSERT_EQ(2 * N, (size_t) nfinished);
+    }
+
+    // Start a batch larger than the runqueue of the worker, which can only
+    // be done if other workers are woken up to steal the queued fibers.
+    static void *start_large_batch(void *) {
+        const size_t N = 10000;
+        std::vector<fiber_id_t> tids(N);
+        std::vector<flare::base::function<void *(void *)>> fns(N);
+        for (size_t i = 0; i < N; ++i) {
+            fns[i] = count_finished;
+        }
+        EXPECT_EQ(0, fiber_start_batch(tids.data(), nullptr, fns.data(), nullptr, N));
+        for (size_t i = 0; i < N; ++i) {
+            fiber_join(tids[i], nullptr);
+        }
+        return nullptr;
+    }
+
+    TEST(Async, StartBatchLargerThanRunqueue) {
+        nfinished = 0;
+        fiber_id_t tid;
+        ASSERT_EQ(0, fiber_start_background(&tid, nullptr, start_large_batch, nullptr));
+        ASSERT_EQ(0, fiber_join(tid, nullptr));
+        ASSERT_EQ(10000, nfinished);
+    }
+
+    TEST(Async, StartBatchPerformance) {
+        const int ROUNDS = 200;
+        for (int in_fiber = 0; in_fiber < 2; ++in_fiber) {
+            for (int batch = 0; batch < 2; ++batch) {
+                nfinished = 0;
+                void *arg = (batch ? &nfinished : nullptr);
+                flare::stop_watcher tm;
+                tm.start();
+                for (int i = 0; i < ROUNDS; ++i) {
+                    if (in_fiber) {
+                        fiber_id_t tid;
+                        ASSERT_EQ(0, fiber_start_background(&tid, nullptr, start_fibers, arg));
+                        fiber_join(tid, nullptr);
+                    } else {
+                        start_fibers(arg);
+                    }
+                }
+                tm.stop();
+                ASSERT_EQ(ROUNDS * 128, nfinished);
+                FLARE_LOG(INFO) << (batch ? "fiber_start_batch" : "fiber_start_background")
+                                << " from " << (in_fiber ? "fiber" : "pthread")
+                                << ": " << tm.n_elapsed() / (ROUNDS * 128) << "ns per fiber";
+            }
+        }
+    }
+
 }  // namespace flare
@@ -0,0 +1,353 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "testing/gtest_wrap.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include "flare/fiber/fiber_channel.h"
+#include "flare/fiber/fiber_cond.h"
+#include "flare/fiber/fiber_mutex.h"
+#include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/this_fiber.h"
+#include "flare/times/time.h"
+#include "flare/log/logging.h"
+
+namespace {
+
+    TEST(FiberChannelTest, send_recv) {
+        flare::fiber_channel<std::string> ch(3);
+        ASSERT_EQ(4u, ch.capacity());
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_EQ(0, ch.send(std::to_string(i)));
+        }
+        ASSERT_EQ(4u, ch.size());
+        ASSERT_EQ(EAGAIN, ch.try_send("x"));
+        ASSERT_EQ(ETIMEDOUT, ch.send_for("x", 10000));
+        std::string s;
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_EQ(0, ch.try_recv(&s));
+            ASSERT_EQ(std::to_string(i), s);
+        }
+        ASSERT_EQ(EAGAIN, ch.try_recv(&s));
+        const int64_t start_us = flare::get_current_time_micros();
+        ASSERT_EQ(ETIMEDOUT, ch.recv_for(&s, 10000));
+        ASSERT_GE(flare::get_current_time_micros() - start_us, 9000);
+    }
+
+    TEST(FiberChannelTest, close) {
+        flare::fiber_channel<int> ch(4);
+        ASSERT_EQ(0, ch.send(1));
+        ASSERT_EQ(0, ch.send(2));
+        ch.close();
+        ASSERT_TRUE(ch.closed());
+        ASSERT_EQ(EPIPE, ch.send(3));
+        ASSERT_EQ(EPIPE, ch.try_send(3));
+        int v = 0;
+        ASSERT_EQ(0, ch.recv(&v));
+        ASSERT_EQ(1, v);
+        ASSERT_EQ(0, ch.recv(&v));
+        ASSERT_EQ(2, v);
+        ASSERT_EQ(EPIPE, ch.recv(&v));
+        ASSERT_EQ(EPIPE, ch.try_recv(&v));
+    }
+
+    void *recv_until_closed(void *arg) {
+        flare::fiber_channel<int> *ch = (flare::fiber_channel<int> *) arg;
+        int v = 0;
+        EXPECT_EQ(EPIPE, ch->recv(&v));
+        return nullptr;
+    }
+
+    void *send_until_closed(void *arg) {
+        flare::fiber_channel<int> *ch = (flare::fiber_channel<int> *) arg;
+        EXPECT_EQ(EPIPE, ch->send(1));
+        return nullptr;
+    }
+
+    TEST(FiberChannelTest, close_wakes_up_waiters) {
+        flare::fiber_channel<int> empty(4);
+        flare::fiber_channel<int> full(1);
+        ASSERT_EQ(2u, full.capacity());
+        ASSERT_EQ(0, full.send(0));
+        ASSERT_EQ(0, full.send(0));
+        fiber_id_t th[8];
+        for (size_t i = 0; i < FLARE_ARRAY_SIZE(th); ++i) {
+            ASSERT_EQ(0, fiber_start_background(&th[i], nullptr,
+                                                i % 2 ? recv_until_closed : send_until_closed,
+                                                i % 2 ? &empty : &full));
+        }
+        flare::fiber_sleep_for(10000);
+        empty.close();
+        full.close();
+        for (size_t i = 0; i < FLARE_ARRAY_SIZE(th); ++i) {
+            ASSERT_EQ(0, fiber_join(th[i], nullptr));
+        }
+    }
+
+    typedef flare::fiber_channel<std::unique_ptr<int64_t> > PtrChannel;
+
+    struct StressArg {
+        PtrChannel *ch;
+        int64_t n;
+        int64_t sum;
+    };
+
+    void *produce_ptrs(void *arg) {
+        StressArg *a = (StressArg *) arg;
+        for (int64_t i = 1; i <= a->n; ++i) {
+            EXPECT_EQ(0, a->ch->send(std::make_unique<int64_t>(i)));
+        }
+        return nullptr;
+    }
+
+    void *consume_ptrs(void *arg) {
+        StressArg *a = (StressArg *) arg;
+        std::unique_ptr<int64_t> p;
+        while (a->ch->recv(&p) == 0) {
+            a->sum += *p;
+        }
+        return nullptr;
+    }
+
+    TEST(FiberChannelTest, mpmc) {
+        PtrChannel ch(16);
+        const int kProducers = 8;
+        const int kConsumers = 4;
+        const int64_t N = 20000;
+        StressArg producers[kProducers];
+        StressArg consumers[kConsumers];
+        fiber_id_t pth[kProducers];
+        fiber_id_t cth[kConsumers];
+        for (int i = 0; i < kConsumers; ++i) {
+            consumers[i] = StressArg{&ch, 0, 0};
+            ASSERT_EQ(0, fiber_start_background(&cth[i], nullptr, consume_ptrs, &consumers[i]));
+        }
+        for (int i = 0; i < kProducers; ++i) {
+            producers[i] = StressArg{&ch, N, 0};
+            ASSERT_EQ(0, fiber_start_background(&pth[i], nullptr, produce_ptrs, &producers[i]));
+        }
+        for (int i = 0; i < kProducers; ++i) {
+            ASSERT_EQ(0, fiber_join(pth[i], nullptr));
+        }
+        ch.close();
+        int64_t sum = 0;
+        for (int i = 0; i < kConsumers; ++i) {
+            ASSERT_EQ(0, fiber_join(cth[i], nullptr));
+            sum += consumers[i].sum;
+        }
+        ASSERT_EQ(kProducers * N * (N + 1) / 2, sum);
+    }
+
+    void *send_in_batch(void *arg) {
+        flare::fiber_channel<int> *ch = (flare::fiber_channel<int> *) arg;
+        int values[100];
+        for (int i = 0; i < 100; ++i) {
+            values[i] = i;
+        }
+        for (int i = 0; i < 10; ++i) {
+            EXPECT_EQ(100u, ch->send_batch(values, 100));
+        }
+        ch->close();
+        return nullptr;
+    }
+
+    TEST(FiberChannelTest, batch) {
+        flare::fiber_channel<int> ch(32);
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_background(&th, nullptr, send_in_batch, &ch));
+        int values[64];
+        int expected = 0;
+        size_t total = 0;
+        size_t n = 0;
+        while ((n = ch.recv_batch(values, 64)) != 0) {
+            ASSERT_LE(n, 32u);
+            for (size_t i = 0; i < n; ++i) {
+                ASSERT_EQ(expected, values[i]);
+                expected = (expected + 1) % 100;
+            }
+            total += n;
+        }
+        ASSERT_EQ(1000u, total);
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        int v[1];
+        ASSERT_EQ(0u, ch.send_batch(v, 1));
+    }
+
+    struct SelectArg {
+        flare::fiber_channel<int> *ch;
+        int value;
+    };
+
+    void *delayed_send(void *arg) {
+        SelectArg *a = (SelectArg *) arg;
+        flare::fiber_sleep_for(5000);
+        EXPECT_EQ(0, a->ch->send(a->value));
+        return nullptr;
+    }
+
+    TEST(FiberChannelTest, select) {
+        flare::fiber_channel<int> ch[3] = {flare::fiber_channel<int>(4),
+                                           flare::fiber_channel<int>(4),
+                                           flare::fiber_channel<int>(4)};
+        flare::fiber_channel_base *chs[3] = {&ch[0], &ch[1], &ch[2]};
+        size_t index = 0;
+        timespec abstime = flare::time_point::future_unix_millis(10).to_timespec();
+        ASSERT_EQ(ETIMEDOUT, flare::fiber_channel_select(chs, 3, &index, &abstime));
+        ASSERT_EQ(EINVAL, flare::fiber_channel_select(chs, 0, &index, nullptr));
+
+        SelectArg arg{&ch[2], 42};
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_background(&th, nullptr, delayed_send, &arg));
+        ASSERT_EQ(0, flare::fiber_channel_select(chs, 3, &index, nullptr));
+        ASSERT_EQ(2u, index);
+        int v = 0;
+        ASSERT_EQ(0, ch[2].try_recv(&v));
+        ASSERT_EQ(42, v);
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+
+        // Closed channels are selected too.
+        ch[1].close();
+        ASSERT_EQ(0, flare::fiber_channel_select(chs, 3, &index, nullptr));
+        ASSERT_EQ(1u, index);
+        ASSERT_EQ(EPIPE, ch[1].try_recv(&v));
+    }
+
+    // Producer/consumer pipeline built on fiber_mutex + fiber_cond + std::deque
+    // for comparison.
+    class MutexQueue {
+    public:
+        explicit MutexQueue(size_t capacity) : _capacity(capacity), _closed(false) {}
+
+        int send(int64_t v) {
+            std::unique_lock<flare::fiber_mutex> lk(_mutex);
+            while (_queue.size() >= _capacity && !_closed) {
+                _not_full.wait(lk);
+            }
+            if (_closed) {
+                return EPIPE;
+            }
+            _queue.push_back(v);
+            _not_empty.notify_one();
+            return 0;
+        }
+
+        int recv(int64_t *v) {
+            std::unique_lock<flare::fiber_mutex> lk(_mutex);
+            while (_queue.empty() && !_closed) {
+                _not_empty.wait(lk);
+            }
+            if (_queue.empty()) {
+                return EPIPE;
+            }
+            *v = _queue.front();
+            _queue.pop_front();
+            _not_full.notify_one();
+            return 0;
+        }
+
+        void close() {
+            std::unique_lock<flare::fiber_mutex> lk(_mutex);
+            _closed = true;
+            _not_full.notify_all();
+            _not_empty.notify_all();
+        }
+
+    private:
+        const size_t _capacity;
+        bool _closed;
+        std::deque<int64_t> _queue;
+        flare::fiber_mutex _mutex;
+        flare::fiber_cond _not_full;
+        flare::fiber_cond _not_empty;
+    };
+
+    template<typename Q>
+    struct PerfArg {
+        Q *q;
+        int64_t n;
+        int64_t sum;
+    };
+
+    template<typename Q>
+    void *perf_produce(void *arg) {
+        PerfArg<Q> *a = (PerfArg<Q> *) arg;
+        for (int64_t i = 0; i < a->n; ++i) {
+            a->q->send(i);
+        }
+        return nullptr;
+    }
+
+    template<typename Q>
+    void *perf_consume(void *arg) {
+        PerfArg<Q> *a = (PerfArg<Q> *) arg;
+        int64_t v = 0;
+        while (a->q->recv(&v) == 0) {
+            a->sum += v;
+        }
+        return nullptr;
+    }
+
+    template<typename Q>
+    int64_t run_pipeline(Q *q, int nproducer, int nconsumer, int64_t total) {
+        std::vector<PerfArg<Q> > producers(nproducer);
+        std::vector<PerfArg<Q> > consumers(nconsumer);
+        std::vector<fiber_id_t> pth(nproducer);
+        std::vector<fiber_id_t> cth(nconsumer);
+        flare::stop_watcher tm;
+        tm.start();
+        for (int i = 0; i < nconsumer; ++i) {
+            consumers[i] = PerfArg<Q>{q, 0, 0};
+            EXPECT_EQ(0, fiber_start_background(&cth[i], nullptr, perf_consume<Q>, &consumers[i]));
+        }
+        for (int i = 0; i < nproducer; ++i) {
+            producers[i] = PerfArg<Q>{q, total / nproducer, 0};
+            EXPECT_EQ(0, fiber_start_background(&pth[i], nullptr, perf_produce<Q>, &producers[i]));
+        }
+        for (int i = 0; i < nproducer; ++i) {
+            fiber_join(pth[i], nullptr);
+        }
+        q->close();
+        int64_t sum = 0;
+        for (int i = 0; i < nconsumer; ++i) {
+            fiber_join(cth[i], nullptr);
+            sum += consumers[i].sum;
+        }
+        tm.stop();
+        const int64_t n = total / nproducer;
+        EXPECT_EQ(nproducer * n * (n - 1) / 2, sum);
+        return tm.u_elapsed();
+    }
+
+    TEST(FiberChannelTest, performance) {
+        const int64_t kTotal = 200000;
+        const int configs[][2] = {{1, 1}, {4, 1}, {1, 4}, {4, 4}, {16, 16}};
+        for (auto &config : configs) {
+            flare::fiber_channel<int64_t> ch(1024);
+            MutexQueue mq(1024);
+            const int64_t channel_us = run_pipeline(&ch, config[0], config[1], kTotal);
+            const int64_t mutex_us = run_pipeline(&mq, config[0], config[1], kTotal);
+            FLARE_LOG(INFO) << "producers=" << config[0] << " consumers=" << config[1]
+                            << " fiber_channel=" << kTotal * 1000 / std::max<int64_t>(channel_us, 1)
+                            << "/ms mutex+cond=" << kTotal * 1000 / std::max<int64_t>(mutex_us, 1)
+                            << "/ms";
+        }
+    }
+
+}  // namespace
@@ -0,0 +1,298 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+// Built only with -DENABLE_COROUTINE=ON.
+#if defined(__cpp_impl_coroutine)
+
+#include <unistd.h>
+#include <atomic>
+#include <fstream>
+#include <vector>
+#include "testing/gtest_wrap.h"
+#include "flare/fiber/coroutine.h"
+#include "flare/fiber/future.h"
+#include "flare/fiber/this_fiber.h"
+#include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/internal/waitable_event.h"
+#include "flare/times/time.h"
+#include "flare/log/logging.h"
+
+namespace flare {
+
+    namespace {
+
+        fiber_task<int> add(int a, int b) {
+            co_return a + b;
+        }
+
+        fiber_task<int> sum_to(int n) {
+            int total = 0;
+            for (int i = 1; i <= n; ++i) {
+                total = co_await add(total, i);
+            }
+            co_return total;
+        }
+
+        fiber_task<> increase(fiber_mutex *m, int *counter, int times) {
+            for (int i = 0; i < times; ++i) {
+                co_await coro_lock(*m);
+                ++*counter;
+                if (i % 100 == 0) {
+                    co_await coro_yield();
+                }
+                m->unlock();
+            }
+        }
+
+        struct bounded_queue {
+            fiber_mutex m;
+            fiber_cond cond;
+            std::vector<int> items;
+            bool stop = false;
+        };
+
+        fiber_task<int> consume(bounded_queue *q) {
+            int total = 0;
+            std::unique_lock<fiber_mutex> lk(q->m, std::defer_lock);
+            co_await coro_lock(q->m);
+            lk = std::unique_lock<fiber_mutex>(q->m, std::adopt_lock);
+            while (true) {
+                while (q->items.empty() && !q->stop) {
+                    co_await coro_wait(q->cond, lk);
+                }
+                if (q->items.empty()) {
+                    break;
+                }
+                total += q->items.back();
+                q->items.pop_back();
+            }
+            co_return total;
+        }
+
+        fiber_task<> ping_pong(std::atomic<int> *ev, int k, int n) {
+            for (int i = k; i < 2 * n; i += 2) {
+                int v;
+                while ((v = ev->load(std::memory_order_acquire)) != i) {
+                    co_await coro_wait_event(ev, v);
+                }
+                ev->store(i + 1, std::memory_order_release);
+                fiber_internal::waitable_event_wake(ev);
+            }
+        }
+
+        void *ping_pong_fiber(std::atomic<int> *ev, int k, int n) {
+            for (int i = k; i < 2 * n; i += 2) {
+                int v;
+                while ((v = ev->load(std::memory_order_acquire)) != i) {
+                    fiber_internal::waitable_event_wait(ev, v, nullptr);
+                }
+                ev->store(i + 1, std::memory_order_release);
+                fiber_internal::waitable_event_wake(ev);
+            }
+            return nullptr;
+        }
+
+        fiber_task<> wait_for_event(std::atomic<int> *ev, std::atomic<int> *nwoken) {
+            while (ev->load(std::memory_order_acquire) == 0) {
+                co_await coro_wait_event(ev, 0);
+            }
+            nwoken->fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void *wait_for_event_fiber(std::atomic<int> *ev, std::atomic<int> *nwoken) {
+            while (ev->load(std::memory_order_acquire) == 0) {
+                fiber_internal::waitable_event_wait(ev, 0, nullptr);
+            }
+            nwoken->fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        long resident_bytes() {
+            long pages = 0, resident = 0;
+            std::ifstream("/proc/self/statm") >> pages >> resident;
+            return resident * sysconf(_SC_PAGESIZE);
+        }
+
+    }  // namespace
+
+    TEST(FiberCoroutine, return_value) {
+        ASSERT_EQ(5050, fiber_future_get(fiber_task_start(sum_to(100))));
+    }
+
+    TEST(FiberCoroutine, await_future) {
+        promise<int> p;
+        auto f = fiber_task_start([](future<int> f) -> fiber_task<int> {
+            co_return (co_await std::move(f)) * 2;
+        }(p.get_future()));
+        fiber_id_t tid;
+        ASSERT_EQ(0, fiber_start_background(&tid, nullptr, [&](void *) -> void * {
+            flare::fiber_sleep_for(10000);
+            p.set_value(21);
+            return nullptr;
+        }, nullptr));
+        ASSERT_EQ(42, fiber_future_get(std::move(f)));
+        fiber_join(tid, nullptr);
+    }
+
+    TEST(FiberCoroutine, mutex) {
+        fiber_mutex m;
+        int counter = 0;
+        std::vector<future<>> fs;
+        for (int i = 0; i < 16; ++i) {
+            fs.push_back(fiber_task_start(increase(&m, &counter, 1000)));
+        }
+        // Contend with stackful fibers as well.
+        std::vector<fiber_id_t> tids(4);
+        for (auto &tid: tids) {
+            ASSERT_EQ(0, fiber_start_background(&tid, nullptr, [&](void *) -> void * {
+                for (int i = 0; i < 1000; ++i) {
+                    std::lock_guard<fiber_mutex> lk(m);
+                    ++counter;
+                }
+                return nullptr;
+            }, nullptr));
+        }
+        for (auto &f: fs) {
+            fiber_future_get(std::move(f));
+        }
+        for (auto tid: tids) {
+            fiber_join(tid, nullptr);
+        }
+        ASSERT_EQ(20000, counter);
+    }
+
+    TEST(FiberCoroutine, cond) {
+        bounded_queue q;
+        std::vector<future<int>> fs;
+        for (int i = 0; i < 4; ++i) {
+            fs.push_back(fiber_task_start(consume(&q)));
+        }
+        int expected = 0;
+        for (int i = 1; i <= 1000; ++i) {
+            std::lock_guard<fiber_mutex> lk(q.m);
+            q.items.push_back(i);
+            expected += i;
+            if (i % 7 == 0) {
+                q.cond.notify_all();
+            } else {
+                q.cond.notify_one();
+            }
+        }
+        {
+            std::lock_guard<fiber_mutex> lk(q.m);
+            q.stop = true;
+            q.cond.notify_all();
+        }
+        int total = 0;
+        for (auto &f: fs) {
+            total += fiber_future_get(std::move(f));
+        }
+        ASSERT_EQ(expected, total);
+    }
+
+    TEST(FiberCoroutine, event) {
+        auto ev = fiber_internal::waitable_event_create_checked<std::atomic<int>>();
+        ev->store(1);
+        // Unmatched value returns immediately.
+        ASSERT_EQ(EWOULDBLOCK, fiber_future_get(fiber_task_start([](std::atomic<int> *ev) -> fiber_task<int> {
+            co_return co_await coro_wait_event(ev, 0);
+        }(ev))));
+        ev->store(0);
+        std::atomic<int> nwoken{0};
+        std::vector<future<>> fs;
+        for (int i = 0; i < 100; ++i) {
+            fs.push_back(fiber_task_start(wait_for_event(ev, &nwoken)));
+        }
+        flare::fiber_sleep_for(10000);
+        ASSERT_EQ(0, nwoken.load());
+        ev->store(1);
+        fiber_internal::waitable_event_wake_all(ev);
+        for (auto &f: fs) {
+            fiber_future_get(std::move(f));
+        }
+        ASSERT_EQ(100, nwoken.load());
+        fiber_internal::waitable_event_destroy(ev);
+    }
+
+    TEST(FiberCoroutine, performance) {
+        const int N = 10000;
+        for (int stackless = 0; stackless < 2; ++stackless) {
+            auto ev = fiber_internal::waitable_event_create_checked<std::atomic<int>>();
+            ev->store(0);
+            std::atomic<int> nwoken{0};
+            std::vector<future<>> fs;
+            std::vector<fiber_id_t> tids;
+            const long rss_before = resident_bytes();
+            for (int i = 0; i < N; ++i) {
+                if (stackless) {
+                    fs.push_back(fiber_task_start(wait_for_event(ev, &nwoken)));
+                } else {
+                    fiber_id_t tid;
+                    ASSERT_EQ(0, fiber_start_background(&tid, nullptr, [ev, &nwoken](void *) {
+                        return wait_for_event_fiber(ev, &nwoken);
+                    }, nullptr));
+                    tids.push_back(tid);
+                }
+            }
+            flare::fiber_sleep_for(200000);
+            const long rss_after = resident_bytes();
+            FLARE_LOG(INFO) << (stackless ? "fiber_task" : "fiber") << ": "
+                            << (rss_after - rss_before) / N << " bytes per in-flight task";
+            ev->store(1);
+            fiber_internal::waitable_event_wake_all(ev);
+            for (auto &f: fs) {
+                fiber_future_get(std::move(f));
+            }
+            for (auto tid: tids) {
+                fiber_join(tid, nullptr);
+            }
+            ASSERT_EQ(N, nwoken.load());
+            fiber_internal::waitable_event_destroy(ev);
+        }
+
+        const int ROUNDS = 100000;
+        for (int stackless = 0; stackless < 2; ++stackless) {
+            auto ev = fiber_internal::waitable_event_create_checked<std::atomic<int>>();
+            ev->store(0);
+            flare::stop_watcher tm;
+            tm.start();
+            if (stackless) {
+                auto f1 = fiber_task_start(ping_pong(ev, 0, ROUNDS));
+                auto f2 = fiber_task_start(ping_pong(ev, 1, ROUNDS));
+                fiber_future_get(std::move(f1));
+                fiber_future_get(std::move(f2));
+            } else {
+                fiber_id_t tids[2];
+                for (int k = 0; k < 2; ++k) {
+                    ASSERT_EQ(0, fiber_start_background(&tids[k], nullptr, [ev, k](void *) {
+                        return ping_pong_fiber(ev, k, ROUNDS);
+                    }, nullptr));
+                }
+                fiber_join(tids[0], nullptr);
+                fiber_join(tids[1], nullptr);
+            }
+            tm.stop();
+            ASSERT_EQ(2 * ROUNDS, ev->load());
+            FLARE_LOG(INFO) << (stackless ? "fiber_task" : "fiber") << ": "
+                            << tm.n_elapsed() / (2 * ROUNDS) << "ns per switch";
+            fiber_internal::waitable_event_destroy(ev);
+        }
+    }
+
+}  // namespace flare
+
+#endif  // __cpp_impl_coroutine
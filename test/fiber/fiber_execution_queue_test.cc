@@ -9,6 +9,7 @@
 #include "flare/base/fast_rand.h"
 #include "flare/base/gperftools_profiler.h"
 #include "flare/fiber/this_fiber.h"
+#include "flare/variable/variable.h"
 
 namespace {
     bool stopped = false;
@@ -698,4 +699,237 @@ namespace {
 
         ASSERT_EQ(12345, result);
     }
+
+    struct BatchStats {
+        std::atomic<bool> blocked{false};
+        int64_t sum = 0;
+        int max_batch = 0;
+        int nbatch = 0;
+    };
+
+    int add_in_batch(void *meta, flare::fiber_internal::TaskIterator<LongIntTask> &iter) {
+        BatchStats *stats = (BatchStats *) meta;
+        if (iter.is_queue_stopped()) {
+            return 0;
+        }
+        while (stats->blocked) {
+            flare::fiber_sleep_for(100);
+        }
+        int n = 0;
+        for (; iter; ++iter) {
+            stats->sum += iter->value;
+            ++n;
+        }
+        stats->max_batch = std::max(stats->max_batch, n);
+        ++stats->nbatch;
+        return 0;
+    }
+
+    void *push_blocking(void *arg) {
+        flare::fiber_internal::ExecutionQueueId<LongIntTask> *id =
+                (flare::fiber_internal::ExecutionQueueId<LongIntTask> *) arg;
+        EXPECT_EQ(0, flare::fiber_internal::execution_queue_execute(*id, 100));
+        return nullptr;
+    }
+
+    TEST_F(ExecutionQueueTest, bounded) {
+        BatchStats stats;
+        stats.blocked = true;
+        flare::fiber_internal::ExecutionQueueId<LongIntTask> queue_id;
+        flare::fiber_internal::ExecutionQueueOptions options;
+        options.max_pending_tasks = 4;
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_start(&queue_id, &options,
+                                                                  add_in_batch, &stats));
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_EQ(0, flare::fiber_internal::execution_queue_execute(queue_id, 1));
+        }
+        ASSERT_EQ(EAGAIN, flare::fiber_internal::execution_queue_try_execute(queue_id, 1));
+        timespec abstime = flare::time_point::future_unix_millis(10).to_timespec();
+        ASSERT_EQ(ETIMEDOUT, flare::fiber_internal::execution_queue_timed_execute(
+                queue_id, 1, &abstime));
+        // Producers are parked until the consumer catches up.
+        fiber_id_t th[8];
+        for (size_t i = 0; i < FLARE_ARRAY_SIZE(th); ++i) {
+            ASSERT_EQ(0, fiber_start_background(&th[i], nullptr, push_blocking, &queue_id));
+        }
+        usleep(10 * 1000);
+        ASSERT_EQ(0, stats.sum);
+        stats.blocked = false;
+        for (size_t i = 0; i < FLARE_ARRAY_SIZE(th); ++i) {
+            ASSERT_EQ(0, fiber_join(th[i], nullptr));
+        }
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_stop(queue_id));
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_join(queue_id));
+        ASSERT_EQ(4 + 800, stats.sum);
+    }
+
+    void *push_until_stopped(void *arg) {
+        flare::fiber_internal::ExecutionQueueId<LongIntTask> *id =
+                (flare::fiber_internal::ExecutionQueueId<LongIntTask> *) arg;
+        EXPECT_EQ(EINVAL, flare::fiber_internal::execution_queue_execute(*id, 1));
+        return nullptr;
+    }
+
+    TEST_F(ExecutionQueueTest, stop_wakes_blocked_producers) {
+        BatchStats stats;
+        stats.blocked = true;
+        flare::fiber_internal::ExecutionQueueId<LongIntTask> queue_id;
+        flare::fiber_internal::ExecutionQueueOptions options;
+        options.max_pending_tasks = 1;
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_start(&queue_id, &options,
+                                                                  add_in_batch, &stats));
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_execute(queue_id, 1));
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_background(&th, nullptr, push_until_stopped, &queue_id));
+        usleep(10 * 1000);
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_stop(queue_id));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        stats.blocked = false;
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_join(queue_id));
+        ASSERT_EQ(1, stats.sum);
+    }
+
+    TEST_F(ExecutionQueueTest, max_batch_size) {
+        BatchStats stats;
+        stats.blocked = true;
+        flare::fiber_internal::ExecutionQueueId<LongIntTask> queue_id;
+        flare::fiber_internal::ExecutionQueueOptions options;
+        options.max_batch_size = 8;
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_start(&queue_id, &options,
+                                                                  add_in_batch, &stats));
+        for (int i = 0; i < 100; ++i) {
+            ASSERT_EQ(0, flare::fiber_internal::execution_queue_execute(queue_id, i));
+        }
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_execute(
+                queue_id, 1000, &flare::fiber_internal::TASK_OPTIONS_URGENT));
+        stats.blocked = false;
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_stop(queue_id));
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_join(queue_id));
+        ASSERT_EQ(4950 + 1000, stats.sum);
+        ASSERT_EQ(8, stats.max_batch);
+        ASSERT_GE(stats.nbatch, 100 / 8);
+        // Batch sizes and depths are exposed as distributions.
+        ASSERT_FALSE(flare::variable::Variable::describe_exposed("fiber_execq_batch_size").empty());
+        ASSERT_FALSE(flare::variable::Variable::describe_exposed(
+                "fiber_execq_batch_size_percentiles").empty());
+        ASSERT_FALSE(flare::variable::Variable::describe_exposed(
+                "fiber_execq_depth_percentiles").empty());
+    }
+
+    TEST_F(ExecutionQueueTest, max_batch_latency) {
+        BatchStats stats;
+        flare::fiber_internal::ExecutionQueueId<LongIntTask> queue_id;
+        flare::fiber_internal::ExecutionQueueOptions options;
+        options.max_batch_size = 10;
+        options.max_batch_latency_us = 1000000;
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_start(&queue_id, &options,
+                                                                  add_in_batch, &stats));
+        // Tasks pushed one by one are coalesced, the consumer goes as soon
+        // as the batch is full instead of waiting for the whole latency.
+        const int64_t start_us = flare::get_current_time_micros();
+        for (int i = 0; i < 10; ++i) {
+            ASSERT_EQ(0, flare::fiber_internal::execution_queue_execute(queue_id, i));
+            flare::fiber_sleep_for(1000);
+        }
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_stop(queue_id));
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_join(queue_id));
+        ASSERT_LT(flare::get_current_time_micros() - start_us, 500000);
+        ASSERT_EQ(45, stats.sum);
+        ASSERT_EQ(1, stats.nbatch);
+        ASSERT_EQ(10, stats.max_batch);
+
+        // Not filled up, wait for the latency.
+        BatchStats stats2;
+        options.max_batch_latency_us = 20000;
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_start(&queue_id, &options,
+                                                                  add_in_batch, &stats2));
+        for (int i = 0; i < 3; ++i) {
+            ASSERT_EQ(0, flare::fiber_internal::execution_queue_execute(queue_id, i));
+        }
+        usleep(5000);
+        ASSERT_EQ(0, stats2.nbatch);
+        usleep(50000);
+        ASSERT_EQ(1, stats2.nbatch);
+        ASSERT_EQ(3, stats2.max_batch);
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_stop(queue_id));
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_join(queue_id));
+    }
+
+    TEST_F(ExecutionQueueTest, max_batch_latency_skipped) {
+        BatchStats stats;
+        flare::fiber_internal::ExecutionQueueId<LongIntTask> queue_id;
+        flare::fiber_internal::ExecutionQueueOptions options;
+        options.max_batch_size = 10;
+        options.max_batch_latency_us = 1000000;
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_start(&queue_id, &options,
+                                                                  add_in_batch, &stats));
+        // Urgent tasks don't wait for the batch.
+        const int64_t start_us = flare::get_current_time_micros();
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_execute(queue_id, 1));
+        usleep(5000);
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_execute(
+                queue_id, 2, &flare::fiber_internal::TASK_OPTIONS_URGENT));
+        while (stats.sum != 3 &&
+               flare::get_current_time_micros() - start_us < 1000000) {
+            usleep(1000);
+        }
+        ASSERT_EQ(3, stats.sum);
+        ASSERT_LT(flare::get_current_time_micros() - start_us, 500000);
+
+        // Neither does stopping.
+        const int64_t stop_us = flare::get_current_time_micros();
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_execute(queue_id, 3));
+        usleep(5000);
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_stop(queue_id));
+        ASSERT_EQ(0, flare::fiber_internal::execution_queue_join(queue_id));
+        ASSERT_EQ(6, stats.sum);
+        ASSERT_LT(flare::get_current_time_micros() - stop_us, 500000);
+    }
+
+    struct BoundedPushArg {
+        flare::fiber_internal::ExecutionQueueId<LongIntTask> id;
+        std::atomic<bool> *stop;
+        int64_t count = 0;
+    };
+
+    void *push_bounded(void *arg) {
+        BoundedPushArg *a = (BoundedPushArg *) arg;
+        while (!*a->stop) {
+            if (flare::fiber_internal::execution_queue_execute(a->id, 1) == 0) {
+                ++a->count;
+            }
+        }
+        return nullptr;
+    }
+
+    TEST_F(ExecutionQueueTest, bounded_performance) {
+        for (int64_t capacity : {0, 64, 1024}) {
+            int64_t result = 0;
+            flare::fiber_internal::ExecutionQueueId<LongIntTask> queue_id;
+            flare::fiber_internal::ExecutionQueueOptions options;
+            options.max_pending_tasks = capacity;
+            options.max_batch_size = 256;
+            ASSERT_EQ(0, flare::fiber_internal::execution_queue_start(&queue_id, &options,
+                                                                      add, &result));
+            std::atomic<bool> stop{false};
+            BoundedPushArg args[8];
+            fiber_id_t th[8];
+            for (size_t i = 0; i < FLARE_ARRAY_SIZE(th); ++i) {
+                args[i].id = queue_id;
+                args[i].stop = &stop;
+                ASSERT_EQ(0, fiber_start_background(&th[i], nullptr, push_bounded, &args[i]));
+            }
+            usleep(200 * 1000);
+            stop = true;
+            int64_t count = 0;
+            for (size_t i = 0; i < FLARE_ARRAY_SIZE(th); ++i) {
+                ASSERT_EQ(0, fiber_join(th[i], nullptr));
+                count += args[i].count;
+            }
+            ASSERT_EQ(0, flare::fiber_internal::execution_queue_stop(queue_id));
+            ASSERT_EQ(0, flare::fiber_internal::execution_queue_join(queue_id));
+            ASSERT_EQ(count, result);
+            FLARE_LOG(INFO) << "max_pending_tasks=" << capacity << " pushed=" << count;
+        }
+    }
 } // namespace
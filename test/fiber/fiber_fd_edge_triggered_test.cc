@@ -0,0 +1,208 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// Edge-triggered pollers are chosen at the first fiber_fd_*wait of the
+// process, so they're tested in a separate binary from fiber_fd_test.
+
+#include "flare/base/compat.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <gflags/gflags.h>
+#include "testing/gtest_wrap.h"
+#include "flare/times/time.h"
+#include "flare/base/fd_utility.h"
+#include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/internal/unstable.h"
+
+#if defined(FLARE_PLATFORM_LINUX)
+
+#include <sys/epoll.h>
+
+namespace flare::fiber_internal {
+    DECLARE_int32(fiber_epoll_thread_num);
+    DECLARE_bool(fiber_fd_edge_triggered);
+    DECLARE_bool(fiber_worker_poll_fd);
+}
+
+namespace {
+
+    struct PingPongArg {
+        int rfd;
+        int wfd;
+        int times;
+        bool start_by_writing;
+    };
+
+    void *ping_pong(void *void_arg) {
+        PingPongArg *arg = static_cast<PingPongArg *>(void_arg);
+        int n = 0;
+        if (arg->start_by_writing) {
+            EXPECT_EQ(1, write(arg->wfd, &n, 1));
+        }
+        for (int i = 0; i < arg->times; ++i) {
+            char c;
+            ssize_t nr;
+            while ((nr = read(arg->rfd, &c, 1)) < 0 && errno == EAGAIN) {
+                EXPECT_EQ(0, fiber_fd_wait(arg->rfd, EPOLLIN));
+            }
+            EXPECT_EQ(1, nr);
+            if (i + 1 < arg->times || !arg->start_by_writing) {
+                EXPECT_EQ(1, write(arg->wfd, &c, 1));
+            }
+        }
+        return nullptr;
+    }
+
+    TEST(FDEdgeTriggeredTest, ping_pong) {
+        flare::fiber_internal::FLAGS_fiber_epoll_thread_num = 4;
+        flare::fiber_internal::FLAGS_fiber_fd_edge_triggered = true;
+        flare::fiber_internal::FLAGS_fiber_worker_poll_fd = true;
+
+        const int NPAIR = 16;
+        const int TIMES = 2000;
+        int fds[NPAIR][4];
+        PingPongArg args[NPAIR][2];
+        fiber_id_t tids[NPAIR][2];
+        for (int i = 0; i < NPAIR; ++i) {
+            ASSERT_EQ(0, pipe(fds[i]));
+            ASSERT_EQ(0, pipe(fds[i] + 2));
+            for (int j = 0; j < 4; ++j) {
+                flare::base::make_non_blocking(fds[i][j]);
+            }
+            args[i][0] = {fds[i][0], fds[i][3], TIMES, true};
+            args[i][1] = {fds[i][2], fds[i][1], TIMES, false};
+        }
+        flare::stop_watcher tm;
+        tm.start();
+        for (int i = 0; i < NPAIR; ++i) {
+            for (int j = 0; j < 2; ++j) {
+                ASSERT_EQ(0, fiber_start_background(&tids[i][j], nullptr,
+                                                    ping_pong, &args[i][j]));
+            }
+        }
+        for (int i = 0; i < NPAIR; ++i) {
+            ASSERT_EQ(0, fiber_join(tids[i][0], nullptr));
+            ASSERT_EQ(0, fiber_join(tids[i][1], nullptr));
+        }
+        tm.stop();
+        FLARE_LOG(INFO) << NPAIR << " pairs ping-pong " << TIMES << " times in "
+                        << tm.u_elapsed() / (NPAIR * TIMES * 2) << "us/msg";
+        for (int i = 0; i < NPAIR; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                ASSERT_EQ(0, fiber_fd_close(fds[i][j]));
+            }
+        }
+    }
+
+    void *wait_for_the_fd(void *arg) {
+        timespec ts = flare::time_point::future_unix_millis(50).to_timespec();
+        fiber_fd_timedwait(*(int *) arg, EPOLLIN, &ts);
+        return nullptr;
+    }
+
+    TEST(FDEdgeTriggeredTest, timeout) {
+        int fds[2];
+        ASSERT_EQ(0, pipe(fds));
+        fiber_id_t th;
+        flare::stop_watcher tm;
+        tm.start();
+        ASSERT_EQ(0, fiber_start_urgent(&th, nullptr, wait_for_the_fd, &fds[0]));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        tm.stop();
+        ASSERT_GE(tm.m_elapsed(), 40);
+        ASSERT_LT(tm.m_elapsed(), 80);
+        ASSERT_EQ(0, fiber_fd_close(fds[0]));
+        ASSERT_EQ(0, fiber_fd_close(fds[1]));
+    }
+
+    void *wait_after_edge(void *arg) {
+        int *fds = static_cast<int *>(arg);
+        // Register the fd first so that the edge below happens before the wait.
+        timespec ts = flare::time_point::future_unix_millis(1).to_timespec();
+        EXPECT_EQ(-1, fiber_fd_timedwait(fds[0], EPOLLIN, &ts));
+        EXPECT_EQ(ETIMEDOUT, errno);
+        EXPECT_EQ(1, write(fds[1], "x", 1));
+        EXPECT_EQ(0, fiber_fd_wait(fds[0], EPOLLIN));
+        return nullptr;
+    }
+
+    TEST(FDEdgeTriggeredTest, ready_before_wait) {
+        int fds[2];
+        ASSERT_EQ(0, pipe(fds));
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_urgent(&th, nullptr, wait_after_edge, fds));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        ASSERT_EQ(0, fiber_fd_close(fds[0]));
+        ASSERT_EQ(0, fiber_fd_close(fds[1]));
+    }
+
+    void *register_fd(void *arg) {
+        timespec ts = flare::time_point::future_unix_millis(1).to_timespec();
+        EXPECT_EQ(-1, fiber_fd_timedwait(*(int *) arg, EPOLLIN, &ts));
+        EXPECT_EQ(ETIMEDOUT, errno);
+        return nullptr;
+    }
+
+    void *wait_for_reused_fd(void *arg) {
+        timespec ts = flare::time_point::future_unix_millis(500).to_timespec();
+        EXPECT_EQ(0, fiber_fd_timedwait(*(int *) arg, EPOLLIN, &ts));
+        return nullptr;
+    }
+
+    TEST(FDEdgeTriggeredTest, wait_on_reused_fd) {
+        int fds[2];
+        ASSERT_EQ(0, pipe(fds));
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_urgent(&th, nullptr, register_fd, &fds[0]));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        // Closed without fiber_fd_close(), the kernel removes it from epoll.
+        ASSERT_EQ(0, close(fds[0]));
+        ASSERT_EQ(0, close(fds[1]));
+        int fds2[2];
+        ASSERT_EQ(0, pipe(fds2));
+        ASSERT_EQ(fds[0], fds2[0]);
+        ASSERT_EQ(0, fiber_start_urgent(&th, nullptr, wait_for_reused_fd, &fds2[0]));
+        usleep(10000);
+        flare::stop_watcher tm;
+        tm.start();
+        ASSERT_EQ(1, write(fds2[1], "x", 1));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        tm.stop();
+        ASSERT_LT(tm.m_elapsed(), 100);
+        ASSERT_EQ(0, fiber_fd_close(fds2[0]));
+        ASSERT_EQ(0, fiber_fd_close(fds2[1]));
+    }
+
+    TEST(FDEdgeTriggeredTest, close_should_wakeup_waiter) {
+        int fds[2];
+        ASSERT_EQ(0, pipe(fds));
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_urgent(&th, nullptr, wait_for_the_fd, &fds[0]));
+        flare::stop_watcher tm;
+        tm.start();
+        ASSERT_EQ(0, fiber_fd_close(fds[0]));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        tm.stop();
+        ASSERT_LT(tm.m_elapsed(), 5);
+        ASSERT_EQ(-1, fiber_fd_wait(fds[0], EPOLLIN));
+        ASSERT_EQ(EBADF, errno);
+        ASSERT_EQ(0, fiber_fd_close(fds[1]));
+    }
+}  // namespace
+
+#endif  // FLARE_PLATFORM_LINUX
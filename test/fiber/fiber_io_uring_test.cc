@@ -0,0 +1,415 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "flare/base/compat.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include <gflags/gflags.h>
+#include "testing/gtest_wrap.h"
+#include "flare/times/time.h"
+#include "flare/base/fd_utility.h"
+#include "flare/log/logging.h"
+#include "flare/variable/variable.h"
+#include "flare/files/random_access_file.h"
+#include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/internal/unstable.h"
+#include "flare/fiber/internal/io_uring.h"
+
+#if defined(FLARE_PLATFORM_LINUX)
+#include <sys/epoll.h>
+#endif
+
+namespace flare::fiber_internal {
+    DECLARE_int32(fiber_io_uring_submit_batch);
+}
+
+namespace {
+
+    // -fiber_io_uring is off by default.
+    class IoUringEnvironment : public ::testing::Environment {
+    public:
+        void SetUp() override {
+            flare::fiber_internal::FLAGS_fiber_io_uring = true;
+        }
+
+        void TearDown() override {
+            flare::fiber_internal::FLAGS_fiber_io_uring = false;
+        }
+    };
+
+    ::testing::Environment *const io_uring_env =
+            ::testing::AddGlobalTestEnvironment(new IoUringEnvironment);
+
+    template<typename F>
+    void run_in_fiber(F f) {
+        fiber_id_t tid;
+        ASSERT_EQ(0, fiber_start_background(&tid, nullptr, [](void *arg) -> void * {
+            (*static_cast<F *>(arg))();
+            return nullptr;
+        }, &f));
+        ASSERT_EQ(0, fiber_join(tid, nullptr));
+    }
+
+    std::string make_temp_file() {
+        char path[] = "/tmp/fiber_io_uring_test_XXXXXX";
+        const int fd = mkstemp(path);
+        EXPECT_GE(fd, 0);
+        close(fd);
+        return path;
+    }
+
+    void file_read_write() {
+        const std::string path = make_temp_file();
+        const int fd = open(path.c_str(), O_RDWR);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(5, fiber_io_write(fd, "hello", 5, 0));
+        char world[] = " world";
+        char excl[] = "!";
+        iovec wvec[2] = {{world, 6}, {excl, 1}};
+        ASSERT_EQ(7, fiber_io_writev(fd, wvec, 2, 5));
+        ASSERT_EQ(0, fiber_io_fsync(fd));
+
+        char buf[32] = {};
+        ASSERT_EQ(12, fiber_io_read(fd, buf, sizeof(buf), 0));
+        ASSERT_EQ("hello world!", std::string(buf, 12));
+        char a[6] = {};
+        char b[6] = {};
+        iovec rvec[2] = {{a, 5}, {b, 5}};
+        ASSERT_EQ(7, fiber_io_readv(fd, rvec, 2, 5));
+        ASSERT_EQ(" worl", std::string(a, 5));
+        ASSERT_EQ("d!", std::string(b, 2));
+        // Current file offset.
+        ASSERT_EQ(6, lseek(fd, 6, SEEK_SET));
+        ASSERT_EQ(5, fiber_io_read(fd, buf, 5, -1));
+        ASSERT_EQ("world", std::string(buf, 5));
+        ASSERT_EQ(11, lseek(fd, 0, SEEK_CUR));
+        ASSERT_EQ(0, fiber_io_read(fd, buf, sizeof(buf), 100));
+        ASSERT_EQ(-1, fiber_io_read(-1, buf, sizeof(buf), 0));
+        ASSERT_EQ(EBADF, errno);
+        close(fd);
+        unlink(path.c_str());
+    }
+
+    TEST(FiberIoUringTest, file_read_write) {
+        run_in_fiber(file_read_write);
+        // Not in fibers.
+        file_read_write();
+        flare::fiber_internal::FLAGS_fiber_io_uring = false;
+        run_in_fiber(file_read_write);
+        flare::fiber_internal::FLAGS_fiber_io_uring = true;
+    }
+
+    TEST(FiberIoUringTest, random_access_file) {
+        const std::string path = make_temp_file();
+        std::string content(100000, 'x');
+        for (size_t i = 0; i < content.size(); ++i) {
+            content[i] = 'a' + i % 26;
+        }
+        {
+            const int fd = open(path.c_str(), O_WRONLY);
+            ASSERT_EQ((ssize_t) content.size(), write(fd, content.data(), content.size()));
+            close(fd);
+        }
+        run_in_fiber([&] {
+            flare::random_access_file file;
+            ASSERT_TRUE(file.open(path).ok());
+            std::string out;
+            ASSERT_TRUE(file.read(50000, 30000, &out).ok());
+            ASSERT_EQ(content.substr(30000, 50000), out);
+        });
+        unlink(path.c_str());
+    }
+
+    void *accept_and_echo(void *arg) {
+        const int listen_fd = *static_cast<int *>(arg);
+        const int fd = fiber_io_accept(listen_fd, nullptr, nullptr);
+        EXPECT_GE(fd, 0);
+        char buf[64];
+        ssize_t n;
+        while ((n = fiber_io_read(fd, buf, sizeof(buf), -1)) > 0) {
+            EXPECT_EQ(n, fiber_io_write(fd, buf, n, -1));
+        }
+        EXPECT_EQ(0, n);
+        close(fd);
+        return nullptr;
+    }
+
+    void socket_echo() {
+        const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_GE(listen_fd, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ASSERT_EQ(0, bind(listen_fd, (sockaddr *) &addr, sizeof(addr)));
+        ASSERT_EQ(0, listen(listen_fd, 16));
+        socklen_t len = sizeof(addr);
+        ASSERT_EQ(0, getsockname(listen_fd, (sockaddr *) &addr, &len));
+
+        fiber_id_t server;
+        ASSERT_EQ(0, fiber_start_background(&server, nullptr, accept_and_echo, (void *) &listen_fd));
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_EQ(0, fiber_io_connect(fd, (sockaddr *) &addr, sizeof(addr)));
+        for (int i = 0; i < 100; ++i) {
+            const std::string msg = "ping " + std::to_string(i);
+            ASSERT_EQ((ssize_t) msg.size(), fiber_io_write(fd, msg.data(), msg.size(), -1));
+            char buf[64];
+            ASSERT_EQ((ssize_t) msg.size(), fiber_io_read(fd, buf, msg.size(), -1));
+            ASSERT_EQ(msg, std::string(buf, msg.size()));
+        }
+        close(fd);
+        ASSERT_EQ(0, fiber_join(server, nullptr));
+        close(listen_fd);
+    }
+
+    TEST(FiberIoUringTest, socket_echo) {
+        run_in_fiber(socket_echo);
+        flare::fiber_internal::FLAGS_fiber_io_uring = false;
+        run_in_fiber(socket_echo);
+        flare::fiber_internal::FLAGS_fiber_io_uring = true;
+    }
+
+    TEST(FiberIoUringTest, non_blocking_fd) {
+        int fds[2];
+        ASSERT_EQ(0, pipe(fds));
+        flare::base::make_non_blocking(fds[0]);
+        fiber_id_t tid;
+        ASSERT_EQ(0, fiber_start_background(&tid, nullptr, [](void *arg) -> void * {
+            char c;
+            // EAGAIN is waited.
+            EXPECT_EQ(1, fiber_io_read(*static_cast<int *>(arg), &c, 1, -1));
+            EXPECT_EQ('x', c);
+            return nullptr;
+        }, fds));
+        usleep(10000);
+        ASSERT_EQ(1, write(fds[1], "x", 1));
+        ASSERT_EQ(0, fiber_join(tid, nullptr));
+        ASSERT_EQ(0, fiber_fd_close(fds[0]));
+        ASSERT_EQ(0, fiber_fd_close(fds[1]));
+    }
+
+    void run_many_fibers() {
+        const std::string path = make_temp_file();
+        const int fd = open(path.c_str(), O_RDWR);
+        ASSERT_GE(fd, 0);
+        const int N = 1000;
+        std::vector<fiber_id_t> tids(N);
+        std::vector<int> args(N);
+        for (int i = 0; i < N; ++i) {
+            args[i] = (fd << 16) | i;
+            ASSERT_EQ(0, fiber_start_background(&tids[i], nullptr, [](void *arg) -> void * {
+                const int fd = *static_cast<int *>(arg) >> 16;
+                const int i = *static_cast<int *>(arg) & 0xFFFF;
+                EXPECT_EQ(4, fiber_io_write(fd, &i, 4, i * 4));
+                int v = -1;
+                EXPECT_EQ(4, fiber_io_read(fd, &v, 4, i * 4));
+                EXPECT_EQ(i, v);
+                return nullptr;
+            }, &args[i]));
+        }
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_join(tids[i], nullptr));
+        }
+        close(fd);
+        unlink(path.c_str());
+    }
+
+    TEST(FiberIoUringTest, many_fibers) {
+        run_many_fibers();
+    }
+
+    // Operations are queued until the submission queue is full, so that
+    // getting an entry submits and reaps completions, which must not switch
+    // to the woken fibers before the entry is committed.
+    TEST(FiberIoUringTest, many_fibers_with_full_submission_queue) {
+        const int32_t saved_batch = flare::fiber_internal::FLAGS_fiber_io_uring_submit_batch;
+        flare::fiber_internal::FLAGS_fiber_io_uring_submit_batch = 1 << 20;
+        run_many_fibers();
+        flare::fiber_internal::FLAGS_fiber_io_uring_submit_batch = saved_batch;
+    }
+
+    // Busy fibers spread over workers, each creating a ring.
+    void *write_and_read(void *arg) {
+        const int fd = *static_cast<int *>(arg) >> 16;
+        const int i = *static_cast<int *>(arg) & 0xFFFF;
+        const int64_t start_us = flare::get_current_time_micros();
+        while (flare::get_current_time_micros() - start_us < 2000) {
+        }
+        EXPECT_EQ(4, fiber_io_write(fd, &i, 4, i * 4));
+        int v = -1;
+        EXPECT_EQ(4, fiber_io_read(fd, &v, 4, i * 4));
+        EXPECT_EQ(i, v);
+        return nullptr;
+    }
+
+    TEST(FiberIoUringTest, release_rings_of_retired_workers) {
+        const std::string path = make_temp_file();
+        const int fd = open(path.c_str(), O_RDWR);
+        ASSERT_GE(fd, 0);
+        const int old_concurrency = fiber_getconcurrency();
+        ASSERT_EQ(0, fiber_setconcurrency(old_concurrency + 8));
+        const int N = 200;
+        std::vector<fiber_id_t> tids(N);
+        std::vector<int> args(N);
+        for (int i = 0; i < N; ++i) {
+            args[i] = (fd << 16) | i;
+            ASSERT_EQ(0, fiber_start_background(&tids[i], nullptr, write_and_read, &args[i]));
+        }
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_join(tids[i], nullptr));
+        }
+        ASSERT_EQ(0, fiber_setconcurrency(old_concurrency));
+        // Rings of retired workers are destroyed by their reapers.
+        int64_t rings = 0;
+        for (int i = 0; i < 100; ++i) {
+            rings = atoll(flare::variable::Variable::describe_exposed(
+                    "fiber_io_uring_rings").c_str());
+            if (rings <= old_concurrency) {
+                break;
+            }
+            usleep(10000);
+        }
+        ASSERT_LE(rings, old_concurrency);
+        // Remaining rings still work.
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_start_background(&tids[i], nullptr, write_and_read, &args[i]));
+        }
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_join(tids[i], nullptr));
+        }
+        close(fd);
+        unlink(path.c_str());
+    }
+
+#if defined(FLARE_PLATFORM_LINUX)
+
+    struct PingPongArg {
+        int fd;
+        int times;
+        bool use_io_uring;
+        bool start_by_writing;
+    };
+
+    // Blocking fds with fiber_io_*, or non-blocking fds with fiber_fd_wait.
+    void *ping_pong(void *void_arg) {
+        PingPongArg *arg = static_cast<PingPongArg *>(void_arg);
+        char c = 0;
+        if (arg->start_by_writing) {
+            EXPECT_EQ(1, write(arg->fd, &c, 1));
+        }
+        for (int i = 0; i < arg->times; ++i) {
+            ssize_t nr;
+            if (arg->use_io_uring) {
+                nr = fiber_io_read(arg->fd, &c, 1, -1);
+            } else {
+                while ((nr = read(arg->fd, &c, 1)) < 0 && errno == EAGAIN) {
+                    EXPECT_EQ(0, fiber_fd_wait(arg->fd, EPOLLIN));
+                }
+            }
+            EXPECT_EQ(1, nr);
+            if (i + 1 < arg->times || !arg->start_by_writing) {
+                EXPECT_EQ(1, arg->use_io_uring ? fiber_io_write(arg->fd, &c, 1, -1)
+                                               : write(arg->fd, &c, 1));
+            }
+        }
+        return nullptr;
+    }
+
+    int64_t ping_pong_ns(bool use_io_uring, int npair, int times) {
+        std::vector<int> fds(npair * 2);
+        std::vector<PingPongArg> args(npair * 2);
+        std::vector<fiber_id_t> tids(npair * 2);
+        for (int i = 0; i < npair; ++i) {
+            EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[i * 2]));
+            for (int j = 0; j < 2; ++j) {
+                if (!use_io_uring) {
+                    flare::base::make_non_blocking(fds[i * 2 + j]);
+                }
+                args[i * 2 + j] = {fds[i * 2 + j], times, use_io_uring, j == 0};
+            }
+        }
+        flare::stop_watcher tm;
+        tm.start();
+        for (size_t i = 0; i < tids.size(); ++i) {
+            EXPECT_EQ(0, fiber_start_background(&tids[i], nullptr, ping_pong, &args[i]));
+        }
+        for (size_t i = 0; i < tids.size(); ++i) {
+            EXPECT_EQ(0, fiber_join(tids[i], nullptr));
+        }
+        tm.stop();
+        for (int fd : fds) {
+            EXPECT_EQ(0, fiber_fd_close(fd));
+        }
+        return tm.n_elapsed() / (npair * times * 2);
+    }
+
+    TEST(FiberIoUringTest, perf_ping_pong) {
+        const int NPAIR = 16;
+        const int TIMES = 5000;
+        ping_pong_ns(true, 1, 100);  // warm up rings of workers
+        const int64_t epoll_ns = ping_pong_ns(false, NPAIR, TIMES);
+        const int64_t uring_ns = ping_pong_ns(true, NPAIR, TIMES);
+        FLARE_LOG(INFO) << NPAIR << " pairs ping-pong, fiber_fd_wait: " << epoll_ns
+                        << "ns/msg, io_uring: " << uring_ns << "ns/msg";
+    }
+
+    TEST(FiberIoUringTest, perf_file_read) {
+        const std::string path = make_temp_file();
+        const int fd = open(path.c_str(), O_RDWR);
+        ASSERT_GE(fd, 0);
+        const size_t FILE_SIZE = 4 << 20;
+        std::string data(FILE_SIZE, 'x');
+        ASSERT_EQ((ssize_t) FILE_SIZE, write(fd, data.data(), FILE_SIZE));
+        const int NFIBER = 32;
+        const int NREAD = 2000;
+        for (int use_io_uring = 0; use_io_uring < 2; ++use_io_uring) {
+            flare::fiber_internal::FLAGS_fiber_io_uring = use_io_uring;
+            std::vector<fiber_id_t> tids(NFIBER);
+            flare::stop_watcher tm;
+            tm.start();
+            for (int i = 0; i < NFIBER; ++i) {
+                ASSERT_EQ(0, fiber_start_background(&tids[i], nullptr, [](void *arg) -> void * {
+                    const int fd = (int) (intptr_t) arg;
+                    char buf[4096];
+                    for (int j = 0; j < NREAD; ++j) {
+                        const off_t off = (j * 7919 % (FILE_SIZE / sizeof(buf))) * sizeof(buf);
+                        EXPECT_EQ((ssize_t) sizeof(buf), fiber_io_read(fd, buf, sizeof(buf), off));
+                    }
+                    return nullptr;
+                }, (void *) (intptr_t) fd));
+            }
+            for (int i = 0; i < NFIBER; ++i) {
+                ASSERT_EQ(0, fiber_join(tids[i], nullptr));
+            }
+            tm.stop();
+            FLARE_LOG(INFO) << NFIBER << " fibers read 4KB from page cache by "
+                            << (use_io_uring ? "io_uring: " : "pread: ")
+                            << tm.n_elapsed() / (NFIBER * NREAD) << "ns/read";
+        }
+        flare::fiber_internal::FLAGS_fiber_io_uring = true;
+        close(fd);
+        unlink(path.c_str());
+    }
+
+#endif  // FLARE_PLATFORM_LINUX
+
+}  // namespace
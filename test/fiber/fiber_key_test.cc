@@ -26,6 +26,7 @@
 #include "flare/fiber/internal/fiber.h"
 #include "flare/fiber/internal/unstable.h"
 #include "flare/fiber/this_fiber.h"
+#include "flare/fiber/fiber_local.h"
 
 extern "C" {
 int fiber_keytable_pool_size(fiber_keytable_pool_t *pool) {
@@ -407,4 +408,126 @@ namespace {
         ASSERT_EQ(0, fiber_key_delete(key));
     }
 
+    struct LocalValue {
+        static std::atomic<int> nctor;
+        static std::atomic<int> ndtor;
+
+        LocalValue() : value(0) { nctor.fetch_add(1); }
+
+        ~LocalValue() { ndtor.fetch_add(1); }
+
+        int value;
+    };
+
+    std::atomic<int> LocalValue::nctor{0};
+    std::atomic<int> LocalValue::ndtor{0};
+
+    static void *use_fiber_local(void *arg) {
+        flare::fiber_local<LocalValue> *local = (flare::fiber_local<LocalValue> *) arg;
+        LocalValue *v = local->get();
+        EXPECT_EQ(0, v->value);
+        v->value = 1;
+        flare::fiber_sleep_for(1000);
+        EXPECT_EQ(v, local->get());
+        EXPECT_EQ(1, (*local)->value);
+        return nullptr;
+    }
+
+    TEST(KeyTest, fiber_local_constructed_lazily) {
+        LocalValue::nctor = 0;
+        LocalValue::ndtor = 0;
+        {
+            flare::fiber_local<LocalValue> local;
+            ASSERT_EQ(0, LocalValue::nctor.load());
+            fiber_id_t th[16];
+            for (size_t i = 0; i < FLARE_ARRAY_SIZE(th); ++i) {
+                ASSERT_EQ(0, fiber_start_background(&th[i], nullptr, use_fiber_local, &local));
+            }
+            for (size_t i = 0; i < FLARE_ARRAY_SIZE(th); ++i) {
+                ASSERT_EQ(0, fiber_join(th[i], nullptr));
+            }
+            ASSERT_EQ(16, LocalValue::nctor.load());
+            ASSERT_EQ(16, LocalValue::ndtor.load());
+        }
+    }
+
+    static void *touch_fiber_local(void *arg) {
+        flare::fiber_local<LocalValue> *local = (flare::fiber_local<LocalValue> *) arg;
+        ++(*local)->value;
+        return nullptr;
+    }
+
+    TEST(KeyTest, fiber_local_using_pool) {
+        LocalValue::nctor = 0;
+        LocalValue::ndtor = 0;
+        flare::fiber_local<LocalValue> local;
+        fiber_keytable_pool_t pool;
+        ASSERT_EQ(0, fiber_keytable_pool_init(&pool));
+        fiber_attribute attr;
+        ASSERT_EQ(0, fiber_attr_init(&attr));
+        attr.keytable_pool = &pool;
+        // Fibers run one after another reuse the keytable and the value in it.
+        for (int i = 0; i < 10; ++i) {
+            fiber_id_t th;
+            ASSERT_EQ(0, fiber_start_urgent(&th, &attr, touch_fiber_local, &local));
+            ASSERT_EQ(0, fiber_join(th, nullptr));
+        }
+        ASSERT_EQ(1, LocalValue::nctor.load());
+        ASSERT_EQ(0, LocalValue::ndtor.load());
+        ASSERT_EQ(1, fiber_keytable_pool_size(&pool));
+        ASSERT_EQ(0, fiber_keytable_pool_destroy(&pool));
+        ASSERT_EQ(1, LocalValue::ndtor.load());
+    }
+
+    thread_local int tls_value = 0;
+
+    struct PerfArg {
+        flare::fiber_local<int> *local;
+        fiber_local_key key;
+        int64_t elapsed_ns[3];
+    };
+
+    static void *access_locals(void *arg) {
+        PerfArg *a = (PerfArg *) arg;
+        const int N = 10000000;
+        fiber_setspecific(a->key, &tls_value);
+        flare::stop_watcher tm;
+        tm.start();
+        for (int i = 0; i < N; ++i) {
+            ++*static_cast<volatile int *>(&tls_value);
+        }
+        tm.stop();
+        a->elapsed_ns[0] = tm.n_elapsed();
+        tm.start();
+        for (int i = 0; i < N; ++i) {
+            ++*static_cast<volatile int *>(fiber_getspecific(a->key));
+        }
+        tm.stop();
+        a->elapsed_ns[1] = tm.n_elapsed();
+        tm.start();
+        for (int i = 0; i < N; ++i) {
+            ++*static_cast<volatile int *>(a->local->get());
+        }
+        tm.stop();
+        a->elapsed_ns[2] = tm.n_elapsed();
+        for (int j = 0; j < 3; ++j) {
+            a->elapsed_ns[j] = a->elapsed_ns[j] * 1000 / N;
+        }
+        return nullptr;
+    }
+
+    TEST(KeyTest, fiber_local_performance) {
+        flare::fiber_local<int> local;
+        PerfArg arg;
+        ASSERT_EQ(0, fiber_key_create(&arg.key, nullptr));
+        arg.local = &local;
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_urgent(&th, nullptr, access_locals, &arg));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        FLARE_LOG(INFO) << "thread_local=" << arg.elapsed_ns[0] / 1000.0
+                        << "ns fiber_getspecific=" << arg.elapsed_ns[1] / 1000.0
+                        << "ns fiber_local=" << arg.elapsed_ns[2] / 1000.0 << "ns";
+        ASSERT_EQ(0, fiber_key_delete(arg.key));
+    }
+
 }  // namespace
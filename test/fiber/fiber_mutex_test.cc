@@ -16,6 +16,7 @@
 // under the License.
 
 #include <inttypes.h>
+#include <gflags/gflags.h>
 #include "testing/gtest_wrap.h"
 #include "flare/base/compat.h"
 #include "flare/times/time.h"
@@ -28,6 +29,11 @@
 #include "flare/base/gperftools_profiler.h"
 #include "flare/fiber/this_fiber.h"
 
+namespace flare::fiber_internal {
+    DECLARE_int32(fiber_mutex_max_spin);
+    DECLARE_int32(fiber_mutex_starvation_threshold_us);
+}
+
 namespace {
     inline unsigned *get_butex(fiber_mutex_t &m) {
         return m.event;
@@ -268,4 +274,181 @@ namespace {
             pthread_join(pthreads[i], nullptr);
         }
     }
+
+    struct FLARE_CACHELINE_ALIGNMENT ContentionArgs {
+        flare::fiber_mutex *mutex;
+        int64_t *shared;        // guarded by `mutex'
+        int64_t counter;
+        int64_t max_wait_us;
+        bool sleep_inside;
+    };
+
+    void *lock_and_record_wait(void *void_arg) {
+        ContentionArgs *args = (ContentionArgs *) void_arg;
+        while (!g_started && !g_stopped) {
+            flare::fiber_sleep_for(1000);
+        }
+        while (!g_stopped) {
+            const int64_t start_us = flare::get_current_time_micros();
+            std::unique_lock<flare::fiber_mutex> lck(*args->mutex);
+            args->max_wait_us = std::max(args->max_wait_us,
+                                         flare::get_current_time_micros() - start_us);
+            ++*args->shared;
+            ++args->counter;
+            if (args->sleep_inside && args->counter % 16 == 0) {
+                flare::fiber_sleep_for(10);
+            } else {
+                for (volatile int i = 0; i < 50; ++i) {}
+            }
+        }
+        return nullptr;
+    }
+
+    // Returns throughput in locks per second and sets `max_wait_us'.
+    int64_t run_contention(int nfiber, int npthread, bool sleep_inside,
+                           int64_t duration_ms, int64_t *max_wait_us) {
+        flare::fiber_mutex m;
+        int64_t shared = 0;
+        std::vector<ContentionArgs> args(nfiber + npthread);
+        std::vector<fiber_id_t> fibers(nfiber);
+        std::vector<pthread_t> pthreads(npthread);
+        g_started = false;
+        g_stopped = false;
+        for (size_t i = 0; i < args.size(); ++i) {
+            args[i].mutex = &m;
+            args[i].shared = &shared;
+            args[i].counter = 0;
+            args[i].max_wait_us = 0;
+            args[i].sleep_inside = sleep_inside;
+        }
+        for (int i = 0; i < nfiber; ++i) {
+            EXPECT_EQ(0, fiber_start_background(&fibers[i], nullptr, lock_and_record_wait, &args[i]));
+        }
+        for (int i = 0; i < npthread; ++i) {
+            EXPECT_EQ(0, pthread_create(&pthreads[i], nullptr, lock_and_record_wait, &args[nfiber + i]));
+        }
+        usleep(10 * 1000);
+        g_started = true;
+        flare::stop_watcher tm;
+        tm.start();
+        usleep(duration_ms * 1000);
+        g_stopped = true;
+        for (int i = 0; i < nfiber; ++i) {
+            fiber_join(fibers[i], nullptr);
+        }
+        for (int i = 0; i < npthread; ++i) {
+            pthread_join(pthreads[i], nullptr);
+        }
+        tm.stop();
+        int64_t total = 0;
+        *max_wait_us = 0;
+        for (size_t i = 0; i < args.size(); ++i) {
+            total += args[i].counter;
+            *max_wait_us = std::max(*max_wait_us, args[i].max_wait_us);
+        }
+        EXPECT_EQ(total, shared);
+        return total * 1000000 / std::max<int64_t>(tm.u_elapsed(), 1);
+    }
+
+    TEST(MutexTest, starvation_handoff) {
+        const int32_t saved_threshold = flare::fiber_internal::FLAGS_fiber_mutex_starvation_threshold_us;
+        flare::fiber_internal::FLAGS_fiber_mutex_starvation_threshold_us = 100;
+        int64_t max_wait_us = 0;
+        // Fibers sleeping inside the lock keep the mutex in handoff mode
+        // most of the time, mixed with pthreads.
+        ASSERT_GT(run_contention(32, 4, true, 300, &max_wait_us), 0);
+        // Switching modes back and forth with waiters must not lose wakeups.
+        for (int i = 0; i < 10; ++i) {
+            flare::fiber_internal::FLAGS_fiber_mutex_starvation_threshold_us = (i % 2 ? 0 : 1);
+            ASSERT_GT(run_contention(16, 2, true, 20, &max_wait_us), 0);
+        }
+        flare::fiber_internal::FLAGS_fiber_mutex_starvation_threshold_us = saved_threshold;
+    }
+
+    TEST(MutexTest, starvation_handoff_with_cond_and_timedlock) {
+        const int32_t saved_threshold = flare::fiber_internal::FLAGS_fiber_mutex_starvation_threshold_us;
+        flare::fiber_internal::FLAGS_fiber_mutex_starvation_threshold_us = 1;
+        struct Arg {
+            flare::fiber_mutex m;
+            fiber_cond_t c;
+            int64_t value = 0;
+            int64_t timedout = 0;
+        } arg;
+        ASSERT_EQ(0, fiber_cond_init(&arg.c, nullptr));
+        g_stopped = false;
+        auto waiter = [](void *p) -> void * {
+            Arg *a = (Arg *) p;
+            while (!g_stopped) {
+                std::unique_lock<flare::fiber_mutex> lck(a->m);
+                timespec abstime = flare::time_point::future_unix_millis(1).to_timespec();
+                fiber_cond_timedwait(&a->c, a->m.native_handler(), &abstime);
+                ++a->value;
+            }
+            return nullptr;
+        };
+        auto timed_locker = [](void *p) -> void * {
+            Arg *a = (Arg *) p;
+            while (!g_stopped) {
+                timespec abstime = flare::time_point::future_unix_micros(50).to_timespec();
+                if (fiber_mutex_timedlock(a->m.native_handler(), &abstime) == 0) {
+                    ++a->value;
+                    flare::fiber_sleep_for(20);
+                    fiber_mutex_unlock(a->m.native_handler());
+                } else {
+                    __atomic_add_fetch(&a->timedout, 1, __ATOMIC_RELAXED);
+                }
+            }
+            return nullptr;
+        };
+        auto signaler = [](void *p) -> void * {
+            Arg *a = (Arg *) p;
+            while (!g_stopped) {
+                {
+                    std::unique_lock<flare::fiber_mutex> lck(a->m);
+                    ++a->value;
+                }
+                fiber_cond_broadcast(&a->c);
+                flare::fiber_sleep_for(10);
+            }
+            return nullptr;
+        };
+        fiber_id_t th[24];
+        for (size_t i = 0; i < FLARE_ARRAY_SIZE(th); ++i) {
+            void *(*fn)(void *) = (i % 3 == 0 ? +waiter : i % 3 == 1 ? +timed_locker : +signaler);
+            ASSERT_EQ(0, fiber_start_background(&th[i], nullptr, fn, &arg));
+        }
+        usleep(300 * 1000);
+        g_stopped = true;
+        fiber_cond_broadcast(&arg.c);
+        for (size_t i = 0; i < FLARE_ARRAY_SIZE(th); ++i) {
+            ASSERT_EQ(0, fiber_join(th[i], nullptr));
+        }
+        ASSERT_GT(arg.value, 0);
+        // The mutex is released completely.
+        ASSERT_TRUE(arg.m.try_lock());
+        arg.m.unlock();
+        ASSERT_EQ(0, fiber_cond_destroy(&arg.c));
+        flare::fiber_internal::FLAGS_fiber_mutex_starvation_threshold_us = saved_threshold;
+    }
+
+    TEST(MutexTest, perf_contention) {
+        const int32_t saved_threshold = flare::fiber_internal::FLAGS_fiber_mutex_starvation_threshold_us;
+        const int32_t saved_spin = flare::fiber_internal::FLAGS_fiber_mutex_max_spin;
+        const int nfibers[] = {1, 4, 64};
+        for (int max_spin : {0, saved_spin}) {
+            for (int threshold : {0, 1000}) {
+                flare::fiber_internal::FLAGS_fiber_mutex_max_spin = max_spin;
+                flare::fiber_internal::FLAGS_fiber_mutex_starvation_threshold_us = threshold;
+                for (int nfiber : nfibers) {
+                    int64_t max_wait_us = 0;
+                    const int64_t qps = run_contention(nfiber, 0, false, 200, &max_wait_us);
+                    FLARE_LOG(INFO) << "fiber_mutex nfiber=" << nfiber << " max_spin=" << max_spin
+                                    << " starvation_threshold_us=" << threshold
+                                    << " throughput=" << qps << "/s max_wait=" << max_wait_us << "us";
+                }
+            }
+        }
+        flare::fiber_internal::FLAGS_fiber_mutex_max_spin = saved_spin;
+        flare::fiber_internal::FLAGS_fiber_mutex_starvation_threshold_us = saved_threshold;
+    }
 } // namespace
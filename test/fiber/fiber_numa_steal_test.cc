@@ -0,0 +1,107 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gflags/gflags.h>
+#include "sstream_workaround.h"
+// NUMA domains are laid out by hand, the machine running tests may have a
+// single node only.
+#define private public
+#include "flare/fiber/internal/schedule_group.h"
+#include "flare/fiber/internal/fiber_worker.h"
+#undef private
+#include "testing/gtest_wrap.h"
+
+DECLARE_int32(fiber_numa_steal_miss_threshold);
+DECLARE_int32(task_group_runqueue_capacity);
+
+namespace {
+
+    using flare::fiber_internal::fiber_worker;
+    using flare::fiber_internal::schedule_group;
+
+    class NumaStealTest : public ::testing::Test {
+    protected:
+        void SetUp() override {
+            _c = new schedule_group;
+            _c->_nnodes = 2;
+            for (int i = 0; i < 2; ++i) {
+                _c->_domains[i].groups = (fiber_worker **) calloc(
+                        FIBER_MAX_CONCURRENCY, sizeof(fiber_worker *));
+                _g[i] = new fiber_worker(_c);
+                _g[i]->_numa_node = i;
+                ASSERT_EQ(0, _g[i]->init(FLAGS_task_group_runqueue_capacity));
+                ASSERT_EQ(0, _c->_add_group(_g[i]));
+            }
+        }
+
+        void TearDown() override {
+            delete _c;
+            for (int i = 0; i < 2; ++i) {
+                delete _g[i];
+            }
+        }
+
+        schedule_group *_c = nullptr;
+        fiber_worker *_g[2] = {nullptr, nullptr};
+    };
+
+    TEST_F(NumaStealTest, steal_in_node_first) {
+        _g[0]->_remote_rq.push(100);
+        _g[1]->_remote_rq.push(101);
+        fiber_id_t tid = 0;
+        size_t seed = 0;
+        int nmiss = 0;
+        ASSERT_TRUE(_c->steal_task(&tid, &seed, 1, 0, &nmiss));
+        ASSERT_EQ(100u, tid);
+        ASSERT_EQ(0, nmiss);
+        ASSERT_EQ(1, _c->_domains[0].local_steal.get_value());
+        ASSERT_EQ(0, _c->_domains[0].remote_steal.get_value());
+    }
+
+    TEST_F(NumaStealTest, remote_steal_after_misses) {
+        _g[1]->_remote_rq.push(101);
+        fiber_id_t tid = 0;
+        size_t seed = 0;
+        int nmiss = 0;
+        for (int i = 1; i < FLAGS_fiber_numa_steal_miss_threshold; ++i) {
+            ASSERT_FALSE(_c->steal_task(&tid, &seed, 1, 0, &nmiss));
+            ASSERT_EQ(i, nmiss);
+        }
+        ASSERT_TRUE(_c->steal_task(&tid, &seed, 1, 0, &nmiss));
+        ASSERT_EQ(101u, tid);
+        ASSERT_EQ(0, nmiss);
+        ASSERT_EQ(0, _c->_domains[0].local_steal.get_value());
+        ASSERT_EQ(1, _c->_domains[0].remote_steal.get_value());
+        ASSERT_EQ(0, _c->_domains[1].remote_steal.get_value());
+    }
+
+    TEST_F(NumaStealTest, same_node_victim_of_global_steal_is_local) {
+        // Misses of node 1 reach the threshold, then the global steal finds
+        // the task pushed to node 1 meanwhile.
+        fiber_id_t tid = 0;
+        size_t seed = 0;
+        int nmiss = FLAGS_fiber_numa_steal_miss_threshold - 1;
+        ASSERT_EQ(1u, _c->_domains[1].ngroup.exchange(0));
+        _g[1]->_remote_rq.push(101);
+        ASSERT_TRUE(_c->steal_task(&tid, &seed, 1, 1, &nmiss));
+        _c->_domains[1].ngroup.store(1);
+        ASSERT_EQ(101u, tid);
+        ASSERT_EQ(1, _c->_domains[1].local_steal.get_value());
+        ASSERT_EQ(0, _c->_domains[1].remote_steal.get_value());
+    }
+
+}  // namespace
@@ -0,0 +1,232 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "testing/gtest_wrap.h"
+
+#include <algorithm>                        // std::sort
+#include <vector>
+#include "flare/times/time.h"
+#include "flare/base/scoped_lock.h"
+#include "flare/container/bounded_queue.h"
+#include "flare/fiber/internal/remote_task_queue.h"
+
+namespace {
+    // The mutex-protected queue used before RemoteTaskQueue became lock-free,
+    // kept as the baseline of the performance test.
+    class LockedTaskQueue {
+    public:
+        int init(size_t cap) {
+            flare::container::bounded_queue<fiber_id_t> q(cap);
+            _tasks.swap(q);
+            return 0;
+        }
+
+        bool pop(fiber_id_t *task) {
+            if (_tasks.empty()) {
+                return false;
+            }
+            FLARE_SCOPED_LOCK(_mutex);
+            return _tasks.pop(task);
+        }
+
+        void push(fiber_id_t task) {
+            while (true) {
+                {
+                    FLARE_SCOPED_LOCK(_mutex);
+                    if (_tasks.push(task)) {
+                        return;
+                    }
+                }
+                sched_yield();
+            }
+        }
+
+    private:
+        flare::container::bounded_queue<fiber_id_t> _tasks;
+        flare::base::Mutex _mutex;
+    };
+
+    const size_t N_PER_PRODUCER = 100000;
+
+    template<typename Q>
+    struct QueueArg {
+        Q *q;
+        fiber_id_t base;
+        size_t n;
+        std::atomic<bool> *stop;
+    };
+
+    template<typename Q>
+    void *producer(void *void_arg) {
+        QueueArg<Q> *arg = static_cast<QueueArg<Q> *>(void_arg);
+        for (size_t i = 0; i < arg->n; ++i) {
+            arg->q->push(arg->base + i);
+        }
+        return nullptr;
+    }
+
+    template<typename Q>
+    void *consumer(void *void_arg) {
+        QueueArg<Q> *arg = static_cast<QueueArg<Q> *>(void_arg);
+        std::vector<fiber_id_t> *popped = new std::vector<fiber_id_t>;
+        fiber_id_t val;
+        while (true) {
+            if (arg->q->pop(&val)) {
+                popped->push_back(val);
+            } else if (arg->stop->load(std::memory_order_acquire)) {
+                // Drain tasks pushed right before `stop' was set.
+                while (arg->q->pop(&val)) {
+                    popped->push_back(val);
+                }
+                break;
+            } else {
+                asm volatile("pause\n": : :"memory");
+            }
+        }
+        return popped;
+    }
+
+    // Returns elapsed microseconds, all popped values are appended to `values'.
+    template<typename Q>
+    int64_t run(Q *q, size_t nproducer, size_t nconsumer, size_t n_per_producer,
+                std::vector<fiber_id_t> *values) {
+        std::atomic<bool> stop(false);
+        std::vector<QueueArg<Q> > args(nproducer);
+        std::vector<pthread_t> pth(nproducer);
+        std::vector<pthread_t> cth(nconsumer);
+        QueueArg<Q> carg = {q, 0, 0, &stop};
+        for (size_t i = 0; i < nconsumer; ++i) {
+            EXPECT_EQ(0, pthread_create(&cth[i], nullptr, consumer<Q>, &carg));
+        }
+        flare::stop_watcher tm;
+        tm.start();
+        for (size_t i = 0; i < nproducer; ++i) {
+            args[i].q = q;
+            args[i].base = i * n_per_producer;
+            args[i].n = n_per_producer;
+            args[i].stop = &stop;
+            EXPECT_EQ(0, pthread_create(&pth[i], nullptr, producer<Q>, &args[i]));
+        }
+        for (size_t i = 0; i < nproducer; ++i) {
+            pthread_join(pth[i], nullptr);
+        }
+        stop.store(true, std::memory_order_release);
+        for (size_t i = 0; i < nconsumer; ++i) {
+            std::vector<fiber_id_t> *res = nullptr;
+            pthread_join(cth[i], (void **) &res);
+            if (values) {
+                values->insert(values->end(), res->begin(), res->end());
+            }
+            delete res;
+        }
+        tm.stop();
+        return tm.u_elapsed();
+    }
+
+    TEST(RemoteTaskQueueTest, push_and_pop) {
+        flare::fiber_internal::RemoteTaskQueue q;
+        ASSERT_EQ(0, q.init(6));
+        ASSERT_EQ(8u, q.capacity());
+        fiber_id_t val;
+        ASSERT_FALSE(q.pop(&val));
+        // Overflowing tasks are not lost.
+        for (fiber_id_t i = 1; i <= 20; ++i) {
+            q.push(i);
+        }
+        ASSERT_EQ(20u, q.volatile_size());
+        std::vector<fiber_id_t> values;
+        while (q.pop(&val)) {
+            values.push_back(val);
+        }
+        ASSERT_EQ(20u, values.size());
+        std::sort(values.begin(), values.end());
+        for (size_t i = 0; i < values.size(); ++i) {
+            ASSERT_EQ(i + 1, values[i]);
+        }
+    }
+
+    TEST(RemoteTaskQueueTest, overflowed_tasks_are_not_starved) {
+        flare::fiber_internal::RemoteTaskQueue q;
+        ASSERT_EQ(0, q.init(4));
+        fiber_id_t next_push = 1;
+        fiber_id_t next_pop = 1;
+        for (; next_push <= 10; ++next_push) {
+            q.push(next_push);
+        }
+        // Keep pushing while popping, tasks come out in the pushed order.
+        fiber_id_t val;
+        for (int i = 0; i < 100; ++i) {
+            ASSERT_TRUE(q.pop(&val));
+            ASSERT_EQ(next_pop++, val);
+            q.push(next_push++);
+        }
+        while (q.pop(&val)) {
+            ASSERT_EQ(next_pop++, val);
+        }
+        ASSERT_EQ(next_push, next_pop);
+        ASSERT_EQ(0u, q.volatile_size());
+    }
+
+    TEST(RemoteTaskQueueTest, capacity_of_one) {
+        flare::fiber_internal::RemoteTaskQueue q;
+        ASSERT_EQ(0, q.init(1));
+        // A ring of one cell would overwrite the first task.
+        ASSERT_EQ(2u, q.capacity());
+        for (fiber_id_t i = 1; i <= 5; ++i) {
+            q.push(i);
+        }
+        fiber_id_t val;
+        for (fiber_id_t i = 1; i <= 5; ++i) {
+            ASSERT_TRUE(q.pop(&val));
+            ASSERT_EQ(i, val);
+        }
+        ASSERT_FALSE(q.pop(&val));
+    }
+
+    TEST(RemoteTaskQueueTest, multiple_producers_and_consumers) {
+        flare::fiber_internal::RemoteTaskQueue q;
+        // Small capacity to exercise the overflow list.
+        ASSERT_EQ(0, q.init(64));
+        const size_t NPRODUCER = 8;
+        std::vector<fiber_id_t> values;
+        run(&q, NPRODUCER, 4, N_PER_PRODUCER, &values);
+        ASSERT_EQ(NPRODUCER * N_PER_PRODUCER, values.size());
+        std::sort(values.begin(), values.end());
+        for (size_t i = 0; i < values.size(); ++i) {
+            ASSERT_EQ(i, values[i]);
+        }
+    }
+
+    TEST(RemoteTaskQueueTest, performance) {
+        const size_t NCONSUMER = 4;
+        const size_t NTASK = 1000000;
+        for (size_t nproducer = 1; nproducer <= 64; nproducer *= 2) {
+            flare::fiber_internal::RemoteTaskQueue lockfree_q;
+            ASSERT_EQ(0, lockfree_q.init(2048));
+            LockedTaskQueue locked_q;
+            ASSERT_EQ(0, locked_q.init(2048));
+            const size_t n = NTASK / nproducer;
+            const int64_t lockfree_us = run(&lockfree_q, nproducer, NCONSUMER, n, nullptr);
+            const int64_t locked_us = run(&locked_q, nproducer, NCONSUMER, n, nullptr);
+            const double ntask = nproducer * n;
+            std::cout << "producers=" << nproducer
+                      << " lockfree=" << ntask * 1000 / lockfree_us << "k/s"
+                      << " locked=" << ntask * 1000 / locked_us << "k/s"
+                      << std::endl;
+        }
+    }
+} // namespace
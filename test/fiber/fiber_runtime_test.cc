@@ -24,8 +24,10 @@
 #include <flare/fiber/internal/waitable_event.h>
 #include "flare/log/logging.h"
 #include "flare/fiber/runtime.h"
+#include "flare/fiber/this_fiber.h"
 #include "flare/fiber/internal/fiber.h"
 #include "flare/fiber/internal/schedule_group.h"
+#include "flare/variable/variable.h"
 
 namespace flare::fiber_internal {
     extern schedule_group *g_task_control;
@@ -52,8 +54,34 @@ namespace {
         ASSERT_EQ(FIBER_MIN_CONCURRENCY + 1, flare::fiber_getconcurrency());
         ASSERT_EQ(0, flare::fiber_setconcurrency(FIBER_MIN_CONCURRENCY + 5));
         ASSERT_EQ(FIBER_MIN_CONCURRENCY + 5, flare::fiber_getconcurrency());
-        ASSERT_EQ(EPERM, flare::fiber_setconcurrency(FIBER_MIN_CONCURRENCY + 1));
-        ASSERT_EQ(FIBER_MIN_CONCURRENCY + 5, flare::fiber_getconcurrency());
+        ASSERT_EQ(0, flare::fiber_setconcurrency(FIBER_MIN_CONCURRENCY + 1));  // retire workers
+        ASSERT_EQ(FIBER_MIN_CONCURRENCY + 1, flare::fiber_getconcurrency());
+        ASSERT_EQ(FIBER_MIN_CONCURRENCY + 1, flare::fiber_internal::g_task_control->concurrency());
+    }
+
+    TEST(FiberTest, retire_workers_not_started) {
+        const int old_concurrency = flare::fiber_getconcurrency();
+        // Shrink right after growing, before the new workers are likely
+        // started, which should not block.
+        ASSERT_EQ(0, flare::fiber_setconcurrency(old_concurrency + 8));
+        const int64_t start_us = flare::get_current_time_micros();
+        ASSERT_EQ(0, flare::fiber_setconcurrency(old_concurrency));
+        ASSERT_LT(flare::get_current_time_micros() - start_us, 50000);
+        ASSERT_EQ(old_concurrency, flare::fiber_internal::g_task_control->concurrency());
+        // All retired workers quit.
+        int64_t nworkers = 0;
+        for (int i = 0; i < 100; ++i) {
+            nworkers = atoll(flare::variable::Variable::describe_exposed(
+                    "fiber_worker_count").c_str());
+            if (nworkers == old_concurrency) {
+                break;
+            }
+            usleep(10000);
+        }
+        ASSERT_EQ(old_concurrency, nworkers);
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_background(&th, nullptr, dummy, nullptr));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
     }
 
     static std::atomic<int> *odd;
@@ -125,6 +153,48 @@ namespace {
         FLARE_LOG(INFO) << "Touched pthreads=" << npthreads;
     }
 
+    static std::atomic<int64_t> nyield(0);
+
+    static void *yield_until_stop(void *) {
+        while (!stop) {
+            nyield.fetch_add(1, std::memory_order_relaxed);
+            if (nyield.load(std::memory_order_relaxed) % 16 == 0) {
+                flare::fiber_sleep_for(100);
+            } else {
+                flare::fiber_yield();
+            }
+        }
+        return nullptr;
+    }
+
+    TEST(FiberTest, reduce_concurrency_with_running_fiber) {
+        stop = false;
+        const int N = 200;
+        std::vector<fiber_id_t> tids;
+        for (int i = 0; i < N; ++i) {
+            fiber_id_t tid;
+            ASSERT_EQ(0, fiber_start_background(&tid, &FIBER_ATTR_SMALL, yield_until_stop, nullptr));
+            tids.push_back(tid);
+        }
+        const int old_concurrency = flare::fiber_getconcurrency();
+        for (int i = old_concurrency - 1; i >= FIBER_MIN_CONCURRENCY + 2; i -= 37) {
+            ASSERT_EQ(0, flare::fiber_setconcurrency(i));
+            ASSERT_EQ(i, flare::fiber_getconcurrency());
+        }
+        ASSERT_EQ(0, flare::fiber_setconcurrency(FIBER_MIN_CONCURRENCY + 2));
+        ASSERT_EQ(FIBER_MIN_CONCURRENCY + 2, flare::fiber_internal::g_task_control->concurrency());
+        // Fibers queued in retired workers are still running.
+        const int64_t n = nyield.load();
+        usleep(200000);
+        ASSERT_LT(n, nyield.load());
+        stop = true;
+        for (size_t i = 0; i < tids.size(); ++i) {
+            ASSERT_EQ(0, fiber_join(tids[i], nullptr));
+        }
+        FLARE_LOG(INFO) << "Reduced concurrency from " << old_concurrency
+                        << " to " << flare::fiber_getconcurrency() << ", nyield=" << nyield;
+    }
+
     void *sleep_proc(void *) {
         usleep(100000);
         return nullptr;
@@ -19,9 +19,14 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <signal.h>
+#include <mutex>
+#include <shared_mutex>
 #include "testing/gtest_wrap.h"
 #include "flare/times/time.h"
 #include "flare/base/profile.h"
+#include "flare/log/logging.h"
+#include "flare/fiber/fiber_shared_mutex.h"
+#include "flare/fiber/this_fiber.h"
 
 namespace {
 void* read_thread(void* arg) {
@@ -76,4 +81,264 @@ TEST(RWLockTest, rdlock_performance) {
     pthread_mutex_destroy(&lock1);
 #endif
 }
+
+TEST(RWLockTest, fiber_rwlock_sanity) {
+    fiber_rwlock_t rw;
+    ASSERT_EQ(0, fiber_rwlock_init(&rw, nullptr));
+    ASSERT_EQ(0, fiber_rwlock_rdlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_tryrdlock(&rw));
+    ASSERT_EQ(EBUSY, fiber_rwlock_trywrlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_wrlock(&rw));
+    ASSERT_EQ(EBUSY, fiber_rwlock_tryrdlock(&rw));
+    ASSERT_EQ(EBUSY, fiber_rwlock_trywrlock(&rw));
+    timespec abstime = flare::time_point::future_unix_millis(10).to_timespec();
+    ASSERT_EQ(ETIMEDOUT, fiber_rwlock_timedrdlock(&rw, &abstime));
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_trywrlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_destroy(&rw));
+}
+
+struct WriterPreferenceArg {
+    flare::fiber_shared_mutex mutex;
+    std::atomic<int> stage{0};
+};
+
+void *pending_writer(void *arg) {
+    WriterPreferenceArg *a = (WriterPreferenceArg *) arg;
+    std::unique_lock<flare::fiber_shared_mutex> lck(a->mutex);
+    a->stage = 1;
+    return nullptr;
+}
+
+void *late_reader(void *arg) {
+    WriterPreferenceArg *a = (WriterPreferenceArg *) arg;
+    std::shared_lock<flare::fiber_shared_mutex> lck(a->mutex);
+    // The pending writer goes first.
+    EXPECT_EQ(1, a->stage.load());
+    a->stage = 2;
+    return nullptr;
+}
+
+TEST(RWLockTest, writer_preference) {
+    WriterPreferenceArg arg;
+    arg.mutex.lock_shared();
+    fiber_id_t writer;
+    ASSERT_EQ(0, fiber_start_background(&writer, nullptr, pending_writer, &arg));
+    usleep(10 * 1000);
+    // New readers are blocked by the pending writer.
+    ASSERT_FALSE(arg.mutex.try_lock_shared());
+    fiber_id_t reader;
+    ASSERT_EQ(0, fiber_start_background(&reader, nullptr, late_reader, &arg));
+    usleep(10 * 1000);
+    ASSERT_EQ(0, arg.stage.load());
+    arg.mutex.unlock_shared();
+    ASSERT_EQ(0, fiber_join(writer, nullptr));
+    ASSERT_EQ(0, fiber_join(reader, nullptr));
+    ASSERT_EQ(2, arg.stage.load());
+}
+
+void *timed_writer(void *arg) {
+    fiber_rwlock_t *rw = (fiber_rwlock_t *) arg;
+    timespec abstime = flare::time_point::future_unix_millis(20).to_timespec();
+    EXPECT_EQ(ETIMEDOUT, fiber_rwlock_timedwrlock(rw, &abstime));
+    return nullptr;
+}
+
+void *timed_reader(void *arg) {
+    fiber_rwlock_t *rw = (fiber_rwlock_t *) arg;
+    timespec abstime = flare::time_point::future_unix_millis(20).to_timespec();
+    EXPECT_EQ(ETIMEDOUT, fiber_rwlock_timedrdlock(rw, &abstime));
+    return nullptr;
+}
+
+TEST(RWLockTest, timed_lock_gives_up) {
+    fiber_rwlock_t rw;
+    ASSERT_EQ(0, fiber_rwlock_init(&rw, nullptr));
+    // A writer timed out waiting for readers.
+    ASSERT_EQ(0, fiber_rwlock_rdlock(&rw));
+    fiber_id_t th[2];
+    ASSERT_EQ(0, fiber_start_background(&th[0], nullptr, timed_writer, &rw));
+    usleep(5 * 1000);
+    // Blocked by the writer which gives up later.
+    ASSERT_EQ(0, fiber_start_background(&th[1], nullptr, timed_reader, &rw));
+    ASSERT_EQ(0, fiber_join(th[0], nullptr));
+    ASSERT_EQ(0, fiber_join(th[1], nullptr));
+    // The lock is released on behalf of the writer by the last reader.
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_trywrlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_rdlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_destroy(&rw));
+}
+
+struct StressArg {
+    flare::fiber_shared_mutex rwlock;
+    flare::fiber_sharded_shared_mutex sharded{4};
+    std::atomic<int> nreader{0};
+    std::atomic<int> nwriter{0};
+    int64_t value = 0;
+    std::atomic<bool> stop{false};
+    std::atomic<int64_t> nread{0};
+};
+
+void *stress_reader(void *arg) {
+    StressArg *a = (StressArg *) arg;
+    int64_t n = 0;
+    for (int i = 0; !a->stop; ++i) {
+        const bool sharded = i % 2;
+        const bool timed = i % 3 == 0;
+        size_t shard = 0;
+        if (sharded) {
+            shard = a->sharded.lock_shared();
+        } else if (timed) {
+            timespec abstime = flare::time_point::future_unix_micros(100).to_timespec();
+            if (fiber_rwlock_timedrdlock(a->rwlock.native_handler(), &abstime) != 0) {
+                continue;
+            }
+        } else {
+            a->rwlock.lock_shared();
+        }
+        ++a->nreader;
+        EXPECT_EQ(0, a->nwriter.load());
+        if (i % 16 == 0) {
+            flare::fiber_sleep_for(10);
+        }
+        EXPECT_EQ(0, a->nwriter.load());
+        --a->nreader;
+        if (sharded) {
+            a->sharded.unlock_shared(shard);
+        } else {
+            a->rwlock.unlock_shared();
+        }
+        ++n;
+    }
+    a->nread += n;
+    return nullptr;
+}
+
+void *stress_writer(void *arg) {
+    StressArg *a = (StressArg *) arg;
+    for (int i = 0; !a->stop; ++i) {
+        const bool sharded = i % 2;
+        if (sharded) {
+            a->rwlock.lock();
+        } else {
+            timespec abstime = flare::time_point::future_unix_micros(50).to_timespec();
+            if (fiber_rwlock_timedwrlock(a->rwlock.native_handler(), &abstime) != 0) {
+                continue;
+            }
+        }
+        // Readers of the sharded lock also check nwriter.
+        a->sharded.lock();
+        EXPECT_EQ(0, a->nreader.load());
+        EXPECT_EQ(1, ++a->nwriter);
+        ++a->value;
+        EXPECT_EQ(0, --a->nwriter);
+        a->sharded.unlock();
+        a->rwlock.unlock();
+        flare::fiber_sleep_for(100);
+    }
+    return nullptr;
+}
+
+TEST(RWLockTest, fiber_shared_mutex_stress) {
+    StressArg arg;
+    fiber_id_t readers[32];
+    fiber_id_t writers[4];
+    pthread_t preaders[2];
+    for (size_t i = 0; i < FLARE_ARRAY_SIZE(readers); ++i) {
+        ASSERT_EQ(0, fiber_start_background(&readers[i], nullptr, stress_reader, &arg));
+    }
+    for (size_t i = 0; i < FLARE_ARRAY_SIZE(writers); ++i) {
+        ASSERT_EQ(0, fiber_start_background(&writers[i], nullptr, stress_writer, &arg));
+    }
+    for (size_t i = 0; i < FLARE_ARRAY_SIZE(preaders); ++i) {
+        ASSERT_EQ(0, pthread_create(&preaders[i], nullptr, stress_reader, &arg));
+    }
+    usleep(500 * 1000);
+    arg.stop = true;
+    for (size_t i = 0; i < FLARE_ARRAY_SIZE(readers); ++i) {
+        ASSERT_EQ(0, fiber_join(readers[i], nullptr));
+    }
+    for (size_t i = 0; i < FLARE_ARRAY_SIZE(writers); ++i) {
+        ASSERT_EQ(0, fiber_join(writers[i], nullptr));
+    }
+    for (size_t i = 0; i < FLARE_ARRAY_SIZE(preaders); ++i) {
+        ASSERT_EQ(0, pthread_join(preaders[i], nullptr));
+    }
+    FLARE_LOG(INFO) << "nread=" << arg.nread << " nwrite=" << arg.value;
+    ASSERT_GT(arg.nread.load(), 0);
+    ASSERT_GT(arg.value, 0);
+    ASSERT_TRUE(arg.rwlock.try_lock());
+    arg.rwlock.unlock();
+    ASSERT_TRUE(arg.sharded.try_lock());
+    arg.sharded.unlock();
+}
+
+template <typename Mutex>
+struct ReadPerfArg {
+    Mutex *mutex;
+    std::atomic<bool> *stop;
+    int64_t count;
+};
+
+void read_locked(flare::fiber_shared_mutex *m) {
+    std::shared_lock<flare::fiber_shared_mutex> lck(*m);
+}
+
+void read_locked(flare::fiber_sharded_shared_mutex *m) {
+    flare::fiber_sharded_shared_mutex::shared_guard guard(*m);
+}
+
+template <typename Mutex>
+void *read_until_stopped(void *arg) {
+    ReadPerfArg<Mutex> *a = (ReadPerfArg<Mutex> *) arg;
+    while (!a->stop->load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 100; ++i) {
+            read_locked(a->mutex);
+        }
+        a->count += 100;
+        // Let writers of the test in when all workers are occupied.
+        flare::fiber_yield();
+    }
+    return nullptr;
+}
+
+template <typename Mutex>
+void ReadPerfTest(const char *name, int nreader) {
+    Mutex mutex;
+    std::atomic<bool> stop{false};
+    std::vector<ReadPerfArg<Mutex>> args(nreader, ReadPerfArg<Mutex>{&mutex, &stop, 0});
+    std::vector<fiber_id_t> th(nreader);
+    flare::stop_watcher tm;
+    tm.start();
+    for (int i = 0; i < nreader; ++i) {
+        ASSERT_EQ(0, fiber_start_background(&th[i], nullptr, read_until_stopped<Mutex>, &args[i]));
+    }
+    // Written once in a while.
+    for (int i = 0; i < 10; ++i) {
+        usleep(20 * 1000);
+        std::unique_lock<Mutex> lck(mutex);
+    }
+    stop = true;
+    int64_t count = 0;
+    for (int i = 0; i < nreader; ++i) {
+        fiber_join(th[i], nullptr);
+        count += args[i].count;
+    }
+    tm.stop();
+    FLARE_LOG(INFO) << name << " nreader=" << nreader
+                    << " reads=" << count * 1000 / std::max<int64_t>(tm.m_elapsed(), 1) << "/s";
+}
+
+TEST(RWLockTest, perf_read_mostly) {
+    for (int nreader : {1, 4, 16}) {
+        ReadPerfTest<flare::fiber_shared_mutex>("fiber_shared_mutex", nreader);
+        ReadPerfTest<flare::fiber_sharded_shared_mutex>("fiber_sharded_shared_mutex", nreader);
+    }
+}
 } // namespace
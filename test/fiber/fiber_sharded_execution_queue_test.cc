@@ -0,0 +1,315 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "testing/gtest_wrap.h"
+
+#include <atomic>
+#include <vector>
+#include "flare/fiber/internal/sharded_execution_queue.h"
+#include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/this_fiber.h"
+#include "flare/times/time.h"
+#include "flare/log/logging.h"
+
+namespace {
+
+    const int kKeys = 64;
+
+    struct KeyedTask {
+        uint64_t key;
+        int64_t seq;
+    };
+
+    struct Checker {
+        std::atomic<int64_t> last[kKeys];
+        std::atomic<int64_t> executed{0};
+        std::atomic<int> out_of_order{0};
+        std::atomic<int> nstopped{0};
+
+        Checker() {
+            for (int i = 0; i < kKeys; ++i) {
+                last[i].store(-1, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    int check_order(void *meta, flare::fiber_internal::ShardedTaskIterator<KeyedTask> &iter) {
+        Checker *c = (Checker *) meta;
+        if (iter.is_queue_stopped()) {
+            c->nstopped.fetch_add(1);
+            return 0;
+        }
+        for (; iter; ++iter) {
+            std::atomic<int64_t> &last = c->last[iter->key];
+            if (last.load(std::memory_order_relaxed) + 1 != iter->seq) {
+                c->out_of_order.fetch_add(1);
+            }
+            last.store(iter->seq, std::memory_order_relaxed);
+            c->executed.fetch_add(1, std::memory_order_relaxed);
+        }
+        return 0;
+    }
+
+    struct ProducerArg {
+        flare::fiber_internal::ShardedExecutionQueue<KeyedTask> *q;
+        uint64_t key;
+        int64_t ntask;
+    };
+
+    void *produce(void *arg) {
+        ProducerArg *a = (ProducerArg *) arg;
+        for (int64_t i = 0; i < a->ntask; ++i) {
+            EXPECT_EQ(0, a->q->execute(a->key, KeyedTask{a->key, i}));
+            if (i % 16 == 0) {
+                flare::fiber_yield();
+            }
+        }
+        return nullptr;
+    }
+
+    TEST(ShardedExecutionQueueTest, order_per_key) {
+        Checker checker;
+        flare::fiber_internal::ShardedExecutionQueue<KeyedTask> q;
+        ASSERT_EQ(0, q.start(4, nullptr, check_order, &checker));
+        ASSERT_EQ(4u, q.shard_count());
+        ProducerArg args[kKeys];
+        fiber_id_t th[kKeys];
+        for (int i = 0; i < kKeys; ++i) {
+            args[i] = ProducerArg{&q, (uint64_t) i, 1000};
+            ASSERT_EQ(0, fiber_start_background(&th[i], nullptr, produce, &args[i]));
+        }
+        for (int i = 0; i < kKeys; ++i) {
+            ASSERT_EQ(0, fiber_join(th[i], nullptr));
+        }
+        ASSERT_EQ(0, q.stop());
+        ASSERT_EQ(0, q.join());
+        ASSERT_EQ(kKeys * 1000, checker.executed.load());
+        ASSERT_EQ(0, checker.out_of_order.load());
+        // Told once for all the shards.
+        ASSERT_EQ(1, checker.nstopped.load());
+        ASSERT_EQ(EINVAL, q.execute(0, KeyedTask{0, 1000}));
+    }
+
+    struct MoverArg {
+        flare::fiber_internal::ShardedExecutionQueue<KeyedTask> *q;
+        std::atomic<bool> *stop;
+        int nmoved;
+    };
+
+    void *move_buckets(void *arg) {
+        MoverArg *a = (MoverArg *) arg;
+        size_t bucket = 0;
+        while (!*a->stop) {
+            const size_t b = bucket++ % a->q->bucket_count();
+            const size_t shard = (a->q->shard_of(b) + 1) % a->q->shard_count();
+            EXPECT_EQ(0, a->q->move_bucket(b, shard));
+            ++a->nmoved;
+            flare::fiber_yield();
+        }
+        return nullptr;
+    }
+
+    TEST(ShardedExecutionQueueTest, move_bucket_keeps_order) {
+        Checker checker;
+        flare::fiber_internal::ShardedExecutionQueue<KeyedTask> q;
+        ASSERT_EQ(0, q.start(3, nullptr, check_order, &checker));
+        ASSERT_EQ(EINVAL, q.move_bucket(q.bucket_count(), 0));
+        ASSERT_EQ(EINVAL, q.move_bucket(0, q.shard_count()));
+
+        const size_t bucket = q.bucket_of(7);
+        const size_t shard = (q.shard_of(7) + 1) % q.shard_count();
+        ASSERT_EQ(0, q.move_bucket(bucket, shard));
+        ASSERT_EQ(shard, q.shard_of(7));
+
+        std::atomic<bool> stop{false};
+        MoverArg mover{&q, &stop, 0};
+        fiber_id_t mover_th;
+        ASSERT_EQ(0, fiber_start_background(&mover_th, nullptr, move_buckets, &mover));
+        ProducerArg args[kKeys];
+        fiber_id_t th[kKeys];
+        for (int i = 0; i < kKeys; ++i) {
+            args[i] = ProducerArg{&q, (uint64_t) i, 2000};
+            ASSERT_EQ(0, fiber_start_background(&th[i], nullptr, produce, &args[i]));
+        }
+        for (int i = 0; i < kKeys; ++i) {
+            ASSERT_EQ(0, fiber_join(th[i], nullptr));
+        }
+        stop = true;
+        ASSERT_EQ(0, fiber_join(mover_th, nullptr));
+        ASSERT_EQ(0, q.stop());
+        ASSERT_EQ(0, q.join());
+        FLARE_LOG(INFO) << "Moved " << mover.nmoved << " buckets";
+        ASSERT_GT(mover.nmoved, 0);
+        ASSERT_EQ(kKeys * 2000, checker.executed.load());
+        ASSERT_EQ(0, checker.out_of_order.load());
+    }
+
+    // Collects the tasks of a batch and executes them after iterating.
+    int execute_after_iterating(void *meta, flare::fiber_internal::ShardedTaskIterator<KeyedTask> &iter) {
+        Checker *c = (Checker *) meta;
+        if (iter.is_queue_stopped()) {
+            return 0;
+        }
+        std::vector<KeyedTask> batch;
+        for (; iter; ++iter) {
+            batch.push_back(*iter);
+        }
+        flare::fiber_sleep_for(20000);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            c->last[batch[i].key].store(batch[i].seq, std::memory_order_relaxed);
+            c->executed.fetch_add(1, std::memory_order_relaxed);
+        }
+        return 0;
+    }
+
+    TEST(ShardedExecutionQueueTest, move_bucket_waits_for_execution) {
+        Checker checker;
+        flare::fiber_internal::ShardedExecutionQueue<KeyedTask> q;
+        ASSERT_EQ(0, q.start(2, nullptr, execute_after_iterating, &checker));
+        const size_t bucket = q.bucket_of(3);
+        for (int i = 0; i < 10; ++i) {
+            const int64_t executed = checker.executed.load();
+            ASSERT_EQ(0, q.execute(3, KeyedTask{3, i}));
+            // Returns after the task is executed even if the barrier is
+            // iterated in the same batch.
+            ASSERT_EQ(0, q.move_bucket(bucket, (q.shard_of(3) + 1) % q.shard_count()));
+            ASSERT_EQ(executed + 1, checker.executed.load());
+            ASSERT_EQ(i, checker.last[3].load());
+        }
+        ASSERT_EQ(0, q.stop());
+        ASSERT_EQ(0, q.join());
+    }
+
+    TEST(ShardedExecutionQueueTest, rebalance) {
+        Checker checker;
+        flare::fiber_internal::ShardedExecutionQueue<KeyedTask> q;
+        ASSERT_EQ(0, q.start(2, nullptr, check_order, &checker));
+        // Find 4 keys in different buckets of shard 0.
+        std::vector<uint64_t> keys;
+        std::vector<size_t> buckets;
+        for (uint64_t key = 0; key < (uint64_t) kKeys && keys.size() < 4; ++key) {
+            if (q.shard_of(key) == 0 &&
+                std::find(buckets.begin(), buckets.end(), q.bucket_of(key)) == buckets.end()) {
+                keys.push_back(key);
+                buckets.push_back(q.bucket_of(key));
+            }
+        }
+        ASSERT_EQ(4u, keys.size());
+        for (uint64_t key : keys) {
+            for (int64_t i = 0; i < 100; ++i) {
+                ASSERT_EQ(0, q.execute(key, KeyedTask{key, i}));
+            }
+        }
+        ASSERT_EQ(1, q.rebalance());
+        size_t nmoved = 0;
+        for (uint64_t key : keys) {
+            nmoved += q.shard_of(key);
+        }
+        ASSERT_EQ(1u, nmoved);
+        // Loads are reset by rebalance.
+        ASSERT_EQ(0, q.rebalance());
+        // A single hot key can't be spread.
+        for (int64_t i = 100; i < 200; ++i) {
+            ASSERT_EQ(0, q.execute(keys[0], KeyedTask{keys[0], i}));
+        }
+        ASSERT_EQ(0, q.rebalance());
+        ASSERT_EQ(0, q.stop());
+        ASSERT_EQ(0, q.join());
+        ASSERT_EQ(500, checker.executed.load());
+        ASSERT_EQ(0, checker.out_of_order.load());
+    }
+
+    int count_tasks(void *meta, flare::fiber_internal::ShardedTaskIterator<KeyedTask> &iter) {
+        std::atomic<int64_t> *count = (std::atomic<int64_t> *) meta;
+        int64_t n = 0;
+        for (; iter; ++iter) {
+            ++n;
+        }
+        count->fetch_add(n, std::memory_order_relaxed);
+        return 0;
+    }
+
+    int count_tasks_single(void *meta, flare::fiber_internal::TaskIterator<KeyedTask> &iter) {
+        std::atomic<int64_t> *count = (std::atomic<int64_t> *) meta;
+        int64_t n = 0;
+        for (; iter; ++iter) {
+            ++n;
+        }
+        count->fetch_add(n, std::memory_order_relaxed);
+        return 0;
+    }
+
+    struct PerfArg {
+        flare::fiber_internal::ShardedExecutionQueue<KeyedTask> *sharded;
+        flare::fiber_internal::ExecutionQueueId<KeyedTask> single;
+        uint64_t key;
+        int64_t ntask;
+    };
+
+    void *produce_perf(void *arg) {
+        PerfArg *a = (PerfArg *) arg;
+        for (int64_t i = 0; i < a->ntask; ++i) {
+            if (a->sharded) {
+                a->sharded->execute(a->key + i, KeyedTask{0, i});
+            } else {
+                flare::fiber_internal::execution_queue_execute(a->single, KeyedTask{0, i});
+            }
+        }
+        return nullptr;
+    }
+
+    TEST(ShardedExecutionQueueTest, performance) {
+        const int kProducers = 8;
+        const int64_t kTasks = 100000;
+        for (int sharded = 0; sharded < 2; ++sharded) {
+            std::atomic<int64_t> count{0};
+            flare::fiber_internal::ShardedExecutionQueue<KeyedTask> q;
+            flare::fiber_internal::ExecutionQueueId<KeyedTask> single;
+            if (sharded) {
+                ASSERT_EQ(0, q.start(0, nullptr, count_tasks, &count));
+            } else {
+                ASSERT_EQ(0, flare::fiber_internal::execution_queue_start(
+                        &single, nullptr, count_tasks_single, &count));
+            }
+            PerfArg args[kProducers];
+            fiber_id_t th[kProducers];
+            flare::stop_watcher tm;
+            tm.start();
+            for (int i = 0; i < kProducers; ++i) {
+                args[i] = PerfArg{sharded ? &q : nullptr, single, (uint64_t) i * kTasks, kTasks};
+                ASSERT_EQ(0, fiber_start_background(&th[i], nullptr, produce_perf, &args[i]));
+            }
+            for (int i = 0; i < kProducers; ++i) {
+                ASSERT_EQ(0, fiber_join(th[i], nullptr));
+            }
+            if (sharded) {
+                ASSERT_EQ(0, q.stop());
+                ASSERT_EQ(0, q.join());
+            } else {
+                ASSERT_EQ(0, flare::fiber_internal::execution_queue_stop(single));
+                ASSERT_EQ(0, flare::fiber_internal::execution_queue_join(single));
+            }
+            tm.stop();
+            ASSERT_EQ(kProducers * kTasks, count.load());
+            FLARE_LOG(INFO) << (sharded ? "sharded" : "single") << " queue: "
+                            << kProducers * kTasks * 1000 / std::max<int64_t>(tm.u_elapsed(), 1)
+                            << " tasks/ms";
+        }
+    }
+
+}  // namespace
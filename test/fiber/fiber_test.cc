@@ -16,6 +16,7 @@
 // under the License.
 
 #include <execinfo.h>
+#include <inttypes.h>
 #include "testing/gtest_wrap.h"
 #include "flare/times/time.h"
 #include "flare/log/logging.h"
@@ -23,8 +24,18 @@
 #include "flare/fiber/internal/fiber.h"
 #include "flare/fiber/internal/unstable.h"
 #include "flare/fiber/internal/fiber_entity.h"
+#include "flare/fiber/internal/processor.h"
+#include "flare/fiber/internal/fiber_accounting.h"
+#include "flare/fiber/internal/sched_trace.h"
+#include "flare/fiber/internal/stack.h"
+#include "flare/fiber/runtime.h"
 #include "flare/fiber/this_fiber.h"
 
+namespace flare::fiber_internal {
+    DECLARE_int32(fiber_priority_aging_interval);
+    DECLARE_int32(fiber_sched_trace_capacity);
+}
+
 namespace {
     class FiberTest : public ::testing::Test {
     protected:
@@ -553,4 +564,335 @@ namespace {
         ASSERT_EQ(0, fiber_join(tid, nullptr));
     }
 
+    static void *check_priority(void *arg) {
+        fiber_attribute attr;
+        EXPECT_EQ(0, fiber_getattr(fiber_self(), &attr));
+        EXPECT_EQ(*(fiber_priority_t *) arg, attr.priority);
+        flare::fiber_yield();
+        return nullptr;
+    }
+
+    TEST_F(FiberTest, priority) {
+        static fiber_priority_t priorities[] = {
+                FIBER_PRIORITY_LOW, FIBER_PRIORITY_NORMAL, FIBER_PRIORITY_HIGH};
+        std::vector<fiber_id_t> tids;
+        for (size_t i = 0; i < 300; ++i) {
+            fiber_attribute attr = FIBER_ATTR_NORMAL;
+            attr.priority = priorities[i % FLARE_ARRAY_SIZE(priorities)];
+            fiber_id_t tid;
+            ASSERT_EQ(0, fiber_start_background(
+                    &tid, &attr, check_priority, &priorities[i % FLARE_ARRAY_SIZE(priorities)]));
+            tids.push_back(tid);
+        }
+        for (size_t i = 0; i < tids.size(); ++i) {
+            ASSERT_EQ(0, fiber_join(tids[i], nullptr));
+        }
+    }
+
+    struct PriorityOrderArgs {
+        std::atomic<int> *counter;
+        int seq;
+    };
+
+    static void *record_run_order(void *arg) {
+        PriorityOrderArgs *a = (PriorityOrderArgs *) arg;
+        a->seq = a->counter->fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    // Start N fibers of each priority without signaling workers.
+    static void start_prioritized_fibers(std::vector<PriorityOrderArgs> *args,
+                                         std::vector<fiber_id_t> *tids) {
+        static const fiber_priority_t priorities[] = {
+                FIBER_PRIORITY_LOW, FIBER_PRIORITY_NORMAL, FIBER_PRIORITY_HIGH};
+        const size_t n = args->size() / FLARE_ARRAY_SIZE(priorities);
+        for (size_t i = 0; i < args->size(); ++i) {
+            fiber_attribute attr = FIBER_ATTR_NORMAL | FIBER_NOSIGNAL;
+            attr.priority = priorities[i / n];
+            fiber_id_t tid;
+            EXPECT_EQ(0, fiber_start_background(&tid, &attr, record_run_order, &(*args)[i]));
+            tids->push_back(tid);
+        }
+    }
+
+    static void join_fibers(const std::vector<fiber_id_t> &tids) {
+        for (size_t i = 0; i < tids.size(); ++i) {
+            EXPECT_EQ(0, fiber_join(tids[i], nullptr));
+        }
+    }
+
+    static void *start_and_join_prioritized_fibers(void *arg) {
+        std::vector<fiber_id_t> tids;
+        start_prioritized_fibers((std::vector<PriorityOrderArgs> *) arg, &tids);
+        fiber_flush();
+        join_fibers(tids);
+        return nullptr;
+    }
+
+    struct OccupyArgs {
+        std::atomic<int> nbusy;
+        std::atomic<bool> stop;
+    };
+
+    static void *occupy_worker(void *arg) {
+        OccupyArgs *a = (OccupyArgs *) arg;
+        a->nbusy.fetch_add(1);
+        while (!a->stop.load()) {
+            cpu_relax();
+        }
+        return nullptr;
+    }
+
+    // Returns average run order of fibers of each priority, indexed by
+    // priority. Fibers are started in a fiber if `in_fiber' is true, or
+    // in this pthread and queued in remote runqueues otherwise. Other
+    // workers are kept busy so that the fibers are all queued before any
+    // of them runs.
+    static std::vector<double> run_prioritized_fibers(
+            size_t n, bool in_fiber, std::vector<PriorityOrderArgs> *args) {
+        std::atomic<int> counter(0);
+        args->assign(n * 3, PriorityOrderArgs{&counter, -1});
+        OccupyArgs occupy_args;
+        occupy_args.nbusy = 0;
+        occupy_args.stop = false;
+        const int noccupy = fiber_getconcurrency() - (in_fiber ? 1 : 0);
+        std::vector<fiber_id_t> occupiers(noccupy);
+        for (int i = 0; i < noccupy; ++i) {
+            EXPECT_EQ(0, fiber_start_background(&occupiers[i], nullptr, occupy_worker, &occupy_args));
+        }
+        while (occupy_args.nbusy.load() != noccupy) {
+            usleep(1000);
+        }
+        if (in_fiber) {
+            fiber_id_t tid;
+            EXPECT_EQ(0, fiber_start_background(
+                    &tid, nullptr, start_and_join_prioritized_fibers, args));
+            EXPECT_EQ(0, fiber_join(tid, nullptr));
+            occupy_args.stop = true;
+        } else {
+            std::vector<fiber_id_t> tids;
+            start_prioritized_fibers(args, &tids);
+            occupy_args.stop = true;
+            fiber_flush();
+            join_fibers(tids);
+        }
+        join_fibers(occupiers);
+        // Fibers were started in the order of low, normal and high.
+        std::vector<double> avg(FIBER_PRIORITY_NUM, 0);
+        const fiber_priority_t priorities[] = {
+                FIBER_PRIORITY_LOW, FIBER_PRIORITY_NORMAL, FIBER_PRIORITY_HIGH};
+        for (size_t i = 0; i < args->size(); ++i) {
+            EXPECT_LE(0, (*args)[i].seq);
+            avg[priorities[i / n]] += (*args)[i].seq / (double) n;
+        }
+        return avg;
+    }
+
+    TEST_F(FiberTest, higher_priority_runs_first) {
+        const int32_t saved_interval = flare::fiber_internal::FLAGS_fiber_priority_aging_interval;
+        flare::fiber_internal::FLAGS_fiber_priority_aging_interval = 0;
+        const size_t N = 50;
+        std::vector<PriorityOrderArgs> args;
+        for (int i = 0; i < 2; ++i) {
+            const bool in_fiber = (i == 0);
+            std::vector<double> avg = run_prioritized_fibers(N, in_fiber, &args);
+            FLARE_LOG(INFO) << "in_fiber=" << in_fiber
+                            << " avg order high=" << avg[FIBER_PRIORITY_HIGH]
+                            << " normal=" << avg[FIBER_PRIORITY_NORMAL]
+                            << " low=" << avg[FIBER_PRIORITY_LOW];
+            EXPECT_LT(avg[FIBER_PRIORITY_HIGH], avg[FIBER_PRIORITY_NORMAL]);
+            EXPECT_LT(avg[FIBER_PRIORITY_NORMAL], avg[FIBER_PRIORITY_LOW]);
+        }
+        flare::fiber_internal::FLAGS_fiber_priority_aging_interval = saved_interval;
+    }
+
+    TEST_F(FiberTest, lower_priority_is_not_starved) {
+        const int32_t saved_interval = flare::fiber_internal::FLAGS_fiber_priority_aging_interval;
+        flare::fiber_internal::FLAGS_fiber_priority_aging_interval = 4;
+        const size_t N = 50;
+        std::vector<PriorityOrderArgs> args;
+        run_prioritized_fibers(N, true, &args);
+        flare::fiber_internal::FLAGS_fiber_priority_aging_interval = saved_interval;
+        // Low-priority fibers are the first N ones, high-priority ones are
+        // the last N ones.
+        int first_low = std::numeric_limits<int>::max();
+        int last_high = -1;
+        for (size_t i = 0; i < N; ++i) {
+            first_low = std::min(first_low, args[i].seq);
+            last_high = std::max(last_high, args[2 * N + i].seq);
+        }
+        ASSERT_LT(first_low, last_high);
+    }
+
+    void *spin_and_yield(void *) {
+        for (int i = 0; i < 10; ++i) {
+            const int64_t start_ns = flare::get_current_time_nanos();
+            while (flare::get_current_time_nanos() - start_ns < 100000) {}
+            flare::fiber_yield();
+        }
+        return nullptr;
+    }
+
+    TEST_F(FiberTest, accounting_by_tag) {
+        flare::fiber_internal::FLAGS_fiber_enable_accounting = true;
+        const int N = 16;
+        std::vector<fiber_id_t> tids;
+        for (int i = 0; i < N; ++i) {
+            fiber_attribute attr = FIBER_ATTR_NORMAL;
+            attr.tag = "spin_and_yield";
+            fiber_id_t tid;
+            ASSERT_EQ(0, fiber_start_background(&tid, &attr, spin_and_yield, nullptr));
+            tids.push_back(tid);
+        }
+        for (size_t i = 0; i < tids.size(); ++i) {
+            ASSERT_EQ(0, fiber_join(tids[i], nullptr));
+        }
+        flare::fiber_internal::FLAGS_fiber_enable_accounting = false;
+
+        std::string tag = "spin_and_yield";
+        flare::fiber_internal::fiber_tag_stat *s =
+                flare::fiber_internal::get_or_create_tag_stat(tag.c_str());
+        ASSERT_TRUE(s != nullptr);
+        ASSERT_EQ(N, s->nfiber.get_value());
+        // Each fiber switches out at most once per yield and once at the end.
+        ASSERT_LE(N, s->nswitch.get_value());
+        ASSERT_GE(N * 11, s->nswitch.get_value());
+        // Each fiber spins for 1ms at least.
+        ASSERT_LE(N * 1000000L, flare::fiber_internal::accounting_cycles_to_ns(s->cpu_cycles.get_value()));
+        ASSERT_LT(0, s->runnable_cycles.get_value());
+        ASSERT_TRUE(flare::fiber_internal::get_or_create_tag_stat(nullptr) == nullptr);
+
+        std::ostringstream os;
+        flare::fiber_internal::describe_top_tags(os, 10);
+        FLARE_LOG(INFO) << os.str();
+        ASSERT_NE(std::string::npos, os.str().find("\nspin_and_yield "));
+    }
+
+    void *wait_event(void *arg) {
+        flare::fiber_internal::waitable_event_wait(arg, 0, nullptr);
+        return nullptr;
+    }
+
+    TEST_F(FiberTest, sched_trace) {
+        flare::fiber_internal::FLAGS_fiber_enable_sched_trace = true;
+        std::atomic<int> *event = flare::fiber_internal::waitable_event_create_checked<std::atomic<int> >();
+        event->store(0);
+        std::vector<fiber_id_t> tids;
+        for (int i = 0; i < 8; ++i) {
+            fiber_id_t tid;
+            ASSERT_EQ(0, fiber_start_background(&tid, nullptr, wait_event, event));
+            tids.push_back(tid);
+        }
+        usleep(10000);
+        fiber_id_t waker;
+        ASSERT_EQ(0, fiber_start_background(&waker, nullptr, [event](void *) -> void * {
+            event->store(1);
+            flare::fiber_internal::waitable_event_wake_all(event);
+            return nullptr;
+        }, nullptr));
+        for (size_t i = 0; i < tids.size(); ++i) {
+            ASSERT_EQ(0, fiber_join(tids[i], nullptr));
+        }
+        ASSERT_EQ(0, fiber_join(waker, nullptr));
+        flare::fiber_internal::FLAGS_fiber_enable_sched_trace = false;
+        flare::fiber_internal::waitable_event_destroy(event);
+
+        std::ostringstream os;
+        ASSERT_EQ(0, flare::fiber_dump_sched_trace(os));
+        const std::string json = os.str();
+        ASSERT_EQ(0u, json.find("{\"traceEvents\":["));
+        ASSERT_EQ('}', json.back());
+        ASSERT_NE(std::string::npos, json.find("\"name\":\"create\""));
+        ASSERT_NE(std::string::npos, json.find("\"name\":\"butex_wait\""));
+        ASSERT_NE(std::string::npos, json.find("\"name\":\"butex_wake\""));
+        ASSERT_NE(std::string::npos, json.find("\"cat\":\"run\",\"ph\":\"X\""));
+        char tid_str[32];
+        snprintf(tid_str, sizeof(tid_str), "\"fiber %" PRIu64 "\"", tids[0]);
+        ASSERT_NE(std::string::npos, json.find(tid_str));
+    }
+
+    struct TraceAdderArgs {
+        flare::fiber_internal::SchedTraceBuffer *buf;
+        std::atomic<bool> *start;
+        std::atomic<int> *ndone;
+    };
+
+    static void *add_trace_events(void *arg) {
+        TraceAdderArgs *a = (TraceAdderArgs *) arg;
+        while (!a->start->load()) {
+            cpu_relax();
+        }
+        for (int i = 0; i < 100; ++i) {
+            a->buf->add(flare::fiber_internal::SCHED_EVENT_READY, i + 1);
+        }
+        a->ndone->fetch_add(1);
+        return nullptr;
+    }
+
+    TEST_F(FiberTest, sched_trace_buffer_allocated_concurrently) {
+        const int32_t saved_capacity = flare::fiber_internal::FLAGS_fiber_sched_trace_capacity;
+        const int NTHREAD = 4;
+        for (int round = 0; round < 100; ++round) {
+            flare::fiber_internal::SchedTraceBuffer buf;
+            std::atomic<bool> start(false);
+            std::atomic<int> ndone(0);
+            TraceAdderArgs args = {&buf, &start, &ndone};
+            pthread_t th[NTHREAD];
+            for (int i = 0; i < NTHREAD; ++i) {
+                ASSERT_EQ(0, pthread_create(&th[i], nullptr, add_trace_events, &args));
+            }
+            // Threads allocating slots see different capacities.
+            start = true;
+            for (int i = 0; ndone.load() != NTHREAD; ++i) {
+                flare::fiber_internal::FLAGS_fiber_sched_trace_capacity = (i % 2 ? 64 : 65536);
+            }
+            for (int i = 0; i < NTHREAD; ++i) {
+                ASSERT_EQ(0, pthread_join(th[i], nullptr));
+            }
+            std::vector<flare::fiber_internal::sched_event> events;
+            buf.snapshot(&events);
+            // All events fit in either capacity except that the smaller one
+            // keeps the newest 64 only.
+            ASSERT_TRUE(events.size() == 64u || events.size() == 100u * NTHREAD)
+                    << events.size();
+        }
+        flare::fiber_internal::FLAGS_fiber_sched_trace_capacity = saved_capacity;
+    }
+
+    void *use_stack(void *arg) {
+        volatile char buf[100 * 1024];
+        for (size_t i = 0; i < sizeof(buf); i += 512) {
+            buf[i] = (char) i;
+        }
+        flare::fiber_sleep_for(10000);
+        return (void *) (intptr_t) buf[512];
+    }
+
+    TEST_F(FiberTest, stack_trim_and_usage) {
+        FLAGS_stack_measure_usage = true;
+        FLAGS_stack_idle_budget_mb = 1;
+        const int N = 32;
+        fiber_id_t tids[N];
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_start_background(&tids[i], nullptr, use_stack, nullptr));
+        }
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_join(tids[i], nullptr));
+        }
+        FLAGS_stack_measure_usage = false;
+        FLAGS_stack_idle_budget_mb = 0;
+
+        const std::string usage = flare::variable::Variable::describe_exposed("fiber_stack_usage_normal");
+        // 100K and a few pages for frames.
+        ASSERT_NE(std::string::npos, usage.find("128K:")) << usage;
+        const size_t max_pos = usage.find("max:");
+        ASSERT_NE(std::string::npos, max_pos) << usage;
+        ASSERT_LE(100, atoi(usage.c_str() + max_pos + 4)) << usage;
+        ASSERT_NE("0", flare::variable::Variable::describe_exposed("fiber_stack_trimmed"));
+        const int64_t idle_resident = atoll(
+                flare::variable::Variable::describe_exposed("fiber_stack_idle_resident").c_str());
+        // Stacks are trimmed once over budget except pages holding contexts.
+        ASSERT_GE((1 << 20) + N * 16 * 1024, idle_resident);
+    }
+
 } // namespace
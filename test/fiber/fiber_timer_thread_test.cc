@@ -15,6 +15,8 @@
 // specific language governing permissions and limitations
 // under the License.
 
+#include <set>
+#include <atomic>
 #include "testing/gtest_wrap.h"
 #include <gflags/gflags.h>
 #include "flare/fiber/internal/sys_futex.h"
@@ -249,4 +251,152 @@ namespace {
         keeper5.expect_first_run();
     }
 
+    TEST(TimerThreadTest, timing_wheel) {
+        flare::fiber_internal::TimerThreadOptions options;
+        options.use_timing_wheel = true;
+        options.wheel_tick_us = 1000;
+        flare::fiber_internal::TimerThread timer_thread;
+        ASSERT_EQ(0, timer_thread.start(&options));
+
+        timespec past_time = {0, 0};
+        TimeKeeper keeper1(past_time, "keeper1");
+        keeper1.schedule(&timer_thread);
+        const timespec keeper1_addtime = flare::time_point::future_unix_seconds(0).to_timespec();
+        // Within level 0, level 1 and cascaded from level 1.
+        TimeKeeper keeper2(flare::time_point::future_unix_millis(100).to_timespec(), "keeper2");
+        keeper2.schedule(&timer_thread);
+        TimeKeeper keeper3(flare::time_point::future_unix_millis(300).to_timespec(), "keeper3");
+        keeper3.schedule(&timer_thread);
+        TimeKeeper keeper4(flare::time_point::future_unix_millis(1500).to_timespec(), "keeper4");
+        keeper4.schedule(&timer_thread);
+        TimeKeeper keeper5(flare::time_point::future_unix_millis(1500).to_timespec(), "keeper5");
+        keeper5.schedule(&timer_thread);
+        // Beyond the last level.
+        timespec future_time = {std::numeric_limits<int>::max(), 0};
+        TimeKeeper keeper6(future_time, "keeper6");
+        keeper6.schedule(&timer_thread);
+
+        usleep(200000);
+        ASSERT_EQ(0, timer_thread.unschedule(keeper5._task_id));
+        ASSERT_EQ(0, timer_thread.unschedule(keeper6._task_id));
+        sleep(2);
+        timer_thread.stop_and_join();
+
+        keeper1.expect_first_run(keeper1_addtime);
+        keeper2.expect_first_run();
+        keeper3.expect_first_run();
+        keeper4.expect_first_run();
+        keeper5.expect_not_run();
+        keeper6.expect_not_run();
+    }
+
+    struct SlackTimer {
+        int64_t expected_us;
+        int64_t slack_us;
+        int64_t run_us;
+    };
+
+    void run_slack_timer(void *arg) {
+        static_cast<SlackTimer *>(arg)->run_us = flare::get_current_time_micros();
+    }
+
+    TEST(TimerThreadTest, slack) {
+        for (int use_timing_wheel = 0; use_timing_wheel < 2; ++use_timing_wheel) {
+            flare::fiber_internal::TimerThreadOptions options;
+            options.use_timing_wheel = use_timing_wheel;
+            flare::fiber_internal::TimerThread timer_thread;
+            ASSERT_EQ(0, timer_thread.start(&options));
+            std::vector<SlackTimer> timers(100);
+            const int64_t now_us = flare::get_current_time_micros();
+            for (size_t i = 0; i < timers.size(); ++i) {
+                timers[i].expected_us = now_us + 10000 + i * 997;
+                timers[i].slack_us = 50000;
+                timers[i].run_us = 0;
+                timer_thread.schedule(run_slack_timer, &timers[i],
+                                      flare::time_point::from_unix_micros(
+                                              timers[i].expected_us).to_timespec(),
+                                      timers[i].slack_us);
+            }
+            usleep(300000);
+            timer_thread.stop_and_join();
+            std::set<int64_t> run_times;
+            for (auto &t : timers) {
+                ASSERT_GE(t.run_us, t.expected_us);
+                // 20ms for scheduling delays of the timer thread.
+                ASSERT_LE(t.run_us, t.expected_us + t.slack_us + 20000);
+                run_times.insert(t.run_us / 1000);
+            }
+            // Coalesced into few runs.
+            ASSERT_LE(run_times.size(), 10u);
+        }
+    }
+
+    // 1M pending timers, 95% of which are cancelled before expiration like
+    // RPC timeouts.
+    void run_timers_with_cancellation(bool use_timing_wheel) {
+        flare::fiber_internal::TimerThreadOptions options;
+        options.use_timing_wheel = use_timing_wheel;
+        flare::fiber_internal::TimerThread timer_thread;
+        ASSERT_EQ(0, timer_thread.start(&options));
+        clockid_t cpu_clock;
+        ASSERT_EQ(0, pthread_getcpuclockid(timer_thread.thread_id(), &cpu_clock));
+        timespec cpu_begin;
+        clock_gettime(cpu_clock, &cpu_begin);
+
+        // Keep the timer thread busy pulling tasks like a server does.
+        struct Ticker {
+            flare::fiber_internal::TimerThread *timer_thread;
+
+            static void run(void *arg) {
+                Ticker *t = static_cast<Ticker *>(arg);
+                t->timer_thread->schedule(run, t, flare::time_point::future_unix_millis(1).to_timespec());
+            }
+        } ticker = {&timer_thread};
+        Ticker::run(&ticker);
+
+        const int N = 1000000;
+        static std::atomic<int> ntriggered;
+        ntriggered = 0;
+        std::vector<flare::fiber_internal::TimerThread::TaskId> ids(N);
+        flare::stop_watcher tm;
+        tm.start();
+        const int64_t now_us = flare::get_current_time_micros();
+        for (int i = 0; i < N; ++i) {
+            // Timeouts spread within [0.5s, 1.5s) in random order.
+            ids[i] = timer_thread.schedule(
+                    [](void *) { ntriggered.fetch_add(1, std::memory_order_relaxed); }, nullptr,
+                    flare::time_point::from_unix_micros(now_us + 500000 + (i * 7919L) % 1000000).to_timespec());
+        }
+        tm.stop();
+        const int64_t schedule_ns = tm.n_elapsed() / N;
+        // Let the timer thread pull tasks before cancelling.
+        usleep(100000);
+        tm.start();
+        int ncancelled = 0;
+        for (int i = 0; i < N; ++i) {
+            if (i % 20 != 0) {
+                ncancelled += (timer_thread.unschedule(ids[i]) == 0);
+            }
+        }
+        tm.stop();
+        const int64_t unschedule_ns = tm.n_elapsed() / (N - N / 20);
+        while (ntriggered.load(std::memory_order_relaxed) + ncancelled < N) {
+            usleep(10000);
+        }
+        timespec cpu_end;
+        clock_gettime(cpu_clock, &cpu_end);
+        timer_thread.stop_and_join();
+        // Timers fired before being cancelled on a loaded machine are fine.
+        ASSERT_EQ(N - ncancelled, ntriggered.load());
+        FLARE_LOG(INFO) << (use_timing_wheel ? "timing wheel" : "heap")
+                        << ": schedule=" << schedule_ns << "ns unschedule=" << unschedule_ns
+                        << "ns timer thread cpu=" << timespec_diff_us(cpu_end, cpu_begin) / 1000
+                        << "ms";
+    }
+
+    TEST(TimerThreadTest, perf_cancellation) {
+        run_timers_with_cancellation(false);
+        run_timers_with_cancellation(true);
+    }
+
 } // end namespace
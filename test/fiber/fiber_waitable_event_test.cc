@@ -227,6 +227,54 @@ namespace {
         flare::fiber_internal::waitable_event_destroy(event);
     }
 
+    struct requeue_arg {
+        int *event;
+        bool requeued;
+    };
+
+    void *wait_requeued(void *void_arg) {
+        requeue_arg *arg = static_cast<requeue_arg *>(void_arg);
+        arg->requeued = true;
+        EXPECT_EQ(0, flare::fiber_internal::waitable_event_wait(arg->event, 0, nullptr, &arg->requeued));
+        return nullptr;
+    }
+
+    void count_wakeup(void *arg) {
+        __atomic_add_fetch(static_cast<int *>(arg), 1, __ATOMIC_RELAXED);
+    }
+
+    TEST(WaitableEventTest, requeue) {
+        int *event1 = flare::fiber_internal::waitable_event_create_checked<int>();
+        int *event2 = flare::fiber_internal::waitable_event_create_checked<int>();
+        *event1 = 0;
+        *event2 = 0;
+        for (int i = 0; i < 2; ++i) {
+            const fiber_attribute attr =
+                    (i == 0 ? FIBER_ATTR_PTHREAD : FIBER_ATTR_NORMAL);
+            requeue_arg args[2] = {{event1, false}, {event1, false}};
+            fiber_id_t th[2];
+            for (size_t j = 0; j < FLARE_ARRAY_SIZE(th); ++j) {
+                ASSERT_EQ(0, fiber_start_urgent(&th[j], &attr, wait_requeued, &args[j]));
+            }
+            int ncallback = 0;
+            ASSERT_EQ(0, flare::fiber_internal::waitable_event_wait_async(
+                    event1, 0, count_wakeup, &ncallback));
+            usleep(10 * 1000);
+            // One waiter is woken up, the other one is moved to event2 and
+            // the callback can't be moved.
+            ASSERT_EQ(2, flare::fiber_internal::waitable_event_requeue(event1, event2));
+            ASSERT_EQ(1, ncallback);
+            usleep(10 * 1000);
+            ASSERT_EQ(1, flare::fiber_internal::waitable_event_wake(event2));
+            for (size_t j = 0; j < FLARE_ARRAY_SIZE(th); ++j) {
+                ASSERT_EQ(0, fiber_join(th[j], nullptr));
+            }
+            ASSERT_NE(args[0].requeued, args[1].requeued);
+        }
+        flare::fiber_internal::waitable_event_destroy(event1);
+        flare::fiber_internal::waitable_event_destroy(event2);
+    }
+
     TEST(WaitableEventTest, stop_after_running) {
         int *event = flare::fiber_internal::waitable_event_create_checked<int>();
         *event = 7;
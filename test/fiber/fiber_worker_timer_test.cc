@@ -0,0 +1,267 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <errno.h>
+#include <atomic>
+#include <vector>
+#include <gflags/gflags.h>
+#include "testing/gtest_wrap.h"
+#include "flare/times/time.h"
+#include "flare/log/logging.h"
+#include "flare/fiber/internal/fiber.h"
+#include "flare/fiber/internal/waitable_event.h"
+#include "flare/fiber/internal/worker_timer.h"
+#include "flare/fiber/this_fiber.h"
+
+namespace {
+
+    using flare::fiber_internal::WorkerTimerQueue;
+    using flare::fiber_internal::TimerThread;
+
+    std::vector<int> run_order;
+
+    void record(void *arg) {
+        run_order.push_back((int) (intptr_t) arg);
+    }
+
+    TEST(WorkerTimerTest, queue) {
+        WorkerTimerQueue q;
+        ASSERT_EQ(std::numeric_limits<int64_t>::max(), q.nearest_run_time());
+        const int64_t now_us = flare::get_current_time_micros();
+        const WorkerTimerQueue::TaskId id3 = q.schedule(record, (void *) 3, now_us - 10);
+        const WorkerTimerQueue::TaskId id1 = q.schedule(record, (void *) 1, now_us - 30);
+        const WorkerTimerQueue::TaskId id2 = q.schedule(record, (void *) 2, now_us - 20);
+        const WorkerTimerQueue::TaskId id4 = q.schedule(record, (void *) 4, now_us + 1000000);
+        ASSERT_TRUE(WorkerTimerQueue::owns(id1));
+        ASSERT_TRUE(WorkerTimerQueue::owns(id4));
+        ASSERT_EQ(now_us - 30, q.nearest_run_time());
+        ASSERT_EQ(0, WorkerTimerQueue::unschedule(id2));
+        ASSERT_EQ(-1, WorkerTimerQueue::unschedule(id2));
+
+        run_order.clear();
+        ASSERT_EQ(2, q.run_timers(now_us));
+        ASSERT_EQ((std::vector<int>{1, 3}), run_order);
+        ASSERT_EQ(now_us + 1000000, q.nearest_run_time());
+        ASSERT_EQ(-1, WorkerTimerQueue::unschedule(id3));
+
+        // Remaining timers run in TimerThread after hand_over().
+        TimerThread timer_thread;
+        ASSERT_EQ(0, timer_thread.start(nullptr));
+        ASSERT_FALSE(WorkerTimerQueue::owns(timer_thread.schedule(
+                record, (void *) 5, flare::time_point::future_unix_seconds(10).to_timespec())));
+        q.hand_over(&timer_thread);
+        ASSERT_EQ(std::numeric_limits<int64_t>::max(), q.nearest_run_time());
+        ASSERT_EQ(0, WorkerTimerQueue::unschedule(id4));
+        timer_thread.stop_and_join();
+        ASSERT_EQ((std::vector<int>{1, 3}), run_order);
+    }
+
+    struct SleepArg {
+        int64_t sleep_us;
+        int64_t elapsed_us;
+    };
+
+    void *sleeper(void *void_arg) {
+        SleepArg *arg = static_cast<SleepArg *>(void_arg);
+        const int64_t start_us = flare::get_current_time_micros();
+        EXPECT_EQ(0, flare::fiber_sleep_for(arg->sleep_us));
+        arg->elapsed_us = flare::get_current_time_micros() - start_us;
+        return nullptr;
+    }
+
+    TEST(WorkerTimerTest, sleep) {
+        SleepArg arg = {20000, 0};
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_background(&th, nullptr, sleeper, &arg));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        ASSERT_GE(arg.elapsed_us, 20000L);
+        ASSERT_LT(arg.elapsed_us, 60000L);
+    }
+
+    void *interrupted_sleeper(void *) {
+        EXPECT_EQ(-1, flare::fiber_sleep_for(10000000L));
+        EXPECT_EQ(EINTR, errno);
+        return nullptr;
+    }
+
+    TEST(WorkerTimerTest, interrupt_sleep) {
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_background(&th, nullptr, interrupted_sleeper, nullptr));
+        flare::fiber_sleep_for(10000);
+        const int64_t start_us = flare::get_current_time_micros();
+        ASSERT_EQ(0, fiber_interrupt(th));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        ASSERT_LT(flare::get_current_time_micros() - start_us, 1000000L);
+    }
+
+    struct TimedWaitArg {
+        std::atomic<int> *event;
+        int64_t timeout_us;
+        int rc;
+        int error;
+        int64_t elapsed_us;
+    };
+
+    void *timed_waiter(void *void_arg) {
+        TimedWaitArg *arg = static_cast<TimedWaitArg *>(void_arg);
+        const int64_t start_us = flare::get_current_time_micros();
+        const timespec abstime =
+                flare::time_point::future_unix_micros(arg->timeout_us).to_timespec();
+        arg->rc = flare::fiber_internal::waitable_event_wait(arg->event, 0, &abstime);
+        arg->error = errno;
+        arg->elapsed_us = flare::get_current_time_micros() - start_us;
+        return nullptr;
+    }
+
+    TEST(WorkerTimerTest, timed_wait) {
+        std::atomic<int> *event =
+                flare::fiber_internal::waitable_event_create_checked<std::atomic<int> >();
+        event->store(0);
+
+        // Timed out.
+        TimedWaitArg arg1 = {event, 20000, 0, 0, 0};
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_background(&th, nullptr, timed_waiter, &arg1));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        ASSERT_EQ(-1, arg1.rc);
+        ASSERT_EQ(ETIMEDOUT, arg1.error);
+        ASSERT_GE(arg1.elapsed_us, 20000L);
+        ASSERT_LT(arg1.elapsed_us, 60000L);
+
+        // Woken up before the timer, which is unscheduled by the waker.
+        TimedWaitArg arg2 = {event, 10000000L, 0, 0, 0};
+        ASSERT_EQ(0, fiber_start_background(&th, nullptr, timed_waiter, &arg2));
+        usleep(10000);
+        ASSERT_EQ(1, flare::fiber_internal::waitable_event_wake(event));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        ASSERT_EQ(0, arg2.rc);
+        ASSERT_LT(arg2.elapsed_us, 1000000L);
+        flare::fiber_internal::waitable_event_destroy(event);
+    }
+
+    // Timers of microseconds may fire before the waiter is queued.
+    void *short_timed_waiter(void *arg) {
+        std::atomic<int> *event = static_cast<std::atomic<int> *>(arg);
+        for (int i = 0; i < 20000; ++i) {
+            const timespec abstime = flare::time_point::from_unix_micros(
+                    flare::get_current_time_micros() + 3).to_timespec();
+            EXPECT_EQ(-1, flare::fiber_internal::waitable_event_wait(event, 0, &abstime));
+            EXPECT_EQ(ETIMEDOUT, errno);
+        }
+        return nullptr;
+    }
+
+    TEST(WorkerTimerTest, short_timed_waits) {
+        std::atomic<int> *event =
+                flare::fiber_internal::waitable_event_create_checked<std::atomic<int> >();
+        event->store(0);
+        const int N = 8;
+        fiber_id_t th[N];
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_start_background(&th[i], nullptr, short_timed_waiter, event));
+        }
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_join(th[i], nullptr));
+        }
+        flare::fiber_internal::waitable_event_destroy(event);
+    }
+
+    struct BlockingArg {
+        fiber_id_t sleeper_tid;
+        SleepArg sleep_arg;
+    };
+
+    void *blocking_fiber(void *void_arg) {
+        BlockingArg *arg = static_cast<BlockingArg *>(void_arg);
+        // The sleeper runs in this worker first and adds its timer here.
+        EXPECT_EQ(0, fiber_start_urgent(&arg->sleeper_tid, nullptr, sleeper,
+                                        &arg->sleep_arg));
+        // Block the worker without scheduling.
+        const int64_t start_us = flare::get_current_time_micros();
+        while (flare::get_current_time_micros() - start_us < 300000L) {
+        }
+        return nullptr;
+    }
+
+    TEST(WorkerTimerTest, run_by_peer_when_blocked) {
+        ASSERT_EQ(0, fiber_setconcurrency(std::max(4, fiber_getconcurrency())));
+        BlockingArg arg = {INVALID_FIBER_ID, {10000, 0}};
+        fiber_id_t th;
+        ASSERT_EQ(0, fiber_start_background(&th, nullptr, blocking_fiber, &arg));
+        ASSERT_EQ(0, fiber_join(th, nullptr));
+        fiber_join(arg.sleeper_tid, nullptr);
+        ASSERT_GE(arg.sleep_arg.elapsed_us, 10000L);
+        // Woken up by an idle worker long before the blocking fiber ends.
+        ASSERT_LT(arg.sleep_arg.elapsed_us, 200000L);
+    }
+
+    TEST(WorkerTimerTest, sleep_across_retired_workers) {
+        const int old_concurrency = fiber_getconcurrency();
+        ASSERT_EQ(0, fiber_setconcurrency(old_concurrency + 8));
+        const int N = 64;
+        std::vector<SleepArg> args(N, SleepArg{50000, 0});
+        fiber_id_t th[N];
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_start_background(&th[i], nullptr, sleeper, &args[i]));
+        }
+        flare::fiber_sleep_for(5000);
+        // Timers of the retired workers are handed over to TimerThread and
+        // must wake up the sleepers after the workers are destroyed.
+        ASSERT_EQ(0, fiber_setconcurrency(old_concurrency));
+        for (int i = 0; i < N; ++i) {
+            ASSERT_EQ(0, fiber_join(th[i], nullptr));
+            ASSERT_GE(args[i].elapsed_us, 50000L);
+        }
+    }
+
+    // Fibers sleeping for 1ms repeatedly, lateness of the wakeups is the
+    // timeout jitter.
+    void *jitter_sleeper(void *arg) {
+        std::atomic<int64_t> *total_late_us = static_cast<std::atomic<int64_t> *>(arg);
+        for (int i = 0; i < 200; ++i) {
+            const int64_t start_us = flare::get_current_time_micros();
+            flare::fiber_sleep_for(1000);
+            total_late_us->fetch_add(flare::get_current_time_micros() - start_us - 1000,
+                                     std::memory_order_relaxed);
+        }
+        return nullptr;
+    }
+
+    int64_t sleep_jitter_us(bool worker_timer) {
+        flare::fiber_internal::FLAGS_fiber_worker_timer = worker_timer;
+        const int N = 16;
+        std::atomic<int64_t> total_late_us(0);
+        fiber_id_t th[N];
+        for (int i = 0; i < N; ++i) {
+            EXPECT_EQ(0, fiber_start_background(&th[i], nullptr, jitter_sleeper, &total_late_us));
+        }
+        for (int i = 0; i < N; ++i) {
+            fiber_join(th[i], nullptr);
+        }
+        flare::fiber_internal::FLAGS_fiber_worker_timer = true;
+        return total_late_us.load() / (N * 200);
+    }
+
+    TEST(WorkerTimerTest, perf_sleep_jitter) {
+        const int64_t global_late_us = sleep_jitter_us(false);
+        const int64_t worker_late_us = sleep_jitter_us(true);
+                FLARE_LOG(INFO) << "Average lateness of 1ms sleeps: global TimerThread="
+                        << global_late_us << "us worker timers=" << worker_late_us << "us";
+    }
+
+}  // namespace
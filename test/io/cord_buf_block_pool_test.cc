@@ -0,0 +1,157 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "testing/gtest_wrap.h"
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "flare/io/cord_buf.h"
+#include "flare/io/cord_buf_block_pool.h"
+#include "flare/times/time.h"
+#include "flare/log/logging.h"
+
+namespace {
+
+    class BlockPoolTest : public testing::Test {
+    protected:
+        static void SetUpTestCase() {
+            flare::iobuf::block_pool_options options;
+            // 8 slabs, small enough to test running out of it.
+            options.max_memory = 16 * 1024 * 1024;
+            options.tls_cache_size = 16;
+            ASSERT_EQ(0, flare::iobuf::enable_block_pool(&options));
+            ASSERT_TRUE(flare::iobuf::block_pool_enabled());
+        }
+    };
+
+    TEST_F(BlockPoolTest, append_and_free) {
+        const size_t nblock0 = flare::cord_buf::block_count();
+        std::string data(100000, 'x');
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = 'a' + i % 26;
+        }
+        {
+            flare::cord_buf buf;
+            buf.append(data);
+            ASSERT_EQ(data, buf.to_string());
+            ASSERT_GT(flare::cord_buf::block_count(), nblock0);
+            ASSERT_EQ(2u * 1024 * 1024, flare::cord_buf::block_pool_memory());
+            FLARE_LOG(INFO) << "huge_page_memory="
+                            << flare::cord_buf::block_pool_huge_page_memory();
+        }
+        flare::iobuf::block_pool_flush_tls_cache();
+        // All the blocks of the slab are back except the ones in the TLS
+        // block chain of cord_buf.
+        ASSERT_GE(flare::cord_buf::block_pool_free_count(), 2u * 1024 * 1024 / 8192 - 8);
+    }
+
+    void *free_bufs(void *arg) {
+        std::vector<flare::cord_buf> *bufs = (std::vector<flare::cord_buf> *) arg;
+        bufs->clear();
+        return nullptr;
+    }
+
+    TEST_F(BlockPoolTest, free_in_other_thread) {
+        std::vector<flare::cord_buf> bufs(100);
+        const std::string data(20000, 'y');
+        for (auto &buf : bufs) {
+            buf.append(data);
+        }
+        flare::iobuf::block_pool_flush_tls_cache();
+        const size_t nfree0 = flare::cord_buf::block_pool_free_count();
+        const size_t nblock0 = flare::cord_buf::block_count();
+        pthread_t th;
+        ASSERT_EQ(0, pthread_create(&th, nullptr, free_bufs, &bufs));
+        ASSERT_EQ(0, pthread_join(th, nullptr));
+        ASSERT_TRUE(bufs.empty());
+        // Blocks cached by the exited thread are back to the pool, except
+        // the one still referenced by the TLS block chain of this thread.
+        const size_t nfreed = nblock0 - flare::cord_buf::block_count();
+        ASSERT_GE(nfreed, 200u);
+        ASSERT_EQ(nfree0 + nfreed, flare::cord_buf::block_pool_free_count());
+    }
+
+    TEST_F(BlockPoolTest, fallback_to_malloc_when_used_up) {
+        // More than 16MB, the remaining blocks are allocated by malloc.
+        std::vector<flare::cord_buf> bufs(40);
+        const std::string data(512 * 1024, 'z');
+        for (auto &buf : bufs) {
+            buf.append(data);
+        }
+        ASSERT_EQ(16u * 1024 * 1024, flare::cord_buf::block_pool_memory());
+        for (auto &buf : bufs) {
+            ASSERT_EQ(data, buf.to_string());
+        }
+        bufs.clear();
+        // Other sizes are always allocated by malloc.
+        void *p = flare::iobuf::block_pool_allocate(100);
+        ASSERT_TRUE(p != nullptr);
+        flare::iobuf::block_pool_deallocate(p);
+    }
+
+    struct PerfArg {
+        bool use_pool;
+        int64_t elapsed_ns;
+    };
+
+    void *alloc_and_free(void *arg) {
+        PerfArg *a = (PerfArg *) arg;
+        const int N = 500000;
+        void *blocks[8];
+        flare::stop_watcher tm;
+        tm.start();
+        for (int i = 0; i < N; ++i) {
+            for (int j = 0; j < 8; ++j) {
+                blocks[j] = a->use_pool
+                            ? flare::iobuf::block_pool_allocate(flare::cord_buf::DEFAULT_BLOCK_SIZE)
+                            : ::malloc(flare::cord_buf::DEFAULT_BLOCK_SIZE);
+                *(char *) blocks[j] = 1;
+            }
+            for (int j = 0; j < 8; ++j) {
+                if (a->use_pool) {
+                    flare::iobuf::block_pool_deallocate(blocks[j]);
+                } else {
+                    ::free(blocks[j]);
+                }
+            }
+        }
+        tm.stop();
+        a->elapsed_ns = tm.n_elapsed() / N / 8;
+        return nullptr;
+    }
+
+    TEST_F(BlockPoolTest, performance) {
+        for (int use_pool = 0; use_pool < 2; ++use_pool) {
+            PerfArg args[4];
+            pthread_t th[4];
+            for (int i = 0; i < 4; ++i) {
+                args[i] = PerfArg{(bool) use_pool, 0};
+                ASSERT_EQ(0, pthread_create(&th[i], nullptr, alloc_and_free, &args[i]));
+            }
+            int64_t total = 0;
+            for (int i = 0; i < 4; ++i) {
+                ASSERT_EQ(0, pthread_join(th[i], nullptr));
+                total += args[i].elapsed_ns;
+            }
+            FLARE_LOG(INFO) << (use_pool ? "block pool" : "malloc") << ": "
+                            << total / 4 << "ns per allocation";
+        }
+    }
+
+}  // namespace
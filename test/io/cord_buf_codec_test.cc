@@ -0,0 +1,358 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "testing/gtest_wrap.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+#include "flare/base/crc32c.h"
+#include "flare/io/cord_buf.h"
+#include "flare/io/cord_buf_codec.h"
+#include "flare/io/snappy/snappy.h"
+#include "flare/times/time.h"
+#include "flare/log/logging.h"
+
+namespace {
+
+    // Append `data' to `buf' in backing blocks of random sizes in
+    // [1, max_block_size].
+    void append_fragmented(flare::cord_buf *buf, const std::string &data,
+                           size_t max_block_size, std::mt19937 *rng) {
+        size_t i = 0;
+        while (i < data.size()) {
+            const size_t len = std::min(data.size() - i, 1 + (*rng)() % max_block_size);
+            char *p = (char *) malloc(len);
+            memcpy(p, data.data() + i, len);
+            ASSERT_EQ(0, buf->append_user_data(p, len, free));
+            i += len;
+        }
+    }
+
+    // Text-like data compressing to about a half.
+    std::string compressible_data(size_t n, std::mt19937 *rng) {
+        static const char *words[] = {"flare ", "cord_buf ", "snappy ", "fiber ",
+                                      "rpc ", "compress ", "\n", "0123 "};
+        std::string s;
+        while (s.size() < n) {
+            if ((*rng)() % 4 == 0) {
+                s.push_back('a' + (*rng)() % 26);
+            } else {
+                s.append(words[(*rng)() % 8]);
+            }
+        }
+        s.resize(n);
+        return s;
+    }
+
+    std::string random_data(size_t n, std::mt19937 *rng) {
+        std::string s(n, 0);
+        for (auto &c : s) {
+            c = (*rng)();
+        }
+        return s;
+    }
+
+    std::string chunk(uint8_t type, const std::string &data, bool with_crc = true) {
+        std::string s;
+        const size_t len = data.size() + (with_crc ? 4 : 0);
+        s.push_back(type);
+        s.push_back(len);
+        s.push_back(len >> 8);
+        s.push_back(len >> 16);
+        if (with_crc) {
+            const uint32_t crc = flare::base::mask(flare::base::value(data.data(), data.size()));
+            s.append((const char *) &crc, 4);
+        }
+        return s + data;
+    }
+
+    const std::string IDENTIFIER("\xff\x06\x00\x00sNaPpY", 10);
+
+    // Codecs built in, lz4 and zstd are absent without the libraries.
+    std::vector<const flare::compression_codec *> builtin_codecs() {
+        std::vector<const flare::compression_codec *> codecs;
+        for (const char *name : {"snappy", "lz4", "zstd"}) {
+            const flare::compression_codec *codec = flare::find_compression_codec(name);
+            if (codec != NULL) {
+                codecs.push_back(codec);
+            }
+        }
+        return codecs;
+    }
+
+    TEST(CordBufCodecTest, registry) {
+        const flare::compression_codec *snappy = flare::find_compression_codec("snappy");
+        ASSERT_TRUE(snappy != NULL);
+        ASSERT_EQ("snappy", snappy->name());
+        ASSERT_TRUE(flare::find_compression_codec("lz5") == NULL);
+#ifdef FLARE_HAVE_LZ4
+        ASSERT_TRUE(flare::find_compression_codec("lz4") != NULL);
+#endif
+#ifdef FLARE_HAVE_ZSTD
+        ASSERT_TRUE(flare::find_compression_codec("zstd") != NULL);
+#endif
+        ASSERT_EQ(-1, flare::register_compression_codec(snappy));
+
+        // Contexts are cached by the thread.
+        flare::stream_compressor *c = flare::thread_local_compressor(snappy);
+        ASSERT_EQ(c, flare::thread_local_compressor(snappy));
+        flare::stream_decompressor *d = flare::thread_local_decompressor(snappy);
+        ASSERT_EQ(d, flare::thread_local_decompressor(snappy));
+    }
+
+    TEST(CordBufCodecTest, round_trip) {
+        for (const flare::compression_codec *codec : builtin_codecs()) {
+            std::mt19937 rng(1);
+            for (size_t n : {0, 1, 100, 65535, 65536, 65537, 200000, 1000000}) {
+                for (bool compressible : {true, false}) {
+                    const std::string data = compressible ? compressible_data(n, &rng) : random_data(n, &rng);
+                    flare::cord_buf in;
+                    append_fragmented(&in, data, 1 + rng() % 20000, &rng);
+                    flare::cord_buf compressed;
+                    ASSERT_EQ(0, flare::compress_cord_buf(codec, in, &compressed));
+                    ASSERT_EQ(data, in.to_string());
+                    if (compressible && n >= 1000) {
+                        ASSERT_LT(compressed.size(), n * 3 / 4) << codec->name();
+                    }
+                    flare::cord_buf out;
+                    ASSERT_EQ(0, flare::decompress_cord_buf(codec, compressed, &out));
+                    ASSERT_EQ(data, out.to_string()) << codec->name() << " n=" << n;
+                }
+            }
+        }
+    }
+
+    // Round trips of streams of `codec' fed in random pieces.
+    void check_streaming(const flare::compression_codec *codec) {
+        std::mt19937 rng(2);
+        const std::string data = compressible_data(500000, &rng);
+        auto compressor = codec->new_compressor();
+        auto decompressor = codec->new_decompressor();
+        for (int round = 0; round < 2; ++round) {
+            // Feed the compressor and then the decompressor in random pieces.
+            flare::cord_buf compressed;
+            for (size_t i = 0; i < data.size();) {
+                const size_t len = std::min(data.size() - i, (size_t) rng() % 30000);
+                flare::cord_buf piece;
+                piece.append(data.data() + i, len);
+                ASSERT_EQ(0, compressor->compress(piece, &compressed));
+                if (rng() % 4 == 0) {
+                    ASSERT_EQ(0, compressor->flush(&compressed));
+                }
+                i += len;
+            }
+            ASSERT_EQ(0, compressor->finish(&compressed));
+            compressor->reset();
+
+            flare::cord_buf out;
+            while (!compressed.empty()) {
+                flare::cord_buf piece;
+                compressed.cutn(&piece, rng() % 10000);
+                ASSERT_EQ(0, decompressor->decompress(piece, &out));
+            }
+            ASSERT_TRUE(decompressor->at_frame_boundary());
+            ASSERT_EQ(data, out.to_string());
+            decompressor->reset();
+        }
+    }
+
+    TEST(CordBufCodecTest, streaming) {
+        for (const flare::compression_codec *codec : builtin_codecs()) {
+            SCOPED_TRACE(std::string(codec->name()));
+            check_streaming(codec);
+        }
+    }
+
+    TEST(CordBufCodecTest, framing_format) {
+        const flare::compression_codec *codec = flare::find_compression_codec("snappy");
+        // The empty stream.
+        flare::cord_buf in;
+        flare::cord_buf compressed;
+        ASSERT_EQ(0, flare::compress_cord_buf(codec, in, &compressed));
+        ASSERT_EQ(IDENTIFIER, compressed.to_string());
+
+        // Chunks of compressed data are standard snappy.
+        std::mt19937 rng(3);
+        const std::string data = compressible_data(1000, &rng);
+        in.append(data);
+        compressed.clear();
+        ASSERT_EQ(0, flare::compress_cord_buf(codec, in, &compressed));
+        const std::string s = compressed.to_string();
+        ASSERT_EQ(IDENTIFIER, s.substr(0, 10));
+        ASSERT_EQ(0, s[10]);
+        const size_t len = (uint8_t) s[11] | ((uint8_t) s[12] << 8) | ((uint8_t) s[13] << 16);
+        ASSERT_EQ(s.size(), 14 + len);
+        std::string uncompressed;
+        ASSERT_TRUE(flare::snappy::Uncompress(s.data() + 18, len - 4, &uncompressed));
+        ASSERT_EQ(data, uncompressed);
+
+        // Hand-made stream with padding, skippable and uncompressed chunks.
+        std::string compressed_hello;
+        flare::snappy::Compress("hello ", 6, &compressed_hello);
+        std::string stream = IDENTIFIER + chunk(0x01, "abc") + chunk(0xfe, "\0\0\0", false) +
+                             chunk(0x80, "skipped", false) + IDENTIFIER;
+        std::string hello_chunk = chunk(0x00, "hello ");
+        hello_chunk.replace(8, 6, compressed_hello);
+        hello_chunk[1] = compressed_hello.size() + 4;
+        stream += hello_chunk + chunk(0x01, "world");
+        flare::cord_buf buf;
+        buf.append(stream);
+        flare::cord_buf out;
+        ASSERT_EQ(0, flare::decompress_cord_buf(codec, buf, &out));
+        ASSERT_EQ("abchello world", out.to_string());
+    }
+
+    TEST(CordBufCodecTest, corrupted) {
+        const flare::compression_codec *codec = flare::find_compression_codec("snappy");
+        std::mt19937 rng(4);
+        flare::cord_buf in;
+        in.append(compressible_data(100000, &rng));
+        flare::cord_buf compressed;
+        ASSERT_EQ(0, flare::compress_cord_buf(codec, in, &compressed));
+        const std::string s = compressed.to_string();
+        flare::cord_buf out;
+
+        // Bad checksum.
+        std::string bad = s;
+        bad[14] ^= 1;
+        flare::cord_buf buf;
+        buf.append(bad);
+        ASSERT_EQ(-1, flare::decompress_cord_buf(codec, buf, &out));
+        // Bad data.
+        bad = s;
+        bad[100] ^= 0x55;
+        buf.clear();
+        buf.append(bad);
+        out.clear();
+        ASSERT_EQ(-1, flare::decompress_cord_buf(codec, buf, &out));
+        // Truncated.
+        buf.clear();
+        buf.append(s.substr(0, s.size() - 1));
+        out.clear();
+        ASSERT_EQ(-1, flare::decompress_cord_buf(codec, buf, &out));
+        // No stream identifier.
+        buf.clear();
+        buf.append(s.substr(10));
+        ASSERT_EQ(-1, flare::decompress_cord_buf(codec, buf, &out));
+        // Reserved unskippable chunk.
+        buf.clear();
+        buf.append(IDENTIFIER + chunk(0x02, "abc"));
+        ASSERT_EQ(-1, flare::decompress_cord_buf(codec, buf, &out));
+        // The decompressor fails until reset.
+        auto decompressor = codec->new_decompressor();
+        ASSERT_EQ(-1, decompressor->decompress(buf, &out));
+        buf.clear();
+        buf.append(IDENTIFIER);
+        ASSERT_EQ(-1, decompressor->decompress(buf, &out));
+        decompressor->reset();
+        ASSERT_EQ(0, decompressor->decompress(buf, &out));
+    }
+
+    TEST(CordBufCodecTest, corrupted_frames) {
+        for (const char *name : {"lz4", "zstd"}) {
+            const flare::compression_codec *codec = flare::find_compression_codec(name);
+            if (codec == NULL) {
+                continue;
+            }
+            std::mt19937 rng(4);
+            flare::cord_buf in;
+            in.append(compressible_data(100000, &rng));
+            flare::cord_buf compressed;
+            ASSERT_EQ(0, flare::compress_cord_buf(codec, in, &compressed));
+            const std::string s = compressed.to_string();
+            flare::cord_buf out;
+
+            // Bad data, caught by the checksum at least.
+            std::string bad = s;
+            bad[s.size() / 2] ^= 0x55;
+            flare::cord_buf buf;
+            buf.append(bad);
+            ASSERT_EQ(-1, flare::decompress_cord_buf(codec, buf, &out)) << name;
+            // Truncated.
+            buf.clear();
+            buf.append(s.substr(0, s.size() - 1));
+            out.clear();
+            ASSERT_EQ(-1, flare::decompress_cord_buf(codec, buf, &out)) << name;
+            // Not a frame.
+            buf.clear();
+            buf.append("not a frame of any codec");
+            ASSERT_EQ(-1, flare::decompress_cord_buf(codec, buf, &out)) << name;
+            // The decompressor fails until reset.
+            auto decompressor = codec->new_decompressor();
+            ASSERT_EQ(-1, decompressor->decompress(buf, &out));
+            buf.clear();
+            buf.append(s);
+            ASSERT_EQ(-1, decompressor->decompress(buf, &out));
+            decompressor->reset();
+            out.clear();
+            ASSERT_EQ(0, decompressor->decompress(buf, &out));
+            ASSERT_TRUE(decompressor->at_frame_boundary());
+            ASSERT_EQ(in.to_string(), out.to_string());
+        }
+    }
+
+    TEST(CordBufCodecTest, performance) {
+        const flare::compression_codec *codec = flare::find_compression_codec("snappy");
+        std::mt19937 rng(5);
+        const std::string data = compressible_data(16 * 1024 * 1024, &rng);
+        std::string flat_compressed;
+        flare::stop_watcher tm;
+        tm.start();
+        flare::snappy::Compress(data.data(), data.size(), &flat_compressed);
+        tm.stop();
+        FLARE_LOG(INFO) << "flat snappy compress=" << data.size() * 1000.0 / tm.n_elapsed() << "MB/s";
+
+        for (size_t block_size : {512, 8192, 65536, 1024 * 1024}) {
+            flare::cord_buf in;
+            for (size_t i = 0; i < data.size(); i += block_size) {
+                const size_t len = std::min(block_size, data.size() - i);
+                char *p = (char *) malloc(len);
+                memcpy(p, data.data() + i, len);
+                in.append_user_data(p, len, free);
+            }
+            // The path flattening cord_buf to std::string.
+            tm.start();
+            std::string flattened = in.to_string();
+            std::string compressed_string;
+            flare::snappy::Compress(flattened.data(), flattened.size(), &compressed_string);
+            tm.stop();
+            const int64_t flatten_ns = tm.n_elapsed();
+
+            flare::cord_buf compressed;
+            tm.start();
+            ASSERT_EQ(0, flare::compress_cord_buf(codec, in, &compressed));
+            tm.stop();
+            const int64_t compress_ns = tm.n_elapsed();
+            flare::cord_buf out;
+            tm.start();
+            ASSERT_EQ(0, flare::decompress_cord_buf(codec, compressed, &out));
+            tm.stop();
+            const int64_t decompress_ns = tm.n_elapsed();
+            ASSERT_EQ(data.size(), out.size());
+            FLARE_LOG(INFO) << "snappy block_size=" << block_size
+                            << " ratio=" << (double) compressed.size() / data.size()
+                            << " flatten+compress=" << data.size() * 1000.0 / flatten_ns << "MB/s"
+                            << " compress=" << data.size() * 1000.0 / compress_ns << "MB/s"
+                            << " decompress=" << data.size() * 1000.0 / decompress_ns << "MB/s";
+        }
+    }
+
+}  // namespace
@@ -0,0 +1,250 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "testing/gtest_wrap.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include "flare/io/cord_buf.h"
+#include "flare/io/cord_buf_mapped_file.h"
+#include "flare/io/cord_buf_zero_copy.h"
+#include "flare/times/time.h"
+#include "flare/log/logging.h"
+
+namespace {
+
+    class MappedFileTest : public testing::Test {
+    protected:
+        void SetUp() override {
+            char path[] = "/tmp/cord_buf_mapped_file_XXXXXX";
+            _fd = mkstemp(path);
+            ASSERT_GE(_fd, 0);
+            unlink(path);
+            _data.resize(3 * 1024 * 1024 + 17);
+            for (size_t i = 0; i < _data.size(); ++i) {
+                _data[i] = 'a' + (i * 13 + i / 4096) % 26;
+            }
+            ASSERT_EQ((ssize_t) _data.size(), write(_fd, _data.data(), _data.size()));
+        }
+
+        void TearDown() override {
+            close(_fd);
+        }
+
+        int _fd;
+        std::string _data;
+    };
+
+    bool fd_is_open(int fd) {
+        return fcntl(fd, F_GETFD) >= 0;
+    }
+
+    TEST_F(MappedFileTest, append_and_release) {
+        const size_t nblock0 = flare::cord_buf::block_count();
+        int mapped_fd = -1;
+        {
+            flare::cord_buf buf;
+            ASSERT_EQ(0, flare::append_mapped_file(&buf, _fd, 1001, 2 * 1024 * 1024));
+            ASSERT_EQ(2u * 1024 * 1024, buf.size());
+            ASSERT_EQ(1u, buf.backing_block_num());
+            ASSERT_EQ(_data.substr(1001, 2 * 1024 * 1024), buf.to_string());
+            // Not counted as cord_buf memory.
+            ASSERT_EQ(nblock0, flare::cord_buf::block_count());
+
+            off_t offset = 0;
+            ASSERT_EQ(buf.size(), flare::mapped_file_front(buf, &mapped_fd, &offset));
+            ASSERT_EQ(1001, offset);
+            ASSERT_NE(_fd, mapped_fd);
+            ASSERT_TRUE(fd_is_open(mapped_fd));
+        }
+        // The mapping is released with the last reference.
+        ASSERT_FALSE(fd_is_open(mapped_fd));
+    }
+
+    TEST_F(MappedFileTest, cut_and_share) {
+        flare::cord_buf buf;
+        ASSERT_EQ(0, flare::append_mapped_file(&buf, _fd, 0, _data.size()));
+        flare::cord_buf head;
+        buf.cutn(&head, 100000);
+        flare::cord_buf copy = buf;
+        int mapped_fd = -1;
+        off_t offset = 0;
+        ASSERT_EQ(buf.size(), flare::mapped_file_front(buf, &mapped_fd, &offset));
+        ASSERT_EQ(100000, offset);
+
+        buf.clear();
+        ASSERT_EQ(_data.substr(0, 100000), head.to_string());
+        head.clear();
+        ASSERT_TRUE(fd_is_open(mapped_fd));
+        ASSERT_EQ(_data.substr(100000), copy.to_string());
+        copy.clear();
+        ASSERT_FALSE(fd_is_open(mapped_fd));
+    }
+
+    TEST_F(MappedFileTest, front) {
+        flare::cord_buf buf;
+        buf.append("HEADER");
+        ASSERT_EQ(0, flare::append_mapped_file(&buf, _fd, 4096, 8192));
+        // Contiguous with the previous range.
+        ASSERT_EQ(0, flare::append_mapped_file(&buf, _fd, 12288, 100));
+        int mapped_fd = -1;
+        off_t offset = 0;
+        ASSERT_EQ(0u, flare::mapped_file_front(buf, &mapped_fd, &offset));
+        ASSERT_FALSE(flare::is_mapped_file_block(buf, 0));
+        ASSERT_TRUE(flare::is_mapped_file_block(buf, 1));
+        buf.pop_front(6);
+        ASSERT_EQ(8192u, flare::mapped_file_front(buf, &mapped_fd, &offset));
+        ASSERT_EQ(4096, offset);
+        buf.pop_front(8000);
+        ASSERT_EQ(192u, flare::mapped_file_front(buf, &mapped_fd, &offset));
+        ASSERT_EQ(4096 + 8000, offset);
+        ASSERT_EQ(_data.substr(4096 + 8000, 292), buf.to_string());
+    }
+
+    TEST_F(MappedFileTest, invalid_range) {
+        flare::cord_buf buf;
+        errno = 0;
+        ASSERT_EQ(-1, flare::append_mapped_file(&buf, _fd, 0, _data.size() + 1));
+        ASSERT_EQ(EINVAL, errno);
+        ASSERT_EQ(-1, flare::append_mapped_file(&buf, _fd, -1, 10));
+        ASSERT_EQ(-1, flare::append_mapped_file(&buf, -1, 0, 10));
+        ASSERT_EQ(0, flare::append_mapped_file(&buf, _fd, _data.size(), 0));
+        ASSERT_TRUE(buf.empty());
+    }
+
+    TEST_F(MappedFileTest, prefetch_and_populate) {
+        flare::mapped_file_options options;
+        options.prefetch = true;
+        flare::cord_buf buf;
+        ASSERT_EQ(0, flare::append_mapped_file(&buf, _fd, 0, _data.size(), &options));
+        options.prefetch = false;
+        options.populate = true;
+        ASSERT_EQ(0, flare::append_mapped_file(&buf, _fd, 0, _data.size(), &options));
+        ASSERT_EQ(_data + _data, buf.to_string());
+    }
+
+    TEST_F(MappedFileTest, portal_into_file_descriptor) {
+        flare::IOPortal portal;
+        ASSERT_EQ(0, flare::append_mapped_file(&portal, _fd, 0, _data.size()));
+        char path[] = "/tmp/cord_buf_mapped_file_out_XXXXXX";
+        const int out_fd = mkstemp(path);
+        ASSERT_GE(out_fd, 0);
+        unlink(path);
+        while (!portal.empty()) {
+            ASSERT_GT(portal.cut_into_file_descriptor(out_fd), 0);
+        }
+        flare::IOPortal result;
+        ssize_t nr = 0;
+        while ((nr = result.pappend_from_file_descriptor(out_fd, result.size(), 1024 * 1024)) > 0) {
+        }
+        ASSERT_EQ(0, nr);
+        ASSERT_EQ(_data, result.to_string());
+        close(out_fd);
+    }
+
+    TEST_F(MappedFileTest, sendfile) {
+        int listener = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_GE(listener, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ASSERT_EQ(0, bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+        ASSERT_EQ(0, listen(listener, 1));
+        socklen_t len = sizeof(addr);
+        ASSERT_EQ(0, getsockname(listener, (struct sockaddr *) &addr, &len));
+        const int client = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_EQ(0, connect(client, (struct sockaddr *) &addr, sizeof(addr)));
+        const int server = accept(listener, nullptr, nullptr);
+        ASSERT_GE(server, 0);
+        close(listener);
+
+        const std::string expected = "HEADER" + _data.substr(10) + "TRAILER";
+        std::string received;
+        std::thread reader([&] {
+            char buf[65536];
+            while (received.size() < expected.size()) {
+                ssize_t nr = read(server, buf, sizeof(buf));
+                ASSERT_GT(nr, 0);
+                received.append(buf, nr);
+            }
+        });
+        flare::cord_buf buf;
+        buf.append("HEADER");
+        ASSERT_EQ(0, flare::append_mapped_file(&buf, _fd, 10, _data.size() - 10));
+        buf.append("TRAILER");
+        flare::cord_buf_zero_copy_sender sender;
+        sender.init(client);
+        // The header is written alone, leaving the file to sendfile.
+        ASSERT_EQ(6, sender.cut_from(&buf));
+        while (!buf.empty()) {
+            ASSERT_GT(sender.cut_from(&buf), 0);
+        }
+        reader.join();
+        ASSERT_EQ(expected, received);
+        ASSERT_EQ(0u, sender.pending_count());
+        close(client);
+        close(server);
+    }
+
+    // Touch a byte of every page.
+    size_t touch(const flare::cord_buf &buf) {
+        size_t sum = 0;
+        for (size_t i = 0; i < buf.backing_block_num(); ++i) {
+            std::string_view block = buf.backing_block(i);
+            for (size_t j = 0; j < block.size(); j += 4096) {
+                sum += block[j];
+            }
+        }
+        return sum;
+    }
+
+    TEST_F(MappedFileTest, performance) {
+        const int N = 100;
+        size_t sum1 = 0;
+        flare::stop_watcher tm;
+        tm.start();
+        for (int i = 0; i < N; ++i) {
+            flare::IOPortal portal;
+            while (portal.pappend_from_file_descriptor(_fd, portal.size(), _data.size() - portal.size()) > 0) {
+            }
+            sum1 += touch(portal);
+        }
+        tm.stop();
+        FLARE_LOG(INFO) << "pappend_from_file_descriptor: "
+                        << (double) _data.size() * N / tm.n_elapsed() << "GB/s";
+        size_t sum2 = 0;
+        tm.start();
+        for (int i = 0; i < N; ++i) {
+            flare::cord_buf buf;
+            ASSERT_EQ(0, flare::append_mapped_file(&buf, _fd, 0, _data.size()));
+            sum2 += touch(buf);
+        }
+        tm.stop();
+        FLARE_LOG(INFO) << "append_mapped_file: " << (double) _data.size() * N / tm.n_elapsed() << "GB/s";
+        ASSERT_GT(sum1, 0u);
+        ASSERT_GT(sum2, 0u);
+    }
+
+}  // namespace
@@ -0,0 +1,247 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "testing/gtest_wrap.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include "flare/io/cord_buf.h"
+#include "flare/times/time.h"
+#include "flare/log/logging.h"
+
+namespace {
+
+    // Append `data' to `buf' in backing blocks of random sizes in
+    // [1, max_block_size].
+    void append_fragmented(flare::cord_buf *buf, const std::string &data,
+                           size_t max_block_size, std::mt19937 *rng) {
+        size_t i = 0;
+        while (i < data.size()) {
+            const size_t len = std::min(data.size() - i, 1 + (*rng)() % max_block_size);
+            char *p = (char *) malloc(len);
+            memcpy(p, data.data() + i, len);
+            ASSERT_EQ(0, buf->append_user_data(p, len, free));
+            i += len;
+        }
+    }
+
+    std::string random_string(size_t n, const char *alphabet, std::mt19937 *rng) {
+        const size_t na = strlen(alphabet);
+        std::string s(n, 0);
+        for (size_t i = 0; i < n; ++i) {
+            s[i] = alphabet[(*rng)() % na];
+        }
+        return s;
+    }
+
+    TEST(CordBufSearchTest, find_char) {
+        std::mt19937 rng(1);
+        for (int round = 0; round < 200; ++round) {
+            const std::string data = random_string(rng() % 300, "abcdefgh\r\n\x80", &rng);
+            flare::cord_buf buf;
+            append_fragmented(&buf, data, 1 + rng() % 40, &rng);
+            ASSERT_EQ(data, buf.to_string());
+            for (char c : std::string("a\n\x80z")) {
+                for (size_t pos = 0; pos <= data.size() + 1; pos += 1 + rng() % 7) {
+                    ASSERT_EQ(data.find(c, pos), buf.find(c, pos));
+                }
+            }
+        }
+        ASSERT_EQ(flare::cord_buf::npos, flare::cord_buf().find('a'));
+    }
+
+    TEST(CordBufSearchTest, find_delim) {
+        std::mt19937 rng(2);
+        const std::string delims[] = {"\r\n", "\r\n\r\n", "ab", "aab\r", "ba\x80",
+                                      "abababababababababab"};
+        for (int round = 0; round < 300; ++round) {
+            const std::string data = random_string(rng() % 500, "ab\r\n\x80", &rng);
+            flare::cord_buf buf;
+            append_fragmented(&buf, data, 1 + rng() % 64, &rng);
+            for (auto &delim : delims) {
+                for (size_t pos = 0; pos <= data.size() + 1; pos += 1 + rng() % 13) {
+                    ASSERT_EQ(data.find(delim, pos), buf.find(delim, pos))
+                                                << "delim=" << delim << " pos=" << pos;
+                }
+            }
+            // A substring of the data.
+            if (data.size() > 40) {
+                const std::string delim = data.substr(rng() % (data.size() - 40), 1 + rng() % 40);
+                ASSERT_EQ(data.find(delim), buf.find(delim));
+            }
+        }
+        flare::cord_buf buf;
+        buf.append("abc");
+        ASSERT_EQ(1u, buf.find(std::string_view(), 1));
+        ASSERT_EQ(flare::cord_buf::npos, buf.find("abcd"));
+    }
+
+    TEST(CordBufSearchTest, find_first_of) {
+        std::mt19937 rng(3);
+        const std::string sets[] = {" \r\n", "xy", "\x80", "0123456789abcdef",
+                                    "0123456789ABCDEFGHIJ\n"};
+        for (int round = 0; round < 200; ++round) {
+            const std::string data =
+                    random_string(rng() % 400, "abcdefghijklmnopqrstuvwxyz \r\n\x80", &rng);
+            flare::cord_buf buf;
+            append_fragmented(&buf, data, 1 + rng() % 64, &rng);
+            for (auto &set : sets) {
+                for (size_t pos = 0; pos <= data.size() + 1; pos += 1 + rng() % 11) {
+                    ASSERT_EQ(data.find_first_of(set, pos), buf.find_first_of(set, pos));
+                }
+            }
+        }
+        flare::cord_buf buf;
+        buf.append("abc");
+        ASSERT_EQ(flare::cord_buf::npos, buf.find_first_of(std::string_view()));
+    }
+
+    TEST(CordBufSearchTest, cut_until_across_blocks) {
+        std::mt19937 rng(4);
+        const std::string data = "GET / HTTP/1.1\r\nHost: a\r\n\r\nbody";
+        flare::cord_buf buf;
+        append_fragmented(&buf, data, 1, &rng);
+        ASSERT_EQ(data.size(), buf.backing_block_num());
+        flare::cord_buf line;
+        ASSERT_EQ(0, buf.cut_until(&line, "\r\n"));
+        ASSERT_EQ("GET / HTTP/1.1", line.to_string());
+        line.clear();
+        ASSERT_EQ(0, buf.cut_until(&line, "\r\n"));
+        ASSERT_EQ("Host: a", line.to_string());
+        line.clear();
+        ASSERT_EQ(0, buf.cut_until(&line, '\r' + std::string("\n")));
+        ASSERT_TRUE(line.empty());
+        ASSERT_EQ(-1, buf.cut_until(&line, "\r\n"));
+        ASSERT_EQ("body", buf.to_string());
+
+        // Delimiters longer than 8 bytes.
+        buf.clear();
+        append_fragmented(&buf, "key1=value1--boundary-0123--key2", 3, &rng);
+        ASSERT_EQ(0, buf.cut_until(&line, "--boundary-0123--"));
+        ASSERT_EQ("key1=value1", line.to_string());
+        ASSERT_EQ("key2", buf.to_string());
+    }
+
+    TEST(CordBufSearchTest, bytes_iterator_forward_to) {
+        std::mt19937 rng(5);
+        const std::string data = "abc\ndefgh\nij";
+        flare::cord_buf buf;
+        append_fragmented(&buf, data, 2, &rng);
+        flare::cord_buf_bytes_iterator it(buf);
+        ASSERT_EQ(3u, it.forward_to('\n'));
+        ASSERT_EQ('\n', *it);
+        ++it;
+        ASSERT_EQ(5u, it.forward_to('\n'));
+        ASSERT_EQ(data.size() - 9, it.bytes_left());
+        ASSERT_EQ(0u, it.forward_to('\n'));
+        ++it;
+        ASSERT_EQ(2u, it.forward_to('\n'));
+        ASSERT_EQ(0u, it.bytes_left());
+    }
+
+    // Count lines of pipelined redis replies byte by byte as the old
+    // implementation of cut_until did.
+    size_t count_lines_bytewise(const flare::cord_buf &buf) {
+        size_t n = 0;
+        char prev = 0;
+        for (flare::cord_buf_bytes_iterator it(buf); it; ++it) {
+            if (prev == '\r' && *it == '\n') {
+                ++n;
+            }
+            prev = *it;
+        }
+        return n;
+    }
+
+    // Parsers search from the front and consume what's parsed.
+    size_t count_lines(flare::cord_buf buf) {
+        size_t n = 0;
+        for (size_t pos = buf.find("\r\n"); pos != flare::cord_buf::npos; pos = buf.find("\r\n")) {
+            buf.pop_front(pos + 2);
+            ++n;
+        }
+        return n;
+    }
+
+    size_t count_separators(flare::cord_buf buf) {
+        size_t n = 0;
+        for (size_t pos = buf.find_first_of(" \r\n"); pos != flare::cord_buf::npos;
+             pos = buf.find_first_of(" \r\n")) {
+            buf.pop_front(pos + 1);
+            ++n;
+        }
+        return n;
+    }
+
+    size_t count_char(flare::cord_buf buf, char c) {
+        size_t n = 0;
+        for (size_t pos = buf.find(c); pos != flare::cord_buf::npos; pos = buf.find(c)) {
+            buf.pop_front(pos + 1);
+            ++n;
+        }
+        return n;
+    }
+
+    TEST(CordBufSearchTest, performance) {
+        std::mt19937 rng(6);
+        std::string data;
+        size_t nline = 0;
+        while (data.size() < 4 * 1024 * 1024) {
+            nline += 2;
+            data.append("$64\r\n");
+            data.append(random_string(64, "abcdefghijklmnopqrstuvwxyz", &rng));
+            data.append("\r\n");
+        }
+        for (size_t block_size : {64, 512, 8192, 65536}) {
+            flare::cord_buf buf;
+            size_t i = 0;
+            while (i < data.size()) {
+                const size_t len = std::min(data.size() - i, block_size);
+                char *p = (char *) malloc(len);
+                memcpy(p, data.data() + i, len);
+                buf.append_user_data(p, len, free);
+                i += len;
+            }
+            flare::stop_watcher tm;
+            tm.start();
+            ASSERT_EQ(nline, count_lines_bytewise(buf));
+            tm.stop();
+            const int64_t bytewise_ns = tm.n_elapsed();
+            tm.start();
+            ASSERT_EQ(nline, count_lines(buf));
+            tm.stop();
+            const int64_t find_ns = tm.n_elapsed();
+            tm.start();
+            ASSERT_EQ(nline * 2, count_separators(buf));
+            tm.stop();
+            const int64_t first_of_ns = tm.n_elapsed();
+            tm.start();
+            ASSERT_EQ(nline / 2, count_char(buf, '$'));
+            tm.stop();
+            const int64_t find_char_ns = tm.n_elapsed();
+            FLARE_LOG(INFO) << "block_size=" << block_size
+                            << " bytewise=" << data.size() * 1000.0 / bytewise_ns << "MB/s"
+                            << " find(delim)=" << data.size() * 1000.0 / find_ns << "MB/s"
+                            << " find_first_of=" << data.size() * 1000.0 / first_of_ns << "MB/s"
+                            << " find(char)=" << data.size() * 1000.0 / find_char_ns << "MB/s";
+        }
+    }
+
+}  // namespace
@@ -0,0 +1,294 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "testing/gtest_wrap.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include "flare/io/cord_buf.h"
+#include "flare/io/cord_buf_zero_copy.h"
+#include "flare/times/time.h"
+#include "flare/log/logging.h"
+
+namespace {
+
+    // Connected TCP sockets over loopback, MSG_ZEROCOPY is not supported by
+    // unix domain sockets.
+    void make_tcp_pair(int fds[2]) {
+        int listener = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_GE(listener, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ASSERT_EQ(0, bind(listener, (struct sockaddr *) &addr, sizeof(addr)));
+        ASSERT_EQ(0, listen(listener, 1));
+        socklen_t len = sizeof(addr);
+        ASSERT_EQ(0, getsockname(listener, (struct sockaddr *) &addr, &len));
+        fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_EQ(0, connect(fds[0], (struct sockaddr *) &addr, sizeof(addr)));
+        fds[1] = accept(listener, nullptr, nullptr);
+        ASSERT_GE(fds[1], 0);
+        close(listener);
+    }
+
+    std::string make_data(size_t n) {
+        std::string data(n, 0);
+        for (size_t i = 0; i < n; ++i) {
+            data[i] = 'a' + (i * 7 + i / 4096) % 26;
+        }
+        return data;
+    }
+
+    // Wait until all zero-copy sends are completed.
+    void wait_completions(flare::cord_buf_zero_copy_sender *sender, int fd) {
+        for (int i = 0; i < 1000 && sender->pending_count() > 0; ++i) {
+            struct pollfd pfd = {fd, 0, 0};
+            poll(&pfd, 1, 10);
+            ASSERT_GE(sender->reap_completions(), 0);
+        }
+        ASSERT_EQ(0u, sender->pending_count());
+        ASSERT_EQ(0u, sender->pending_bytes());
+    }
+
+    TEST(ZeroCopySenderTest, send_and_reap) {
+        int fds[2];
+        make_tcp_pair(fds);
+        const std::string data = make_data(8 * 1024 * 1024 + 123);
+        std::string received;
+        std::thread reader([&] {
+            char buf[65536];
+            while (received.size() < data.size()) {
+                ssize_t nr = read(fds[1], buf, sizeof(buf));
+                ASSERT_GT(nr, 0);
+                received.append(buf, nr);
+            }
+        });
+
+        flare::cord_buf_zero_copy_sender sender;
+        sender.init(fds[0]);
+        flare::cord_buf buf;
+        buf.append(data);
+        const size_t nblock0 = flare::cord_buf::block_count();
+        while (!buf.empty()) {
+            ASSERT_GT(sender.cut_from(&buf), 0);
+        }
+        // Blocks are held by the sender until completed.
+        if (sender.zero_copy_enabled() && sender.pending_count() > 0) {
+            ASSERT_GT(sender.pending_bytes(), 0u);
+            ASSERT_GT(flare::cord_buf::block_count(), 0u);
+        }
+        reader.join();
+        ASSERT_EQ(data, received);
+        wait_completions(&sender, fds[0]);
+        ASSERT_LE(flare::cord_buf::block_count(), nblock0);
+        if (sender.zero_copy_enabled()) {
+            ASSERT_GT(sender.completed_count(), 0u);
+            ASSERT_LE(sender.copied_count(), sender.completed_count());
+        }
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    TEST(ZeroCopySenderTest, small_sends_are_copied) {
+        int fds[2];
+        make_tcp_pair(fds);
+        flare::cord_buf_zero_copy_sender sender;
+        sender.init(fds[0]);
+        flare::cord_buf buf;
+        buf.append("hello world");
+        ASSERT_EQ(11, sender.cut_from(&buf));
+        ASSERT_TRUE(buf.empty());
+        ASSERT_EQ(0u, sender.pending_count());
+        char out[16];
+        ASSERT_EQ(11, read(fds[1], out, sizeof(out)));
+        ASSERT_EQ("hello world", std::string(out, 11));
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    TEST(ZeroCopySenderTest, max_pending_bytes) {
+        int fds[2];
+        make_tcp_pair(fds);
+        flare::zero_copy_sender_options options;
+        options.max_pending_bytes = 64 * 1024;
+        flare::cord_buf_zero_copy_sender sender(options);
+        if (sender.init(fds[0]) != 0) {
+            close(fds[0]);
+            close(fds[1]);
+            return;
+        }
+        const std::string data = make_data(1024 * 1024);
+        std::string received;
+        std::thread reader([&] {
+            char buf[65536];
+            while (received.size() < data.size()) {
+                ssize_t nr = read(fds[1], buf, sizeof(buf));
+                ASSERT_GT(nr, 0);
+                received.append(buf, nr);
+            }
+        });
+        flare::cord_buf buf;
+        buf.append(data);
+        while (!buf.empty()) {
+            ASSERT_GT(sender.cut_from(&buf, 32 * 1024), 0);
+            ASSERT_LE(sender.pending_bytes(), options.max_pending_bytes);
+        }
+        reader.join();
+        ASSERT_EQ(data, received);
+        wait_completions(&sender, fds[0]);
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    TEST(ZeroCopySenderTest, destroy_waits_for_completions) {
+        int fds[2];
+        make_tcp_pair(fds);
+        const std::string data = make_data(4 * 1024 * 1024);
+        std::string received;
+        std::thread reader([&] {
+            char buf[65536];
+            while (received.size() < data.size()) {
+                ssize_t nr = read(fds[1], buf, sizeof(buf));
+                ASSERT_GT(nr, 0);
+                received.append(buf, nr);
+            }
+        });
+        const size_t nblock0 = flare::cord_buf::block_count();
+        {
+            flare::cord_buf_zero_copy_sender sender;
+            sender.init(fds[0]);
+            flare::cord_buf buf;
+            buf.append(data);
+            while (!buf.empty()) {
+                ASSERT_GT(sender.cut_from(&buf), 0);
+            }
+            // Destroyed without reaping completions.
+        }
+        reader.join();
+        ASSERT_EQ(data, received);
+        // Blocks of pending sends are released once completed.
+        ASSERT_LE(flare::cord_buf::block_count(), nblock0);
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    TEST(ZeroCopySenderTest, send_file) {
+        char path[] = "/tmp/zero_copy_send_file_XXXXXX";
+        const int file_fd = mkstemp(path);
+        ASSERT_GE(file_fd, 0);
+        unlink(path);
+        const std::string data = make_data(100000);
+        ASSERT_EQ((ssize_t) data.size(), write(file_fd, data.data(), data.size()));
+
+        int fds[2];
+        make_tcp_pair(fds);
+        flare::cord_buf_zero_copy_sender sender;
+        sender.init(fds[0]);
+        std::string received;
+        std::thread reader([&] {
+            char buf[65536];
+            while (received.size() < data.size() - 1000) {
+                ssize_t nr = read(fds[1], buf, sizeof(buf));
+                ASSERT_GT(nr, 0);
+                received.append(buf, nr);
+            }
+        });
+        size_t sent = 0;
+        while (sent < data.size() - 1000) {
+            ssize_t nw = sender.send_file(file_fd, 1000 + sent, data.size() - 1000 - sent);
+            ASSERT_GT(nw, 0);
+            sent += nw;
+        }
+        reader.join();
+        ASSERT_EQ(data.substr(1000), received);
+        close(file_fd);
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    int64_t thread_cpu_us() {
+        struct rusage usage;
+        getrusage(RUSAGE_THREAD, &usage);
+        return usage.ru_utime.tv_sec * 1000000L + usage.ru_utime.tv_usec +
+               usage.ru_stime.tv_sec * 1000000L + usage.ru_stime.tv_usec;
+    }
+
+    // CPU time of the sending thread per GB, zero copy only pays off on
+    // NICs, over loopback the kernel copies anyway.
+    void send_performance(bool zero_copy) {
+        int fds[2];
+        make_tcp_pair(fds);
+        const size_t total = 256 * 1024 * 1024;
+        std::thread reader([&] {
+            std::string buf(1024 * 1024, 0);
+            size_t nread = 0;
+            while (nread < total) {
+                ssize_t nr = read(fds[1], &buf[0], buf.size());
+                ASSERT_GT(nr, 0);
+                nread += nr;
+            }
+        });
+        flare::cord_buf_zero_copy_sender sender;
+        if (zero_copy) {
+            sender.init(fds[0]);
+        }
+        flare::cord_buf chunk;
+        chunk.append(make_data(1024 * 1024));
+
+        flare::stop_watcher tm;
+        tm.start();
+        const int64_t cpu0 = thread_cpu_us();
+        size_t sent = 0;
+        while (sent < total) {
+            flare::cord_buf buf;
+            buf.append(chunk);
+            while (!buf.empty()) {
+                ssize_t nw = zero_copy ? sender.cut_from(&buf) : buf.cut_into_file_descriptor(fds[0]);
+                ASSERT_GT(nw, 0);
+                sent += nw;
+            }
+        }
+        const int64_t cpu = thread_cpu_us() - cpu0;
+        tm.stop();
+        reader.join();
+        if (zero_copy) {
+            wait_completions(&sender, fds[0]);
+        }
+        FLARE_LOG(INFO) << (zero_copy ? "MSG_ZEROCOPY" : "writev")
+                        << ": cpu=" << cpu * 1024 * 1024 * 1024 / total / 1000 << "ms/GB"
+                        << " elapsed=" << tm.m_elapsed() << "ms"
+                        << " copied=" << sender.copied_count() << "/" << sender.completed_count();
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    TEST(ZeroCopySenderTest, performance) {
+        send_performance(false);
+        send_performance(true);
+    }
+
+}  // namespace
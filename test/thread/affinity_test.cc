@@ -0,0 +1,55 @@
+#include <sched.h>
+#include <string>
+#include <vector>
+#include "flare/thread/affinity.h"
+#include "testing/gtest_wrap.h"
+
+namespace flare {
+
+    TEST(AffinityTest, parse_cpu_list) {
+        std::vector<int> ids;
+        ASSERT_TRUE(core_affinity::parse_cpu_list("0-3,8,10-11\n", &ids));
+        ASSERT_EQ((std::vector<int>{0, 1, 2, 3, 8, 10, 11}), ids);
+        ASSERT_TRUE(core_affinity::parse_cpu_list("0,2", &ids));
+        ASSERT_EQ((std::vector<int>{0, 2}), ids);
+        ASSERT_TRUE(core_affinity::parse_cpu_list("\n", &ids));
+        ASSERT_TRUE(ids.empty());
+    }
+
+    TEST(AffinityTest, parse_malformed_cpu_list) {
+        std::vector<int> ids;
+        ASSERT_FALSE(core_affinity::parse_cpu_list("a", &ids));
+        ASSERT_FALSE(core_affinity::parse_cpu_list("3-1", &ids));
+        ASSERT_FALSE(core_affinity::parse_cpu_list("0-", &ids));
+        ASSERT_FALSE(core_affinity::parse_cpu_list("0;1", &ids));
+        ASSERT_FALSE(core_affinity::parse_cpu_list("-1", &ids));
+    }
+
+    TEST(AffinityTest, cpu_list_out_of_cpu_set) {
+        std::vector<int> ids;
+        const std::string last = std::to_string(CPU_SETSIZE - 1);
+        ASSERT_TRUE(core_affinity::parse_cpu_list(last.c_str(), &ids));
+        ASSERT_EQ(1u, ids.size());
+        const std::string over = "0-" + std::to_string(CPU_SETSIZE);
+        ASSERT_FALSE(core_affinity::parse_cpu_list(over.c_str(), &ids));
+    }
+
+    TEST(AffinityTest, numa_topology) {
+        const int nodes = core_affinity::num_numa_nodes();
+        ASSERT_GE(nodes, 1);
+        // Node 0 is always online.
+        core_affinity cores = core_affinity::numa_node_cores(0);
+        ASSERT_GT(cores.count(), 0u);
+        size_t total = 0;
+        for (int i = 0; i < nodes; ++i) {
+            core_affinity node = core_affinity::numa_node_cores(i);
+            for (size_t j = 0; j < node.count(); ++j) {
+                ASSERT_EQ(i, node[j].group);
+            }
+            total += node.count();
+        }
+        ASSERT_LE(total, (size_t) CPU_SETSIZE);
+        ASSERT_GT(total, 0u);
+    }
+
+}  // namespace flare